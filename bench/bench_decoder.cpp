@@ -0,0 +1,142 @@
+// Content-Encoding解码的吞吐：按HTTPConnection中带sink的接收路径，每收到64KB原始数据解码一次，
+// 解码结果交给丢弃数据的sink。数据来自内存中的MemoryTransport，不经过socket；
+// identity一行是同样路径上不解码时的上限，MB/s都按解码后的字节数计算
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Decoder.h"
+#include "ResponseReader.h"
+
+#ifdef MULTI_GET_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MULTI_GET_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+// 与HTTPConnection.cpp中的PROGRESS_STEP相同
+constexpr size_t STEP = 64 * 1024;
+
+// 类似访问日志的文本，压缩率与常见的文本文件接近
+std::string makePayload(size_t size) {
+    std::string text;
+    text.reserve(size + 256);
+    char line[256];
+    uint32_t seed = 12345;
+    for (size_t i = 0; text.size() < size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        std::snprintf(line, sizeof(line),
+                      "10.%u.%u.%u - - [23/May/2022:08:%02zu:%02zu +0800] \"GET /files/%u.bin HTTP/1.1\" %d %u\n",
+                      (seed >> 8) & 0xff, (seed >> 16) & 0xff, (seed >> 24) & 0xff, (i / 60) % 60, i % 60,
+                      seed % 10000, seed % 7 ? 200 : 206, seed % 1000000);
+        text.append(line);
+    }
+    text.resize(size);
+    return text;
+}
+
+#ifdef MULTI_GET_HAVE_ZLIB
+// windowBits为31时是gzip，15时是zlib格式（HTTP的deflate），-15时是原始deflate
+std::string deflateWith(const std::string &input, int windowBits) {
+    z_stream zs{};
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&zs, static_cast<uLong>(input.size())), '\0');
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    zs.avail_in = static_cast<uInt>(input.size());
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = static_cast<uInt>(out.size());
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+#endif
+
+#ifdef MULTI_GET_HAVE_ZSTD
+std::string zstdCompress(const std::string &input) {
+    std::string out(ZSTD_compressBound(input.size()), '\0');
+    out.resize(ZSTD_compress(out.data(), out.size(), input.data(), input.size(), 3));
+    return out;
+}
+#endif
+
+std::string makeResponse(const std::string &body, const char *encoding) {
+    std::string text = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n";
+    if (encoding)
+        text.append("Content-Encoding: ").append(encoding).append("\r\n");
+    text.append("Content-Length: ").append(std::to_string(body.size())).append("\r\n\r\n");
+    return text.append(body);
+}
+
+// 返回解码后的字节数，失败时返回0
+size_t receive(multi_get::MemoryTransport &transport) {
+    transport.rewind();
+    multi_get::StreamReader reader{transport};
+    auto res = reader.readHeaders();
+    auto decoder = multi_get::Decoder::create(res["Content-Encoding"]);
+    multi_get::Rope raw;
+    multi_get::Rope decoded;
+    size_t total = 0;
+    auto error = multi_get::Error::Ok;
+    auto fill = reader.readInto(raw, static_cast<size_t>(res.declaredLength()), STEP, [&](size_t) {
+        if (decoder) {
+            raw.forEach([&](const char *data, size_t n) {
+                if (error == multi_get::Error::Ok)
+                    error = decoder->decode(data, n, decoded);
+            });
+            raw.clear();
+        } else {
+            std::swap(raw, decoded);
+        }
+        total += decoded.size();
+        decoded.clear();
+        return error == multi_get::Error::Ok;
+    });
+    if (fill != multi_get::Fill::Ok || (decoder && decoder->finish() != multi_get::Error::Ok))
+        return 0;
+    return total;
+}
+
+void measure(const char *name, const std::string &body, const char *encoding, size_t iterations) {
+    const auto text = makeResponse(body, encoding);
+    multi_get::MemoryTransport transport{text, STEP};
+    size_t decoded = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        decoded += receive(transport);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (decoded == 0) {
+        std::cout << name << ": decode failed" << std::endl;
+        return;
+    }
+    std::printf("%-10s %8.1f MB/s decoded, %8.1f MB/s on the wire (ratio %.2f)\n", name,
+                static_cast<double>(decoded) / seconds / 1e6,
+                static_cast<double>(body.size()) * static_cast<double>(iterations) / seconds / 1e6,
+                static_cast<double>(decoded) / static_cast<double>(body.size() * iterations));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 10;
+    size_t size = argc > 2 ? std::stoul(argv[2]) : 32 * 1024 * 1024;
+    const auto payload = makePayload(size);
+    std::cout << "accepted encodings: "
+              << (multi_get::Decoder::accepted().empty() ? "(none)" : multi_get::Decoder::accepted()) << std::endl;
+
+    measure("identity", payload, nullptr, iterations);
+#ifdef MULTI_GET_HAVE_ZLIB
+    measure("gzip", deflateWith(payload, MAX_WBITS + 16), "gzip", iterations);
+    measure("deflate", deflateWith(payload, MAX_WBITS), "deflate", iterations);
+    measure("raw", deflateWith(payload, -MAX_WBITS), "deflate", iterations);
+#endif
+#ifdef MULTI_GET_HAVE_ZSTD
+    measure("zstd", zstdCompress(payload), "zstd", iterations);
+#endif
+    return 0;
+}
@@ -0,0 +1,96 @@
+// 响应头解析的微基准：对比旧的istringstream + unordered_map解析方式与原地解析
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "HTTPResponse.h"
+
+namespace {
+
+const std::string SAMPLE =
+    "HTTP/1.1 206 Partial Content\r\n"
+    "Server: nginx/1.18.0\r\n"
+    "Date: Mon, 23 May 2022 08:00:00 GMT\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "content-length: 1048576\r\n"
+    "Last-Modified: Sun, 22 May 2022 10:00:00 GMT\r\n"
+    "Connection: keep-alive\r\n"
+    "ETag: \"628a0c10-40000000\"\r\n"
+    "Content-Range: bytes 1048576-2097151/1073741824\r\n"
+    "Accept-Ranges: bytes\r\n"
+    "Cache-Control: max-age=3600\r\n"
+    "\r\n";
+
+// 旧版HTTPResponse::parse(const std::string &)的实现
+struct LegacyResponse {
+    std::unordered_map<std::string, std::string> headers;
+    std::string httpVersion;
+    int status{-1};
+    std::string statusText;
+
+    explicit LegacyResponse(const std::string &resText) {
+        std::istringstream buffer(resText);
+        std::string line;
+        bool startLine = true;
+        while (std::getline(buffer, line)) {
+            if (startLine) {
+                std::istringstream temp(line);
+                temp >> httpVersion;
+                temp >> status;
+                temp.get();
+                std::getline(temp, statusText);
+                startLine = false;
+                continue;
+            }
+            if (line.length() <= 1)
+                break;
+            auto idx = line.find(':');
+            if (idx == std::string::npos)
+                continue;
+            auto idx2 = idx + 1;
+            while (line[idx2] == ' ') ++idx2;
+            headers[line.substr(0, idx)] = line.substr(idx2);
+        }
+    }
+
+    std::string operator[](const std::string &key) const {
+        if (headers.count(key))
+            return headers.at(key);
+        return "";
+    }
+};
+
+template <typename F>
+double measure(const char *name, size_t iterations, F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    size_t sink = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        sink += f();
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / double(iterations);
+    std::cout << name << ": " << ns << " ns/op (checksum " << sink << ")" << std::endl;
+    return ns;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 200000;
+
+    auto legacy = measure("legacy parser   ", iterations, [] {
+        LegacyResponse res{SAMPLE};
+        return std::stoull(res["Content-Length"].empty() ? "0" : res["Content-Length"]) + res.status;
+    });
+
+    auto inplace = measure("in-place parser ", iterations, [] {
+        std::vector<char> raw(SAMPLE.begin(), SAMPLE.end());
+        multi_get::HTTPResponse res{std::move(raw)};
+        return static_cast<size_t>(res.declaredLength()) + res.status();
+    });
+
+    std::cout << "speedup: " << legacy / inplace << "x" << std::endl;
+    return 0;
+}
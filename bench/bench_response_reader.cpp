@@ -0,0 +1,164 @@
+// 响应接收路径的微基准：对比旧的逐字节虚函数接收与按传输类型实例化的缓冲读取。
+// 数据来自内存中的MemoryTransport，不经过socket，只衡量解析和调用的开销；
+// 同时统计receive的调用次数，在真实连接上每一次都是一次系统调用（TLS时还有一次SSL_read）
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ResponseReader.h"
+
+namespace {
+
+// 旧版Connection的接收接口
+struct VirtualTransport {
+    virtual ~VirtualTransport() = default;
+    virtual ssize_t receive(char *buf, size_t n) const = 0;
+};
+
+struct VirtualMemoryTransport final : VirtualTransport {
+    multi_get::MemoryTransport memory;
+    mutable size_t calls{0};
+    explicit VirtualMemoryTransport(std::string_view data) : memory(data) {}
+    ssize_t receive(char *buf, size_t n) const override {
+        ++calls;
+        return memory.receive(buf, n);
+    }
+};
+
+// 传输策略可以叠加，统计调用次数不引入虚函数
+template <typename Transport>
+struct CountingTransport {
+    Transport inner;
+    mutable size_t calls{0};
+    ssize_t receive(char *buf, size_t n) const {
+        ++calls;
+        return inner.receive(buf, n);
+    }
+    [[nodiscard]] bool timedOut() const {
+        return inner.timedOut();
+    }
+};
+
+// 旧版HTTPConnection::get的实现：头部和chunk长度逐字节接收，每次都是一次虚函数调用
+size_t legacyReceive(const VirtualTransport &conn, multi_get::Rope &body) {
+    std::vector<char> headers;
+    char c;
+    int state = 0;
+    while (state != 4 && conn.receive(&c, 1) > 0) {
+        headers.push_back(c);
+        if (c == '\r')
+            state = state == 2 ? 3 : 1;
+        else if (c == '\n')
+            state = state == 1 ? 2 : (state == 3 ? 4 : 0);
+        else
+            state = 0;
+    }
+    multi_get::HTTPResponse res{std::move(headers)};
+    std::string chunkLength;
+    while (true) {
+        while (conn.receive(&c, 1) > 0) {
+            if (c == '\r') {
+                conn.receive(&c, 1);
+                break;
+            }
+            chunkLength += c;
+        }
+        size_t n = std::stoull(chunkLength, nullptr, 16);
+        chunkLength.clear();
+        if (n == 0)
+            break;
+        while (n) {
+            auto [ptr, avail] = body.prepare();
+            auto len = std::min(n, avail);
+            size_t got = 0;
+            while (got < len) {
+                auto r = conn.receive(ptr + got, len - got);
+                if (r <= 0)
+                    return 0;
+                got += static_cast<size_t>(r);
+            }
+            body.commit(len);
+            n -= len;
+        }
+        char crlf[2];
+        conn.receive(crlf, sizeof(crlf));
+    }
+    return body.size() + static_cast<size_t>(res.status());
+}
+
+template <typename Transport>
+size_t readerReceive(const Transport &transport, multi_get::Rope &body) {
+    multi_get::StreamReader reader{transport};
+    auto res = reader.readHeaders();
+    auto ignore = [](size_t) {};
+    while (auto n = reader.readChunkSize()) {
+        if (*n == 0) {
+            reader.skipTrailers();
+            break;
+        }
+        if (reader.readInto(body, *n, *n, ignore) != multi_get::Fill::Ok)
+            return 0;
+        reader.readLine();
+    }
+    return body.size() + static_cast<size_t>(res.status());
+}
+
+std::string makeResponse(size_t chunks, size_t chunkSize) {
+    std::string text =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: nginx/1.18.0\r\n"
+        "Date: Mon, 23 May 2022 08:00:00 GMT\r\n"
+        "Content-Type: application/json\r\n"
+        "Connection: keep-alive\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n";
+    const std::string payload(chunkSize, 'x');
+    char size[32];
+    for (size_t i = 0; i < chunks; ++i) {
+        std::snprintf(size, sizeof(size), "%zx\r\n", chunkSize);
+        text.append(size).append(payload).append("\r\n");
+    }
+    return text.append("0\r\n\r\n");
+}
+
+template <typename F>
+double measure(const char *name, size_t iterations, F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    size_t sink = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        sink += f();
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / double(iterations);
+    std::cout << name << ": " << ns << " ns/op (checksum " << sink << ")" << std::endl;
+    return ns;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 2000;
+    // 小chunk的响应，头部和chunk长度的解析占主要部分
+    const auto text = makeResponse(4096, 16);
+
+    VirtualMemoryTransport legacyTransport{text};
+    auto legacy = measure("virtual, byte by byte", iterations, [&] {
+        legacyTransport.memory.rewind();
+        multi_get::Rope body;
+        return legacyReceive(legacyTransport, body);
+    });
+
+    CountingTransport<multi_get::MemoryTransport> transport{multi_get::MemoryTransport{text}};
+    auto buffered = measure("static, buffered     ", iterations, [&] {
+        transport.inner.rewind();
+        multi_get::Rope body;
+        return readerReceive(transport, body);
+    });
+
+    std::cout << "speedup: " << legacy / buffered << "x" << std::endl;
+    std::cout << "receive calls per response: " << legacyTransport.calls / iterations << " vs "
+              << transport.calls / iterations << std::endl;
+    return 0;
+}
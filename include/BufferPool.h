@@ -0,0 +1,123 @@
+#ifndef MULTI_GET_BUFFER_POOL_H
+#define MULTI_GET_BUFFER_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace multi_get {
+
+class BufferPool;
+
+// 从BufferPool借出的固定大小缓冲区，析构时归还
+class Block {
+  private:
+    friend class BufferPool;
+    BufferPool *pool{};
+    char *ptr{};
+
+    Block(BufferPool *pool, char *ptr) noexcept : pool(pool), ptr(ptr) {}
+
+  public:
+    Block() = default;
+    Block(Block &&other) noexcept : pool(std::exchange(other.pool, nullptr)), ptr(std::exchange(other.ptr, nullptr)) {}
+    Block &operator=(Block &&other) noexcept {
+        if (this != &other) {
+            reset();
+            pool = std::exchange(other.pool, nullptr);
+            ptr = std::exchange(other.ptr, nullptr);
+        }
+        return *this;
+    }
+    Block(const Block &) = delete;
+    Block &operator=(const Block &) = delete;
+    ~Block() {
+        reset();
+    }
+
+    void reset() noexcept;
+
+    [[nodiscard]] char *data() const noexcept {
+        return ptr;
+    }
+    [[nodiscard]] size_t size() const noexcept;
+    explicit operator bool() const noexcept {
+        return ptr != nullptr;
+    }
+};
+
+// 进程内共享的接收缓冲区池。内存按slab（多个页对齐的块）一次申请，
+// 块归还后复用，整个slab空闲时可以用trim释放。借出的总量不超过limit；
+// 预算用尽时acquire阻塞，由此对接收方形成背压，进程的内存占用是可预期的。
+class BufferPool {
+  public:
+    constexpr static size_t BLOCK_SIZE = 256 * 1024;
+    constexpr static size_t BLOCKS_PER_SLAB = 16;
+    constexpr static size_t DEFAULT_LIMIT = 256 * 1024 * 1024;
+
+  private:
+    struct SlabDeleter {
+        void operator()(char *p) const noexcept;
+    };
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<std::unique_ptr<char, SlabDeleter>> slabs;
+    std::vector<char *> freeBlocks;
+    size_t _limit{DEFAULT_LIMIT};
+    size_t _inUse{0};
+
+    BufferPool() = default;
+    // 调用者需持有m
+    bool grow();
+    // 调用者需持有m
+    void releaseIdleSlabs();
+    Block take() noexcept;
+    void release(char *ptr) noexcept;
+
+    friend class Block;
+
+  public:
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    static BufferPool &getInstance() {
+        static BufferPool instance;
+        return instance;
+    }
+
+    // 借出一个块，预算用尽时等待其他传输归还
+    Block acquire();
+    // 最多等待patience，仍然超出预算时返回空块，由调用者按内存不足处理。
+    // 用于会长期持有多个块的场景（如内存中的body），互相等待时不会永远阻塞
+    Block acquire(std::chrono::milliseconds patience);
+    // 预算用尽时立即返回空块
+    Block tryAcquire();
+
+    // 总内存上限（字节），至少为一个块；调小时释放空闲的slab
+    void setLimit(size_t bytes);
+    // 释放所有块都已归还的slab
+    void trim();
+    [[nodiscard]] size_t limit();
+    // 正在借出的字节数
+    [[nodiscard]] size_t inUse();
+};
+
+inline void Block::reset() noexcept {
+    if (ptr)
+        pool->release(ptr);
+    pool = nullptr;
+    ptr = nullptr;
+}
+
+inline size_t Block::size() const noexcept {
+    return ptr ? BufferPool::BLOCK_SIZE : 0;
+}
+
+} // namespace multi_get
+
+#endif // MULTI_GET_BUFFER_POOL_H
@@ -0,0 +1,53 @@
+#ifndef MULTI_GET_CACHE_H
+#define MULTI_GET_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+#include "Error.h"
+
+namespace multi_get {
+
+// 本地下载缓存。按url记录ETag/Last-Modified，内容按SHA-256存放，不同url的相同文件只保存一份。
+// 目录结构：
+//   objects/<hash前两位>/<hash>  只读的文件内容
+//   urls/<url的hash>             url对应的校验信息和内容hash
+//   lock                         多个进程之间用flock互斥
+// 读取使用共享锁，写入和淘汰使用排他锁，文件都先写到临时名再rename，进程中途退出不会留下半个文件
+class Cache {
+  public:
+    struct Entry {
+        std::string etag;
+        std::string lastModified;
+        // 内容的SHA-256
+        std::string object;
+        uint64_t size{0};
+    };
+
+  private:
+    std::filesystem::path root;
+    // 对象总大小的上限，0表示不限制
+    uint64_t limit;
+
+    [[nodiscard]] std::filesystem::path objectPath(const std::string &hash) const;
+    [[nodiscard]] std::filesystem::path metaPath(const std::string &url) const;
+    // 调用者需持有排他锁
+    void evict();
+
+  public:
+    Cache(std::filesystem::path root, uint64_t limit);
+
+    // 只有带校验信息且内容仍然存在的记录才会返回
+    [[nodiscard]] std::optional<Entry> lookup(const std::string &url) const;
+    // 把缓存的内容放到target，依次尝试reflink、硬链接和复制，并更新最近使用时间
+    Error restore(const Entry &entry, const std::filesystem::path &target) const;
+    // 把下载好的file加入缓存，之后按最近使用时间淘汰超出limit的对象
+    Error store(const std::string &url, const std::string &etag, const std::string &lastModified,
+                const std::filesystem::path &file);
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_CACHE_H
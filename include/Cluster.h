@@ -0,0 +1,116 @@
+#ifndef MULTI_GET_CLUSTER_H
+#define MULTI_GET_CLUSTER_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Connection.h"
+#include "Error.h"
+#include "MultiGet.h"
+#include "Rope.h"
+#include "SegmentPlan.h"
+#include "SegmentScheduler.h"
+
+namespace multi_get {
+
+// 集群模式：协调者做探测和分段规划，分段交给连接上来的worker进程（Client::work）下载，
+// 单机网卡不再是大文件的瓶颈。协调者与worker之间是一条TCP连接上的文本协议，
+// 每条消息一行，与HTTP一样以CRLF结束：
+//   worker -> 协调者  HELLO <slots>               worker同时下载的分段数
+//   协调者 -> worker  URL <url>                   最终（重定向之后）的地址
+//                     ETAG <etag>                 可以为空，不为空时worker带If-Match请求，文件变化时失败而不是混入新版本
+//                     OUTPUT <path>               共享文件系统上的临时文件；为'-'时worker把数据传回协调者
+//                     SEG <id> <first> <last>     分配一个分段，闭区间
+//                     BYE                         下载结束（完成或失败），worker退出
+//   worker -> 协调者  DONE <id>                   分段已写入共享文件并fdatasync
+//                     DATA <id> <length>          之后紧跟length字节的分段数据
+//                     FAIL <id> <error> <status>  worker重试后仍然失败，error为Error的数值
+// worker断开或报告可恢复的失败时，它手上的分段放回队列分给其他worker，同一分段最多失败attempts次。
+class Coordinator {
+  public:
+    using Range = SegmentScheduler::Range;
+
+    struct Job {
+        std::string url;
+        std::string etag;
+        // worker写入的共享文件，为空时数据传回协调者
+        std::string output;
+    };
+
+    struct Hooks {
+        // 返回true时停止
+        std::function<bool()> cancelled;
+        // 传回协调者的分段，返回错误时停止
+        std::function<Error(size_t idx, Rope &&body)> deliver;
+        // worker已经写入共享文件的分段
+        std::function<void(size_t idx)> written;
+    };
+
+  private:
+    struct Peer {
+        socket_t fd;
+        std::string address;
+        size_t slots{0};
+        // 已分配、还没有完成的分段
+        std::vector<size_t> assigned;
+        uint64_t bytes{0};
+        bool closed{false};
+        std::thread thread;
+    };
+
+    uint16_t port;
+    Job job;
+    SegmentPlan ranges;
+    unsigned attempts;
+    socket_t listenFd{invalid_socket};
+    Hooks hooks;
+
+    std::mutex m;
+    std::list<Peer> peers;
+    std::deque<size_t> pending;
+    std::vector<bool> completed;
+    std::vector<unsigned> failures;
+    size_t finished{0};
+    bool stopping{false};
+    Error _error{Error::Ok};
+    int _status{0};
+
+    void serve(Peer &peer);
+    // 把待下载的分段分给有空闲的worker，调用者需持有m
+    void dispatch();
+    // 分段完成，返回false表示不是该worker的分段或已经完成过，调用者需持有m
+    bool complete(Peer &peer, size_t idx);
+    // 把分段放回队列，失败次数过多时停止下载，调用者需持有m
+    void requeue(size_t idx, Error e, int status);
+    // 只记录第一个错误，调用者需持有m
+    void fail(Error e, int status = 0);
+    void disconnect(Peer &peer);
+    void stop();
+
+  public:
+    Coordinator(uint16_t port, Job job, SegmentPlan ranges, unsigned attempts);
+    Coordinator(const Coordinator &) = delete;
+    Coordinator &operator=(const Coordinator &) = delete;
+    ~Coordinator();
+
+    // 开始监听，端口被占用等情况返回Error::ListenFailed
+    Error listen();
+    // 接受worker并分配分段，阻塞直到全部完成或出错，返回第一个错误
+    Error run(Hooks hooks);
+    // error为HTTPStatus时的状态码
+    [[nodiscard]] int status() const noexcept {
+        return _status;
+    }
+    // 各worker完成的字节数，包括已经断开的
+    [[nodiscard]] std::vector<PathStats> workers();
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_CLUSTER_H
@@ -1,16 +1,23 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <chrono>
 #include <csignal>
 #include <cstdlib>
 #include <cstring>
+#include <initializer_list>
 #include <iostream>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <unordered_map>
 #include <utility>
 
 #include <openssl/ssl.h>
 
+#include "Error.h"
 #include "Logger.h"
 
 #ifdef _WIN32
@@ -18,7 +25,13 @@
 #include <WS2tcpip.h>
 #include <winsock2.h>
 using ssize_t = SSIZE_T;
+constexpr int SEND_FLAGS = 0;
 using socket_t = SOCKET;
+constexpr socket_t invalid_socket = INVALID_SOCKET;
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
 inline void close_socket(socket_t sock) {
     ::closesocket(sock);
 }
@@ -44,9 +57,17 @@ public:
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 using socket_t = int;
+constexpr socket_t invalid_socket = -1;
+// 对端已关闭时写入返回EPIPE，而不是让进程收到SIGPIPE
+#ifdef MSG_NOSIGNAL
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
 inline void close_socket(socket_t sock) {
     ::close(sock);
 }
@@ -57,12 +78,79 @@ inline void close_socket(socket_t sock) {
 
 namespace multi_get {
 
+class Executor;
+template <typename T>
+class Task;
+
+// 各阶段的超时，0表示不限制
+struct Timeouts {
+    std::chrono::milliseconds connect{std::chrono::seconds(10)};
+    // 发出请求后等待响应头
+    std::chrono::milliseconds firstByte{std::chrono::seconds(30)};
+    // 接收body时两次收到数据的最大间隔
+    std::chrono::milliseconds idle{std::chrono::seconds(30)};
+};
+
+// 套接字调优，默认值保持系统设置（TCP_NODELAY除外）
+struct SocketOptions {
+    // SO_RCVBUF字节数，0表示交给内核自动调整。需要在connect之前设置才能协商到足够的窗口缩放
+    uint32_t receiveBuffer{0};
+    // 预期带宽（字节/秒），未指定receiveBuffer时按到同一host的上一条连接测得的RTT，
+    // 在connect之前将SO_RCVBUF设为两倍带宽时延积；还没有RTT时交给内核自动调整
+    uint64_t bandwidth{0};
+    // 请求分多次写出时不等待Nagle算法合并
+    bool noDelay{true};
+    // TCP_FASTOPEN_CONNECT：已有服务器的cookie时，第一次写出的数据随SYN发送（仅Linux）
+    bool fastOpen{false};
+    // TCP_CONGESTION，如bbr，为空时使用系统默认（仅Linux）
+    std::string congestion;
+    // SO_BUSY_POLL微秒数，接收时忙等网卡队列以降低延迟，0表示不启用（仅Linux）
+    uint32_t busyPoll{0};
+    // 本地源地址（如192.168.1.10）或网卡名（如eth1），为空时由内核按路由选择
+    std::string source;
+
+    // 区分不同配置的连接，默认配置为空串
+    [[nodiscard]] std::string key() const;
+};
+
+// 连接上实际生效的套接字参数，不支持的项为默认值
+struct SocketInfo {
+    int receiveBuffer{0};
+    bool noDelay{false};
+    // SYN携带了数据
+    bool fastOpen{false};
+    std::string congestion;
+    int busyPoll{0};
+    // 内核平滑后的RTT
+    std::chrono::microseconds rtt{0};
+};
+
+// 代理地址，格式为scheme://[user:password@]host[:port]
+//   socks5   目标域名在本地解析，以IP地址发给代理
+//   socks5h  目标域名交给代理解析
+//   http     用HTTP CONNECT建立隧道，http和https请求都经过隧道
+struct ProxyConfig {
+    enum class Type {
+        None,
+        Socks5,
+        Socks5h,
+        HTTP
+    };
+    Type type{Type::None};
+    std::string host;
+    uint16_t port{0};
+    std::string user;
+    std::string password;
+
+    [[nodiscard]] bool enabled() const noexcept {
+        return type != Type::None;
+    }
+    // 空串表示不使用代理，格式不支持时返回空
+    static std::optional<ProxyConfig> parse(std::string_view url);
+};
+
 class Connection {
   protected:
-    union PORT {
-        char port_chars[2];
-        uint16_t port_short;
-    };
     constexpr static const char *const SOCKS_ERROR_STR[] = {
         "Succeed",
         "General SOCKS server failure",
@@ -74,70 +162,118 @@ class Connection {
         "Command not supported",
         "Address type not supported"};
 
-    socket_t sock{};
+    socket_t sock{invalid_socket};
     bool _connected{false};
     std::string hostname;
     uint16_t port{0};
-    std::string proxyAddr;
-    uint16_t proxyPort{0};
-
-    static socket_t openClientFd(const std::string &hostname, uint16_t port) {
-        socket_t clientFd;
-        addrinfo hints{}, *listp, *p;
-        std::memset(&hints, 0, sizeof(hints));
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
-        std::string portStr = std::to_string(port);
-        if (int s = ::getaddrinfo(hostname.c_str(), portStr.c_str(), &hints, &listp);
-            0 != s) {
-            LOG_ERROR("getaddrinfo: %s", gai_strerror(s));
-            exit(EXIT_FAILURE);
-        }
-
-        for (p = listp; p; p = p->ai_next) {
-            if ((clientFd = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
-                continue;
-            }
-            if (::connect(clientFd, p->ai_addr, static_cast<int>(p->ai_addrlen)) != -1) {
-                break;
-            }
-            close_socket(clientFd);
-        }
-        ::freeaddrinfo(listp);
-        if (!p) {
-            ::perror("Socket Connection Error");
-            exit(EXIT_FAILURE);
-        }
-        return clientFd;
-    }
+    ProxyConfig proxy;
+    // setProxy收到了不支持的代理地址，connect总是失败，而不是绕过代理直连
+    bool proxyInvalid{false};
+
+    Error _error{Error::Ok};
+    Timeouts timeouts;
+    SocketOptions socketOptions;
+    std::chrono::milliseconds receiveTimeout{};
+    // 最近一次收发因超时而失败
+    mutable bool _timedOut{false};
+
+    // 解析结果会被缓存，失败时返回invalid_socket并设置err
+    static socket_t openClientFd(const std::string &hostname, uint16_t port, Error &err,
+                                 std::chrono::milliseconds timeout = {}, const SocketOptions &options = {});
+    // connect之前设置的选项，失败只记录警告
+    static void applySocketOptions(socket_t fd, const SocketOptions &options);
+    // connect时使用的选项：按带宽和记录的RTT补上receiveBuffer
+    [[nodiscard]] SocketOptions connectOptions() const;
+    // 连接建立后记录RTT，供之后到同一host的连接在connect之前设置接收缓冲区
+    void recordRtt() const;
+    // 连接代理并建立到hostname:port的隧道，失败时设置_error
+    bool connectProxy();
 
   public:
     [[nodiscard]] bool connected() const noexcept {
         return _connected;
     }
+    [[nodiscard]] socket_t fd() const noexcept {
+        return sock;
+    }
+    // connect失败的原因
+    [[nodiscard]] Error error() const noexcept {
+        return _error;
+    }
+    [[nodiscard]] bool timedOut() const noexcept {
+        return _timedOut;
+    }
+    // 在connect之前设置，之后的修改从下一次setReceiveTimeout开始生效
+    void setTimeouts(const Timeouts &t) noexcept {
+        timeouts = t;
+    }
+    [[nodiscard]] const Timeouts &getTimeouts() const noexcept {
+        return timeouts;
+    }
+    // 在connect之前设置
+    void setSocketOptions(const SocketOptions &options) {
+        socketOptions = options;
+    }
+    // 查询当前生效的套接字参数，未连接时返回默认值
+    [[nodiscard]] SocketInfo socketInfo() const;
+    // 设置阻塞接收的超时（SO_RCVTIMEO），协程版本也使用该值
+    void setReceiveTimeout(std::chrono::milliseconds timeout) noexcept;
+    // 中断其他线程中阻塞的收发，连接之后不能再使用
+    void shutdown() const noexcept;
+
     // 建立socket连接
     virtual bool connect() {
         if (_connected)
             return true;
 
-        //        const auto &[hostAddr, hostPort] = getHostAndPort(host);
-        if (proxyAddr.empty()) {
-            sock = openClientFd(hostname, port);
-            _connected = true;
+        // 新socket使用系统默认的超时
+        receiveTimeout = {};
+        if (proxyInvalid) {
+            _error = Error::ProxyFailed;
+            return false;
+        }
+        if (!proxy.enabled()) {
+            sock = openClientFd(hostname, port, _error, timeouts.connect, connectOptions());
+            _connected = sock != invalid_socket;
         } else {
-            sock = openClientFd(proxyAddr, proxyPort);
-            _connected = do_proxy_handshake();
+            _connected = connectProxy();
+        }
+        if (_connected) {
+            setReceiveTimeout(timeouts.idle);
+            recordRtt();
         }
-        //        struct timeval timeout = {3, 0};
-        //        setoption(SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval));
         return _connected;
     }
 
+    // 虚接口只用于连接池和连接建立等不在热路径上的调用；
+    // 响应的接收和解析按具体的连接类型实例化（见Transport.h），直接调用子类的实现
     virtual ssize_t send(const char *_buf, size_t _n) const = 0;
     virtual ssize_t receive(char *_buf, size_t _n) const = 0;
-    void receiveNBytes(char* _buf, size_t n) const;
-
-    [[nodiscard]] bool do_proxy_handshake() const;
+    // 发送多个不连续的缓冲区，默认实现先拼接再调用send
+    virtual ssize_t sendv(const iovec *iov, size_t cnt) const;
+    // 按批发送任意数量的切片（PlainConnection一次最多合并8个），全部发送成功时返回true
+    bool sendSlices(const iovec *iov, size_t cnt) const;
+    // 返回实际收到的字节数，小于n表示连接已断开
+    size_t receiveNBytes(char* _buf, size_t n) const;
+
+    // 非阻塞收发的返回值，表示需要等待socket可读/可写后重试
+    constexpr static ssize_t WANT_READ = -2;
+    constexpr static ssize_t WANT_WRITE = -3;
+    virtual ssize_t trySend(const char *_buf, size_t _n) const = 0;
+    virtual ssize_t tryReceive(char *_buf, size_t _n) const = 0;
+    bool setNonBlocking(bool on) const noexcept;
+
+    // 协程版本：socket未就绪时挂起当前协程而不阻塞线程，连接会被切换为非阻塞模式
+    virtual Task<bool> asyncConnect(Executor &ex);
+    // 全部发送成功时返回_n，失败返回-1
+    Task<ssize_t> asyncSend(Executor &ex, const char *_buf, size_t _n) const;
+    // 至少收到1字节才返回，0表示对端关闭，-1表示出错
+    Task<ssize_t> asyncReceive(Executor &ex, char *_buf, size_t _n) const;
+    Task<size_t> asyncReceiveNBytes(Executor &ex, char *_buf, size_t n) const;
+
+    // 在已连接到代理的sock上建立到hostname:port的隧道。optimistic时SOCKS5的问候和CONNECT一次发出，
+    // 失败且pipelineRejected为true时说明代理可能不接受提前发送，应重新连接后逐步握手
+    [[nodiscard]] bool do_proxy_handshake(bool optimistic, bool &pipelineRejected) const;
     void setProxy(const std::string &proxyStr);
 
     Connection() = default;
@@ -147,22 +283,24 @@ class Connection {
     }
 
     virtual ~Connection() {
-        if (_connected)
+        if (sock != invalid_socket)
             close_socket(sock);
     }
 };
 
-class PlainConnection : public Connection {
+class PlainConnection final : public Connection {
   public:
     PlainConnection(const std::string &hostname, uint16_t port) : Connection(hostname, port){};
     PlainConnection(const std::string &hostname, uint16_t port, const std::string& proxy) : Connection(hostname, port, proxy){};
-    ssize_t send(const char *_buf, size_t _n) const override {
-        return ::send(sock, _buf, static_cast<int>(_n), 0);
-    }
+    ssize_t send(const char *_buf, size_t _n) const override;
+    ssize_t receive(char *_buf, size_t _n) const override;
 
-    ssize_t receive(char *_buf, size_t _n) const override {
-        return ::recv(sock, _buf, static_cast<int>(_n), 0);
-    }
+    ssize_t trySend(const char *_buf, size_t _n) const override;
+    ssize_t tryReceive(char *_buf, size_t _n) const override;
+
+#ifndef _WIN32
+    ssize_t sendv(const iovec *iov, size_t cnt) const override;
+#endif
 };
 
 class SSLInitializer {
@@ -191,24 +329,67 @@ class SSLInitializer {
     }
 };
 
-class SSLConnection : public Connection {
+// 进程内共享的SSL_CTX，并按host缓存TLS会话，后续连接可以复用会话跳过完整握手
+class SSLContext {
   private:
-    SSL *ssl{};
     SSL_CTX *ctx{};
+    std::mutex m;
+    std::unordered_map<std::string, SSL_SESSION *> sessions;
 
-  protected:
-    ssize_t send(const char *_buf, size_t _n) const override;
+    SSLContext();
+    static int onNewSession(SSL *ssl, SSL_SESSION *session);
 
-    ssize_t receive(char *_buf, size_t _n) const override;
+  public:
+    ~SSLContext();
+    SSLContext(const SSLContext &) = delete;
+    SSLContext &operator=(const SSLContext &) = delete;
+
+    static SSLContext &getInstance() {
+        static SSLContext instance;
+        return instance;
+    }
 
+    [[nodiscard]] SSL_CTX *get() const noexcept {
+        return ctx;
+    }
+    // 为即将握手的ssl设置之前缓存的会话
+    void resume(SSL *ssl, const std::string &key);
+};
+
+class SSLConnection final : public Connection {
+  private:
+    SSL *ssl{};
+    // host:port，用于TLS会话缓存
+    std::string sessionKey;
+    // ALPN协议列表（wire format），为空时不协商
+    std::string alpn;
+
+    // 创建SSL对象并设置SNI、ALPN和缓存的会话，握手前调用
+    bool prepare();
+
+  protected:
     bool connect() override;
 
   public:
+    ssize_t send(const char *_buf, size_t _n) const override;
+    ssize_t receive(char *_buf, size_t _n) const override;
+    ssize_t trySend(const char *_buf, size_t _n) const override;
+    ssize_t tryReceive(char *_buf, size_t _n) const override;
+    Task<bool> asyncConnect(Executor &ex) override;
+
     SSLConnection(const std::string &hostname, uint16_t port) : Connection(hostname, port){};
     SSLConnection(const std::string &hostname, uint16_t port, const std::string& proxy) : Connection(hostname, port, proxy){};
+
+    // 需要在connect之前调用，如 {"h2", "http/1.1"}
+    void setAlpn(std::initializer_list<std::string_view> protocols);
+    // 握手后服务器选择的协议，未协商时为空
+    [[nodiscard]] std::string_view alpnSelected() const noexcept;
+    [[nodiscard]] SSL *handle() const noexcept {
+        return ssl;
+    }
+
     ~SSLConnection() override {
         if (ssl) {
-            ::SSL_CTX_free(ctx);
             ::SSL_shutdown(ssl);
             ::SSL_free(ssl);
         }
@@ -216,6 +397,8 @@ class SSLConnection : public Connection {
 };
 
 std::tuple<std::string, std::string, uint16_t, std::string> formatHost(const std::string &url);
+// 将重定向的Location（可能是相对路径）解析为完整url
+std::string resolveUrl(const std::string &base, std::string_view location);
 
 } // namespace multi_get
 
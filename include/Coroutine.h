@@ -0,0 +1,278 @@
+#ifndef MULTI_GET_COROUTINE_H
+#define MULTI_GET_COROUTINE_H
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+#include "Connection.h"
+
+namespace multi_get {
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    // 结束时直接切换到等待者（对称转移），不会加深调用栈
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            auto next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        exception = std::current_exception();
+    }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U &&v) {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T result() {
+        if (exception)
+            std::rethrow_exception(exception);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result() {
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+} // namespace detail
+
+// 惰性启动的协程，被co_await时才开始执行
+template <typename T = void>
+class Task {
+  public:
+    using promise_type = detail::Promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+  private:
+    handle_type h;
+
+  public:
+    explicit Task(handle_type h) noexcept : h(h) {}
+    Task(Task &&other) noexcept : h(std::exchange(other.h, {})) {}
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            if (h)
+                h.destroy();
+            h = std::exchange(other.h, {});
+        }
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() {
+        if (h)
+            h.destroy();
+    }
+
+    bool await_ready() const noexcept {
+        return !h || h.done();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        h.promise().continuation = awaiting;
+        return h;
+    }
+    T await_resume() {
+        return h.promise().result();
+    }
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() noexcept {
+    return Task<T>{std::coroutine_handle<Promise<T>>::from_promise(*this)};
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept {
+    return Task<void>{std::coroutine_handle<Promise<void>>::from_promise(*this)};
+}
+
+} // namespace detail
+
+// 单线程事件循环：协程在socket不可读/写时挂起，由run()在就绪后恢复。
+// 每个线程可以运行一个Executor，一个Executor上可以同时挂起成千上万个协程。
+class Executor {
+  private:
+    using Clock = std::chrono::steady_clock;
+    struct FdAwaiter;
+
+    struct Waiters {
+        FdAwaiter *reader{};
+        FdAwaiter *writer{};
+    };
+
+    int pollFd{-1};
+    size_t active{0};
+    std::deque<std::coroutine_handle<>> ready;
+    std::unordered_map<socket_t, Waiters> waiters;
+    // 按截止时间排序的等待者，超时后以失败恢复
+    std::multimap<Clock::time_point, FdAwaiter *> timers;
+
+    void wait(FdAwaiter *awaiter);
+    void wake(FdAwaiter *awaiter);
+    void addTimer(FdAwaiter *awaiter);
+    // 等待IO就绪，timeout为毫秒，-1表示一直等待
+    void poll(int timeout);
+    void expireTimers();
+
+    struct FdAwaiter {
+        Executor &ex;
+        socket_t fd;
+        bool write;
+        std::chrono::milliseconds timeout;
+        std::coroutine_handle<> handle{};
+        std::multimap<Clock::time_point, FdAwaiter *>::iterator timer{};
+        bool timed{false};
+        bool timedOut{false};
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            // 没有fd时只是定时器
+            if (fd == invalid_socket)
+                ex.addTimer(this);
+            else
+                ex.wait(this);
+        }
+        // 超时返回false
+        bool await_resume() const noexcept {
+            return !timedOut;
+        }
+    };
+
+    struct Detached {
+        struct promise_type {
+            Executor *ex;
+            promise_type(Executor &ex, Task<void> &) : ex(&ex) {}
+            Detached get_return_object() noexcept {
+                return {};
+            }
+            std::suspend_never initial_suspend() noexcept {
+                return {};
+            }
+            std::suspend_never final_suspend() noexcept {
+                --ex->active;
+                return {};
+            }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept {}
+        };
+    };
+
+    static Detached launch(Executor &ex, Task<void> task);
+
+  public:
+    Executor();
+    ~Executor();
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    // 启动一个协程，它与调用者并发执行
+    void spawn(Task<void> task);
+    // 运行直到所有协程结束
+    void run();
+
+    // 让出执行权，稍后由run()恢复
+    auto yield() {
+        struct Awaiter {
+            Executor &ex;
+            bool await_ready() const noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> h) {
+                ex.ready.push_back(h);
+            }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+    // 等待fd可读/可写，timeout为0表示不限时，超时时co_await的结果为false
+    FdAwaiter readable(socket_t fd, std::chrono::milliseconds timeout = {}) {
+        return {*this, fd, false, timeout};
+    }
+    FdAwaiter writable(socket_t fd, std::chrono::milliseconds timeout = {}) {
+        return {*this, fd, true, timeout};
+    }
+
+    // 挂起当前协程一段时间
+    FdAwaiter sleep(std::chrono::milliseconds duration) {
+        return {*this, invalid_socket, false, duration};
+    }
+
+    // 在当前线程运行task直到完成并返回其结果
+    template <typename T>
+    T blockOn(Task<T> task) {
+        std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> result;
+        std::exception_ptr error;
+        spawn([](Task<T> t, auto &out, std::exception_ptr &err) -> Task<void> {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    co_await t;
+                    out.emplace(true);
+                } else {
+                    out.emplace(co_await t);
+                }
+            } catch (...) {
+                err = std::current_exception();
+            }
+        }(std::move(task), result, error));
+        run();
+        if (error)
+            std::rethrow_exception(error);
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*result);
+    }
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_COROUTINE_H
@@ -0,0 +1,33 @@
+#ifndef MULTI_GET_DECODER_H
+#define MULTI_GET_DECODER_H
+
+#include <memory>
+#include <string_view>
+
+#include "Error.h"
+#include "Rope.h"
+
+namespace multi_get {
+
+// Content-Encoding的流式解码。输入可以按到达的顺序分成任意多段，解码结果直接追加到Rope的块中，
+// 不需要先收完整个压缩的body。gzip/deflate需要编译时找到zlib，zstd需要libzstd
+class Decoder {
+  public:
+    virtual ~Decoder() = default;
+
+    // 解码一段输入追加到out，数据损坏时返回Error::DecodeFailed
+    virtual Error decode(const char *data, size_t n, Rope &out) = 0;
+    // 输入已经结束，压缩流不完整时返回Error::DecodeFailed
+    [[nodiscard]] virtual Error finish() = 0;
+
+    // 按响应的Content-Encoding创建，不支持的编码返回空
+    static std::unique_ptr<Decoder> create(std::string_view encoding);
+    // 不需要解码：没有Content-Encoding或为identity
+    static bool identity(std::string_view encoding) noexcept;
+    // 请求中Accept-Encoding的值，编译时没有可用的库时为空
+    static std::string_view accepted() noexcept;
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_DECODER_H
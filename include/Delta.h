@@ -0,0 +1,56 @@
+#ifndef MULTI_GET_DELTA_H
+#define MULTI_GET_DELTA_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace multi_get {
+
+// zsync式的块校验文件：新文件按blockSize分块，每块记录rsync滚动校验和与截断的SHA-256，
+// 下载时在本地旧文件中逐字节滚动查找相同的块，只请求找不到的部分。
+// 格式为"Key: Value"形式的文本头部，以空行结束，之后是每块20字节的记录：
+//   4字节滚动校验和（大端） + SHA-256的前16字节
+// 最后一块不足blockSize时按补零计算
+class BlockMap {
+  public:
+    constexpr static size_t STRONG_BYTES = 16;
+    constexpr static uint32_t DEFAULT_BLOCK_SIZE = 4096;
+    constexpr static uint32_t MAX_BLOCK_SIZE = 16 * 1024 * 1024;
+    using Strong = std::array<uint8_t, STRONG_BYTES>;
+
+    uint64_t length{0};
+    uint32_t blockSize{DEFAULT_BLOCK_SIZE};
+    // 整个新文件的SHA-256，用于校验拼好的结果
+    std::string sha256;
+    std::vector<uint32_t> weak;
+    std::vector<Strong> strong;
+
+    [[nodiscard]] size_t blocks() const noexcept {
+        return weak.size();
+    }
+    // 第idx块在新文件中的实际长度
+    [[nodiscard]] uint64_t blockLength(size_t idx) const noexcept {
+        return std::min<uint64_t>(blockSize, length - idx * static_cast<uint64_t>(blockSize));
+    }
+
+    // 格式不正确时返回空
+    static std::optional<BlockMap> parse(std::string_view data);
+    [[nodiscard]] std::string serialize() const;
+    // 为file生成块校验，读取失败时返回空
+    static std::optional<BlockMap> build(const std::filesystem::path &file, uint32_t blockSize = DEFAULT_BLOCK_SIZE);
+    // 在file中查找与各完整块内容相同的数据，返回每块在file中的偏移，找不到时为-1
+    [[nodiscard]] std::vector<int64_t> locate(const std::filesystem::path &file) const;
+};
+
+// rsync的滚动校验和：低16位为字节和，高16位为按位置加权的和
+uint32_t weakChecksum(const uint8_t *data, size_t n) noexcept;
+
+} // namespace multi_get
+
+#endif // MULTI_GET_DELTA_H
@@ -0,0 +1,58 @@
+#ifndef MULTI_GET_DIGEST_H
+#define MULTI_GET_DIGEST_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct evp_md_ctx_st;
+
+namespace multi_get {
+
+// 基于OpenSSL的增量SHA-256
+class Sha256 {
+  public:
+    using Digest = std::array<uint8_t, 32>;
+
+  private:
+    struct Free {
+        void operator()(evp_md_ctx_st *ctx) const noexcept;
+    };
+    std::unique_ptr<evp_md_ctx_st, Free> ctx;
+
+  public:
+    Sha256();
+    void update(const void *data, size_t n);
+    Digest finish();
+};
+
+// 上传分段的Content-MD5，与S3分段的ETag比较
+class Md5 {
+  public:
+    using Digest = std::array<uint8_t, 16>;
+
+  private:
+    struct Free {
+        void operator()(evp_md_ctx_st *ctx) const noexcept;
+    };
+    std::unique_ptr<evp_md_ctx_st, Free> ctx;
+
+  public:
+    Md5();
+    void update(const void *data, size_t n);
+    Digest finish();
+};
+
+std::string toHex(const uint8_t *data, size_t n);
+std::string toBase64(const uint8_t *data, size_t n);
+std::string sha256Hex(std::string_view data);
+// 读取失败时返回空串
+std::string sha256File(const std::filesystem::path &path);
+
+} // namespace multi_get
+
+#endif // MULTI_GET_DIGEST_H
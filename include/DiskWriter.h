@@ -0,0 +1,57 @@
+#ifndef MULTI_GET_DISK_WRITER_H
+#define MULTI_GET_DISK_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Error.h"
+#include "OutputFile.h"
+#include "Rope.h"
+
+namespace multi_get {
+
+// 接收与磁盘写入之间的流水线：网络线程把收到的数据放入有界队列后立即继续接收，
+// 由专门的写线程按偏移合并相邻的范围，一次写出。磁盘较慢时只有队列满了才阻塞网络线程，
+// 不会因为一次慢写而让连接的接收窗口收缩。每个输出文件（即每块磁盘）有自己的队列。
+class DiskWriter {
+  public:
+    constexpr static uint64_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+    // 合并后单次写出的上限
+    constexpr static uint64_t MAX_WRITE = 32 * 1024 * 1024;
+
+  private:
+    OutputFile &out;
+    uint64_t capacity;
+    std::mutex m;
+    std::condition_variable hasWork;
+    std::condition_variable hasSpace;
+    // 按偏移排序，相邻的范围可以一起取出
+    std::map<uint64_t, Rope> pending;
+    // 排队和正在写入的字节数
+    uint64_t queued{0};
+    bool closing{false};
+    Error _error{Error::Ok};
+    std::vector<std::thread> threads;
+
+    void run();
+
+  public:
+    explicit DiskWriter(OutputFile &out, size_t threadCount = 1, uint64_t capacity = DEFAULT_CAPACITY);
+    // 等待已排队的数据写完
+    ~DiskWriter();
+    DiskWriter(const DiskWriter &) = delete;
+    DiskWriter &operator=(const DiskWriter &) = delete;
+
+    // 放入从offset开始的数据，队列满时阻塞。写入已经失败时返回错误
+    Error push(uint64_t offset, Rope &&data);
+    // 等待队列写完并停止写线程，返回第一个错误
+    Error finish();
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_DISK_WRITER_H
@@ -0,0 +1,81 @@
+#ifndef MULTI_GET_ERROR_H
+#define MULTI_GET_ERROR_H
+
+namespace multi_get {
+
+// 库内部不再调用exit()，所有失败都以错误码的形式返回给调用者
+enum class Error {
+    Ok = 0,
+    InvalidUrl,
+    ResolveFailed,
+    ConnectFailed,
+    ProxyFailed,
+    TLSFailed,
+    SendFailed,
+    BadResponse,
+    HTTPStatus,
+    IncompleteBody,
+    OutOfMemory,
+    FileError,
+    OutputError,
+    Cancelled,
+    Timeout,
+    DiskFull,
+    InputError,
+    ChecksumMismatch,
+    ListenFailed,
+    CoordinatorLost,
+    DecodeFailed
+};
+
+inline const char *errorString(Error e) noexcept {
+    switch (e) {
+    case Error::Ok:
+        return "Succeed";
+    case Error::InvalidUrl:
+        return "Unsupported url, the url should starts with http:// or https://";
+    case Error::ResolveFailed:
+        return "Failed to resolve host";
+    case Error::ConnectFailed:
+        return "Failed to connect to host";
+    case Error::ProxyFailed:
+        return "Proxy handshake failed";
+    case Error::TLSFailed:
+        return "TLS handshake failed";
+    case Error::SendFailed:
+        return "Failed to send request";
+    case Error::BadResponse:
+        return "Malformed HTTP response";
+    case Error::HTTPStatus:
+        return "Unexpected HTTP status";
+    case Error::IncompleteBody:
+        return "Connection closed before the whole body was received";
+    case Error::OutOfMemory:
+        return "Failed to alloc memory";
+    case Error::FileError:
+        return "Failed to write output file";
+    case Error::OutputError:
+        return "Failed to write output stream";
+    case Error::Cancelled:
+        return "Download cancelled";
+    case Error::Timeout:
+        return "Connection timed out";
+    case Error::DiskFull:
+        return "Not enough disk space for the output file";
+    case Error::InputError:
+        return "Failed to read input file";
+    case Error::ChecksumMismatch:
+        return "Checksum of the uploaded data does not match";
+    case Error::ListenFailed:
+        return "Failed to listen for cluster workers";
+    case Error::CoordinatorLost:
+        return "Lost connection to the cluster coordinator";
+    case Error::DecodeFailed:
+        return "Failed to decode the compressed body";
+    }
+    return "Unknown error";
+}
+
+} // namespace multi_get
+
+#endif // MULTI_GET_ERROR_H
@@ -0,0 +1,45 @@
+#ifndef MULTI_GET_HPACK_H
+#define MULTI_GET_HPACK_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace multi_get::hpack {
+
+struct HeaderEntry {
+    std::string_view name;
+    std::string_view value;
+};
+
+using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+// 请求只发送一次头部，编码器不维护动态表，只使用静态表和不索引的字面量
+class Encoder {
+  public:
+    static void encode(std::vector<char> &out, std::string_view name, std::string_view value);
+};
+
+class Decoder {
+  private:
+    std::deque<std::pair<std::string, std::string>> dynamicTable;
+    size_t tableSize{0};
+    size_t maxTableSize{4096};
+
+    void insert(std::string name, std::string value);
+    void evict();
+    bool lookup(uint64_t index, std::string &name, std::string *value) const;
+
+  public:
+    // 解码一个完整的头部块，格式错误时返回false（此时应当以COMPRESSION_ERROR关闭连接）
+    bool decode(const uint8_t *data, size_t len, HeaderList &headers);
+};
+
+bool huffmanDecode(const uint8_t *data, size_t len, std::string &out);
+
+} // namespace multi_get::hpack
+
+#endif // MULTI_GET_HPACK_H
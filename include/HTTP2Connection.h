@@ -0,0 +1,135 @@
+#ifndef MULTI_GET_HTTP2CONNECTION_H
+#define MULTI_GET_HTTP2CONNECTION_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "HPACK.h"
+#include "HTTPConnection.h"
+
+namespace multi_get {
+
+struct HTTP2Settings {
+    // 高BDP链路需要足够大的窗口，否则单连接吞吐受限于 窗口/RTT
+    uint32_t streamWindow{16 * 1024 * 1024};
+    uint32_t connectionWindow{64 * 1024 * 1024};
+    uint32_t maxFrameSize{256 * 1024};
+};
+
+// 一条TLS连接上的HTTP/2会话，多个线程的请求作为并发的stream复用该连接。
+// 所有SSL读写都在会话自己的IO线程中完成，请求线程只负责入队和等待。
+class HTTP2Session {
+  public:
+    using Settings = HTTP2Settings;
+
+  private:
+    struct Stream {
+        hpack::HeaderList headers;
+        // IO线程不等待缓冲池的预算：块不够时暂停读取socket，由TCP和流控窗口对服务器形成背压
+        Rope body;
+        uint32_t unacked{0};
+        // 收到的DATA字节数，用于判断是否超时
+        uint64_t received{0};
+        Transfer *transfer{nullptr};
+        bool headersDone{false};
+        bool done{false};
+        bool failed{false};
+        // 缓冲池的预算长时间用尽而放弃
+        bool outOfMemory{false};
+    };
+
+    std::shared_ptr<SSLConnection> conn;
+    Settings settings;
+    std::thread ioThread;
+    int wakeFds[2]{-1, -1};
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::unordered_map<uint32_t, std::shared_ptr<Stream>> streams;
+    uint32_t nextStreamId{1};
+    uint32_t peerMaxConcurrent{100};
+    uint32_t peerMaxFrameSize{16384};
+    std::vector<char> outbox;
+    bool goaway{false};
+    bool shutdown{false};
+
+    // 以下成员只在IO线程中访问
+    hpack::Decoder decoder;
+    std::vector<uint8_t> headerBlock;
+    uint32_t headerBlockStream{0};
+    bool headerBlockEndStream{false};
+    uint32_t connectionUnacked{0};
+    // 当前的DATA帧因缓冲池预算用尽而没有处理，等待后重试
+    bool stalled{false};
+    std::chrono::steady_clock::time_point stalledSince{};
+
+    HTTP2Session(std::shared_ptr<SSLConnection> conn, const Settings &settings);
+
+    void ioLoop();
+    void wake() const;
+    bool handleFrame(uint8_t type, uint8_t flags, uint32_t streamId, const uint8_t *payload, uint32_t len);
+    bool handleHeaderBlock();
+    void failAll();
+    static void appendFrame(std::vector<char> &out, uint8_t type, uint8_t flags, uint32_t streamId,
+                            const char *payload, uint32_t len);
+    void queueWindowUpdate(uint32_t streamId, uint32_t increment);
+
+  public:
+    HTTP2Session(const HTTP2Session &) = delete;
+    HTTP2Session &operator=(const HTTP2Session &) = delete;
+    ~HTTP2Session();
+
+    // 建立TLS连接并通过ALPN协商h2，服务器不支持h2时返回nullptr
+    static std::shared_ptr<HTTP2Session> open(const std::string &hostname, uint16_t port, const std::string &proxy,
+                                              const Settings &settings = {}, const Timeouts &timeouts = {},
+                                              const SocketOptions &options = {});
+
+    // 超时或被取消时发送RST_STREAM，只放弃这个stream而不影响连接上的其他请求
+    HTTPResponse request(std::string_view method, std::string_view authority, std::string_view path,
+                         const Headers &headers, int64_t beginPos = -1, int64_t endPos = -1,
+                         const Timeouts &timeouts = {}, Transfer *transfer = nullptr);
+
+    [[nodiscard]] bool usable();
+    [[nodiscard]] SocketInfo socketInfo() const {
+        return conn->socketInfo();
+    }
+};
+
+// 与HTTPConnection接口相同，但https请求通过HTTP/2 stream发送。
+// 同一host的请求共享sessionsPerHost条连接；不支持h2的host退回HTTP/1.1。
+class HTTP2Connection : public HTTPConnection {
+  private:
+    size_t sessionsPerHost;
+    HTTP2Session::Settings settings;
+    std::mutex sessionMutex;
+    std::unordered_map<std::string, std::vector<std::shared_ptr<HTTP2Session>>> sessions;
+    std::unordered_set<std::string> http1Hosts;
+    // 正在建立会话的host，建立期间不持有sessionMutex，同一host的其他请求等待它完成
+    std::unordered_map<std::string, std::shared_future<void>> opening;
+    std::atomic<size_t> roundRobin{0};
+
+    std::shared_ptr<HTTP2Session> session(const std::string &hostname, uint16_t port);
+    HTTPResponse request(std::string_view method, const std::string &url, int64_t beginPos, int64_t endPos,
+                         Transfer *transfer, bool &handled);
+
+  public:
+    explicit HTTP2Connection(size_t sessionsPerHost = 1, const HTTP2Session::Settings &settings = {})
+        : sessionsPerHost(sessionsPerHost ? sessionsPerHost : 1), settings(settings) {}
+
+    using HTTPConnection::get;
+    HTTPResponse get(const std::string &url, int64_t beginPos, int64_t endPos, Transfer *transfer = nullptr) override;
+    HTTPResponse head(const std::string &url, Transfer *transfer = nullptr) override;
+    void prewarm(const std::string &url, size_t count) override;
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_HTTP2CONNECTION_H
@@ -1,10 +1,105 @@
 #ifndef HTTPCONNECTION_H
 #define HTTPCONNECTION_H
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
 #include "HTTPResponse.h"
 #include "Pool.h"
+#include "RequestTemplate.h"
 
 namespace multi_get {
+
+// 一次GET的进度与控制，可以在其他线程中观察进度或中断请求
+class Transfer {
+  public:
+    // 接收body的函数，返回false时停止接收
+    using Sink = std::function<bool(Rope &&data)>;
+
+  private:
+    std::atomic<uint64_t> _received{0};
+    std::atomic<bool> _cancelled{false};
+    std::atomic<uint64_t> *counter{nullptr};
+    std::mutex m;
+    std::function<void()> interrupt;
+    std::function<void(const std::string &, const HTTPResponse &)> onHeaders;
+    Headers extra;
+    Sink sink;
+    bool decode{false};
+
+  public:
+    // 只随本次请求发送的头部（如条件请求），应在请求开始前设置
+    void setRequestHeaders(Headers h) {
+        extra = std::move(h);
+    }
+    [[nodiscard]] const Headers &requestHeaders() const noexcept {
+        return extra;
+    }
+    // 2xx响应的body边收边交给f，不再留在响应中，其他状态的body照常保留。应在请求开始前设置
+    void setSink(Sink f) {
+        sink = std::move(f);
+    }
+    [[nodiscard]] const Sink &bodySink() const noexcept {
+        return sink;
+    }
+    // 请求时带上Accept-Encoding，并按响应的Content-Encoding解码body。只用于不带Range的请求，
+    // 解码后的长度与Content-Length不同；目前只有HTTP/1.1支持，应在请求开始前设置
+    void setDecoding(bool on) noexcept {
+        decode = on;
+    }
+    [[nodiscard]] bool decoding() const noexcept {
+        return decode;
+    }
+    // 收到最终（重定向之后）的响应头时在请求线程中调用，此时body还在接收。
+    // 参数为最终的url和响应头，应在请求开始前设置
+    void setHeadersCallback(std::function<void(const std::string &url, const HTTPResponse &res)> f) {
+        onHeaders = std::move(f);
+    }
+    void headersReceived(const std::string &url, const HTTPResponse &res) const {
+        if (onHeaders)
+            onHeaders(url, res);
+    }
+    // 由传输实现在请求开始时注册中断方式，已取消时立即中断
+    void attach(std::function<void()> f) {
+        std::lock_guard<std::mutex> locker(m);
+        interrupt = std::move(f);
+        if (_cancelled && interrupt)
+            interrupt();
+    }
+    void detach() {
+        std::lock_guard<std::mutex> locker(m);
+        interrupt = nullptr;
+    }
+    // 收到的字节同时累加到该计数器（如ProgressMeter中连接的计数），应在请求开始前设置
+    void setCounter(std::atomic<uint64_t> *c) noexcept {
+        counter = c;
+    }
+    void addReceived(uint64_t n) noexcept {
+        _received.fetch_add(n, std::memory_order_relaxed);
+        if (counter)
+            counter->fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // 已收到的body字节数
+    [[nodiscard]] uint64_t received() const noexcept {
+        return _received.load(std::memory_order_relaxed);
+    }
+    [[nodiscard]] bool cancelled() const noexcept {
+        return _cancelled;
+    }
+    // 中断正在进行的请求，get会带着已收到的部分body返回Error::Cancelled
+    void cancel() {
+        std::lock_guard<std::mutex> locker(m);
+        _cancelled = true;
+        if (interrupt)
+            interrupt();
+    }
+};
+
 class HTTPConnection {
   public:
     HTTPConnection() {
@@ -16,20 +111,73 @@ class HTTPConnection {
             this->proxy = proxy;
     };
 
-    virtual HTTPResponse get(const std::string &url);
-    virtual HTTPResponse head(const std::string &url);
+    HTTPConnection(const HTTPConnection &) = delete;
+    HTTPConnection &operator=(const HTTPConnection &) = delete;
+    virtual ~HTTPConnection() = default;
+
+    // get/head不修改共享状态，配置完成后可被多个线程同时调用
+    HTTPResponse get(const std::string &url) {
+        return get(url, -1, -1);
+    }
+    // 请求[beginPos, endPos]范围，beginPos < 0表示不带Range。
+    // transfer不为空时可以从其他线程观察进度和中断请求
+    virtual HTTPResponse get(const std::string &url, int64_t beginPos, int64_t endPos, Transfer *transfer = nullptr);
+    virtual HTTPResponse head(const std::string &url, Transfer *transfer = nullptr);
+    // 发送带body的请求（如上传用的PUT/POST），不跟随重定向，只使用HTTP/1.1。
+    // headerLines为已序列化的额外头部，Content-Length按body的总长度生成
+    HTTPResponse request(std::string_view method, const std::string &url, std::string_view headerLines,
+                         const iovec *body = nullptr, size_t count = 0, Transfer *transfer = nullptr);
+    // 协程版本，等待网络时挂起而不阻塞线程，只支持HTTP/1.1。
+    // 同一个Executor上的多个请求并发进行，各自使用连接池中的独立连接
+    Task<HTTPResponse> asyncGet(Executor &ex, std::string url, int64_t beginPos = -1, int64_t endPos = -1);
+    Task<HTTPResponse> asyncHead(Executor &ex, std::string url);
+    // 以下配置接口不是线程安全的，应在发起请求前调用
     void setHeader(const std::string &key, const std::string &val);
     void setProxy(const std::string &_proxy);
+    void setTimeouts(const Timeouts &t) noexcept {
+        timeouts = t;
+    }
+    void setSocketOptions(const SocketOptions &options) {
+        socketOptions = options;
+    }
+    // 最近一次完成的请求所用连接上生效的套接字参数
+    [[nodiscard]] SocketInfo socketInfo() const {
+        std::lock_guard<std::mutex> locker(socketMutex);
+        return lastSocket;
+    }
+
+    // 并行建立count条到url所在host的连接（含TLS握手）放入连接池，阻塞直到完成
+    virtual void prewarm(const std::string &url, size_t count);
+    // 返回url按已缓存的重定向得到的最终地址
+    [[nodiscard]] std::string redirected(const std::string &url) const;
 
   protected:
     Headers headers;
     std::string proxy;
-    std::string constructHeaders(const std::string &path, const std::string &method = "GET") const noexcept;
-    static HTTPResponse receiveHTTPHeaders(const std::shared_ptr<Connection> &conn);
-    static HTTPResponse receiveHTTPHeaders(const PoolGuard &guard) {
-        return receiveHTTPHeaders(guard.get());
-    }
+    Timeouts timeouts;
+    SocketOptions socketOptions;
+    mutable std::mutex socketMutex;
+    mutable SocketInfo lastSocket;
+    // 本进程内见过的重定向，之后的请求直接访问最终地址
+    mutable std::mutex redirectMutex;
+    std::unordered_map<std::string, std::string> redirects;
+    mutable std::mutex templateMutex;
+    mutable std::unordered_map<std::string, std::shared_ptr<const RequestTemplate>> templates;
+
+    std::shared_ptr<const RequestTemplate> requestTemplate(std::string_view method, const std::string &host) const;
+    static bool sendRequest(const std::shared_ptr<Connection> &conn, const RequestTemplate &tpl,
+                            std::string_view path, int64_t beginPos = -1, int64_t endPos = -1,
+                            std::string_view extra = {});
     void initHeaders() noexcept;
+    void noteSocket(SocketInfo info) const {
+        std::lock_guard<std::mutex> locker(socketMutex);
+        lastSocket = std::move(info);
+    }
+    // 记录重定向并返回新的地址
+    std::string redirect(const std::string &url, const HTTPResponse &res);
+    // 发送一次请求并读取响应，不处理重定向
+    Task<HTTPResponse> asyncRequest(Executor &ex, std::string_view method, const std::string &url,
+                                    int64_t beginPos, int64_t endPos);
 };
 } // namespace multi_get
 
@@ -1,76 +1,164 @@
 #ifndef HTTPRESPONSE_H
 #define HTTPRESPONSE_H
 
-#include <unordered_map>
+#include <array>
+#include <cstdint>
 #include <iostream>
-#include <vector>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
+#include "Error.h"
+#include "Rope.h"
 
 namespace multi_get {
 
 using Headers = std::unordered_map<std::string, std::string>;
 
+// 响应头字段，name/value均指向HTTPResponse内部的接收缓冲区
+struct HeaderField {
+    std::string_view name;
+    std::string_view value;
+};
+
+// Content-Range: bytes first-last/total，total未知时为-1
+struct ContentRange {
+    int64_t first{-1};
+    int64_t last{-1};
+    int64_t total{-1};
+
+    [[nodiscard]] bool valid() const noexcept {
+        return first >= 0 && last >= first;
+    }
+};
+
+bool iequals(std::string_view a, std::string_view b) noexcept;
+
 class HTTPResponse {
+  public:
+    constexpr static size_t MAX_HEADERS = 64;
+
   private:
-    Headers _headers;
-    enum class ResponseParts {
-        StartLine = 0,
-        Headers,
-        Body
-    };
-    int _status{-1};
-    std::string _statusText;
-    std::vector<char> _body;
-    std::string _httpVersion;
+    // 接收到的原始头部，所有string_view都指向这里
+    std::vector<char> _raw;
+    std::array<HeaderField, MAX_HEADERS> _headers{};
+    size_t _headerCount{0};
 
-    void parse(const std::string &resText);
+    int _status{-1};
+    std::string_view _statusText;
+    std::string_view _httpVersion;
+    int64_t _declaredLength{-1};
+    ContentRange _contentRange;
+    bool _chunked{false};
 
-    void parse(const std::vector<char> &data);
+    Rope _body;
+    Error _error{Error::Ok};
 
-    static bool getline(const std::vector<char> &data, size_t &pos, std::string &val);
+    bool parse() noexcept;
+    void rebase(const char *oldBase) noexcept;
 
   public:
-    explicit HTTPResponse(const std::string &text) {
-        parse(text);
+    explicit HTTPResponse(std::vector<char> &&raw) : _raw(std::move(raw)) {
+        parse();
     }
-    explicit HTTPResponse(const std::vector<char> &buffer) {
-        parse(buffer);
+    explicit HTTPResponse(const std::string &text) : _raw(text.begin(), text.end()) {
+        parse();
     }
 
     explicit HTTPResponse() = default;
 
+    // 请求失败时返回的响应，status为-1
+    static HTTPResponse failure(Error e) {
+        HTTPResponse res;
+        res._error = e;
+        return res;
+    }
+
+    HTTPResponse(const HTTPResponse &other);
+    HTTPResponse &operator=(const HTTPResponse &other);
+    // vector的移动不会改变其数据地址，string_view无需重定位
+    HTTPResponse(HTTPResponse &&other) noexcept = default;
+    HTTPResponse &operator=(HTTPResponse &&other) noexcept = default;
+
     void parseHeaders(const std::string &h) {
-        parse(h);
+        _raw.assign(h.begin(), h.end());
+        parse();
     }
 
-    void parseBody(std::vector<char> &b) {
+    void parseBody(Rope &b) {
         _body = std::move(b);
     }
 
-    std::string operator[](const std::string &key) const noexcept {
-        if (_headers.count(key))
-            return _headers.at(key);
-        return "";
+    // 大小写不敏感，不存在时返回空串
+    std::string_view operator[](std::string_view key) const noexcept {
+        const auto *field = find(key);
+        return field ? field->value : std::string_view{};
     }
 
-    bool contains(const std::string& key) const noexcept {
-        return _headers.find(key) != _headers.end();
+    bool contains(std::string_view key) const noexcept {
+        return find(key) != nullptr;
     }
-    const char *data() const noexcept {
-        return _body.data();
+
+    const HeaderField *find(std::string_view key) const noexcept {
+        for (size_t i = 0; i < _headerCount; ++i) {
+            if (iequals(_headers[i].name, key))
+                return &_headers[i];
+        }
+        return nullptr;
+    }
+
+    const HeaderField *begin() const noexcept { return _headers.data(); }
+    const HeaderField *end() const noexcept { return _headers.data() + _headerCount; }
+
+    // 多于一个块时会拼接出连续的副本，能用body()时尽量不用
+    const char *data() const {
+        return _body.flatten().data();
     }
 
     auto contentLength() const noexcept {
         return _body.size();
     }
 
+    // 响应头中的Content-Length，没有该字段时为-1
+    int64_t declaredLength() const noexcept {
+        return _declaredLength;
+    }
+
+    // 是否是对[first, last]的Range请求的成功响应，body可能不完整
+    bool answersRange(uint64_t first, uint64_t last) const noexcept {
+        if (_status < 200 || _status >= 300 || declaredLength() != static_cast<int64_t>(last - first + 1))
+            return false;
+        return !contentRange().valid() || contentRange().first == static_cast<int64_t>(first);
+    }
+    const ContentRange &contentRange() const noexcept {
+        return _contentRange;
+    }
+
+    bool chunked() const noexcept {
+        return _chunked;
+    }
+
+    // 1xx、204和304的响应没有body
+    bool hasBody() const noexcept {
+        return _status >= 200 && _status != 204 && _status != 304;
+    }
+
     const auto &body() const noexcept {
         return _body;
     }
 
+    Rope takeBody() noexcept {
+        return std::move(_body);
+    }
+
     const auto &status() const noexcept { return this->_status; }
 
+    Error error() const noexcept { return _error; }
+
+    void setError(Error e) noexcept { _error = e; }
+
     const auto &statusText() const noexcept {
         return _statusText;
     }
@@ -83,4 +171,4 @@ class HTTPResponse {
 };
 } // namespace std
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,252 @@
+#ifndef MULTI_GET_MULTIGET_H
+#define MULTI_GET_MULTIGET_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Error.h"
+#include "Retry.h"
+#include "Rope.h"
+
+namespace multi_get {
+
+class HTTPConnection;
+
+struct Progress {
+    uint64_t downloaded{0};
+    // 服务器未给出长度时为-1
+    int64_t total{-1};
+};
+
+// 一条连接（下载线程）在一次采样中的情况
+struct ConnectionSample {
+    // 累计收到的字节数
+    uint64_t bytes{0};
+    // 上一个采样间隔内的速度，字节/秒
+    double speed{0};
+    // 有请求在进行，但超过ProgressMeter::STALL_AFTER没有收到数据
+    bool stalled{false};
+};
+
+// 采样线程按固定间隔给出的实时进度。协程模式和集群模式没有各连接的计数，
+// connections为空，downloaded只随完成的分段增加
+struct ProgressSample {
+    uint64_t downloaded{0};
+    // 服务器未给出长度时为-1
+    int64_t total{-1};
+    double elapsed{0};
+    // 滑动平均的总速度，字节/秒
+    double speed{0};
+    // 按滑动平均速度预计的剩余秒数，未知时为-1
+    double eta{-1};
+    std::vector<ConnectionSample> connections;
+    // 下载结束后的最后一次采样
+    bool finished{false};
+};
+
+// 多源下载时一个源收到的字节数
+struct PathStats {
+    std::string source;
+    uint64_t bytes{0};
+};
+
+struct DownloadResult {
+    Error error{Error::Ok};
+    // error为HTTPStatus时的状态码
+    int status{0};
+    uint64_t bytes{0};
+    double seconds{0};
+    // 是否使用了多线程Range下载
+    bool ranged{false};
+    // 服务器返回304，文件直接从本地缓存放置
+    bool cached{false};
+    // 增量下载时从本地文件复用的字节数
+    uint64_t reused{0};
+    std::string filename;
+    // 最后完成的请求所用连接上生效的套接字参数
+    SocketInfo socket;
+    // 设置了sources时各源的收发情况，顺序与sources相同
+    std::vector<PathStats> paths;
+};
+
+// 回调在下载线程中执行，不应长时间阻塞
+using ProgressCallback = std::function<void(const Progress &)>;
+using CompletionCallback = std::function<void(const DownloadResult &)>;
+// 在采样线程中执行，不影响接收
+using SampleCallback = std::function<void(const ProgressSample &)>;
+
+struct DownloadOptions {
+    std::string url;
+    // 输出文件名，为空时由url推导
+    std::string output;
+    // >= 0时按顺序写入该fd（stdout/管道），忽略output
+    int outputFd{-1};
+    size_t threadCount{4};
+    std::string proxy;
+    bool http2{false};
+    // 在一个线程上用协程并发下载各分段，threadCount为并发分段数（不支持http2）
+    bool async{false};
+    // 流式输出时重排缓冲区的大小
+    size_t window{64 * 1024 * 1024};
+    // 连接、首字节和空闲超时，0表示不限制
+    Timeouts timeouts;
+    // 接收缓冲区、TCP_NODELAY、Fast Open、拥塞控制和忙轮询
+    SocketOptions socket;
+    // 多个本地源地址或网卡，多线程下载的线程轮流绑定到各个源上以叠加多条上行链路的带宽。
+    // 分段切得更细并按需领取，较快的链路领到更多分段。不为空时覆盖socket.source，线程数不少于源的个数
+    std::vector<std::string> sources;
+    // 多线程下载时，连接速度（字节/秒）持续低于该值则从断点在新连接上重新请求，0表示不检查
+    uint64_t minSpeed{0};
+    // 多线程下载时用空闲线程重复请求最慢分段的剩余部分，先完成的胜出
+    bool hedge{false};
+    // 分段下载失败后的重试，从已收到的位置继续请求
+    RetryPolicy retry;
+    // 用第一个分段的Range GET代替HEAD探测文件大小，同时预热其余连接（协程模式下不生效）
+    bool fastStart{true};
+    uint64_t probeSize{1024 * 1024};
+    // 请求gzip/deflate（编译时有libzstd时还有zstd）压缩，用一条连接不带Range地下载整个文件，
+    // 边收边解码写入文件或fd。不使用快速启动和协程，HTTP/2时不协商压缩
+    bool compressed{false};
+    // 本地缓存目录，为空时不使用，只对写入文件的下载生效。
+    // 已缓存的url会带上If-None-Match/If-Modified-Since探测，返回304时直接从缓存放置文件
+    std::string cacheDir;
+    // 缓存内容的总大小上限，超出时淘汰最久未使用的，0表示不限制
+    uint64_t cacheLimit{10ULL * 1024 * 1024 * 1024};
+    // 块校验文件（BlockMap）的url，不为空时先在seed中查找与新文件相同的块，只用Range请求缺少的部分。
+    // seed为空时使用输出文件的旧版本，只对写入文件的下载生效，校验失败时退回完整下载
+    std::string blocksUrl;
+    std::string seed;
+    // 大小已知的文件会先用fallocate预留空间，收到的分段经有界队列交给writerThreads个写线程，
+    // 相邻的分段合并后写出。mmapOutput时复制进映射的文件，directIO时用O_DIRECT绕过页缓存（优先于mmapOutput），
+    // 否则用pwrite。完成时统一fdatasync一次
+    bool mmapOutput{false};
+    bool directIO{false};
+    // 不预留空间，全零的块不写出，输出文件中留下空洞（只对写入文件的下载生效）
+    bool sparse{false};
+    size_t writerThreads{1};
+    // 等待写入的数据上限，超出时网络线程阻塞
+    uint64_t writeQueue{64 * 1024 * 1024};
+    // 不为0时作为集群的协调者：在该端口等待worker进程（Client::work）连接，本机只做探测和分段规划，
+    // 各分段交给worker下载，worker断开或失败时分段改派给其他worker。只用于下载到文件，不使用快速启动
+    uint16_t coordinatorPort{0};
+    // 输出文件在所有worker上以相同的路径可见（共享文件系统），worker直接写入对应偏移；
+    // 否则worker把分段传回协调者写入
+    bool sharedOutput{false};
+    ProgressCallback onProgress;
+    CompletionCallback onComplete;
+    // 不为空时由单独的采样线程每隔sampleInterval读取各连接的计数器并回调，
+    // 接收循环中只多一次relaxed的原子加法
+    SampleCallback onSample;
+    std::chrono::milliseconds sampleInterval{500};
+};
+
+// 上传完成后的结果
+struct UploadResult {
+    Error error{Error::Ok};
+    // error为HTTPStatus时的状态码
+    int status{0};
+    uint64_t bytes{0};
+    double seconds{0};
+    size_t parts{0};
+    // 服务器最后返回的ETag（分段上传时为完成请求的ETag）
+    std::string etag{};
+};
+
+enum class UploadMode {
+    // 每个分段一个PUT，带Content-Range: bytes first-last/total，由服务器写入对应偏移
+    Range,
+    // S3风格：POST ?uploads开始，PUT ?partNumber=N&uploadId=ID上传各分段，POST ?uploadId=ID完成
+    Multipart
+};
+
+struct UploadOptions {
+    std::string url;
+    // 本地文件，分段用pread读取
+    std::string input;
+    UploadMode mode{UploadMode::Range};
+    // 同时上传的分段数
+    size_t threadCount{4};
+    // S3要求除最后一段外不小于5 MiB
+    uint64_t partSize{8 * 1024 * 1024};
+    std::string proxy;
+    Timeouts timeouts;
+    SocketOptions socket;
+    // 分段失败（包括服务器返回的ETag与Content-MD5不一致）后重新上传整个分段
+    RetryPolicy retry;
+    // downloaded为已确认上传的字节数
+    ProgressCallback onProgress;
+};
+
+class DownloadJob {
+  private:
+    friend class Client;
+    std::atomic<bool> _cancelled{false};
+    std::promise<DownloadResult> promise;
+    std::shared_future<DownloadResult> result{promise.get_future().share()};
+
+  public:
+    // 取消后正在进行的请求完成即停止，结果为Error::Cancelled
+    void cancel() noexcept {
+        _cancelled = true;
+    }
+    [[nodiscard]] bool cancelled() const noexcept {
+        return _cancelled;
+    }
+    [[nodiscard]] const std::shared_future<DownloadResult> &future() const noexcept {
+        return result;
+    }
+    [[nodiscard]] bool done() const {
+        return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+    const DownloadResult &wait() const {
+        return result.get();
+    }
+};
+
+using JobHandle = std::shared_ptr<DownloadJob>;
+
+// 嵌入式下载接口。连接池、DNS缓存和TLS会话在进程内共享，
+// HTTP/2会话由Client持有，因此在多个任务之间都会被复用。
+class Client {
+  private:
+    std::mutex m;
+    // 在共享线程池上运行的任务
+    std::vector<std::pair<std::future<void>, JobHandle>> jobs;
+    std::unordered_map<std::string, std::shared_ptr<HTTPConnection>> connections;
+
+    std::shared_ptr<HTTPConnection> connection(const DownloadOptions &options);
+    static std::shared_ptr<HTTPConnection> makeConnection(const DownloadOptions &options);
+    void reap();
+    DownloadResult perform(const DownloadOptions &options, DownloadJob *job, Rope *body);
+
+  public:
+    Client() = default;
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+    // 取消并等待所有未完成的任务
+    ~Client();
+
+    // 立即返回，下载在共享线程池中进行
+    JobHandle submit(DownloadOptions options);
+    // 在调用线程中同步下载
+    DownloadResult download(const DownloadOptions &options, DownloadJob *job = nullptr);
+    // 下载到内存，忽略output/outputFd。并行分段直接填入body的对应偏移，不做整体拷贝
+    DownloadResult fetch(const DownloadOptions &options, Rope &body, DownloadJob *job = nullptr);
+    // 在调用线程中同步上传，各分段在线程池上并行发送，只使用HTTP/1.1
+    UploadResult upload(const UploadOptions &options);
+    // 作为集群的worker连接到协调者（host:port），下载分配到的分段，直到协调者结束下载。
+    // 使用options中本机的连接、线程数、源地址和重试配置，忽略url和输出设置
+    Error work(const std::string &coordinator, const DownloadOptions &options);
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_MULTIGET_H
@@ -0,0 +1,86 @@
+#ifndef MULTI_GET_OUTPUT_FILE_H
+#define MULTI_GET_OUTPUT_FILE_H
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Connection.h"
+#include "Error.h"
+#include "Rope.h"
+
+namespace multi_get {
+
+// 大小已知的输出文件：先在临时文件中用fallocate预留全部空间（空间不足时立即失败），
+// 各线程把收到的分段直接写入对应偏移，写完的范围异步回写磁盘，全部完成后统一fdatasync并rename到目标位置。
+// 写入是线程安全的，不同线程写入的范围不应重叠。
+// sparse时不预留空间，全零的块不写出，在文件中留下空洞，适合大部分为零的磁盘镜像等超大文件
+class OutputFile {
+  public:
+    enum class Mode {
+        // pwrite写入
+        Write,
+        // 映射整个文件，收到的数据直接复制进映射区
+        Map,
+        // O_DIRECT绕过页缓存，下载大文件时不挤掉其他服务的缓存。
+        // 页对齐的部分经对齐的缓冲区拼成大块写出，不对齐的头尾走普通写入
+        Direct
+    };
+    constexpr static size_t DIRECT_ALIGN = 4096;
+    constexpr static size_t DIRECT_CHUNK = 4 * 1024 * 1024;
+    // sparse时按该大小对齐的全零块不写出
+    constexpr static size_t SPARSE_BLOCK = 4096;
+
+  private:
+    std::filesystem::path target;
+    std::filesystem::path temp;
+    uint64_t size;
+    Mode mode;
+    bool sparse;
+    // 没有写出的全零字节数
+    std::atomic<uint64_t> holes{0};
+#ifdef _WIN32
+    std::mutex m;
+    std::fstream out;
+#else
+    int fd{-1};
+    int directFd{-1};
+    char *mapped{nullptr};
+
+    Error writeDirect(uint64_t offset, const iovec *iov, size_t cnt, uint64_t n);
+#endif
+
+    // 异步回写[offset, offset + n)，不等待完成
+    void flush(uint64_t offset, uint64_t n) noexcept;
+    // 按mode写出，不跳过全零的块
+    Error writeAt(uint64_t offset, const iovec *iov, size_t cnt);
+
+  public:
+    OutputFile(std::filesystem::path target, uint64_t size, Mode mode = Mode::Write, bool sparse = false);
+    ~OutputFile();
+    OutputFile(const OutputFile &) = delete;
+    OutputFile &operator=(const OutputFile &) = delete;
+
+    // 创建并预留空间，空间不足时返回DiskFull
+    Error open();
+    // 从offset开始依次写入各段数据
+    Error write(uint64_t offset, const iovec *iov, size_t cnt);
+    Error write(uint64_t offset, const char *data, size_t n);
+    Error write(uint64_t offset, const Rope &data);
+    // 临时文件的路径，commit之前可以读取已写入的内容
+    [[nodiscard]] const std::filesystem::path &path() const noexcept {
+        return temp;
+    }
+    // 关闭并rename到目标位置
+    Error commit();
+    // 关闭并删除临时文件，析构时未commit的文件也会被删除
+    void discard() noexcept;
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_OUTPUT_FILE_H
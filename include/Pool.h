@@ -5,21 +5,28 @@
 #ifndef MULTI_GET_POOL_H
 #define MULTI_GET_POOL_H
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <sstream>
 #include <unordered_map>
 #include <unordered_set>
 
 #include "Connection.h"
+#include "ThreadPool.h"
 
 namespace multi_get {
 
 class Pool {
   private:
-    std::unordered_map<std::string, std::queue<std::shared_ptr<Connection>>> http_pool;
+    struct Idle {
+        std::shared_ptr<Connection> conn;
+        // 最后使用它的工作线程
+        size_t worker;
+    };
+    std::unordered_map<std::string, std::deque<Idle>> http_pool;
     //    std::unordered_map<std::string, std::queue<std::shared_ptr<Connection>>> https_pool;
     std::mutex m;
 
@@ -27,17 +34,24 @@ class Pool {
         LOG_INFO("Initializing connection pool...");
     }
 
-    static std::shared_ptr<Connection> createConnection(const std::string &protocol, const std::string &hostname, uint16_t port, const std::string& proxy) {
+    static std::shared_ptr<Connection> createConnection(const std::string &protocol, const std::string &hostname, uint16_t port, const std::string& proxy, bool connect, const Timeouts &timeouts, const SocketOptions &options) {
         std::shared_ptr<Connection> conn;
         if (protocol == "https")
             conn = std::make_shared<SSLConnection>(hostname, port, proxy);
         else
             conn = std::make_shared<PlainConnection>(hostname, port, proxy);
+        conn->setTimeouts(timeouts);
+        conn->setSocketOptions(options);
+        if (!connect)
+            return conn;
 
         int retry = 5;
         while (retry--) {
             if (conn->connect())
                 return conn;
+            // 连接超时是调用者给出的上限，不再重试
+            if (conn->error() == Error::Timeout)
+                break;
         }
         LOG_ERROR("Connection to %s failed.", hostname.c_str());
         return conn;
@@ -51,31 +65,43 @@ class Pool {
     }
 
   public:
-    std::shared_ptr<Connection> get(const std::string &url, const std::string& proxy = "") {
+    // 经过不同代理或套接字配置不同的连接不能互相复用
+    static std::string key(const std::string &url, const std::string &proxy, const SocketOptions &options) {
         const auto [protocol, hostname, port, _] = formatHost(url);
         std::stringstream ss;
         ss << protocol << "://" << hostname << ':' << port;
-        const std::string key = ss.str();
-        if (http_pool.count(key) && !http_pool[key].empty()) {
-            auto &pool = http_pool[key];
-            std::unique_lock<std::mutex> locker(m);
-            auto res = std::move(pool.front());
-            pool.pop();
-            locker.unlock();
-            return res;
-        } else {
-            // need to create connection
-            return createConnection(protocol, hostname, port, proxy);
-        }
+        if (!proxy.empty())
+            ss << '|' << proxy;
+        if (auto k = options.key(); !k.empty())
+            ss << '#' << k;
+        return ss.str();
     }
 
-    void put(const std::string &url, std::shared_ptr<Connection> &&conn) {
+    // connect为false时新建的连接不会立即连接，由调用者（如协程）自行连接
+    std::shared_ptr<Connection> get(const std::string &url, const std::string& proxy = "", bool connect = true, const Timeouts &timeouts = {},
+                                    const SocketOptions &options = {}) {
         const auto [protocol, hostname, port, _] = formatHost(url);
-        std::stringstream ss;
-        ss << protocol << "://" << hostname << ':' << port;
-        const std::string key = ss.str();
+        const std::string key = Pool::key(url, proxy, options);
+        std::unique_lock<std::mutex> locker(m);
+        if (auto it = http_pool.find(key); it != http_pool.end() && !it->second.empty()) {
+            // 工作线程优先取回自己用过的连接，其次才是其他线程的
+            auto &idle = it->second;
+            const auto self = ThreadPool::workerIndex();
+            auto pick = std::find_if(idle.begin(), idle.end(), [self](const Idle &c) { return c.worker == self; });
+            if (pick == idle.end())
+                pick = idle.begin();
+            auto res = std::move(pick->conn);
+            idle.erase(pick);
+            return res;
+        }
+        locker.unlock();
+        // need to create connection
+        return createConnection(protocol, hostname, port, proxy, connect, timeouts, options);
+    }
 
-        http_pool[key].push(std::move(conn));
+    void put(const std::string &url, const std::string &proxy, const SocketOptions &options, std::shared_ptr<Connection> &&conn) {
+        std::lock_guard<std::mutex> locker(m);
+        http_pool[key(url, proxy, options)].push_back({std::move(conn), ThreadPool::workerIndex()});
     }
 
     static Pool &getInstance() {
@@ -88,22 +114,31 @@ class PoolGuard {
   private:
     std::shared_ptr<Connection> conn;
     std::string url;
+    std::string proxy;
+    SocketOptions options;
+    bool reusable{true};
   public:
     [[nodiscard]] const std::shared_ptr<Connection>& get() const {
         return conn;
     }
 
     void release() {
-        Pool::getInstance().put(url, std::move(conn));
+        Pool::getInstance().put(url, proxy, options, std::move(conn));
         conn.reset();
     }
 
-    explicit PoolGuard(const std::string& url, const std::string& proxy = "") : url(url) {
-        conn = Pool::getInstance().get(url, proxy);
+    // 出错或被中断的连接状态未知，析构时直接关闭而不放回连接池
+    void discard() noexcept {
+        reusable = false;
+    }
+
+    explicit PoolGuard(const std::string& url, const std::string& proxy = "", bool connect = true, const Timeouts &timeouts = {},
+                       const SocketOptions &options = {}) : url(url), proxy(proxy), options(options) {
+        conn = Pool::getInstance().get(url, proxy, connect, timeouts, options);
     }
 
     ~PoolGuard() {
-        if (conn) release();
+        if (conn && reusable) release();
     }
 
     const std::shared_ptr<Connection>& operator->() const noexcept {
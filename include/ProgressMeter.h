@@ -0,0 +1,111 @@
+#ifndef MULTI_GET_PROGRESS_METER_H
+#define MULTI_GET_PROGRESS_METER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MultiGet.h"
+
+namespace multi_get {
+
+// 实时进度。每条连接（下载线程）一个计数器，接收循环中只做relaxed的fetch_add，不加锁也不回调；
+// 采样线程按固定间隔读取所有计数器，算出各连接的速度、滑动平均的总速度和ETA，再交给回调渲染。
+// 计数器各占一个缓存行，上百条连接同时累加也不会互相争用
+class ProgressMeter {
+  public:
+    struct alignas(64) Lane {
+        std::atomic<uint64_t> bytes{0};
+        // 正在进行的请求数，空闲的连接不算停滞
+        std::atomic<unsigned> busy{0};
+    };
+
+    // 请求期间把连接标记为忙，lane为空时不做任何事
+    class Busy {
+      private:
+        Lane *lane;
+
+      public:
+        explicit Busy(Lane *lane) noexcept : lane(lane) {
+            if (lane)
+                lane->busy.fetch_add(1, std::memory_order_relaxed);
+        }
+        ~Busy() {
+            if (lane)
+                lane->busy.fetch_sub(1, std::memory_order_relaxed);
+        }
+        Busy(const Busy &) = delete;
+        Busy &operator=(const Busy &) = delete;
+    };
+
+    // 连接上有请求但这么久没有收到数据时标记为停滞
+    constexpr static std::chrono::seconds STALL_AFTER{3};
+    // 总速度指数滑动平均的时间常数
+    constexpr static double SMOOTHING_SECONDS = 5.0;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    // 采样线程自己的状态，不与接收线程共享
+    struct LaneState {
+        uint64_t bytes{0};
+        Clock::time_point changed;
+    };
+
+    std::unique_ptr<Lane[]> lanes;
+    size_t count;
+    std::chrono::milliseconds interval;
+    SampleCallback sink;
+    // 已写出的字节数，没有经过计数器的下载（协程、集群、缓存）以它为准
+    std::atomic<uint64_t> saved{0};
+    // 没有重新下载的字节数，如增量下载复用的块
+    std::atomic<uint64_t> credited{0};
+    std::atomic<int64_t> total{-1};
+
+    Clock::time_point start;
+    Clock::time_point last;
+    uint64_t lastDownloaded{0};
+    double smoothed{-1};
+    std::vector<LaneState> states;
+
+    std::mutex m;
+    std::condition_variable cv;
+    bool stopping{false};
+    std::thread sampler;
+
+    ProgressSample sample(bool finished);
+
+  public:
+    ProgressMeter(size_t lanes, std::chrono::milliseconds interval, SampleCallback sink);
+    ProgressMeter(const ProgressMeter &) = delete;
+    ProgressMeter &operator=(const ProgressMeter &) = delete;
+    ~ProgressMeter();
+
+    // 超出范围时返回空，调用者不计数
+    [[nodiscard]] Lane *lane(size_t idx) noexcept {
+        return idx < count ? &lanes[idx] : nullptr;
+    }
+    void setTotal(int64_t n) noexcept {
+        total.store(n, std::memory_order_relaxed);
+    }
+    void addSaved(uint64_t n) noexcept {
+        saved.fetch_add(n, std::memory_order_relaxed);
+    }
+    void credit(uint64_t n) noexcept {
+        credited.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // 启动采样线程
+    void run();
+    // 停止采样线程，并给出finished的最后一次采样
+    void stop();
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_PROGRESS_METER_H
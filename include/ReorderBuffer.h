@@ -0,0 +1,92 @@
+#ifndef MULTI_GET_REORDER_BUFFER_H
+#define MULTI_GET_REORDER_BUFFER_H
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include "Connection.h"
+#include "Rope.h"
+
+namespace multi_get {
+
+// 将乱序完成的分段按偏移顺序写入fd（如stdout/管道）。
+// 只有落在[cursor, cursor + capacity)窗口内的分段才允许开始下载，
+// 因此缓存的数据量不会超过capacity。
+class ReorderBuffer {
+  private:
+    int fd;
+    uint64_t capacity;
+    uint64_t cursor{0};
+    bool writing{false};
+    bool failed{false};
+    std::map<uint64_t, Rope> pending;
+    std::mutex m;
+    std::condition_variable cv;
+
+    bool writeAll(const char *data, size_t n) {
+        while (n) {
+            auto len = ::write(fd, data, n);
+            if (len < 0) {
+                if (errno == EINTR)
+                    continue;
+                LOG_ERROR("Writing output failed: %s", std::strerror(errno));
+                return false;
+            }
+            data += len;
+            n -= static_cast<size_t>(len);
+        }
+        return true;
+    }
+
+  public:
+    ReorderBuffer(int fd, uint64_t capacity) : fd(fd), capacity(capacity) {}
+
+    // 阻塞直到[begin, end)进入输出窗口，返回false表示输出已失败
+    bool reserve(uint64_t begin, uint64_t end) {
+        std::unique_lock<std::mutex> locker(m);
+        cv.wait(locker, [&] { return failed || end - cursor <= capacity || begin == cursor; });
+        return !failed;
+    }
+
+    // 提交从offset开始的数据，当前写指针处的数据会被立即顺序写出
+    bool push(uint64_t offset, Rope &&data) {
+        std::unique_lock<std::mutex> locker(m);
+        if (failed)
+            return false;
+        pending.emplace(offset, std::move(data));
+        if (writing)
+            return true;
+        writing = true;
+        while (!failed && !pending.empty() && pending.begin()->first == cursor) {
+            auto node = pending.extract(pending.begin());
+            locker.unlock();
+            bool ok = true;
+            node.mapped().forEach([&](const char *data, size_t n) { ok = ok && writeAll(data, n); });
+            locker.lock();
+            cursor += node.mapped().size();
+            failed = failed || !ok;
+            cv.notify_all();
+        }
+        writing = false;
+        return !failed;
+    }
+
+    // 下载失败时唤醒所有等待窗口的线程
+    void fail() {
+        std::lock_guard<std::mutex> locker(m);
+        failed = true;
+        cv.notify_all();
+    }
+
+    [[nodiscard]] uint64_t written() {
+        std::lock_guard<std::mutex> locker(m);
+        return cursor;
+    }
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_REORDER_BUFFER_H
@@ -0,0 +1,54 @@
+#ifndef MULTI_GET_REQUEST_TEMPLATE_H
+#define MULTI_GET_REQUEST_TEMPLATE_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "Connection.h"
+#include "HTTPResponse.h"
+
+namespace multi_get {
+
+// 单次请求中需要变化的部分：path、额外头部与Range，写入可复用的缓冲区
+class RequestBuffer {
+  public:
+    constexpr static size_t MAX_SLICES = 6;
+
+  private:
+    friend class RequestTemplate;
+    std::array<iovec, MAX_SLICES> slices{};
+    size_t count{0};
+    // "Range: bytes=<int64>-<int64>\r\n"
+    char range[64]{};
+
+  public:
+    [[nodiscard]] const iovec *data() const noexcept { return slices.data(); }
+    [[nodiscard]] size_t size() const noexcept { return count; }
+    [[nodiscard]] size_t bytes() const noexcept {
+        size_t n = 0;
+        for (size_t i = 0; i < count; ++i)
+            n += slices[i].iov_len;
+        return n;
+    }
+};
+
+// 针对某个host预先序列化好的请求，构造后不可变，可在多个线程间共享
+class RequestTemplate {
+  private:
+    std::string prefix; // "GET "
+    std::string suffix; // " HTTP/1.1\r\nHost: ...\r\n<headers>"
+    static constexpr std::string_view TERMINATOR = "\r\n";
+
+  public:
+    RequestTemplate(std::string_view method, std::string_view host, const Headers &headers);
+
+    // extra为已经序列化的头部行。返回的切片引用了本模板、path、extra以及buf，发送完成前它们都必须有效
+    void fill(RequestBuffer &buf, std::string_view path, int64_t beginPos = -1, int64_t endPos = -1,
+              std::string_view extra = {}) const noexcept;
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_REQUEST_TEMPLATE_H
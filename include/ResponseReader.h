@@ -0,0 +1,219 @@
+#ifndef MULTI_GET_RESPONSE_READER_H
+#define MULTI_GET_RESPONSE_READER_H
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "HTTPResponse.h"
+#include "Logger.h"
+#include "Rope.h"
+#include "Transport.h"
+
+namespace multi_get {
+
+enum class Fill {
+    Ok,
+    Short,
+    OutOfMemory
+};
+
+// 阻塞接收的带缓冲读取，按传输类型实例化（见Transport.h）。
+// 响应头和chunk长度从缓冲区中解析，不再逐字节接收；body直接收到Rope的块中
+template <typename Transport>
+class StreamReader {
+  public:
+    constexpr static size_t BUFFER_SIZE = 16 * 1024;
+
+  private:
+    const Transport &transport;
+    std::array<char, BUFFER_SIZE> buf;
+    size_t pos{0};
+    size_t end{0};
+
+  public:
+    explicit StreamReader(const Transport &transport) noexcept : transport(transport) {}
+    StreamReader(const StreamReader &) = delete;
+    StreamReader &operator=(const StreamReader &) = delete;
+
+    [[nodiscard]] std::string_view available() const noexcept {
+        return {buf.data() + pos, end - pos};
+    }
+    void consume(size_t n) noexcept {
+        pos += n;
+    }
+    // 追加读取一次，连接关闭、出错或缓冲区已满时返回false
+    bool more() {
+        if (pos == end) {
+            pos = end = 0;
+        } else if (end == buf.size() && pos > 0) {
+            std::memmove(buf.data(), buf.data() + pos, end - pos);
+            end -= pos;
+            pos = 0;
+        }
+        if (end == buf.size())
+            return false;
+        auto len = transport.receive(buf.data() + end, buf.size() - end);
+        if (len <= 0)
+            return false;
+        end += static_cast<size_t>(len);
+        return true;
+    }
+
+    // 读取到空行为止的响应头，不完整时带有Error::BadResponse
+    HTTPResponse readHeaders() {
+        // 原样保留接收到的字节，由HTTPResponse在该缓冲区上原地解析
+        std::vector<char> raw;
+        raw.reserve(1024);
+        while (true) {
+            const auto data = available();
+            const size_t old = raw.size();
+            raw.insert(raw.end(), data.begin(), data.end());
+            // 空行可能跨越两次接收
+            const auto found = std::string_view(raw.data(), raw.size()).find("\r\n\r\n", old < 3 ? 0 : old - 3);
+            if (found != std::string_view::npos) {
+                const size_t headerEnd = found + 4;
+                consume(headerEnd - old);
+                raw.resize(headerEnd);
+                HTTPResponse res{std::move(raw)};
+                if (res.status() < 0)
+                    res.setError(Error::BadResponse);
+                return res;
+            }
+            consume(data.size());
+            if (!more()) {
+                HTTPResponse res{std::move(raw)};
+                res.setError(Error::BadResponse);
+                return res;
+            }
+        }
+    }
+
+    // 读取一行，不含CRLF。返回值指向内部缓冲区，下次读取前有效；
+    // 连接中断或一行超过缓冲区时返回空
+    std::optional<std::string_view> readLine() {
+        size_t scanned = 0;
+        while (true) {
+            const auto data = available();
+            if (auto eol = data.find("\r\n", scanned); eol != std::string_view::npos) {
+                consume(eol + 2);
+                return data.substr(0, eol);
+            }
+            scanned = data.empty() ? 0 : data.size() - 1;
+            if (!more())
+                return std::nullopt;
+        }
+    }
+
+    // chunk长度行，忽略chunk扩展
+    std::optional<size_t> readChunkSize() {
+        auto line = readLine();
+        if (!line)
+            return std::nullopt;
+        auto digits = line->substr(0, line->find(';'));
+        while (!digits.empty() && (digits.back() == ' ' || digits.back() == '\t'))
+            digits.remove_suffix(1);
+        size_t n = 0;
+        auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), n, 16);
+        if (digits.empty() || ec != std::errc() || ptr != digits.data() + digits.size()) {
+            LOG_ERROR("Invalid chunk length: %.*s", static_cast<int>(line->size()), line->data());
+            return std::nullopt;
+        }
+        return n;
+    }
+
+    // 跳过最后一个chunk之后的trailer，直到空行
+    bool skipTrailers() {
+        while (auto line = readLine()) {
+            if (line->empty())
+                return true;
+        }
+        return false;
+    }
+
+    // 先取缓冲区中已有的数据，不足部分直接收到dst，返回收到的字节数
+    size_t read(char *dst, size_t n) {
+        auto take = std::min(n, available().size());
+        if (take)
+            std::memcpy(dst, available().data(), take);
+        consume(take);
+        while (take < n) {
+            auto len = transport.receive(dst + take, n - take);
+            if (len < 0) {
+                LOG_WARN("receive n bytes: %s", std::strerror(errno));
+                break;
+            } else if (len == 0) {
+                LOG_WARN("peer closed after %zu of %zu bytes", take, n);
+                break;
+            }
+            take += static_cast<size_t>(len);
+        }
+        return take;
+    }
+
+    // 通知收到了n字节。onReceived可以返回bool，返回false表示停止接收
+    template <typename OnReceived>
+    static bool notify(OnReceived &onReceived, size_t n) {
+        if constexpr (std::is_same_v<std::invoke_result_t<OnReceived &, size_t>, bool>) {
+            return onReceived(n);
+        } else {
+            onReceived(n);
+            return true;
+        }
+    }
+
+    // 读取n字节追加到body，每次最多接收step字节，之后调用onReceived(实际字节数)。
+    // onReceived返回false时停止，返回Fill::Short
+    template <typename OnReceived>
+    Fill readInto(Rope &body, size_t n, size_t step, OnReceived &&onReceived) {
+        while (n) {
+            auto [ptr, avail] = body.prepare();
+            if (!ptr)
+                return Fill::OutOfMemory;
+            auto len = std::min({n, avail, step});
+            auto received = read(ptr, len);
+            body.commit(received);
+            if (!notify(onReceived, received) || received != len)
+                return Fill::Short;
+            n -= len;
+        }
+        return Fill::Ok;
+    }
+
+    // 没有长度信息的body，读到连接关闭为止。出错或onReceived返回false时返回Fill::Short
+    template <typename OnReceived>
+    Fill readUntilClosed(Rope &body, OnReceived &&onReceived) {
+        while (true) {
+            auto [ptr, avail] = body.prepare();
+            if (!ptr)
+                return Fill::OutOfMemory;
+            ssize_t len;
+            if (const auto data = available(); !data.empty()) {
+                len = static_cast<ssize_t>(std::min(avail, data.size()));
+                std::memcpy(ptr, data.data(), static_cast<size_t>(len));
+                consume(static_cast<size_t>(len));
+            } else {
+                len = transport.receive(ptr, avail);
+            }
+            if (len < 0) {
+                LOG_WARN("receive without length: %s", std::strerror(errno));
+                return Fill::Short;
+            }
+            if (len == 0)
+                return Fill::Ok;
+            body.commit(static_cast<size_t>(len));
+            if (!notify(onReceived, static_cast<size_t>(len)))
+                return Fill::Short;
+        }
+    }
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_RESPONSE_READER_H
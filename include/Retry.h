@@ -0,0 +1,51 @@
+#ifndef MULTI_GET_RETRY_H
+#define MULTI_GET_RETRY_H
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "Error.h"
+
+namespace multi_get {
+
+// 失败后的重试策略：指数退避，并加入随机抖动，避免多个分段同时重连
+struct RetryPolicy {
+    // 连续失败的最大重试次数，有数据进展后重新计数，0表示不重试
+    unsigned attempts{5};
+    std::chrono::milliseconds base{500};
+    std::chrono::milliseconds max{std::chrono::seconds(30)};
+
+    // 第n次（从1开始）重试前的等待时间，在[cap / 2, cap]中随机
+    [[nodiscard]] std::chrono::milliseconds delay(unsigned n) const {
+        thread_local std::mt19937 rng{std::random_device{}()};
+        auto cap = base.count() << std::min(n - 1, 16u);
+        cap = std::max<long long>(std::min<long long>(cap, max.count()), 1);
+        std::uniform_int_distribution<long long> jitter(cap / 2, cap);
+        return std::chrono::milliseconds(jitter(rng));
+    }
+};
+
+// 可能自行恢复、值得重试的错误
+inline bool retryable(Error e, int status = 0) noexcept {
+    switch (e) {
+    case Error::ResolveFailed:
+    case Error::ConnectFailed:
+    case Error::ProxyFailed:
+    case Error::TLSFailed:
+    case Error::SendFailed:
+    case Error::BadResponse:
+    case Error::IncompleteBody:
+    case Error::Timeout:
+    case Error::ChecksumMismatch:
+        return true;
+    case Error::HTTPStatus:
+        return status == 408 || status == 429 || status >= 500;
+    default:
+        return false;
+    }
+}
+
+} // namespace multi_get
+
+#endif // MULTI_GET_RETRY_H
@@ -0,0 +1,98 @@
+#ifndef MULTI_GET_ROPE_H
+#define MULTI_GET_ROPE_H
+
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "BufferPool.h"
+#include "Connection.h"
+
+namespace multi_get {
+
+// 由BufferPool中固定大小的块串成的内存body。第i个块保存
+// [i * BLOCK_SIZE, (i + 1) * BLOCK_SIZE)，增长时不需要搬移已有数据，
+// 块对齐的分段可以直接移入指定偏移而不拷贝。
+class Rope {
+  public:
+    constexpr static size_t BLOCK_SIZE = BufferPool::BLOCK_SIZE;
+    // 预算用尽时等待其他传输归还块的时间，超时后申请失败（内存不足），避免互相等待时永远阻塞
+    constexpr static std::chrono::milliseconds DEFAULT_PATIENCE{500};
+
+  private:
+    std::vector<Block> blocks;
+    size_t _size{0};
+    std::chrono::milliseconds patience{DEFAULT_PATIENCE};
+    // flatten()的缓存，修改后失效
+    mutable std::vector<char> flat;
+
+    Block &blockAt(size_t idx);
+
+  public:
+    Rope() = default;
+    Rope(Rope &&other) noexcept
+        : blocks(std::move(other.blocks)), _size(std::exchange(other._size, 0)), patience(other.patience),
+          flat(std::move(other.flat)) {}
+    Rope &operator=(Rope &&other) noexcept {
+        if (this != &other) {
+            blocks = std::move(other.blocks);
+            _size = std::exchange(other._size, 0);
+            patience = other.patience;
+            flat = std::move(other.flat);
+        }
+        return *this;
+    }
+    Rope(const Rope &other);
+    Rope &operator=(const Rope &other);
+
+    // 在不能长时间阻塞的线程（如HTTP/2的IO线程）中设为0
+    void setPatience(std::chrono::milliseconds p) noexcept {
+        patience = p;
+    }
+
+    [[nodiscard]] size_t size() const noexcept {
+        return _size;
+    }
+    [[nodiscard]] bool empty() const noexcept {
+        return _size == 0;
+    }
+    void clear() noexcept;
+
+    // 返回末尾可直接写入的空间，随后用commit提交实际写入的字节数。
+    // 申请块失败（内存耗尽）时返回{nullptr, 0}
+    std::pair<char *, size_t> prepare();
+    void commit(size_t n) noexcept;
+    // 不等待预算地为之后的n字节申请好块，预算不足时返回false，已申请的块保留。
+    // 供不能阻塞线程的调用者（协程、HTTP/2的IO线程）自己决定如何等待
+    bool tryReserve(size_t n);
+    // 追加数据，内存耗尽时返回false
+    bool append(const char *data, size_t n);
+    bool append(const Rope &other);
+
+    // 设置大小，新增部分的块在写入时才申请
+    void resize(size_t n);
+    // 写入[offset, offset + n)，不同线程可以同时写入互不共享块的范围
+    bool write(size_t offset, const char *data, size_t n);
+    // 将other移入offset处，offset必须按块对齐；other的块会被直接接管
+    void place(size_t offset, Rope &&other);
+
+    // 按顺序列出各段数据，供writev等分散写接口使用
+    [[nodiscard]] std::vector<iovec> slices() const;
+    template <typename F>
+    void forEach(F &&f) const {
+        for (size_t i = 0, remain = _size; remain; ++i) {
+            auto n = std::min(remain, BLOCK_SIZE);
+            f(blocks[i].data(), n);
+            remain -= n;
+        }
+    }
+    // 连续的视图，多于一个块时才拷贝，结果会被缓存
+    [[nodiscard]] std::string_view flatten() const;
+    [[nodiscard]] std::vector<char> toVector() const;
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_ROPE_H
@@ -0,0 +1,57 @@
+#ifndef MULTI_GET_SEGMENT_PLAN_H
+#define MULTI_GET_SEGMENT_PLAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace multi_get {
+
+// 分段表：若干个区间，每个区间按固定大小切成分段，分段的范围按下标现算。
+// 上百GB的文件切成10^5以上的分段也只占几个区间的内存，偏移全部是64位
+class SegmentPlan {
+  public:
+    // 闭区间[first, second]
+    using Range = std::pair<uint64_t, uint64_t>;
+
+  private:
+    struct Span {
+        uint64_t first;
+        uint64_t last;
+        uint64_t step;
+        // 该区间第一个分段的下标
+        size_t index;
+    };
+
+    std::vector<Span> spans;
+    size_t count{0};
+    uint64_t total{0};
+
+  public:
+    SegmentPlan() = default;
+    // 把整个文件[0, size)按step切分，size为0时没有分段
+    SegmentPlan(uint64_t size, uint64_t step) {
+        if (size)
+            add(0, size - 1, step);
+    }
+
+    // 把闭区间[first, last]按step切分后追加到表尾
+    void add(uint64_t first, uint64_t last, uint64_t step);
+
+    [[nodiscard]] size_t size() const noexcept {
+        return count;
+    }
+    [[nodiscard]] bool empty() const noexcept {
+        return count == 0;
+    }
+    // 所有分段的总字节数
+    [[nodiscard]] uint64_t bytes() const noexcept {
+        return total;
+    }
+    [[nodiscard]] Range operator[](size_t idx) const noexcept;
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_SEGMENT_PLAN_H
@@ -0,0 +1,180 @@
+#ifndef MULTI_GET_SEGMENT_SCHEDULER_H
+#define MULTI_GET_SEGMENT_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Error.h"
+#include "HTTPConnection.h"
+#include "ProgressMeter.h"
+#include "Retry.h"
+#include "Rope.h"
+#include "SegmentPlan.h"
+#include "ThreadPool.h"
+
+namespace multi_get {
+
+// 在常驻线程池（ThreadPool）上用固定数量的任务下载一组Range分段。
+// 可恢复的错误按retry退避后从已收到的位置继续请求，不会从头重新下载分段；
+// 连接速度在一个测速窗口内低于minSpeed时中断它，剩余部分在新连接上重新请求；
+// 开启hedge后，没有新分段可领取的线程会重复请求预计最晚完成的分段的剩余部分，
+// 先完成的一方胜出，另一方被取消。
+// 有多条路径（如绑定到不同源地址的连接）时线程轮流分到各条路径，分段按需领取，
+// 较快的路径自然领到更多分段。
+// 分段的范围由SegmentPlan按下标算出，只有正在下载的分段才有状态，
+// 超大文件切成10^5以上的分段时内存和测速、追赶的开销只与线程数有关。
+class SegmentScheduler {
+  public:
+    // 闭区间[first, second]
+    using Range = SegmentPlan::Range;
+
+    struct Policy {
+        // 字节/秒，0表示不检查
+        uint64_t minSpeed{0};
+        bool hedge{false};
+        RetryPolicy retry;
+    };
+
+    struct Hooks {
+        // 返回true时中断所有请求
+        std::function<bool()> cancelled{};
+        // 分段开始下载前调用，返回false时停止
+        std::function<bool(size_t idx)> before{};
+        // 分段完整下载后调用，返回错误时停止
+        std::function<Error(size_t idx, Rope &&body)> deliver{};
+        // 因出错或取消而停止时调用，用于唤醒阻塞在before中的线程
+        std::function<void()> stopped{};
+    };
+
+    // 调用者已经发出的请求（如快速启动的探测），覆盖[begin, end]
+    struct Prefetch {
+        std::future<HTTPResponse> response;
+        Transfer *transfer{nullptr};
+        uint64_t begin{0};
+        uint64_t end{0};
+    };
+
+    constexpr static std::chrono::milliseconds TICK{500};
+    constexpr static std::chrono::seconds SPEED_WINDOW{3};
+    constexpr static unsigned MAX_REISSUES = 5;
+    // 剩余部分太小时不值得重复请求
+    constexpr static uint64_t MIN_HEDGE_BYTES = 64 * 1024;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Segment {
+        uint64_t begin{0};
+        uint64_t end{0};
+        std::mutex m;
+        bool started{false};
+        bool finished{false};
+        Clock::time_point startTime;
+        // 已提交到body的字节数
+        uint64_t committed{0};
+        // 主请求当前的尝试
+        Transfer *primary{nullptr};
+        Clock::time_point checkTime;
+        uint64_t checkReceived{0};
+        unsigned reissues{0};
+        bool slow{false};
+        // 重复请求
+        bool hedged{false};
+        bool hedgeWon{false};
+        uint64_t hedgeFrom{0};
+        Transfer *hedge{nullptr};
+        Rope hedgeBody;
+        std::optional<Prefetch> prefetch;
+    };
+
+    // 一条下载路径及其收到的字节数
+    struct Path {
+        HTTPConnection *conn;
+        std::atomic<uint64_t> bytes{0};
+        explicit Path(HTTPConnection *conn) : conn(conn) {}
+    };
+
+    std::deque<Path> paths;
+    ProgressMeter *meter{nullptr};
+    std::string url;
+    Policy policy;
+    Hooks hooks;
+    SegmentPlan plan;
+    std::atomic<size_t> next{0};
+    // 已经开始或带有预取请求、还没有结束的分段。追赶的线程可能在分段结束后仍持有它
+    std::mutex activeMutex;
+    std::map<size_t, std::shared_ptr<Segment>> active;
+    std::atomic<bool> _stopped{false};
+    std::mutex hedgeMutex;
+
+    std::mutex errorMutex;
+    Error _error{Error::Ok};
+    int _status{0};
+
+    // 下载任务所在的组，watch只代为执行其中排队的任务
+    ThreadPool::Group group;
+    std::mutex watchMutex;
+    std::condition_variable watchCv;
+    // 还没有结束的下载任务
+    size_t remaining{0};
+    bool done{false};
+
+    // 退避等待期间停止时立即唤醒
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+
+    // lane为该线程在ProgressMeter中的计数器，可以为空
+    // 取得分段的状态，没有时创建
+    std::shared_ptr<Segment> acquire(size_t idx);
+    void release(size_t idx);
+    // 当前活动分段的快照，遍历时不持有activeMutex
+    std::vector<std::shared_ptr<Segment>> snapshot();
+    void worker(Path &path, ProgressMeter::Lane *lane);
+    void runPrimary(size_t idx, Path &path, ProgressMeter::Lane *lane);
+    bool hedgeSlowest(Path &path, ProgressMeter::Lane *lane);
+    void watch();
+    void fail(Error e, int status = 0);
+    void interruptAll();
+    // 返回false表示等待期间已停止
+    bool pause(std::chrono::milliseconds duration);
+
+  public:
+    SegmentScheduler(HTTPConnection &conn, std::string url, SegmentPlan plan, const Policy &policy);
+    SegmentScheduler(const SegmentScheduler &) = delete;
+    SegmentScheduler &operator=(const SegmentScheduler &) = delete;
+
+    // 下载idx时先使用该请求的结果，不足的部分再续传，多出的部分丢弃。应在run之前调用
+    void prefetch(size_t idx, Prefetch &&p);
+    // 在构造时的连接之外增加一条路径，应在run之前调用
+    void addPath(HTTPConnection &conn);
+    // 第i个线程收到的字节计入m.lane(i)，应在run之前调用
+    void setMeter(ProgressMeter &m) noexcept {
+        meter = &m;
+    }
+    // 各条路径收到的字节数，顺序与加入时相同，第一条是构造时的连接
+    [[nodiscard]] std::vector<uint64_t> pathBytes() const;
+
+    // 阻塞直到所有分段完成或出错，返回第一个错误
+    Error run(size_t threadCount, Hooks hooks);
+
+    // error()为HTTPStatus时的状态码
+    [[nodiscard]] int status() const noexcept {
+        return _status;
+    }
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_SEGMENT_SCHEDULER_H
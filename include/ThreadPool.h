@@ -0,0 +1,94 @@
+#ifndef MULTI_GET_THREAD_POOL_H
+#define MULTI_GET_THREAD_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace multi_get {
+
+// 进程内共享的常驻工作线程。没有空闲线程时按需创建，直到limit为止，之后任务排队；
+// 线程创建后不退出，之后的下载直接复用，线程上的连接（见Pool）和其他thread_local状态也保持热的。
+class ThreadPool {
+  public:
+    // 同一次下载或上传提交的任务。等待其中的任务时只代为执行同组排队的任务：
+    // 它们只等待比自己先出队的任务，不会反过来等待等待者；其他任务可能阻塞在等待者之后
+    class Group {};
+
+  private:
+    struct Entry {
+        const Group *group;
+        std::function<void()> task;
+    };
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<Entry> tasks;
+    std::vector<std::thread> threads;
+    size_t idle{0};
+    size_t limit;
+    bool pin{false};
+    bool stopping{false};
+
+    ThreadPool();
+    void run(size_t index);
+    void enqueue(const Group *group, std::function<void()> task);
+
+  public:
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    static ThreadPool &getInstance() {
+        static ThreadPool instance;
+        return instance;
+    }
+
+    // 线程数上限，默认为CPU数的4倍且不少于32，已创建的线程不会减少
+    void setLimit(size_t n);
+    // 之后创建的线程依次绑定到各个CPU上（仅Linux）
+    void setPinning(bool on);
+    [[nodiscard]] size_t size();
+    // 当前线程是否是池中的工作线程
+    [[nodiscard]] static bool inWorker() noexcept;
+    // 当前工作线程的编号，不是工作线程时为NOT_WORKER
+    constexpr static size_t NOT_WORKER = static_cast<size_t>(-1);
+    [[nodiscard]] static size_t workerIndex() noexcept;
+
+    // 提交任务，返回的future在任务完成后就绪。group不为空时任务属于该组
+    template <typename F>
+    auto submit(F &&f, const Group *group = nullptr) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using R = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        auto future = task->get_future();
+        enqueue(group, [task] { (*task)(); });
+        return future;
+    }
+
+    // 取出group中最早排队的任务在当前线程执行，没有时返回false
+    bool runOne(const Group &group);
+
+    // 等待任务完成。给出group时先执行该组排队的任务，线程数到达上限时等待者也不会空等
+    template <typename T>
+    T wait(std::future<T> &future, const Group *group = nullptr) {
+        if (group) {
+            while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                if (!runOne(*group))
+                    future.wait_for(std::chrono::milliseconds(1));
+            }
+        }
+        return future.get();
+    }
+};
+
+} // namespace multi_get
+
+#endif // MULTI_GET_THREAD_POOL_H
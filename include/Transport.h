@@ -0,0 +1,55 @@
+#ifndef MULTI_GET_TRANSPORT_H
+#define MULTI_GET_TRANSPORT_H
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+#include "Connection.h"
+
+namespace multi_get {
+
+// 接收路径上的传输层策略。一个传输类型需要提供：
+//   ssize_t receive(char *buf, size_t n) const   与recv相同，0表示对端关闭，负数表示出错
+//   bool timedOut() const                        最近一次接收是否因超时失败
+// PlainConnection和SSLConnection都是final的，按具体类型调用时没有虚函数开销。
+
+// 从内存中读取的传输，不需要socket，用于解析器的基准测试和测试。
+// 每次最多返回segment字节，模拟数据分多个包到达
+class MemoryTransport {
+  private:
+    std::string_view data;
+    size_t segment;
+    mutable size_t pos{0};
+
+  public:
+    explicit MemoryTransport(std::string_view data, size_t segment = 16 * 1024) noexcept
+        : data(data), segment(std::max<size_t>(segment, 1)) {}
+
+    ssize_t receive(char *buf, size_t n) const noexcept {
+        n = std::min({n, segment, data.size() - pos});
+        std::memcpy(buf, data.data() + pos, n);
+        pos += n;
+        return static_cast<ssize_t>(n);
+    }
+    [[nodiscard]] bool timedOut() const noexcept {
+        return false;
+    }
+    // 从头重新读取
+    void rewind() noexcept {
+        pos = 0;
+    }
+};
+
+// 每个连接只在这里判断一次具体类型，f按该类型实例化
+template <typename F>
+decltype(auto) withTransport(const Connection &conn, F &&f) {
+    if (auto tls = dynamic_cast<const SSLConnection *>(&conn))
+        return std::forward<F>(f)(*tls);
+    return std::forward<F>(f)(static_cast<const PlainConnection &>(conn));
+}
+
+} // namespace multi_get
+
+#endif // MULTI_GET_TRANSPORT_H
@@ -0,0 +1,125 @@
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <new>
+
+#include "Logger.h"
+
+namespace multi_get {
+
+namespace {
+
+// 按页对齐，便于直接用于O_DIRECT等场景
+constexpr size_t BLOCK_ALIGN = 4096;
+constexpr size_t SLAB_SIZE = BufferPool::BLOCK_SIZE * BufferPool::BLOCKS_PER_SLAB;
+
+} // namespace
+
+void BufferPool::SlabDeleter::operator()(char *p) const noexcept {
+    ::operator delete(p, std::align_val_t{BLOCK_ALIGN});
+}
+
+bool BufferPool::grow() {
+    // 已申请的内存最多比limit多出不足一个slab
+    if (slabs.size() * SLAB_SIZE >= _limit)
+        return false;
+    char *slab;
+    try {
+        slab = static_cast<char *>(::operator new(SLAB_SIZE, std::align_val_t{BLOCK_ALIGN}));
+    } catch (std::bad_alloc &) {
+        LOG_ERROR("Failed to alloc buffer slab of %zu bytes.", SLAB_SIZE);
+        return false;
+    }
+    slabs.emplace_back(slab);
+    for (size_t i = BLOCKS_PER_SLAB; i-- > 0;)
+        freeBlocks.push_back(slab + i * BLOCK_SIZE);
+    return true;
+}
+
+Block BufferPool::take() noexcept {
+    _inUse += BLOCK_SIZE;
+    auto *ptr = freeBlocks.back();
+    freeBlocks.pop_back();
+    return {this, ptr};
+}
+
+Block BufferPool::acquire() {
+    std::unique_lock<std::mutex> locker(m);
+    cv.wait(locker, [this] { return (_inUse + BLOCK_SIZE <= _limit) && (!freeBlocks.empty() || grow()); });
+    return take();
+}
+
+Block BufferPool::acquire(std::chrono::milliseconds patience) {
+    std::unique_lock<std::mutex> locker(m);
+    if (cv.wait_for(locker, patience, [this] { return (_inUse + BLOCK_SIZE <= _limit) && (!freeBlocks.empty() || grow()); }))
+        return take();
+    LOG_WARN("Buffer pool reached its limit of %zu bytes.", _limit);
+    return {};
+}
+
+Block BufferPool::tryAcquire() {
+    std::lock_guard<std::mutex> locker(m);
+    if (_inUse + BLOCK_SIZE > _limit || (freeBlocks.empty() && !grow()))
+        return {};
+    return take();
+}
+
+void BufferPool::release(char *ptr) noexcept {
+    {
+        std::lock_guard<std::mutex> locker(m);
+        freeBlocks.push_back(ptr);
+        _inUse -= BLOCK_SIZE;
+    }
+    cv.notify_one();
+}
+
+void BufferPool::releaseIdleSlabs() {
+    if (freeBlocks.size() < BLOCKS_PER_SLAB)
+        return;
+    // 按地址找到各空闲块所属的slab，统计每个slab中空闲的块数
+    std::vector<char *> bases;
+    bases.reserve(slabs.size());
+    for (const auto &slab : slabs)
+        bases.push_back(slab.get());
+    std::sort(bases.begin(), bases.end());
+    std::vector<size_t> idle(bases.size(), 0);
+    auto slabOf = [&](char *ptr) {
+        return static_cast<size_t>(std::upper_bound(bases.begin(), bases.end(), ptr) - bases.begin() - 1);
+    };
+    for (auto *ptr : freeBlocks)
+        ++idle[slabOf(ptr)];
+    auto released = [&](char *ptr) { return idle[slabOf(ptr)] == BLOCKS_PER_SLAB; };
+    freeBlocks.erase(std::remove_if(freeBlocks.begin(), freeBlocks.end(), released), freeBlocks.end());
+    const auto before = slabs.size();
+    slabs.erase(std::remove_if(slabs.begin(), slabs.end(), [&](const auto &slab) { return released(slab.get()); }),
+                slabs.end());
+    if (slabs.size() != before)
+        LOG_INFO("Released %zu idle buffer slab(s).", before - slabs.size());
+}
+
+void BufferPool::setLimit(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> locker(m);
+        _limit = std::max(bytes, BLOCK_SIZE);
+        if (slabs.size() * SLAB_SIZE > _limit)
+            releaseIdleSlabs();
+    }
+    cv.notify_all();
+}
+
+void BufferPool::trim() {
+    std::lock_guard<std::mutex> locker(m);
+    releaseIdleSlabs();
+}
+
+size_t BufferPool::limit() {
+    std::lock_guard<std::mutex> locker(m);
+    return _limit;
+}
+
+size_t BufferPool::inUse() {
+    std::lock_guard<std::mutex> locker(m);
+    return _inUse;
+}
+
+} // namespace multi_get
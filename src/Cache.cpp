@@ -0,0 +1,245 @@
+#include "Cache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "Digest.h"
+#include "Logger.h"
+
+namespace fs = std::filesystem;
+
+namespace multi_get {
+
+namespace {
+
+// 进程间的读写锁，Windows上不加锁
+class FileLock {
+  private:
+    int fd{-1};
+
+  public:
+    FileLock(const fs::path &path, bool exclusive) {
+#ifndef _WIN32
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0 && ::flock(fd, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        if (fd < 0)
+            LOG_WARN("Failed to lock cache %s", path.string().c_str());
+#endif
+    }
+    ~FileLock() {
+#ifndef _WIN32
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+    FileLock(const FileLock &) = delete;
+    FileLock &operator=(const FileLock &) = delete;
+};
+
+// 同一目录下的临时文件名，rename到最终位置后才对其他进程可见
+fs::path tempPath(const fs::path &dir) {
+    thread_local std::mt19937_64 rng{std::random_device{}()};
+    return dir / (".tmp-" + std::to_string(rng()));
+}
+
+// 在支持的文件系统（btrfs、xfs等）上共享数据块，写时复制
+bool reflink(const fs::path &src, const fs::path &dst) {
+#if defined(__linux__) && defined(FICLONE)
+    int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return false;
+    int out = ::open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    bool ok = out >= 0 && ::ioctl(out, FICLONE, in) == 0;
+    ::close(in);
+    if (out >= 0)
+        ::close(out);
+    if (!ok && out >= 0)
+        ::unlink(dst.c_str());
+    return ok;
+#else
+    (void)src;
+    (void)dst;
+    return false;
+#endif
+}
+
+// 先尝试reflink，不支持时复制。不使用硬链接，缓存和输出文件之后的修改互不影响
+bool place(const fs::path &src, const fs::path &dst) {
+    if (reflink(src, dst))
+        return true;
+    std::error_code ec;
+    return fs::copy_file(src, dst, ec) && !ec;
+}
+
+void touch(const fs::path &path) {
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+}
+
+} // namespace
+
+Cache::Cache(fs::path root, uint64_t limit) : root(std::move(root)), limit(limit) {
+    std::error_code ec;
+    fs::create_directories(this->root / "objects", ec);
+    fs::create_directories(this->root / "urls", ec);
+}
+
+fs::path Cache::objectPath(const std::string &hash) const {
+    return root / "objects" / hash.substr(0, 2) / hash;
+}
+
+fs::path Cache::metaPath(const std::string &url) const {
+    return root / "urls" / sha256Hex(url);
+}
+
+std::optional<Cache::Entry> Cache::lookup(const std::string &url) const {
+    FileLock lock{root / "lock", false};
+    std::ifstream in(metaPath(url));
+    std::string storedUrl;
+    Entry entry;
+    if (!std::getline(in, storedUrl) || storedUrl != url || !std::getline(in, entry.etag) ||
+        !std::getline(in, entry.lastModified) || !std::getline(in, entry.object) || !(in >> entry.size))
+        return std::nullopt;
+    if (entry.etag.empty() && entry.lastModified.empty())
+        return std::nullopt;
+    std::error_code ec;
+    if (entry.object.size() < 2 || fs::file_size(objectPath(entry.object), ec) != entry.size || ec)
+        return std::nullopt;
+    return entry;
+}
+
+Error Cache::restore(const Entry &entry, const fs::path &target) const {
+    FileLock lock{root / "lock", false};
+    const auto object = objectPath(entry.object);
+    auto dir = target.parent_path();
+    if (dir.empty())
+        dir = ".";
+    const auto temp = tempPath(dir);
+    std::error_code ec;
+    if (!place(object, temp)) {
+        fs::remove(temp, ec);
+        return Error::FileError;
+    }
+    // 复制会带上缓存对象的只读权限，输出文件恢复为与reflink相同的普通权限
+    fs::permissions(temp, fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read | fs::perms::others_read, ec);
+    fs::rename(temp, target, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return Error::FileError;
+    }
+    touch(object);
+    return Error::Ok;
+}
+
+Error Cache::store(const std::string &url, const std::string &etag, const std::string &lastModified,
+                   const fs::path &file) {
+    // 计算hash不需要持有锁
+    const auto hash = sha256File(file);
+    std::error_code ec;
+    const auto size = fs::file_size(file, ec);
+    if (hash.empty() || ec)
+        return Error::FileError;
+
+    FileLock lock{root / "lock", true};
+    const auto object = objectPath(hash);
+    if (fs::exists(object, ec)) {
+        touch(object);
+    } else {
+        fs::create_directories(object.parent_path(), ec);
+        const auto temp = tempPath(object.parent_path());
+        if (!place(file, temp)) {
+            fs::remove(temp, ec);
+            return Error::FileError;
+        }
+        fs::permissions(temp, fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read, ec);
+        fs::rename(temp, object, ec);
+        if (ec) {
+            fs::remove(temp, ec);
+            return Error::FileError;
+        }
+    }
+
+    const auto meta = metaPath(url);
+    const auto temp = tempPath(meta.parent_path());
+    {
+        std::ofstream out(temp);
+        out << url << '\n' << etag << '\n' << lastModified << '\n' << hash << '\n' << size << '\n';
+        if (!out) {
+            fs::remove(temp, ec);
+            return Error::FileError;
+        }
+    }
+    fs::rename(temp, meta, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return Error::FileError;
+    }
+    evict();
+    return Error::Ok;
+}
+
+void Cache::evict() {
+    if (limit == 0)
+        return;
+    struct Object {
+        fs::file_time_type used;
+        uint64_t size;
+        fs::path path;
+    };
+    std::vector<Object> objects;
+    uint64_t total = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(root / "objects", ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file() || it->path().filename().string().starts_with(".tmp-"))
+            continue;
+        std::error_code e;
+        Object o{it->last_write_time(e), it->file_size(e), it->path()};
+        if (e)
+            continue;
+        total += o.size;
+        objects.push_back(std::move(o));
+    }
+    if (total <= limit)
+        return;
+
+    std::sort(objects.begin(), objects.end(), [](const Object &a, const Object &b) { return a.used < b.used; });
+    size_t removed = 0;
+    for (const auto &o : objects) {
+        if (total <= limit)
+            break;
+        if (fs::remove(o.path, ec)) {
+            total -= o.size;
+            ++removed;
+        }
+    }
+    LOG_INFO("Evicted %zu object(s) from cache %s", removed, root.string().c_str());
+
+    // 清理内容已被淘汰的记录
+    for (fs::directory_iterator it(root / "urls", ec), end; !ec && it != end; it.increment(ec)) {
+        std::ifstream in(it->path());
+        std::string line, hash;
+        for (int i = 0; i < 4 && std::getline(in, line); ++i)
+            hash = line;
+        in.close();
+        std::error_code e;
+        if (hash.size() < 2 || !fs::exists(objectPath(hash), e))
+            fs::remove(it->path(), e);
+    }
+}
+
+} // namespace multi_get
@@ -0,0 +1,658 @@
+#include "Cluster.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+
+#ifdef _WIN32
+#define poll WSAPoll
+#else
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#endif
+
+#include "HTTPConnection.h"
+#include "Logger.h"
+#include "ResponseReader.h"
+#include "Retry.h"
+
+namespace multi_get {
+
+namespace {
+
+// 等待worker连接时检查取消和完成的间隔
+constexpr int TICK_MS = 200;
+constexpr size_t MAX_SLOTS = 64;
+
+// 协调者一侧接受的连接，按StreamReader的传输接口读取
+struct SocketTransport {
+    socket_t fd;
+    ssize_t receive(char *buf, size_t n) const noexcept {
+        ssize_t len;
+        do {
+            len = ::recv(fd, buf, static_cast<int>(n), 0);
+        } while (len < 0 && errno == EINTR);
+        return len;
+    }
+    [[nodiscard]] bool timedOut() const noexcept {
+        return false;
+    }
+};
+
+bool sendAll(socket_t fd, std::string_view data) {
+    while (!data.empty()) {
+        auto len = ::send(fd, data.data(), static_cast<int>(data.size()), SEND_FLAGS);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return false;
+        data.remove_prefix(static_cast<size_t>(len));
+    }
+    return true;
+}
+
+// 唤醒阻塞在该连接上的接收，fd在线程结束后才关闭
+void shutdownSocket(socket_t fd) noexcept {
+#ifdef _WIN32
+    ::shutdown(fd, SD_BOTH);
+#else
+    ::shutdown(fd, SHUT_RDWR);
+#endif
+}
+
+void setSocketFlag(socket_t fd, int level, int name) noexcept {
+    int on = 1;
+    ::setsockopt(fd, level, name, reinterpret_cast<const char *>(&on), sizeof(on));
+}
+
+std::vector<std::string_view> fields(std::string_view line) {
+    std::vector<std::string_view> res;
+    while (!line.empty()) {
+        auto end = line.find(' ');
+        if (end != 0)
+            res.push_back(line.substr(0, end));
+        if (end == std::string_view::npos)
+            break;
+        line.remove_prefix(end + 1);
+    }
+    return res;
+}
+
+template <typename T>
+bool number(std::string_view s, T &out) {
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return !s.empty() && ec == std::errc() && ptr == s.data() + s.size();
+}
+
+// 协议中的错误码来自其他进程，不认识的值按响应异常处理
+Error toError(int value) noexcept {
+    if (value <= 0 || value > static_cast<int>(Error::DecodeFailed))
+        return Error::BadResponse;
+    return static_cast<Error>(value);
+}
+
+std::string peerAddress(const sockaddr_storage &addr, socklen_t len) {
+    char host[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    if (::getnameinfo(reinterpret_cast<const sockaddr *>(&addr), len, host, sizeof(host), port, sizeof(port),
+                      NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+        return "unknown";
+    std::string_view h = host;
+    // 双栈监听时IPv4的地址以映射形式出现
+    if (h.substr(0, 7) == "::ffff:" && h.find('.') != std::string_view::npos)
+        h.remove_prefix(7);
+    if (h.find(':') != std::string_view::npos)
+        return '[' + std::string(h) + "]:" + port;
+    return std::string(h) + ':' + port;
+}
+
+} // namespace
+
+Coordinator::Coordinator(uint16_t port, Job job, SegmentPlan ranges, unsigned attempts)
+    : port(port), job(std::move(job)), ranges(std::move(ranges)), attempts(attempts) {}
+
+Coordinator::~Coordinator() {
+    stop();
+}
+
+Error Coordinator::listen() {
+    // 优先监听双栈的IPv6地址，不支持IPv6时退回IPv4
+    for (int family : {AF_INET6, AF_INET}) {
+        socket_t fd = ::socket(family, SOCK_STREAM, 0);
+        if (fd == invalid_socket)
+            continue;
+        setSocketFlag(fd, SOL_SOCKET, SO_REUSEADDR);
+        sockaddr_storage addr{};
+        socklen_t len;
+        if (family == AF_INET6) {
+            int off = 0;
+            ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char *>(&off), sizeof(off));
+            auto *in6 = reinterpret_cast<sockaddr_in6 *>(&addr);
+            in6->sin6_family = AF_INET6;
+            in6->sin6_addr = in6addr_any;
+            in6->sin6_port = htons(port);
+            len = sizeof(sockaddr_in6);
+        } else {
+            auto *in4 = reinterpret_cast<sockaddr_in *>(&addr);
+            in4->sin_family = AF_INET;
+            in4->sin_addr.s_addr = htonl(INADDR_ANY);
+            in4->sin_port = htons(port);
+            len = sizeof(sockaddr_in);
+        }
+        if (::bind(fd, reinterpret_cast<const sockaddr *>(&addr), len) == 0 && ::listen(fd, SOMAXCONN) == 0) {
+            listenFd = fd;
+            LOG_INFO("Coordinator listening on port %u", static_cast<unsigned>(port));
+            return Error::Ok;
+        }
+        LOG_WARN("Failed to listen on port %u: %s", static_cast<unsigned>(port), std::strerror(errno));
+        close_socket(fd);
+    }
+    return Error::ListenFailed;
+}
+
+Error Coordinator::run(Hooks h) {
+    hooks = std::move(h);
+    std::unique_lock<std::mutex> locker(m);
+    completed.assign(ranges.size(), false);
+    failures.assign(ranges.size(), 0);
+    for (size_t i = 0; i < ranges.size(); ++i)
+        pending.push_back(i);
+    LOG_INFO("Waiting for workers to download %zu segments.", ranges.size());
+
+    // 调用线程负责接受worker和检查取消，各worker的消息在各自的线程中处理
+    while (!stopping && finished < ranges.size()) {
+        locker.unlock();
+        if (hooks.cancelled && hooks.cancelled()) {
+            locker.lock();
+            fail(Error::Cancelled);
+            break;
+        }
+        pollfd p{listenFd, POLLIN, 0};
+        if (::poll(&p, 1, TICK_MS) > 0) {
+            sockaddr_storage addr{};
+            socklen_t len = sizeof(addr);
+            socket_t fd = ::accept(listenFd, reinterpret_cast<sockaddr *>(&addr), &len);
+            if (fd != invalid_socket) {
+                // 控制消息很短，不等待合并；worker所在的机器宕机时由keepalive发现
+                setSocketFlag(fd, IPPROTO_TCP, TCP_NODELAY);
+                setSocketFlag(fd, SOL_SOCKET, SO_KEEPALIVE);
+                std::lock_guard<std::mutex> guard(m);
+                auto &peer = peers.emplace_back();
+                peer.fd = fd;
+                peer.address = peerAddress(addr, len);
+                peer.thread = std::thread(&Coordinator::serve, this, std::ref(peer));
+            }
+        }
+        locker.lock();
+    }
+    locker.unlock();
+    stop();
+    return _error;
+}
+
+void Coordinator::stop() {
+    {
+        std::lock_guard<std::mutex> locker(m);
+        stopping = true;
+        for (auto &peer : peers) {
+            if (peer.closed)
+                continue;
+            sendAll(peer.fd, "BYE\r\n");
+            peer.closed = true;
+            shutdownSocket(peer.fd);
+        }
+    }
+    for (auto &peer : peers) {
+        if (peer.thread.joinable())
+            peer.thread.join();
+        if (peer.fd != invalid_socket) {
+            close_socket(peer.fd);
+            peer.fd = invalid_socket;
+        }
+    }
+    if (listenFd != invalid_socket) {
+        close_socket(listenFd);
+        listenFd = invalid_socket;
+    }
+}
+
+void Coordinator::serve(Peer &peer) {
+    SocketTransport transport{peer.fd};
+    StreamReader reader{transport};
+    const bool shared = !job.output.empty();
+
+    auto hello = reader.readLine();
+    size_t slots = 0;
+    if (auto f = hello ? fields(*hello) : std::vector<std::string_view>{};
+        f.size() != 2 || f[0] != "HELLO" || !number(f[1], slots) || slots == 0) {
+        LOG_WARN("Worker %s did not introduce itself.", peer.address.c_str());
+        disconnect(peer);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> locker(m);
+        const std::string intro =
+            "URL " + job.url + "\r\nETAG " + job.etag + "\r\nOUTPUT " + (shared ? job.output : "-") + "\r\n";
+        if (!stopping && sendAll(peer.fd, intro)) {
+            peer.slots = std::min(slots, MAX_SLOTS);
+            LOG_INFO("Worker %s joined with %zu slot(s).", peer.address.c_str(), peer.slots);
+            dispatch();
+        }
+    }
+
+    while (auto line = reader.readLine()) {
+        const auto f = fields(*line);
+        size_t idx = 0;
+        if (f.size() < 2 || !number(f[1], idx) || idx >= ranges.size()) {
+            LOG_WARN("Unexpected message from worker %s: %.*s", peer.address.c_str(), static_cast<int>(line->size()),
+                     line->data());
+            break;
+        }
+        if (f[0] == "DONE" && f.size() == 2 && shared) {
+            bool fresh;
+            {
+                std::lock_guard<std::mutex> locker(m);
+                fresh = complete(peer, idx);
+            }
+            if (fresh && hooks.written)
+                hooks.written(idx);
+        } else if (f[0] == "DATA" && f.size() == 3 && !shared) {
+            const uint64_t expected = ranges[idx].second - ranges[idx].first + 1;
+            uint64_t length = 0;
+            if (!number(f[2], length) || length != expected) {
+                LOG_WARN("Worker %s sent %.*s bytes for a segment of %llu bytes.", peer.address.c_str(),
+                         static_cast<int>(f[2].size()), f[2].data(), static_cast<unsigned long long>(expected));
+                break;
+            }
+            Rope body;
+            if (reader.readInto(body, length, length, [](size_t) {}) != Fill::Ok)
+                break;
+            bool owned;
+            {
+                std::lock_guard<std::mutex> locker(m);
+                owned = std::find(peer.assigned.begin(), peer.assigned.end(), idx) != peer.assigned.end() &&
+                        !completed[idx];
+            }
+            // 分段只属于一个worker，检查之后不会被改派。没有deliver时收到的数据无处可写
+            auto e = Error::Ok;
+            if (owned)
+                e = hooks.deliver ? hooks.deliver(idx, std::move(body)) : Error::OutputError;
+            std::lock_guard<std::mutex> locker(m);
+            if (e != Error::Ok)
+                fail(e);
+            else if (owned)
+                complete(peer, idx);
+        } else if (f[0] == "FAIL" && f.size() == 4) {
+            int error = 0;
+            int status = 0;
+            if (!number(f[2], error) || !number(f[3], status))
+                break;
+            std::lock_guard<std::mutex> locker(m);
+            auto it = std::find(peer.assigned.begin(), peer.assigned.end(), idx);
+            if (it == peer.assigned.end())
+                continue;
+            peer.assigned.erase(it);
+            LOG_WARN("Worker %s failed segment %zu: %s (%d)", peer.address.c_str(), idx, errorString(toError(error)),
+                     status);
+            requeue(idx, toError(error), status);
+            dispatch();
+        } else {
+            LOG_WARN("Unexpected message from worker %s: %.*s", peer.address.c_str(), static_cast<int>(line->size()),
+                     line->data());
+            break;
+        }
+    }
+    disconnect(peer);
+}
+
+void Coordinator::disconnect(Peer &peer) {
+    std::lock_guard<std::mutex> locker(m);
+    if (!peer.closed) {
+        peer.closed = true;
+        shutdownSocket(peer.fd);
+    }
+    if (stopping)
+        return;
+    if (!peer.assigned.empty())
+        LOG_WARN("Worker %s left with %zu unfinished segment(s), reassigning them.", peer.address.c_str(),
+                 peer.assigned.size());
+    else
+        LOG_INFO("Worker %s left.", peer.address.c_str());
+    for (auto idx : peer.assigned)
+        requeue(idx, Error::IncompleteBody, 0);
+    peer.assigned.clear();
+    dispatch();
+}
+
+void Coordinator::dispatch() {
+    if (stopping)
+        return;
+    for (auto &peer : peers) {
+        while (!peer.closed && peer.assigned.size() < peer.slots && !pending.empty()) {
+            const auto idx = pending.front();
+            const auto [first, last] = ranges[idx];
+            const std::string msg = "SEG " + std::to_string(idx) + ' ' + std::to_string(first) + ' ' +
+                                    std::to_string(last) + "\r\n";
+            if (!sendAll(peer.fd, msg)) {
+                // 由该worker的线程发现断开，收回它手上的分段
+                peer.closed = true;
+                shutdownSocket(peer.fd);
+                break;
+            }
+            pending.pop_front();
+            peer.assigned.push_back(idx);
+        }
+    }
+}
+
+bool Coordinator::complete(Peer &peer, size_t idx) {
+    auto it = std::find(peer.assigned.begin(), peer.assigned.end(), idx);
+    if (it == peer.assigned.end())
+        return false;
+    peer.assigned.erase(it);
+    if (completed[idx])
+        return false;
+    completed[idx] = true;
+    ++finished;
+    peer.bytes += ranges[idx].second - ranges[idx].first + 1;
+    dispatch();
+    return true;
+}
+
+void Coordinator::requeue(size_t idx, Error e, int status) {
+    if (stopping || completed[idx])
+        return;
+    if (!retryable(e, status) || ++failures[idx] > attempts) {
+        LOG_ERROR("Segment %zu failed on the workers: %s", idx, errorString(e));
+        fail(e, status);
+        return;
+    }
+    // 失败的分段优先重新分配，避免拖到最后
+    pending.push_front(idx);
+}
+
+void Coordinator::fail(Error e, int status) {
+    if (_error == Error::Ok) {
+        _error = e;
+        _status = status;
+    }
+    stopping = true;
+}
+
+std::vector<PathStats> Coordinator::workers() {
+    std::lock_guard<std::mutex> locker(m);
+    std::vector<PathStats> res;
+    for (const auto &peer : peers)
+        res.push_back({peer.address, peer.bytes});
+    return res;
+}
+
+namespace {
+
+// 共享文件系统上由协调者预先创建的输出文件，各worker写入分到的偏移
+class SharedOutput {
+  private:
+#ifdef _WIN32
+    std::fstream out;
+    std::mutex m;
+#else
+    int fd{-1};
+#endif
+
+  public:
+    SharedOutput() = default;
+    SharedOutput(const SharedOutput &) = delete;
+    SharedOutput &operator=(const SharedOutput &) = delete;
+    ~SharedOutput() {
+#ifndef _WIN32
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+
+    bool open(const std::string &path) {
+#ifdef _WIN32
+        out.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        return static_cast<bool>(out);
+#else
+        fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        return fd >= 0;
+#endif
+    }
+
+    // 落盘之后才能向协调者报告完成，协调者随后可能立即rename
+    Error write(uint64_t offset, const Rope &data) {
+#ifdef _WIN32
+        std::lock_guard<std::mutex> locker(m);
+        out.seekp(static_cast<std::streamoff>(offset));
+        data.forEach([&](const char *p, size_t n) { out.write(p, static_cast<std::streamsize>(n)); });
+        out.flush();
+        return out ? Error::Ok : Error::FileError;
+#else
+        bool ok = true;
+        data.forEach([&](const char *p, size_t n) {
+            while (ok && n) {
+                auto len = ::pwrite(fd, p, n, static_cast<off_t>(offset));
+                if (len < 0 && errno == EINTR)
+                    continue;
+                if (len <= 0) {
+                    LOG_ERROR("Writing shared output failed: %s", std::strerror(errno));
+                    ok = false;
+                    break;
+                }
+                p += len;
+                n -= static_cast<size_t>(len);
+                offset += static_cast<uint64_t>(len);
+            }
+        });
+        if (ok && ::fdatasync(fd) != 0)
+            ok = false;
+        return ok ? Error::Ok : Error::FileError;
+#endif
+    }
+};
+
+// worker一侧的状态：控制连接的接收在调用线程上，分段在slots个线程上下载
+class Worker {
+  private:
+    struct Assignment {
+        size_t id;
+        SegmentScheduler::Range range;
+    };
+
+    const DownloadOptions &options;
+    PlainConnection &control;
+    std::vector<std::shared_ptr<HTTPConnection>> conns;
+    std::string url;
+    std::string etag;
+    SharedOutput output;
+    bool shared{false};
+
+    std::mutex sendMutex;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<Assignment> queue;
+    std::atomic<bool> stopped{false};
+
+    bool send(const iovec *iov, size_t cnt) {
+        std::lock_guard<std::mutex> locker(sendMutex);
+        return control.sendSlices(iov, cnt);
+    }
+
+    bool sendLine(const std::string &line) {
+        iovec iov{const_cast<char *>(line.data()), line.size()};
+        return send(&iov, 1);
+    }
+
+    Error deliver(const Assignment &a, Rope &&body) {
+        if (shared)
+            return output.write(a.range.first, body);
+        const std::string header = "DATA " + std::to_string(a.id) + ' ' + std::to_string(body.size()) + "\r\n";
+        auto slices = body.slices();
+        slices.insert(slices.begin(), iovec{const_cast<char *>(header.data()), header.size()});
+        return send(slices.data(), slices.size()) ? Error::Ok : Error::CoordinatorLost;
+    }
+
+    void download(HTTPConnection &conn, const Assignment &a) {
+        LOG_INFO("Downloading segment %zu: %llu-%llu", a.id, static_cast<unsigned long long>(a.range.first),
+                 static_cast<unsigned long long>(a.range.second));
+        const auto [first, last] = a.range;
+        SegmentPlan plan;
+        plan.add(first, last, last - first + 1);
+        SegmentScheduler scheduler{conn, url, std::move(plan), {options.minSpeed, options.hedge, options.retry}};
+        const auto error = scheduler.run(1, {.cancelled = [this] { return stopped.load(); },
+                                             .deliver = [&](size_t, Rope &&body) { return deliver(a, std::move(body)); }});
+        if (stopped)
+            return;
+        bool sent;
+        if (error == Error::Ok)
+            sent = !shared || sendLine("DONE " + std::to_string(a.id) + "\r\n");
+        else
+            sent = sendLine("FAIL " + std::to_string(a.id) + ' ' + std::to_string(static_cast<int>(error)) + ' ' +
+                            std::to_string(scheduler.status()) + "\r\n");
+        if (!sent)
+            stop();
+    }
+
+    void slot(size_t index) {
+        auto &conn = *conns[index % conns.size()];
+        while (true) {
+            Assignment a;
+            {
+                std::unique_lock<std::mutex> locker(m);
+                cv.wait(locker, [this] { return stopped || !queue.empty(); });
+                if (stopped)
+                    return;
+                a = queue.front();
+                queue.pop_front();
+            }
+            download(conn, a);
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> locker(m);
+            stopped = true;
+        }
+        cv.notify_all();
+        control.shutdown();
+    }
+
+  public:
+    // conns之后会带上本次下载的If-Match，不能与其他下载共享
+    Worker(const DownloadOptions &options, PlainConnection &control, std::vector<std::shared_ptr<HTTPConnection>> conns)
+        : options(options), control(control), conns(std::move(conns)) {}
+
+    Error run() {
+        const size_t slots = std::clamp<size_t>(options.threadCount, 1, MAX_SLOTS);
+        if (!sendLine("HELLO " + std::to_string(slots) + "\r\n"))
+            return Error::CoordinatorLost;
+
+        std::vector<std::thread> threads;
+        Error result = Error::CoordinatorLost;
+        StreamReader reader{control};
+        while (auto line = reader.readLine()) {
+            const auto f = fields(*line);
+            auto rest = [&] {
+                auto space = line->find(' ');
+                return space == std::string_view::npos ? std::string() : std::string(line->substr(space + 1));
+            };
+            if (f.empty()) {
+                continue;
+            } else if (f[0] == "URL") {
+                url = rest();
+            } else if (f[0] == "ETAG") {
+                etag = rest();
+            } else if (f[0] == "OUTPUT") {
+                const auto path = rest();
+                shared = path != "-";
+                if (shared && !output.open(path)) {
+                    LOG_ERROR("Failed to open shared output %s: %s", path.c_str(), std::strerror(errno));
+                    result = Error::FileError;
+                    break;
+                }
+            } else if (f[0] == "SEG" && f.size() == 4 && !url.empty()) {
+                Assignment a{};
+                if (!number(f[1], a.id) || !number(f[2], a.range.first) || !number(f[3], a.range.second))
+                    break;
+                if (threads.empty()) {
+                    LOG_INFO("Joined the download of %s", url.c_str());
+                    for (auto &conn : conns) {
+                        if (!etag.empty())
+                            conn->setHeader("If-Match", etag);
+                    }
+                    for (size_t i = 0; i < slots; ++i)
+                        threads.emplace_back(&Worker::slot, this, i);
+                }
+                {
+                    std::lock_guard<std::mutex> locker(m);
+                    queue.push_back(a);
+                }
+                cv.notify_one();
+            } else if (f[0] == "BYE") {
+                result = Error::Ok;
+                break;
+            } else {
+                LOG_WARN("Unexpected message from coordinator: %.*s", static_cast<int>(line->size()), line->data());
+                break;
+            }
+        }
+        stop();
+        for (auto &t : threads)
+            t.join();
+        return result;
+    }
+};
+
+} // namespace
+
+Error Client::work(const std::string &coordinator, const DownloadOptions &options) {
+    const auto colon = coordinator.rfind(':');
+    uint16_t port = 0;
+    if (colon == std::string::npos || !number(std::string_view(coordinator).substr(colon + 1), port) || port == 0) {
+        LOG_ERROR("Invalid coordinator address %s, expected host:port", coordinator.c_str());
+        return Error::InvalidUrl;
+    }
+    auto host = coordinator.substr(0, colon);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+
+    // 协调者可能还在探测文件，连接失败时按重试策略等待
+    PlainConnection control{host, port};
+    Timeouts timeouts;
+    timeouts.connect = options.timeouts.connect;
+    timeouts.firstByte = timeouts.idle = {};
+    control.setTimeouts(timeouts);
+    for (unsigned failures = 0; !control.connect(); ) {
+        if (failures >= options.retry.attempts) {
+            LOG_ERROR("Failed to connect to coordinator %s", coordinator.c_str());
+            return control.error();
+        }
+        auto delay = options.retry.delay(++failures);
+        LOG_WARN("Coordinator %s is not ready, retrying in %lld ms.", coordinator.c_str(),
+                 static_cast<long long>(delay.count()));
+        std::this_thread::sleep_for(delay);
+    }
+    setSocketFlag(control.fd(), IPPROTO_TCP, TCP_NODELAY);
+    LOG_INFO("Connected to coordinator %s", coordinator.c_str());
+    // 每个源各自一个HTTPConnection
+    std::vector<std::shared_ptr<HTTPConnection>> conns;
+    std::vector<std::string> sources = options.sources;
+    if (sources.empty())
+        sources.push_back(options.socket.source);
+    for (const auto &source : sources) {
+        auto pathOptions = options;
+        pathOptions.socket.source = source;
+        conns.push_back(makeConnection(pathOptions));
+    }
+    return Worker(options, control, std::move(conns)).run();
+}
+
+} // namespace multi_get
@@ -1,27 +1,54 @@
 #include "Connection.h"
+#include <algorithm>
+#include <cerrno>
+#include <cctype>
+#include <chrono>
+#include <unordered_set>
 #include <vector>
 
+#include <openssl/evp.h>
+
+#include "Coroutine.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#endif
+
+#ifdef __linux__
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#ifndef TCPI_OPT_SYN_DATA
+#define TCPI_OPT_SYN_DATA 32
+#endif
+#endif
+
 namespace multi_get {
 
 ssize_t SSLConnection::send(const char *_buf, size_t _n) const {
     auto len = ::SSL_write(ssl, _buf, int(_n));
-    if (len < 0) {
+    _timedOut = false;
+    if (len <= 0) {
         int err = ::SSL_get_error(ssl, len);
-        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
-            return 0;
-        } else {
-            return -1;
-        }
+        // 阻塞socket上只有SO_SNDTIMEO到期才会出现
+        _timedOut = err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ;
+        return -1;
     }
     return len;
 }
 
 ssize_t SSLConnection::receive(char *_buf, size_t _n) const {
     auto len = ::SSL_read(ssl, _buf, int(_n));
+    _timedOut = false;
     if (len < 0) {
         int err = ::SSL_get_error(ssl, len);
         if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-            return 0;
+            // 阻塞socket上只有SO_RCVTIMEO到期才会出现
+            _timedOut = true;
+            return -1;
         } else if (err == SSL_ERROR_ZERO_RETURN || err == SSL_ERROR_SYSCALL || err == SSL_ERROR_SSL) {
             return -1;
         }
@@ -29,37 +56,108 @@ ssize_t SSLConnection::receive(char *_buf, size_t _n) const {
     return len;
 }
 
-bool SSLConnection::connect() {
-    if (!Connection::connect()) {
-        return false;
+SSLContext::SSLContext() {
+    SSLInitializer::initialize();
+    ctx = ::SSL_CTX_new(::TLS_client_method());
+    if (!ctx) {
+        LOG_ERROR("Error creating SSL context.");
+        return;
     }
+    // 客户端会话缓存由我们自己按host保存
+    ::SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    ::SSL_CTX_sess_set_new_cb(ctx, &SSLContext::onNewSession);
+}
 
-    SSLInitializer::initialize();
+SSLContext::~SSLContext() {
+    for (auto &[key, session] : sessions)
+        ::SSL_SESSION_free(session);
+    if (ctx)
+        ::SSL_CTX_free(ctx);
+}
+
+int SSLContext::onNewSession(SSL *ssl, SSL_SESSION *session) {
+    const auto *key = static_cast<const std::string *>(SSL_get_app_data(ssl));
+    if (!key)
+        return 0;
+    auto &self = getInstance();
+    std::lock_guard<std::mutex> locker(self.m);
+    auto &slot = self.sessions[*key];
+    if (slot)
+        ::SSL_SESSION_free(slot);
+    slot = session;
+    // 返回1表示我们持有了session的引用
+    return 1;
+}
+
+void SSLContext::resume(SSL *ssl, const std::string &key) {
+    std::lock_guard<std::mutex> locker(m);
+    if (auto it = sessions.find(key); it != sessions.end())
+        ::SSL_set_session(ssl, it->second);
+}
+
+bool SSLConnection::prepare() {
+    auto &context = SSLContext::getInstance();
     if (!ssl) {
-        const SSL_METHOD *m = ::TLS_client_method();
-        ctx = ::SSL_CTX_new(m);
-        ssl = ::SSL_new(ctx);
+        ssl = context.get() ? ::SSL_new(context.get()) : nullptr;
         if (!ssl) {
             LOG_ERROR("Error creating SSL context.");
-            std::cerr << "Error creating SSL context." << std::endl;
+            _error = Error::TLSFailed;
             _connected = false;
             return false;
         }
     }
     ::SSL_set_fd(ssl, static_cast<int>(sock));
+    // SNI只能是域名，不能是IP地址
+    in6_addr addr{};
+    if (::inet_pton(AF_INET, hostname.c_str(), &addr) != 1 && ::inet_pton(AF_INET6, hostname.c_str(), &addr) != 1) {
+        ::SSL_set_tlsext_host_name(ssl, hostname.c_str());
+    }
+    if (!alpn.empty()) {
+        ::SSL_set_alpn_protos(ssl, reinterpret_cast<const unsigned char *>(alpn.data()), static_cast<unsigned>(alpn.size()));
+    }
+    sessionKey = hostname + ':' + std::to_string(port) + '/' + alpn;
+    SSL_set_app_data(ssl, &sessionKey);
+    context.resume(ssl, sessionKey);
+    return true;
+}
 
+bool SSLConnection::connect() {
+    if (!Connection::connect() || !prepare()) {
+        return false;
+    }
+
+    setReceiveTimeout(timeouts.connect);
     int err = ::SSL_connect(ssl);
+    setReceiveTimeout(timeouts.idle);
     if (err <= 0) {
         auto error = ::SSL_get_error(ssl, err);
         LOG_ERROR("Error creating SSL connection: %d", error);
-        std::cerr << "Error creating SSL connection: " << error << std::endl;
+        _error = Error::TLSFailed;
         _connected = false;
         return false;
     }
+    if (::SSL_session_reused(ssl))
+        LOG_INFO("Resumed TLS session with %s", sessionKey.c_str());
     _connected = true;
     return true;
 }
 
+void SSLConnection::setAlpn(std::initializer_list<std::string_view> protocols) {
+    alpn.clear();
+    for (auto p : protocols) {
+        alpn.push_back(static_cast<char>(p.size()));
+        alpn.append(p);
+    }
+}
+
+std::string_view SSLConnection::alpnSelected() const noexcept {
+    const unsigned char *data = nullptr;
+    unsigned len = 0;
+    if (ssl)
+        ::SSL_get0_alpn_selected(ssl, &data, &len);
+    return {reinterpret_cast<const char *>(data), len};
+}
+
 std::tuple<std::string, std::string, uint16_t, std::string> formatHost(const std::string &url) {
     std::string protocol;
     std::string hostname;
@@ -74,9 +172,9 @@ std::tuple<std::string, std::string, uint16_t, std::string> formatHost(const std
         protocol = "https";
         beginIdx = 8;
     } else {
+        // 调用者通过protocol为空判断url不合法
         LOG_ERROR("Unsupported url: %s", url.c_str());
-        std::cerr << "Unsupported url: " << url << ". The url should starts with http:// or https://" << std::endl;
-        exit(EXIT_FAILURE);
+        return {protocol, hostname, port, path};
     }
 
     auto pathBeginIdx = url.find_first_of('/', beginIdx);
@@ -89,7 +187,12 @@ std::tuple<std::string, std::string, uint16_t, std::string> formatHost(const std
     if (auto idx = hostPart.find_first_of(':');
         idx != std::string::npos) {
         hostname = hostPart.substr(0, idx);
-        port = std::stoi(hostPart.substr(idx + 1));
+        auto portStr = hostPart.substr(idx + 1);
+        if (portStr.empty() || portStr.size() > 5 || portStr.find_first_not_of("0123456789") != std::string::npos) {
+            LOG_ERROR("Unsupported url: %s", url.c_str());
+            return {};
+        }
+        port = static_cast<uint16_t>(std::stoi(portStr));
     } else {
         hostname = hostPart;
         port = protocol == "https" ? 443 : 80;
@@ -98,86 +201,962 @@ std::tuple<std::string, std::string, uint16_t, std::string> formatHost(const std
     return {protocol, hostname, port, path};
 }
 
-bool Connection::do_proxy_handshake() const {
-    LOG_WARN("Trying proxy socks5://%s:%d", proxyAddr.c_str(), proxyPort);
-    char req[3] = {0x05, 0x01, 0x00};
-    ::send(sock, req, sizeof(req), 0);
-    char res[2];
-    ::recv(sock, res, 2, 0);
+std::string resolveUrl(const std::string &base, std::string_view location) {
+    if (location.substr(0, 7) == "http://" || location.substr(0, 8) == "https://")
+        return std::string(location);
+    auto [protocol, hostname, port, path] = formatHost(base);
+    std::string url = protocol + "://" + hostname;
+    if (port != (protocol == "https" ? 443 : 80))
+        url += ':' + std::to_string(port);
+    if (location.substr(0, 2) == "//")
+        return protocol + ':' + std::string(location);
+    if (location.empty() || location[0] != '/') {
+        // 相对于当前路径所在的目录
+        path = path.substr(0, path.find_last_of('/') + 1);
+        return url + path + std::string(location);
+    }
+    return url + std::string(location);
+}
+
+namespace {
 
-    if (res[0] != 0x05) {
-        LOG_ERROR("Proxy server %s:%d is not a socks5 server.", proxyAddr.c_str(), proxyPort);
-        std::cerr << "Proxy server is not a socks5 server." << std::endl;
-        return false;
+// 按host:port缓存解析结果，同一进程内的多个任务无需重复解析
+class DNSCache {
+  public:
+    struct Entry {
+        std::vector<std::pair<sockaddr_storage, socklen_t>> addrs;
+        std::vector<int> families;
+        std::chrono::steady_clock::time_point expire;
+    };
+
+  private:
+    constexpr static auto TTL = std::chrono::seconds(60);
+    std::mutex m;
+    std::unordered_map<std::string, Entry> cache;
+
+  public:
+    static DNSCache &getInstance() {
+        static DNSCache instance;
+        return instance;
     }
-    if (res[1] != 0) {
-        LOG_ERROR("Proxy server %s:%d doer not support no-auth method.", proxyAddr.c_str(), proxyPort);
-        std::cerr << "Proxy server doer not support no-auth method." << std::endl;
-        return false;
+
+    bool resolve(const std::string &hostname, uint16_t port, Entry &out, Error &err) {
+        const std::string key = hostname + ':' + std::to_string(port);
+        {
+            std::lock_guard<std::mutex> locker(m);
+            if (auto it = cache.find(key); it != cache.end() && it->second.expire > std::chrono::steady_clock::now()) {
+                out = it->second;
+                return true;
+            }
+        }
+
+        addrinfo hints{}, *listp;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+        std::string portStr = std::to_string(port);
+        if (int s = ::getaddrinfo(hostname.c_str(), portStr.c_str(), &hints, &listp);
+            0 != s) {
+            LOG_ERROR("getaddrinfo: %s", gai_strerror(s));
+            err = Error::ResolveFailed;
+            return false;
+        }
+        Entry entry;
+        for (auto p = listp; p; p = p->ai_next) {
+            sockaddr_storage addr{};
+            std::memcpy(&addr, p->ai_addr, p->ai_addrlen);
+            entry.addrs.emplace_back(addr, static_cast<socklen_t>(p->ai_addrlen));
+            entry.families.push_back(p->ai_family);
+        }
+        ::freeaddrinfo(listp);
+        entry.expire = std::chrono::steady_clock::now() + TTL;
+
+        std::lock_guard<std::mutex> locker(m);
+        out = cache[key] = std::move(entry);
+        return true;
+    }
+};
+
+// 按host:port记录最近测得的RTT（微秒）。接收缓冲区要在connect之前设置，
+// 之后到同一host的连接按它计算带宽时延积
+class RttCache {
+  private:
+    std::mutex m;
+    std::unordered_map<std::string, uint32_t> cache;
+
+  public:
+    static RttCache &getInstance() {
+        static RttCache instance;
+        return instance;
     }
 
-    std::vector<char> connectReq;
-    connectReq.push_back(0x05); // socks version
-    connectReq.push_back(0x01); // cmd: connect
-    connectReq.push_back(0x00); // RSV
-    connectReq.push_back(0x03); // address type: domain name
-    connectReq.push_back(static_cast<char>(hostname.length())); // domain length
-    connectReq.insert(connectReq.end(), hostname.begin(), hostname.end()); // domain name
+    uint32_t get(const std::string &key) {
+        std::lock_guard<std::mutex> locker(m);
+        auto it = cache.find(key);
+        return it == cache.end() ? 0 : it->second;
+    }
+    void set(const std::string &key, uint32_t rtt) {
+        std::lock_guard<std::mutex> locker(m);
+        cache[key] = rtt;
+    }
+};
 
-    PORT p{0, 0};
-    p.port_short = htons(port);
-    connectReq.push_back(p.port_chars[0]); // port
-    connectReq.push_back(p.port_chars[1]); // port
+} // namespace
+
+namespace {
+
+// 非阻塞socket上的操作暂时无法完成
+inline bool wouldBlock() noexcept {
+#ifdef _WIN32
+    int err = ::WSAGetLastError();
+    return err == WSAEWOULDBLOCK || err == WSAEINPROGRESS;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+#endif
+}
+
+// 非阻塞connect后等待可写，完成后恢复为阻塞模式
+bool connectWithTimeout(socket_t fd, const sockaddr *addr, socklen_t len, std::chrono::milliseconds timeout,
+                        bool &timedOut) {
+#ifdef _WIN32
+    u_long mode = 1;
+    ::ioctlsocket(fd, FIONBIO, &mode);
+#else
+    int flags = ::fcntl(fd, F_GETFL, 0);
+    ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif
+    bool ok = ::connect(fd, addr, len) == 0;
+    if (!ok && wouldBlock()) {
+        pollfd p{};
+        p.fd = fd;
+        p.events = POLLOUT;
+#ifdef _WIN32
+        int n = ::WSAPoll(&p, 1, static_cast<int>(timeout.count()));
+#else
+        int n = ::poll(&p, 1, static_cast<int>(timeout.count()));
+#endif
+        if (n == 0) {
+            timedOut = true;
+        } else if (n > 0) {
+            int soError = 0;
+            socklen_t optLen = sizeof(soError);
+            ::getsockopt(fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&soError), &optLen);
+            ok = soError == 0;
+        }
+    }
+#ifdef _WIN32
+    mode = 0;
+    ::ioctlsocket(fd, FIONBIO, &mode);
+#else
+    ::fcntl(fd, F_SETFL, flags);
+#endif
+    return ok;
+}
 
-    ::send(sock, connectReq.data(), static_cast<int>(connectReq.size()), 0);
-    ::recv(sock, connectReq.data(), static_cast<int>(connectReq.size()), 0);
-    if (connectReq[1] != 0  && connectReq[1] < sizeof(SOCKS_ERROR_STR) / sizeof(const char* const)) {
-        std::cerr << SOCKS_ERROR_STR[connectReq[1]] << std::endl;
+// 绑定到本地源地址或网卡。source是另一地址族的地址、或网卡上没有该地址族的地址时返回false，
+// 由调用者尝试目标的下一个地址
+bool bindSource(socket_t fd, int family, const std::string &source) {
+    sockaddr_storage local{};
+    socklen_t len = 0;
+    if (family == AF_INET) {
+        auto *in = reinterpret_cast<sockaddr_in *>(&local);
+        if (::inet_pton(AF_INET, source.c_str(), &in->sin_addr) == 1) {
+            in->sin_family = AF_INET;
+            len = sizeof(sockaddr_in);
+        }
+    } else if (family == AF_INET6) {
+        auto *in6 = reinterpret_cast<sockaddr_in6 *>(&local);
+        if (::inet_pton(AF_INET6, source.c_str(), &in6->sin6_addr) == 1) {
+            in6->sin6_family = AF_INET6;
+            len = sizeof(sockaddr_in6);
+        }
+    }
+    if (len == 0) {
+        in6_addr other{};
+        if (::inet_pton(AF_INET, source.c_str(), &other) == 1 || ::inet_pton(AF_INET6, source.c_str(), &other) == 1)
+            return false;
+        // 不是地址时按网卡名处理
+#ifdef __linux__
+        if (::setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, source.c_str(), static_cast<socklen_t>(source.size())) == 0)
+            return true;
+        // 没有权限时退回绑定到网卡上的地址
+        LOG_INFO("SO_BINDTODEVICE %s failed (%s), binding to its address instead.", source.c_str(),
+                 std::strerror(errno));
+#endif
+#ifndef _WIN32
+        ifaddrs *list = nullptr;
+        if (::getifaddrs(&list) != 0)
+            return false;
+        for (auto *p = list; p; p = p->ifa_next) {
+            if (p->ifa_addr && p->ifa_addr->sa_family == family && source == p->ifa_name) {
+                len = family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+                std::memcpy(&local, p->ifa_addr, len);
+                break;
+            }
+        }
+        ::freeifaddrs(list);
+#endif
+        if (len == 0) {
+            LOG_WARN("%s is neither a local address nor an interface with an IPv%c address.", source.c_str(),
+                     family == AF_INET ? '4' : '6');
+            return false;
+        }
+    }
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    // 端口推迟到connect时按四元组分配，大量连接时不会耗尽本地端口
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+    if (::bind(fd, reinterpret_cast<const sockaddr *>(&local), len) != 0) {
+        LOG_WARN("Failed to bind to %s: %s", source.c_str(), std::strerror(errno));
         return false;
     }
     return true;
 }
-void Connection::setProxy(const std::string &proxyStr) {
-    if (proxyStr.substr(0, 9) != "socks5://") return;
-
-    bool proxyAddrParsed = false;
-    std::string p_addr;
-    uint16_t p_port = 0;
-    for (int i = 9; i < proxyStr.length(); ++i) {
-        if (proxyStr[i] == ':') {
-            proxyAddrParsed = true;
+
+} // namespace
+
+socket_t Connection::openClientFd(const std::string &hostname, uint16_t port, Error &err,
+                                  std::chrono::milliseconds timeout, const SocketOptions &options) {
+    DNSCache::Entry entry;
+    if (!DNSCache::getInstance().resolve(hostname, port, entry, err))
+        return invalid_socket;
+
+    bool timedOut = false;
+    for (size_t i = 0; i < entry.addrs.size(); ++i) {
+        socket_t clientFd = ::socket(entry.families[i], SOCK_STREAM, 0);
+        if (clientFd == invalid_socket)
             continue;
+        applySocketOptions(clientFd, options);
+        if (!options.source.empty() && !bindSource(clientFd, entry.families[i], options.source)) {
+            close_socket(clientFd);
+            continue;
+        }
+        const auto &[addr, len] = entry.addrs[i];
+        if (timeout.count() <= 0) {
+            if (::connect(clientFd, reinterpret_cast<const sockaddr *>(&addr), len) != -1)
+                return clientFd;
+        } else if (connectWithTimeout(clientFd, reinterpret_cast<const sockaddr *>(&addr), len, timeout, timedOut)) {
+            return clientFd;
         }
-        if (!proxyAddrParsed) {
-            p_addr.push_back(proxyStr[i]);
+        close_socket(clientFd);
+    }
+    LOG_ERROR("Socket Connection Error: %s:%d", hostname.c_str(), port);
+    err = timedOut ? Error::Timeout : Error::ConnectFailed;
+    return invalid_socket;
+}
+
+std::string SocketOptions::key() const {
+    if (receiveBuffer == 0 && bandwidth == 0 && noDelay && !fastOpen && congestion.empty() && busyPoll == 0 &&
+        source.empty())
+        return {};
+    return std::to_string(receiveBuffer) + '/' + std::to_string(bandwidth) + '/' + (noDelay ? '1' : '0') +
+           (fastOpen ? '1' : '0') + '/' + congestion + '/' + std::to_string(busyPoll) + '/' + source;
+}
+
+void Connection::applySocketOptions(socket_t fd, const SocketOptions &options) {
+    auto set = [fd](int level, int name, int value, const char *what) {
+        if (::setsockopt(fd, level, name, reinterpret_cast<const char *>(&value), sizeof(value)) != 0)
+            LOG_WARN("Failed to set %s: %s", what, std::strerror(errno));
+    };
+    if (options.noDelay)
+        set(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (options.receiveBuffer)
+        set(SOL_SOCKET, SO_RCVBUF, static_cast<int>(std::min<uint32_t>(options.receiveBuffer, INT32_MAX)), "SO_RCVBUF");
+#ifdef __linux__
+    if (options.fastOpen)
+        set(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, "TCP_FASTOPEN_CONNECT");
+    if (!options.congestion.empty() &&
+        ::setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, options.congestion.data(),
+                     static_cast<socklen_t>(options.congestion.size())) != 0)
+        LOG_WARN("Failed to use congestion control %s: %s", options.congestion.c_str(), std::strerror(errno));
+#ifdef SO_BUSY_POLL
+    if (options.busyPoll)
+        set(SOL_SOCKET, SO_BUSY_POLL, static_cast<int>(std::min<uint32_t>(options.busyPoll, INT32_MAX)),
+            "SO_BUSY_POLL");
+#endif
+#endif
+}
+
+SocketOptions Connection::connectOptions() const {
+    auto options = socketOptions;
+    if (options.receiveBuffer || !options.bandwidth)
+        return options;
+    const uint32_t rtt = RttCache::getInstance().get(hostname + ':' + std::to_string(port));
+    if (rtt == 0)
+        return options;
+    // 两倍带宽时延积，留出余量应对RTT抖动
+    const uint64_t bdp = options.bandwidth * rtt / 1000000 * 2;
+    options.receiveBuffer = static_cast<uint32_t>(std::clamp<uint64_t>(bdp, 64 * 1024, INT32_MAX / 2));
+    LOG_INFO("RTT to %s is %uus, receive buffer set to %u bytes", hostname.c_str(), rtt, options.receiveBuffer);
+    return options;
+}
+
+void Connection::recordRtt() const {
+#ifdef __linux__
+    if (socketOptions.receiveBuffer || !socketOptions.bandwidth)
+        return;
+    tcp_info info{};
+    socklen_t len = sizeof(info);
+    if (::getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) != 0 || info.tcpi_rtt == 0)
+        return;
+    RttCache::getInstance().set(hostname + ':' + std::to_string(port), info.tcpi_rtt);
+#endif
+}
+
+SocketInfo Connection::socketInfo() const {
+    SocketInfo info;
+    if (sock == invalid_socket)
+        return info;
+    int value = 0;
+    socklen_t len = sizeof(value);
+    if (::getsockopt(sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char *>(&value), &len) == 0)
+        info.receiveBuffer = value;
+    len = sizeof(value);
+    if (::getsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char *>(&value), &len) == 0)
+        info.noDelay = value != 0;
+#ifdef __linux__
+    char name[16]{};
+    len = sizeof(name);
+    if (::getsockopt(sock, IPPROTO_TCP, TCP_CONGESTION, name, &len) == 0)
+        info.congestion.assign(name, strnlen(name, len));
+#ifdef SO_BUSY_POLL
+    len = sizeof(value);
+    if (::getsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &value, &len) == 0)
+        info.busyPoll = value;
+#endif
+    tcp_info tcp{};
+    len = sizeof(tcp);
+    if (::getsockopt(sock, IPPROTO_TCP, TCP_INFO, &tcp, &len) == 0) {
+        info.rtt = std::chrono::microseconds(tcp.tcpi_rtt);
+        info.fastOpen = tcp.tcpi_options & TCPI_OPT_SYN_DATA;
+    }
+#endif
+    return info;
+}
+
+namespace {
+
+// 握手期间的阻塞收发，受SO_RCVTIMEO/SO_SNDTIMEO限制
+bool sendAll(socket_t sock, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        auto len = ::send(sock, data.data() + sent, static_cast<int>(data.size() - sent), SEND_FLAGS);
+        if (len <= 0)
+            return false;
+        sent += static_cast<size_t>(len);
+    }
+    return true;
+}
+
+bool recvAll(socket_t sock, char *buf, size_t n) {
+    size_t received = 0;
+    while (received < n) {
+        auto len = ::recv(sock, buf + received, static_cast<int>(n - received), 0);
+        if (len <= 0)
+            return false;
+        received += static_cast<size_t>(len);
+    }
+    return true;
+}
+
+std::string percentDecode(std::string_view s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '%' && i + 2 < s.size() && std::isxdigit(static_cast<unsigned char>(s[i + 1])) &&
+            std::isxdigit(static_cast<unsigned char>(s[i + 2]))) {
+            out.push_back(static_cast<char>(std::stoi(std::string(s.substr(i + 1, 2)), nullptr, 16)));
+            i += 2;
         } else {
-            if (std::isdigit(proxyStr[i])) {
-                p_port = p_port * 10 + proxyStr[i] - '0';
-            } else {
-                LOG_ERROR("Unsupported proxy port.");
-                std::cerr << "Unsupported proxy port." << std::endl;
-                return;
+            out.push_back(s[i]);
+        }
+    }
+    return out;
+}
+
+std::string base64(const std::string &s) {
+    std::string out(4 * ((s.size() + 2) / 3), '\0');
+    auto n = ::EVP_EncodeBlock(reinterpret_cast<unsigned char *>(out.data()),
+                               reinterpret_cast<const unsigned char *>(s.data()), static_cast<int>(s.size()));
+    out.resize(static_cast<size_t>(n));
+    return out;
+}
+
+// 不接受提前发送CONNECT的代理，之后对它们逐步握手
+class PipelineRejects {
+  private:
+    std::mutex m;
+    std::unordered_set<std::string> proxies;
+
+  public:
+    static PipelineRejects &getInstance() {
+        static PipelineRejects instance;
+        return instance;
+    }
+    bool contains(const std::string &key) {
+        std::lock_guard<std::mutex> locker(m);
+        return proxies.count(key);
+    }
+    void insert(const std::string &key) {
+        std::lock_guard<std::mutex> locker(m);
+        proxies.insert(key);
+    }
+};
+
+} // namespace
+
+std::optional<ProxyConfig> ProxyConfig::parse(std::string_view url) {
+    ProxyConfig config;
+    if (url.empty())
+        return config;
+    auto sep = url.find("://");
+    if (sep == std::string_view::npos)
+        return std::nullopt;
+    std::string scheme(url.substr(0, sep));
+    std::transform(scheme.begin(), scheme.end(), scheme.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (scheme == "socks5")
+        config.type = Type::Socks5;
+    else if (scheme == "socks5h")
+        config.type = Type::Socks5h;
+    else if (scheme == "http")
+        config.type = Type::HTTP;
+    else
+        return std::nullopt;
+
+    auto rest = url.substr(sep + 3);
+    if (auto slash = rest.find('/'); slash != std::string_view::npos)
+        rest = rest.substr(0, slash);
+    if (auto at = rest.rfind('@'); at != std::string_view::npos) {
+        auto userinfo = rest.substr(0, at);
+        auto colon = userinfo.find(':');
+        config.user = percentDecode(userinfo.substr(0, colon));
+        if (colon != std::string_view::npos)
+            config.password = percentDecode(userinfo.substr(colon + 1));
+        rest = rest.substr(at + 1);
+    }
+    std::string_view portStr;
+    if (!rest.empty() && rest[0] == '[') {
+        // [IPv6]:port
+        auto close = rest.find(']');
+        if (close == std::string_view::npos)
+            return std::nullopt;
+        config.host = rest.substr(1, close - 1);
+        rest = rest.substr(close + 1);
+        if (!rest.empty() && rest[0] != ':')
+            return std::nullopt;
+        portStr = rest.empty() ? rest : rest.substr(1);
+    } else {
+        auto colon = rest.rfind(':');
+        config.host = rest.substr(0, colon);
+        if (colon != std::string_view::npos)
+            portStr = rest.substr(colon + 1);
+    }
+    if (config.host.empty())
+        return std::nullopt;
+    if (portStr.empty()) {
+        config.port = config.type == Type::HTTP ? 80 : 1080;
+    } else {
+        if (portStr.size() > 5 || portStr.find_first_not_of("0123456789") != std::string_view::npos)
+            return std::nullopt;
+        auto value = std::stoul(std::string(portStr));
+        if (value == 0 || value > 65535)
+            return std::nullopt;
+        config.port = static_cast<uint16_t>(value);
+    }
+    return config;
+}
+
+void Connection::setProxy(const std::string &proxyStr) {
+    auto config = ProxyConfig::parse(proxyStr);
+    proxyInvalid = !config;
+    if (proxyInvalid)
+        LOG_ERROR("Unsupported proxy, expected socks5://, socks5h:// or http://");
+    proxy = config.value_or(ProxyConfig{});
+}
+
+bool Connection::connectProxy() {
+    const std::string key = proxy.host + ':' + std::to_string(proxy.port);
+    // 需要认证时要等代理选定方法，不能提前发送
+    bool optimistic = proxy.type != ProxyConfig::Type::HTTP && proxy.user.empty() &&
+                      !PipelineRejects::getInstance().contains(key);
+    while (true) {
+        sock = openClientFd(proxy.host, proxy.port, _error, timeouts.connect, socketOptions);
+        if (sock == invalid_socket)
+            return false;
+        // 握手也受连接超时的限制
+        receiveTimeout = {};
+        setReceiveTimeout(timeouts.connect);
+        bool rejected = false;
+        if (do_proxy_handshake(optimistic, rejected))
+            return true;
+        close_socket(sock);
+        sock = invalid_socket;
+        if (!optimistic || !rejected)
+            break;
+        LOG_WARN("Proxy %s did not accept a pipelined handshake, retrying step by step.", key.c_str());
+        PipelineRejects::getInstance().insert(key);
+        optimistic = false;
+    }
+    _error = Error::ProxyFailed;
+    return false;
+}
+
+bool Connection::do_proxy_handshake(bool optimistic, bool &pipelineRejected) const {
+    pipelineRejected = false;
+    const std::string target = hostname + ':' + std::to_string(port);
+
+    if (proxy.type == ProxyConfig::Type::HTTP) {
+        const std::string authority = hostname.find(':') != std::string::npos
+                                          ? '[' + hostname + "]:" + std::to_string(port)
+                                          : target;
+        std::string req = "CONNECT " + authority + " HTTP/1.1\r\nHost: " + authority + "\r\n";
+        if (!proxy.user.empty())
+            req += "Proxy-Authorization: Basic " + base64(proxy.user + ':' + proxy.password) + "\r\n";
+        req += "\r\n";
+        if (!sendAll(sock, req))
+            return false;
+        // 逐字节读取响应头，不能多读隧道中的数据
+        std::string head;
+        char c;
+        while (head.size() < 16 * 1024 && (head.size() < 4 || head.compare(head.size() - 4, 4, "\r\n\r\n") != 0)) {
+            if (!recvAll(sock, &c, 1)) {
+                LOG_ERROR("Proxy %s:%d closed the connection during CONNECT.", proxy.host.c_str(), proxy.port);
+                return false;
             }
+            head.push_back(c);
+        }
+        auto statusLine = head.substr(0, head.find("\r\n"));
+        auto space = statusLine.find(' ');
+        if (statusLine.compare(0, 5, "HTTP/") != 0 || space == std::string::npos ||
+            statusLine.size() < space + 4 || statusLine[space + 1] != '2') {
+            LOG_ERROR("Proxy refused CONNECT to %s: %s", target.c_str(), statusLine.c_str());
+            return false;
         }
+        return true;
     }
-    proxyAddr = std::move(p_addr);
-    proxyPort = p_port;
+
+    // CONNECT请求，socks5在本地解析目标域名
+    std::string connectReq{0x05, 0x01, 0x00};
+    if (proxy.type == ProxyConfig::Type::Socks5) {
+        DNSCache::Entry entry;
+        Error err;
+        if (!DNSCache::getInstance().resolve(hostname, port, entry, err) || entry.addrs.empty())
+            return false;
+        const auto &addr = entry.addrs.front().first;
+        if (addr.ss_family == AF_INET) {
+            const auto &in = reinterpret_cast<const sockaddr_in &>(addr).sin_addr;
+            connectReq.push_back(0x01);
+            connectReq.append(reinterpret_cast<const char *>(&in), 4);
+        } else {
+            const auto &in6 = reinterpret_cast<const sockaddr_in6 &>(addr).sin6_addr;
+            connectReq.push_back(0x04);
+            connectReq.append(reinterpret_cast<const char *>(&in6), 16);
+        }
+    } else {
+        if (hostname.size() > 255)
+            return false;
+        connectReq.push_back(0x03);
+        connectReq.push_back(static_cast<char>(hostname.size()));
+        connectReq.append(hostname);
+    }
+    connectReq.push_back(static_cast<char>(port >> 8));
+    connectReq.push_back(static_cast<char>(port & 0xff));
+
+    const bool auth = !proxy.user.empty();
+    std::string greeting = auth ? std::string{0x05, 0x02, 0x00, 0x02} : std::string{0x05, 0x01, 0x00};
+    const bool pipelined = optimistic && !auth;
+    // 问候和CONNECT一次发出，省掉一次往返
+    if (pipelined)
+        greeting += connectReq;
+    if (!sendAll(sock, greeting))
+        return false;
+
+    char method[2];
+    if (!recvAll(sock, method, sizeof(method)) || method[0] != 0x05) {
+        LOG_ERROR("Proxy server %s:%d is not a socks5 server.", proxy.host.c_str(), proxy.port);
+        pipelineRejected = pipelined;
+        return false;
+    }
+    if (method[1] == 0x02 && auth) {
+        // RFC 1929用户名/密码认证
+        if (proxy.user.size() > 255 || proxy.password.size() > 255)
+            return false;
+        std::string req{0x01};
+        req.push_back(static_cast<char>(proxy.user.size()));
+        req.append(proxy.user);
+        req.push_back(static_cast<char>(proxy.password.size()));
+        req.append(proxy.password);
+        char res[2];
+        if (!sendAll(sock, req) || !recvAll(sock, res, sizeof(res)) || res[1] != 0) {
+            LOG_ERROR("Proxy server %s:%d rejected the credentials.", proxy.host.c_str(), proxy.port);
+            return false;
+        }
+    } else if (method[1] != 0x00) {
+        LOG_ERROR("Proxy server %s:%d does not accept the offered authentication.", proxy.host.c_str(), proxy.port);
+        return false;
+    }
+    if (!pipelined && !sendAll(sock, connectReq))
+        return false;
+
+    // VER REP RSV ATYP BND.ADDR BND.PORT
+    char reply[4];
+    if (!recvAll(sock, reply, sizeof(reply)) || reply[0] != 0x05) {
+        LOG_ERROR("Bad CONNECT reply from proxy server %s:%d.", proxy.host.c_str(), proxy.port);
+        pipelineRejected = pipelined;
+        return false;
+    }
+    const auto rep = static_cast<unsigned char>(reply[1]);
+    if (rep != 0) {
+        LOG_ERROR("Proxy CONNECT to %s failed: %s", target.c_str(),
+                  rep < sizeof(SOCKS_ERROR_STR) / sizeof(SOCKS_ERROR_STR[0]) ? SOCKS_ERROR_STR[rep] : "Unknown error");
+        return false;
+    }
+    size_t addrLen;
+    switch (reply[3]) {
+    case 0x01:
+        addrLen = 4;
+        break;
+    case 0x04:
+        addrLen = 16;
+        break;
+    case 0x03: {
+        char len;
+        if (!recvAll(sock, &len, 1))
+            return false;
+        addrLen = static_cast<unsigned char>(len);
+        break;
+    }
+    default:
+        return false;
+    }
+    char bound[256 + 2];
+    return recvAll(sock, bound, addrLen + 2);
+}
+
+void Connection::setReceiveTimeout(std::chrono::milliseconds timeout) noexcept {
+    if (sock == invalid_socket || timeout == receiveTimeout)
+        return;
+    receiveTimeout = timeout;
+#ifdef _WIN32
+    DWORD tv = static_cast<DWORD>(timeout.count());
+#else
+    timeval tv{};
+    tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<suseconds_t>(timeout.count() % 1000 * 1000);
+#endif
+    ::setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&tv), sizeof(tv));
+    ::setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char *>(&tv), sizeof(tv));
+}
+
+void Connection::shutdown() const noexcept {
+    if (sock == invalid_socket)
+        return;
+#ifdef _WIN32
+    ::shutdown(sock, SD_BOTH);
+#else
+    ::shutdown(sock, SHUT_RDWR);
+#endif
+}
+
+ssize_t Connection::sendv(const iovec *iov, size_t cnt) const {
+    thread_local std::string buf;
+    buf.clear();
+    for (size_t i = 0; i < cnt; ++i) {
+        buf.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+    }
+    size_t sent = 0;
+    while (sent < buf.size()) {
+        auto len = send(buf.data() + sent, buf.size() - sent);
+        // 没有进展时不能重试，否则对端停止接收后会一直循环
+        if (len <= 0)
+            return -1;
+        sent += len;
+    }
+    return static_cast<ssize_t>(sent);
+}
+
+bool Connection::sendSlices(const iovec *iov, size_t cnt) const {
+    constexpr size_t BATCH = 8;
+    for (size_t i = 0; i < cnt; i += BATCH) {
+        const size_t n = std::min(BATCH, cnt - i);
+        size_t bytes = 0;
+        for (size_t j = i; j < i + n; ++j)
+            bytes += iov[j].iov_len;
+        if (sendv(iov + i, n) != static_cast<ssize_t>(bytes))
+            return false;
+    }
+    return true;
 }
 
-void Connection::receiveNBytes(char *_buf, size_t n) const {
+#ifndef _WIN32
+ssize_t PlainConnection::sendv(const iovec *iov, size_t cnt) const {
+    iovec vec[8];
+    if (cnt > sizeof(vec) / sizeof(vec[0]))
+        return Connection::sendv(iov, cnt);
+    std::copy(iov, iov + cnt, vec);
+
+    // sendmsg可能只写出一部分，需要跳过已发送的切片后继续
+    iovec *cur = vec;
+    size_t remain = cnt;
+    ssize_t total = 0;
+    while (remain) {
+        msghdr msg{};
+        msg.msg_iov = cur;
+        msg.msg_iovlen = remain;
+        auto len = ::sendmsg(sock, &msg, SEND_FLAGS);
+        _timedOut = len < 0 && wouldBlock();
+        if (len < 0)
+            return -1;
+        total += len;
+        while (remain && static_cast<size_t>(len) >= cur->iov_len) {
+            len -= static_cast<ssize_t>(cur->iov_len);
+            ++cur;
+            --remain;
+        }
+        if (remain) {
+            cur->iov_base = static_cast<char *>(cur->iov_base) + len;
+            cur->iov_len -= len;
+        }
+    }
+    return total;
+}
+#endif
+
+size_t Connection::receiveNBytes(char *_buf, size_t n) const {
     auto remainBytes = n;
     ssize_t len;
-    while (remainBytes && (len = receive(_buf, remainBytes)) <= remainBytes) {
+    while (remainBytes && (len = receive(_buf, remainBytes)) <= static_cast<ssize_t>(remainBytes)) {
         if (len == -1) {
-            perror("receive n bytes");
+            LOG_WARN("receive n bytes: %s", std::strerror(errno));
             break;
         } else if (len == 0) {
-            std::cerr << "peer closed..." << std::endl;
+            LOG_WARN("peer closed after %zu of %zu bytes", n - remainBytes, n);
             break;
         }
         remainBytes -= len;
         _buf += len;
     }
+    return n - remainBytes;
+}
+
+bool Connection::setNonBlocking(bool on) const noexcept {
+    if (sock == invalid_socket)
+        return false;
+#ifdef _WIN32
+    u_long mode = on ? 1 : 0;
+    return ::ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    int flags = ::fcntl(sock, F_GETFL, 0);
+    if (flags < 0)
+        return false;
+    flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return ::fcntl(sock, F_SETFL, flags) == 0;
+#endif
+}
+
+ssize_t PlainConnection::send(const char *_buf, size_t _n) const {
+    auto len = ::send(sock, _buf, static_cast<int>(_n), SEND_FLAGS);
+    // 阻塞socket上返回EAGAIN说明SO_SNDTIMEO到期
+    _timedOut = len < 0 && wouldBlock();
+    return len;
+}
+
+ssize_t PlainConnection::receive(char *_buf, size_t _n) const {
+    auto len = ::recv(sock, _buf, static_cast<int>(_n), 0);
+    // 阻塞socket上返回EAGAIN说明SO_RCVTIMEO到期
+    _timedOut = len < 0 && wouldBlock();
+    return len;
+}
+
+ssize_t PlainConnection::trySend(const char *_buf, size_t _n) const {
+    auto len = ::send(sock, _buf, static_cast<int>(_n), SEND_FLAGS);
+    if (len < 0 && wouldBlock())
+        return WANT_WRITE;
+    return len;
+}
+
+ssize_t PlainConnection::tryReceive(char *_buf, size_t _n) const {
+    auto len = ::recv(sock, _buf, static_cast<int>(_n), 0);
+    if (len < 0 && wouldBlock())
+        return WANT_READ;
+    return len;
+}
+
+// TLS的读写都可能需要等待另一个方向（如重新协商），由SSL_get_error给出
+ssize_t SSLConnection::trySend(const char *_buf, size_t _n) const {
+    auto len = ::SSL_write(ssl, _buf, static_cast<int>(_n));
+    if (len > 0)
+        return len;
+    switch (::SSL_get_error(ssl, len)) {
+    case SSL_ERROR_WANT_READ:
+        return WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+        return WANT_WRITE;
+    default:
+        return -1;
+    }
+}
+
+ssize_t SSLConnection::tryReceive(char *_buf, size_t _n) const {
+    auto len = ::SSL_read(ssl, _buf, static_cast<int>(_n));
+    if (len > 0)
+        return len;
+    switch (::SSL_get_error(ssl, len)) {
+    case SSL_ERROR_WANT_READ:
+        return WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+        return WANT_WRITE;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+Task<bool> Connection::asyncConnect(Executor &ex) {
+    if (_connected)
+        co_return true;
+    if (proxy.enabled() || proxyInvalid) {
+        // 代理握手仍是阻塞的，建立后再切换为非阻塞
+        co_return Connection::connect() && setNonBlocking(true);
+    }
+
+    DNSCache::Entry entry;
+    if (!DNSCache::getInstance().resolve(hostname, port, entry, _error))
+        co_return false;
+    receiveTimeout = {};
+    bool timedOut = false;
+    const auto options = connectOptions();
+    for (size_t i = 0; i < entry.addrs.size(); ++i) {
+        sock = ::socket(entry.families[i], SOCK_STREAM, 0);
+        if (sock == invalid_socket)
+            continue;
+        applySocketOptions(sock, options);
+        if (!options.source.empty() && !bindSource(sock, entry.families[i], options.source)) {
+            close_socket(sock);
+            sock = invalid_socket;
+            continue;
+        }
+        setNonBlocking(true);
+        const auto &[addr, len] = entry.addrs[i];
+        int ret = ::connect(sock, reinterpret_cast<const sockaddr *>(&addr), len);
+        if (ret != 0 && wouldBlock()) {
+            if (!co_await ex.writable(sock, timeouts.connect)) {
+                timedOut = true;
+                close_socket(sock);
+                sock = invalid_socket;
+                continue;
+            }
+            int soError = 0;
+            socklen_t optLen = sizeof(soError);
+            ::getsockopt(sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&soError), &optLen);
+            ret = soError == 0 ? 0 : -1;
+        }
+        if (ret == 0) {
+            _connected = true;
+            setReceiveTimeout(timeouts.idle);
+            recordRtt();
+            co_return true;
+        }
+        close_socket(sock);
+        sock = invalid_socket;
+    }
+    LOG_ERROR("Socket Connection Error: %s:%d", hostname.c_str(), port);
+    _error = timedOut ? Error::Timeout : Error::ConnectFailed;
+    co_return false;
+}
+
+Task<bool> SSLConnection::asyncConnect(Executor &ex) {
+    if (_connected)
+        co_return true;
+    if (!co_await Connection::asyncConnect(ex) || !prepare())
+        co_return false;
+
+    while (true) {
+        int ret = ::SSL_connect(ssl);
+        if (ret == 1)
+            break;
+        auto error = ::SSL_get_error(ssl, ret);
+        bool ready = true;
+        if (error == SSL_ERROR_WANT_READ) {
+            ready = co_await ex.readable(sock, timeouts.connect);
+        } else if (error == SSL_ERROR_WANT_WRITE) {
+            ready = co_await ex.writable(sock, timeouts.connect);
+        } else {
+            LOG_ERROR("Error creating SSL connection: %d", error);
+            _error = Error::TLSFailed;
+            _connected = false;
+            co_return false;
+        }
+        if (!ready) {
+            LOG_ERROR("TLS handshake with %s timed out.", hostname.c_str());
+            _error = Error::Timeout;
+            _connected = false;
+            co_return false;
+        }
+    }
+    if (::SSL_session_reused(ssl))
+        LOG_INFO("Resumed TLS session with %s", sessionKey.c_str());
+    co_return true;
+}
+
+Task<ssize_t> Connection::asyncSend(Executor &ex, const char *_buf, size_t _n) const {
+    size_t sent = 0;
+    while (sent < _n) {
+        auto len = trySend(_buf + sent, _n - sent);
+        bool ready = true;
+        if (len == WANT_WRITE) {
+            ready = co_await ex.writable(sock, receiveTimeout);
+        } else if (len == WANT_READ) {
+            ready = co_await ex.readable(sock, receiveTimeout);
+        } else if (len <= 0) {
+            LOG_WARN("async send: %s", std::strerror(errno));
+            co_return -1;
+        } else {
+            sent += static_cast<size_t>(len);
+        }
+        if (!ready) {
+            _timedOut = true;
+            co_return -1;
+        }
+    }
+    co_return static_cast<ssize_t>(sent);
+}
+
+Task<ssize_t> Connection::asyncReceive(Executor &ex, char *_buf, size_t _n) const {
+    _timedOut = false;
+    while (true) {
+        auto len = tryReceive(_buf, _n);
+        bool ready;
+        if (len == WANT_READ) {
+            ready = co_await ex.readable(sock, receiveTimeout);
+        } else if (len == WANT_WRITE) {
+            ready = co_await ex.writable(sock, receiveTimeout);
+        } else {
+            co_return len;
+        }
+        if (!ready) {
+            _timedOut = true;
+            co_return -1;
+        }
+    }
+}
+
+Task<size_t> Connection::asyncReceiveNBytes(Executor &ex, char *_buf, size_t n) const {
+    size_t received = 0;
+    while (received < n) {
+        auto len = co_await asyncReceive(ex, _buf + received, n - received);
+        if (len < 0) {
+            LOG_WARN("receive n bytes: %s", std::strerror(errno));
+            break;
+        } else if (len == 0) {
+            LOG_WARN("peer closed after %zu of %zu bytes", received, n);
+            break;
+        }
+        received += static_cast<size_t>(len);
+    }
+    co_return received;
 }
 
 } // namespace multi_get
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include "Decoder.h"
+#include "HTTPResponse.h"
+#include "Logger.h"
+
+#ifdef MULTI_GET_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MULTI_GET_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace multi_get {
+
+namespace {
+
+#ifdef MULTI_GET_HAVE_ZLIB
+// gzip和deflate。Rope的块远小于4GB，每段输入可以一次交给zlib
+class ZlibDecoder final : public Decoder {
+  private:
+    z_stream zs{};
+    bool ok;
+    bool gzip;
+    // deflate按规范带zlib头，但有些服务器发送原始deflate，第一段输入解析失败时改用原始格式重试
+    bool rawFallback;
+    bool started{false};
+    bool ended{false};
+    // 最后一个gzip成员之后的多余数据，与gunzip一样忽略
+    bool trailing{false};
+
+  public:
+    explicit ZlibDecoder(bool gzip) : gzip(gzip), rawFallback(!gzip) {
+        // gzip时按头部自动识别gzip和zlib格式
+        ok = inflateInit2(&zs, gzip ? MAX_WBITS + 32 : MAX_WBITS) == Z_OK;
+    }
+    ~ZlibDecoder() override {
+        if (ok)
+            inflateEnd(&zs);
+    }
+    ZlibDecoder(const ZlibDecoder &) = delete;
+    ZlibDecoder &operator=(const ZlibDecoder &) = delete;
+
+    Error decode(const char *data, size_t n, Rope &out) override {
+        if (!ok)
+            return Error::OutOfMemory;
+        if (trailing || n == 0)
+            return Error::Ok;
+        const bool first = !started;
+        started = true;
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zs.avail_in = static_cast<uInt>(n);
+        while (true) {
+            if (ended) {
+                if (zs.avail_in == 0)
+                    return Error::Ok;
+                // gzip允许多个成员首尾相接（如pigz的输出）
+                if (!gzip || zs.next_in[0] != 0x1f) {
+                    trailing = true;
+                    return Error::Ok;
+                }
+                if (inflateReset(&zs) != Z_OK)
+                    return Error::DecodeFailed;
+                ended = false;
+            }
+            auto [ptr, avail] = out.prepare();
+            if (!ptr)
+                return Error::OutOfMemory;
+            zs.next_out = reinterpret_cast<Bytef *>(ptr);
+            zs.avail_out = static_cast<uInt>(avail);
+            const int r = inflate(&zs, Z_NO_FLUSH);
+            out.commit(avail - zs.avail_out);
+            if (r == Z_STREAM_END) {
+                ended = true;
+                continue;
+            }
+            if (r == Z_DATA_ERROR && rawFallback && first && zs.total_out == 0) {
+                rawFallback = false;
+                if (inflateReset2(&zs, -MAX_WBITS) != Z_OK)
+                    return Error::DecodeFailed;
+                zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+                zs.avail_in = static_cast<uInt>(n);
+                continue;
+            }
+            if (r != Z_OK && r != Z_BUF_ERROR) {
+                LOG_WARN("inflate failed: %s", zs.msg ? zs.msg : "unknown error");
+                return r == Z_MEM_ERROR ? Error::OutOfMemory : Error::DecodeFailed;
+            }
+            // 输出空间用完时zlib中可能还有待输出的数据，换一个块继续
+            if (zs.avail_out != 0 && (zs.avail_in == 0 || r == Z_BUF_ERROR))
+                return Error::Ok;
+        }
+    }
+
+    Error finish() override {
+        // 有Content-Encoding但body为空的响应
+        return !started || ended ? Error::Ok : Error::DecodeFailed;
+    }
+};
+#endif
+
+#ifdef MULTI_GET_HAVE_ZSTD
+// zstd，多个帧首尾相接时依次解码
+class ZstdDecoder final : public Decoder {
+  private:
+    ZSTD_DStream *stream;
+    // 上一次ZSTD_decompressStream的返回值，为0表示正好结束一个帧
+    size_t hint{0};
+    bool started{false};
+
+  public:
+    ZstdDecoder() : stream(ZSTD_createDStream()) {
+        if (stream)
+            ZSTD_initDStream(stream);
+    }
+    ~ZstdDecoder() override {
+        ZSTD_freeDStream(stream);
+    }
+    ZstdDecoder(const ZstdDecoder &) = delete;
+    ZstdDecoder &operator=(const ZstdDecoder &) = delete;
+
+    Error decode(const char *data, size_t n, Rope &out) override {
+        if (!stream)
+            return Error::OutOfMemory;
+        if (n == 0)
+            return Error::Ok;
+        started = true;
+        ZSTD_inBuffer in{data, n, 0};
+        while (true) {
+            auto [ptr, avail] = out.prepare();
+            if (!ptr)
+                return Error::OutOfMemory;
+            ZSTD_outBuffer o{ptr, avail, 0};
+            const size_t r = ZSTD_decompressStream(stream, &o, &in);
+            out.commit(o.pos);
+            if (ZSTD_isError(r)) {
+                LOG_WARN("zstd decompression failed: %s", ZSTD_getErrorName(r));
+                return Error::DecodeFailed;
+            }
+            hint = r;
+            // 输出没有填满说明输入已经用完，否则解码器中可能还有数据
+            if (in.pos == in.size && o.pos < o.size)
+                return Error::Ok;
+        }
+    }
+
+    Error finish() override {
+        return !started || hint == 0 ? Error::Ok : Error::DecodeFailed;
+    }
+};
+#endif
+
+} // namespace
+
+std::unique_ptr<Decoder> Decoder::create(std::string_view encoding) {
+#ifdef MULTI_GET_HAVE_ZLIB
+    if (iequals(encoding, "gzip") || iequals(encoding, "x-gzip"))
+        return std::make_unique<ZlibDecoder>(true);
+    if (iequals(encoding, "deflate"))
+        return std::make_unique<ZlibDecoder>(false);
+#endif
+#ifdef MULTI_GET_HAVE_ZSTD
+    if (iequals(encoding, "zstd"))
+        return std::make_unique<ZstdDecoder>();
+#endif
+    return nullptr;
+}
+
+bool Decoder::identity(std::string_view encoding) noexcept {
+    return encoding.empty() || iequals(encoding, "identity");
+}
+
+std::string_view Decoder::accepted() noexcept {
+#if defined(MULTI_GET_HAVE_ZLIB) && defined(MULTI_GET_HAVE_ZSTD)
+    return "zstd, gzip, deflate";
+#elif defined(MULTI_GET_HAVE_ZLIB)
+    return "gzip, deflate";
+#elif defined(MULTI_GET_HAVE_ZSTD)
+    return "zstd";
+#else
+    return {};
+#endif
+}
+
+} // namespace multi_get
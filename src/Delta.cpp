@@ -0,0 +1,281 @@
+#include "Delta.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Digest.h"
+#include "Logger.h"
+
+namespace multi_get {
+
+namespace {
+
+constexpr std::string_view MAGIC = "multi-get-blocks";
+constexpr size_t RECORD_SIZE = 4 + BlockMap::STRONG_BYTES;
+
+BlockMap::Strong strongChecksum(const uint8_t *data, size_t n) {
+    Sha256 h;
+    h.update(data, n);
+    auto md = h.finish();
+    BlockMap::Strong s;
+    std::copy_n(md.begin(), s.size(), s.begin());
+    return s;
+}
+
+template <typename T>
+bool parseNumber(std::string_view s, T &value) {
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+    return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+// 滚动校验和的预过滤位图，绝大多数不匹配的位置不需要查索引
+class BitFilter {
+  private:
+    std::vector<uint64_t> bits;
+    uint32_t shift;
+
+    [[nodiscard]] uint32_t slot(uint32_t weak) const noexcept {
+        return (weak * 0x9E3779B1u) >> shift;
+    }
+
+  public:
+    explicit BitFilter(size_t count) {
+        // 每个块至少16位，误报率约为1/16
+        uint32_t order = 16;
+        while (order < 30 && (size_t{1} << order) < count * 16)
+            ++order;
+        shift = 32 - order;
+        bits.resize((size_t{1} << order) / 64);
+    }
+    void insert(uint32_t weak) noexcept {
+        auto s = slot(weak);
+        bits[s / 64] |= uint64_t{1} << (s % 64);
+    }
+    [[nodiscard]] bool test(uint32_t weak) const noexcept {
+        auto s = slot(weak);
+        return bits[s / 64] >> (s % 64) & 1;
+    }
+};
+
+} // namespace
+
+#if defined(__SSE2__)
+// 每次处理16字节：字节和用psadbw，块内的位置权重用pmaddwd，块间的权重由前缀和补上
+uint32_t weakChecksum(const uint8_t *data, size_t n) noexcept {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightsLo = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m128i weightsHi = _mm_setr_epi16(8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i sum = zero;      // 已处理字节之和
+    __m128i prefix = zero;   // 每个16字节块之前的字节和的累加
+    __m128i weighted = zero; // 块内位置加权的和
+    size_t chunks = n / 16;
+    for (size_t c = 0; c < chunks; ++c) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + c * 16));
+        prefix = _mm_add_epi64(prefix, sum);
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+        weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weightsLo));
+        weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weightsHi));
+    }
+    auto low32 = [](__m128i x) { return static_cast<uint32_t>(_mm_cvtsi128_si32(x)); };
+    const uint32_t total = low32(sum) + low32(_mm_srli_si128(sum, 8));
+    const uint32_t prefixes = low32(prefix) + low32(_mm_srli_si128(prefix, 8));
+    weighted = _mm_add_epi32(weighted, _mm_srli_si128(weighted, 8));
+    weighted = _mm_add_epi32(weighted, _mm_srli_si128(weighted, 4));
+    // 第c个16字节块中位置l的权重为n - 16c - l，Σ c·S_c = (chunks - 1)·total - Σ prefix_c
+    uint32_t a = total;
+    uint32_t b = static_cast<uint32_t>(n) * total -
+                 16 * (static_cast<uint32_t>(chunks ? chunks - 1 : 0) * total - prefixes) - low32(weighted);
+    for (size_t i = chunks * 16; i < n; ++i) {
+        a += data[i];
+        b += static_cast<uint32_t>(n - i) * data[i];
+    }
+    return (b & 0xffff) << 16 | (a & 0xffff);
+}
+#else
+uint32_t weakChecksum(const uint8_t *data, size_t n) noexcept {
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (size_t i = 0; i < n; ++i) {
+        a += data[i];
+        b += static_cast<uint32_t>(n - i) * data[i];
+    }
+    return (b & 0xffff) << 16 | (a & 0xffff);
+}
+#endif
+
+std::optional<BlockMap> BlockMap::parse(std::string_view data) {
+    BlockMap map;
+    bool versioned = false;
+    while (true) {
+        auto eol = data.find('\n');
+        if (eol == std::string_view::npos)
+            return std::nullopt;
+        auto line = data.substr(0, eol);
+        data.remove_prefix(eol + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.empty())
+            break;
+        auto colon = line.find(": ");
+        if (colon == std::string_view::npos)
+            return std::nullopt;
+        auto key = line.substr(0, colon);
+        auto value = line.substr(colon + 2);
+        if (key == MAGIC)
+            versioned = value == "1";
+        else if (key == "Length" && !parseNumber(value, map.length))
+            return std::nullopt;
+        else if (key == "Blocksize" && !parseNumber(value, map.blockSize))
+            return std::nullopt;
+        else if (key == "SHA-256")
+            map.sha256 = value;
+    }
+    if (!versioned || map.blockSize == 0 || map.blockSize > MAX_BLOCK_SIZE || map.sha256.size() != 64)
+        return std::nullopt;
+    const uint64_t count = (map.length + map.blockSize - 1) / map.blockSize;
+    if (data.size() != count * RECORD_SIZE)
+        return std::nullopt;
+
+    map.weak.resize(count);
+    map.strong.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const auto *p = reinterpret_cast<const uint8_t *>(data.data() + i * RECORD_SIZE);
+        map.weak[i] = uint32_t{p[0]} << 24 | uint32_t{p[1]} << 16 | uint32_t{p[2]} << 8 | p[3];
+        std::copy_n(p + 4, STRONG_BYTES, map.strong[i].begin());
+    }
+    return map;
+}
+
+std::string BlockMap::serialize() const {
+    std::string out;
+    out.append(MAGIC).append(": 1\n");
+    out.append("Length: ").append(std::to_string(length)).append("\n");
+    out.append("Blocksize: ").append(std::to_string(blockSize)).append("\n");
+    out.append("SHA-256: ").append(sha256).append("\n\n");
+    out.reserve(out.size() + blocks() * RECORD_SIZE);
+    for (size_t i = 0; i < blocks(); ++i) {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back(static_cast<char>(weak[i] >> shift & 0xff));
+        out.append(reinterpret_cast<const char *>(strong[i].data()), STRONG_BYTES);
+    }
+    return out;
+}
+
+std::optional<BlockMap> BlockMap::build(const std::filesystem::path &file, uint32_t blockSize) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in || blockSize == 0 || blockSize > MAX_BLOCK_SIZE)
+        return std::nullopt;
+    BlockMap map;
+    map.blockSize = blockSize;
+    Sha256 whole;
+    std::vector<uint8_t> block(blockSize);
+    while (in) {
+        in.read(reinterpret_cast<char *>(block.data()), blockSize);
+        auto n = static_cast<size_t>(in.gcount());
+        if (n == 0)
+            break;
+        whole.update(block.data(), n);
+        map.length += n;
+        std::fill(block.begin() + static_cast<std::ptrdiff_t>(n), block.end(), 0);
+        map.weak.push_back(weakChecksum(block.data(), blockSize));
+        map.strong.push_back(strongChecksum(block.data(), blockSize));
+    }
+    if (in.bad())
+        return std::nullopt;
+    auto md = whole.finish();
+    map.sha256 = toHex(md.data(), md.size());
+    return map;
+}
+
+std::vector<int64_t> BlockMap::locate(const std::filesystem::path &file) const {
+    std::vector<int64_t> found(blocks(), -1);
+    // 补零的最后一块不参与查找
+    const size_t full = static_cast<size_t>(length / blockSize);
+    std::ifstream in(file, std::ios::binary);
+    if (!in || full == 0)
+        return found;
+
+    // 按滚动校验和排序的索引，相同内容的块会一起被找到
+    std::vector<std::pair<uint32_t, uint32_t>> index;
+    index.reserve(full);
+    BitFilter filter{full};
+    for (size_t i = 0; i < full; ++i) {
+        index.emplace_back(weak[i], static_cast<uint32_t>(i));
+        filter.insert(weak[i]);
+    }
+    std::sort(index.begin(), index.end());
+
+    const size_t bs = blockSize;
+    std::vector<uint8_t> buf(std::max<size_t>(8 * 1024 * 1024, bs * 2 + 1));
+    size_t pos = 0;
+    size_t end = 0;
+    uint64_t base = 0;
+    // 保证从pos开始至少有need字节，文件结束时返回false
+    auto ensure = [&](size_t need) {
+        if (end - pos >= need)
+            return true;
+        std::memmove(buf.data(), buf.data() + pos, end - pos);
+        end -= pos;
+        base += pos;
+        pos = 0;
+        while (end < need && in) {
+            in.read(reinterpret_cast<char *>(buf.data() + end), static_cast<std::streamsize>(buf.size() - end));
+            end += static_cast<size_t>(in.gcount());
+        }
+        return end >= need;
+    };
+
+    size_t remaining = full;
+    bool fresh = true;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    while (remaining && ensure(bs)) {
+        const uint8_t *window = buf.data() + pos;
+        if (fresh) {
+            auto w = weakChecksum(window, bs);
+            a = w & 0xffff;
+            b = w >> 16;
+            fresh = false;
+        }
+        const uint32_t w = (b & 0xffff) << 16 | (a & 0xffff);
+        if (filter.test(w)) {
+            auto it = std::lower_bound(index.begin(), index.end(), std::make_pair(w, uint32_t{0}));
+            bool matched = false;
+            if (it != index.end() && it->first == w) {
+                const auto s = strongChecksum(window, bs);
+                for (; it != index.end() && it->first == w; ++it) {
+                    if (strong[it->second] != s)
+                        continue;
+                    matched = true;
+                    if (found[it->second] < 0) {
+                        found[it->second] = static_cast<int64_t>(base + pos);
+                        --remaining;
+                    }
+                }
+            }
+            if (matched) {
+                // 匹配的数据不会再属于其他块，直接跳过整块
+                pos += bs;
+                fresh = true;
+                continue;
+            }
+        }
+        if (!ensure(bs + 1))
+            break;
+        const uint32_t out = buf[pos];
+        const uint32_t next = buf[pos + bs];
+        a += next - out;
+        b += a - static_cast<uint32_t>(bs) * out;
+        ++pos;
+    }
+    LOG_INFO("Found %zu of %zu blocks in %s", full - remaining, blocks(), file.string().c_str());
+    return found;
+}
+
+} // namespace multi_get
@@ -0,0 +1,90 @@
+#include "Digest.h"
+
+#include <openssl/evp.h>
+
+#include <fstream>
+#include <vector>
+
+namespace multi_get {
+
+void Sha256::Free::operator()(evp_md_ctx_st *ctx) const noexcept {
+    EVP_MD_CTX_free(ctx);
+}
+
+Sha256::Sha256() : ctx(EVP_MD_CTX_new()) {
+    EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr);
+}
+
+void Sha256::update(const void *data, size_t n) {
+    EVP_DigestUpdate(ctx.get(), data, n);
+}
+
+Sha256::Digest Sha256::finish() {
+    Digest md{};
+    unsigned int len = 0;
+    EVP_DigestFinal_ex(ctx.get(), md.data(), &len);
+    return md;
+}
+
+void Md5::Free::operator()(evp_md_ctx_st *ctx) const noexcept {
+    EVP_MD_CTX_free(ctx);
+}
+
+Md5::Md5() : ctx(EVP_MD_CTX_new()) {
+    EVP_DigestInit_ex(ctx.get(), EVP_md5(), nullptr);
+}
+
+void Md5::update(const void *data, size_t n) {
+    EVP_DigestUpdate(ctx.get(), data, n);
+}
+
+Md5::Digest Md5::finish() {
+    Digest md{};
+    unsigned int len = 0;
+    EVP_DigestFinal_ex(ctx.get(), md.data(), &len);
+    return md;
+}
+
+std::string toBase64(const uint8_t *data, size_t n) {
+    std::string out(4 * ((n + 2) / 3), '\0');
+    auto len = ::EVP_EncodeBlock(reinterpret_cast<unsigned char *>(out.data()), data, static_cast<int>(n));
+    out.resize(static_cast<size_t>(len));
+    return out;
+}
+
+std::string toHex(const uint8_t *data, size_t n) {
+    static constexpr char DIGITS[] = "0123456789abcdef";
+    std::string s;
+    s.reserve(n * 2);
+    for (size_t i = 0; i < n; ++i) {
+        s.push_back(DIGITS[data[i] >> 4]);
+        s.push_back(DIGITS[data[i] & 0xf]);
+    }
+    return s;
+}
+
+std::string sha256Hex(std::string_view data) {
+    Sha256 h;
+    h.update(data.data(), data.size());
+    auto md = h.finish();
+    return toHex(md.data(), md.size());
+}
+
+std::string sha256File(const std::filesystem::path &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return {};
+    Sha256 h;
+    std::vector<char> buf(1024 * 1024);
+    while (in) {
+        in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+        if (in.gcount() > 0)
+            h.update(buf.data(), static_cast<size_t>(in.gcount()));
+    }
+    if (in.bad())
+        return {};
+    auto md = h.finish();
+    return toHex(md.data(), md.size());
+}
+
+} // namespace multi_get
@@ -0,0 +1,85 @@
+#include "DiskWriter.h"
+
+#include <algorithm>
+
+namespace multi_get {
+
+DiskWriter::DiskWriter(OutputFile &out, size_t threadCount, uint64_t capacity)
+    : out(out), capacity(std::max<uint64_t>(capacity, 1)) {
+    for (size_t i = 0; i < std::max<size_t>(threadCount, 1); ++i)
+        threads.emplace_back(&DiskWriter::run, this);
+}
+
+DiskWriter::~DiskWriter() {
+    finish();
+}
+
+Error DiskWriter::push(uint64_t offset, Rope &&data) {
+    const uint64_t n = data.size();
+    std::unique_lock<std::mutex> locker(m);
+    // 队列为空时总是接受，单个超过容量的范围也不会永远等待
+    hasSpace.wait(locker, [&] { return _error != Error::Ok || queued == 0 || queued + n <= capacity; });
+    if (_error != Error::Ok)
+        return _error;
+    queued += n;
+    pending.emplace(offset, std::move(data));
+    hasWork.notify_one();
+    return Error::Ok;
+}
+
+void DiskWriter::run() {
+    std::unique_lock<std::mutex> locker(m);
+    while (true) {
+        hasWork.wait(locker, [this] { return closing || !pending.empty(); });
+        if (pending.empty())
+            return;
+
+        // 取出最前面的范围和紧接着它的范围，合并为一次写入
+        std::vector<Rope> batch;
+        const uint64_t offset = pending.begin()->first;
+        uint64_t end = offset;
+        while (!pending.empty() && pending.begin()->first == end && (batch.empty() || end - offset < MAX_WRITE)) {
+            auto node = pending.extract(pending.begin());
+            end += node.mapped().size();
+            batch.push_back(std::move(node.mapped()));
+        }
+        locker.unlock();
+
+        std::vector<iovec> slices;
+        for (const auto &rope : batch) {
+            auto s = rope.slices();
+            slices.insert(slices.end(), s.begin(), s.end());
+        }
+        const auto error = out.write(offset, slices.data(), slices.size());
+        // 写完后立即归还缓冲区
+        batch.clear();
+
+        locker.lock();
+        queued -= end - offset;
+        if (error != Error::Ok && _error == Error::Ok) {
+            _error = error;
+            // 之后的数据不再写入
+            for (const auto &[o, rope] : pending)
+                queued -= rope.size();
+            pending.clear();
+        }
+        hasSpace.notify_all();
+    }
+}
+
+Error DiskWriter::finish() {
+    {
+        std::lock_guard<std::mutex> locker(m);
+        closing = true;
+    }
+    hasWork.notify_all();
+    for (auto &t : threads) {
+        if (t.joinable())
+            t.join();
+    }
+    threads.clear();
+    std::lock_guard<std::mutex> locker(m);
+    return _error;
+}
+
+} // namespace multi_get
@@ -0,0 +1,968 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "BufferPool.h"
+#include "Cache.h"
+#include "Cluster.h"
+#include "Coroutine.h"
+#include "Delta.h"
+#include "Digest.h"
+#include "DiskWriter.h"
+#include "HTTP2Connection.h"
+#include "HTTPConnection.h"
+#include "Logger.h"
+#include "MultiGet.h"
+#include "OutputFile.h"
+#include "ProgressMeter.h"
+#include "ReorderBuffer.h"
+#include "Retry.h"
+#include "SegmentScheduler.h"
+#include "ThreadPool.h"
+
+namespace multi_get {
+
+namespace {
+
+std::string defaultFilename(const std::string &url) {
+    std::string filename = url.substr(url.find_last_of('/') + 1);
+    if (filename.empty())
+        filename = "multi-get.downloaded";
+    return filename;
+}
+
+// 多线程下载时单个分段的上限
+constexpr uint64_t MAX_SEGMENT = 64 * 1024 * 1024;
+// 多源下载时每个线程平均分到的分段数，以及分段的下限
+constexpr uint64_t SEGMENTS_PER_PATH_THREAD = 8;
+constexpr uint64_t MIN_PATH_SEGMENT = 1024 * 1024;
+
+// 分段在内存中收完才交给写线程，所有线程的分段连同重复请求要能同时放进缓冲池，
+// 否则各线程都在等待内存，超过等待时间后以内存不足失败。缓冲池很小时分段可以小到一个块
+uint64_t memorySegment(size_t threadCount) {
+    return std::max<uint64_t>(BufferPool::getInstance().limit() / (threadCount * 2), Rope::BLOCK_SIZE);
+}
+
+std::string outputFilename(const DownloadOptions &options) {
+    return options.output.empty() ? defaultFilename(options.url) : options.output;
+}
+
+// 快速启动时代替HEAD的第一个请求：Range GET第一个分段，响应头到达时即可规划下载，
+// body在后台继续接收，之后作为第一个分段（或不支持Range时的整个文件）使用
+struct Probe {
+    Transfer transfer;
+    uint64_t end{0};
+    // 最终（重定向之后）的url，headers就绪后有效
+    std::string url;
+    std::promise<HTTPResponse> headersPromise;
+    std::future<HTTPResponse> headers{headersPromise.get_future()};
+    std::atomic<bool> published{false};
+    std::promise<HTTPResponse> responsePromise;
+    std::future<HTTPResponse> response{responsePromise.get_future()};
+    // 池中的任务不会在future析构时等待，由Probe自己等待任务结束
+    std::future<void> finished;
+    // 探测和预热的任务，线程池已满时由等待的线程代为执行
+    ThreadPool::Group group;
+    // 服务器忽略Range返回了比探测大的整个文件，探测已取消，只用它的响应头
+    bool abandoned{false};
+
+    ~Probe() {
+        if (finished.valid())
+            ThreadPool::getInstance().wait(finished, &group);
+    }
+
+    void start(HTTPConnection &conn, const std::string &target) {
+        url = target;
+        transfer.setHeadersCallback([this](const std::string &finalUrl, const HTTPResponse &res) {
+            publish(finalUrl, res);
+        });
+        finished = ThreadPool::getInstance().submit([this, &conn, target] {
+            auto res = conn.get(target, 0, static_cast<int64_t>(end), &transfer);
+            // 没有收到响应头时不会回调，直接给出失败的响应
+            publish(target, res);
+            responsePromise.set_value(std::move(res));
+        }, &group);
+    }
+
+    void publish(const std::string &finalUrl, const HTTPResponse &res) {
+        if (published.exchange(true))
+            return;
+        url = finalUrl;
+        headersPromise.set_value(res);
+    }
+};
+
+// 一次下载任务的上下文
+struct Job {
+    const DownloadOptions &options;
+    HTTPConnection &conn;
+    DownloadJob *handle;
+    // 多源下载时各个源上的连接，第一个就是conn
+    std::vector<HTTPConnection *> paths{};
+    std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+    std::atomic<uint64_t> downloaded{0};
+    int64_t total{-1};
+    // 是否按Range分段下载
+    bool rangeable{false};
+    // 快速启动时已经在进行的第一个请求
+    Probe *probe{nullptr};
+    // 设置了onSample时的实时进度
+    ProgressMeter *meter{nullptr};
+    // 探测时附带的条件请求头部，由缓存记录的校验信息生成
+    Headers conditional{};
+    // 探测得到的校验信息，下载完成后存入缓存
+    std::string etag{};
+    std::string lastModified{};
+    // 服务器确认缓存仍然有效
+    bool notModified{false};
+    std::mutex errorMutex{};
+    DownloadResult result{};
+
+    [[nodiscard]] bool cancelled() const noexcept {
+        return handle && handle->cancelled();
+    }
+
+    // 只记录第一个错误
+    void fail(Error e, int status = 0) {
+        std::lock_guard<std::mutex> locker(errorMutex);
+        if (result.error == Error::Ok) {
+            result.error = e;
+            result.status = status;
+        }
+    }
+
+    [[nodiscard]] bool failed() {
+        std::lock_guard<std::mutex> locker(errorMutex);
+        return result.error != Error::Ok;
+    }
+
+    void progress(uint64_t bytes) {
+        auto now = downloaded += bytes;
+        if (meter)
+            meter->addSaved(bytes);
+        if (options.onProgress)
+            options.onProgress(Progress{now, total});
+    }
+
+    // 规划下载的响应：304表示缓存有效，否则记录校验信息。返回false表示已经处理，不再继续规划
+    bool validate(const HTTPResponse &res) {
+        if (res.error() == Error::Ok && res.status() == 304 && !conditional.empty()) {
+            notModified = true;
+            return false;
+        }
+        etag = res["ETag"];
+        lastModified = res["Last-Modified"];
+        return true;
+    }
+
+    // 不分段时下载整个文件，快速启动的探测已经是完整的响应。sink不为空时2xx响应的body
+    // （compressed时已解码）边收边交给它，不留在响应中；HTTP/2等不支持sink的实现仍放在响应中
+    HTTPResponse whole(Transfer::Sink sink = {}) {
+        if (auto *p = std::exchange(probe, nullptr); p && !p->abandoned)
+            return ThreadPool::getInstance().wait(p->response, &p->group);
+        auto *lane = meter ? meter->lane(0) : nullptr;
+        if (!lane && !sink && !options.compressed)
+            return conn.get(options.url);
+        Transfer transfer;
+        transfer.setSink(std::move(sink));
+        transfer.setDecoding(options.compressed);
+        if (lane)
+            transfer.setCounter(&lane->bytes);
+        ProgressMeter::Busy busy{lane};
+        return conn.get(options.url, -1, -1, &transfer);
+    }
+};
+
+// 检查响应是否是预期的完整分段
+bool checkResponse(Job &job, const HTTPResponse &res, int64_t expected) {
+    if (res.error() != Error::Ok) {
+        job.fail(res.error());
+        return false;
+    }
+    if (res.status() < 200 || res.status() >= 300) {
+        LOG_ERROR("Unexpected HTTP status %d", res.status());
+        job.fail(Error::HTTPStatus, res.status());
+        return false;
+    }
+    if (expected >= 0 && res.contentLength() != static_cast<uint64_t>(expected)) {
+        LOG_ERROR("Expected %lld bytes, got %zu.", static_cast<long long>(expected), res.contentLength());
+        job.fail(Error::IncompleteBody);
+        return false;
+    }
+    return true;
+}
+
+void rangeSaved(Job &job, uint64_t size, int64_t beginPos, int64_t endPos) {
+    std::stringstream ss;
+    ss << std::this_thread::get_id();
+    LOG_INFO("Thread %s downloaded %llu bytes: from %lld to %lld", ss.str().c_str(), static_cast<unsigned long long>(size),
+             static_cast<long long>(beginPos), static_cast<long long>(endPos));
+    job.progress(size);
+}
+
+// 不分段时整个body直接写入目标文件
+Error saveWhole(Job &job, const std::string &name, const Rope &body) {
+    std::ofstream out(name, std::ios::binary);
+    body.forEach([&](const char *data, size_t n) { out.write(data, static_cast<std::streamsize>(n)); });
+    out.close();
+    if (!out)
+        return Error::FileError;
+    rangeSaved(job, body.size(), -1, -1);
+    return Error::Ok;
+}
+
+// 分段交给写线程写入输出文件的对应偏移，网络线程不等待磁盘
+Error saveRange(Job &job, DiskWriter &writer, Rope &&body, uint64_t beginPos, uint64_t endPos) {
+    const auto size = body.size();
+    if (auto e = writer.push(beginPos, std::move(body)); e != Error::Ok)
+        return e;
+    rangeSaved(job, size, static_cast<int64_t>(beginPos), static_cast<int64_t>(endPos));
+    return Error::Ok;
+}
+
+// 多线程下载一组分段，慢连接会被重新请求，末尾的分段可以重复请求
+void runSegments(Job &job, size_t threadCount, const SegmentPlan &plan, SegmentScheduler::Hooks hooks) {
+    SegmentScheduler scheduler{job.conn, job.options.url, plan,
+                               {job.options.minSpeed, job.options.hedge, job.options.retry}};
+    if (job.probe) {
+        auto *probe = std::exchange(job.probe, nullptr);
+        // 文件比探测小时，服务器只返回到文件末尾
+        const auto end = std::min<uint64_t>(probe->end, static_cast<uint64_t>(job.total) - 1);
+        scheduler.prefetch(0, {std::move(probe->response), &probe->transfer, 0, end});
+    }
+    for (size_t i = 1; i < job.paths.size(); ++i)
+        scheduler.addPath(*job.paths[i]);
+    if (job.meter)
+        scheduler.setMeter(*job.meter);
+    hooks.cancelled = [&job] { return job.cancelled(); };
+    auto error = scheduler.run(threadCount, std::move(hooks));
+    if (error != Error::Ok)
+        job.fail(error, scheduler.status());
+    if (!job.options.sources.empty()) {
+        const auto bytes = scheduler.pathBytes();
+        job.result.paths.resize(bytes.size());
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            job.result.paths[i].source = job.options.sources[i];
+            job.result.paths[i].bytes += bytes[i];
+        }
+    }
+}
+
+// 集群模式下本机只接受worker并分配分段，worker写入共享文件或把分段传回后写入
+void runCluster(Job &job, const SegmentPlan &segments, const OutputFile &out, DiskWriter &writer) {
+    const auto &options = job.options;
+    Coordinator::Job task{job.conn.redirected(options.url), {}, {}};
+    // 弱ETag不能用于If-Match
+    if (job.etag.rfind("W/", 0) != 0)
+        task.etag = job.etag;
+    if (options.sharedOutput)
+        task.output = std::filesystem::absolute(out.path()).string();
+    Coordinator coordinator{options.coordinatorPort, std::move(task), segments, options.retry.attempts};
+    auto error = coordinator.listen();
+    if (error == Error::Ok) {
+        error = coordinator.run({.cancelled = [&job] { return job.cancelled(); },
+                                 .deliver =
+                                     [&](size_t idx, Rope &&body) {
+                                         const auto [b, e] = segments[idx];
+                                         return saveRange(job, writer, std::move(body), b, e);
+                                     },
+                                 .written =
+                                     [&](size_t idx) {
+                                         const auto [b, e] = segments[idx];
+                                         rangeSaved(job, e - b + 1, static_cast<int64_t>(b), static_cast<int64_t>(e));
+                                     }});
+    }
+    if (error != Error::Ok)
+        job.fail(error, coordinator.status());
+    job.result.paths = coordinator.workers();
+}
+
+// body边收边写入临时文件，完成后再改名，不支持Range的大文件也不需要整个放在内存中
+void downloadWhole(Job &job, const std::string &filename) {
+    if (job.cancelled() || job.failed())
+        return;
+    const auto temp = filename + ".download";
+    std::ofstream out;
+    uint64_t written = 0;
+    // 临时文件打不开时out.is_open()仍为false，要与没有经过sink的body区分开
+    bool sinkUsed = false;
+    auto res = job.whole([&](Rope &&data) {
+        sinkUsed = true;
+        // 确认是2xx响应后才创建文件
+        if (!out.is_open())
+            out.open(temp, std::ios::binary);
+        if (!out.is_open())
+            return false;
+        data.forEach([&](const char *p, size_t n) { out.write(p, static_cast<std::streamsize>(n)); });
+        written += data.size();
+        job.progress(data.size());
+        return static_cast<bool>(out);
+    });
+    if (sinkUsed && !out.is_open()) {
+        LOG_ERROR("Failed to open %s", temp.c_str());
+        job.fail(Error::FileError);
+        return;
+    }
+    if (!sinkUsed) {
+        // 探测的响应或没有经过sink的body
+        if (checkResponse(job, res, -1)) {
+            if (auto e = saveWhole(job, filename, res.body()); e != Error::Ok)
+                job.fail(e);
+        }
+        return;
+    }
+    out.close();
+    std::error_code ec;
+    if (!out) {
+        job.fail(Error::FileError);
+    } else if (checkResponse(job, res, -1)) {
+        std::filesystem::rename(temp, filename, ec);
+        if (ec)
+            job.fail(Error::FileError);
+    }
+    if (job.failed()) {
+        std::filesystem::remove(temp, ec);
+        return;
+    }
+    LOG_INFO("Saved %llu bytes to %s", static_cast<unsigned long long>(written), filename.c_str());
+}
+
+// 协程版本的分段下载，可恢复的错误退避后从已收到的位置继续请求
+Task<bool> asyncFetchRange(Executor &ex, Job &job, uint64_t beginPos, uint64_t endPos, Rope &body) {
+    const auto &retry = job.options.retry;
+    unsigned failures = 0;
+    while (!job.cancelled() && !job.failed()) {
+        const uint64_t from = beginPos + body.size();
+        auto res = co_await job.conn.asyncGet(ex, job.options.url, static_cast<int64_t>(from),
+                                              static_cast<int64_t>(endPos));
+        const bool usable = res.answersRange(from, endPos);
+        const auto before = body.size();
+        if (usable && body.empty()) {
+            body = res.takeBody();
+        } else if (usable && !body.append(res.body())) {
+            job.fail(Error::OutOfMemory);
+            co_return false;
+        }
+        if (res.error() == Error::Ok && usable)
+            co_return true;
+
+        auto error = res.error();
+        if (error == Error::Ok) {
+            // 2xx但范围不对说明服务器不按Range返回，重试也没有用
+            if (res.status() >= 200 && res.status() < 300) {
+                job.fail(Error::BadResponse);
+                co_return false;
+            }
+            error = Error::HTTPStatus;
+        }
+        if (body.size() > before)
+            failures = 0;
+        if (!retryable(error, res.status()) || failures >= retry.attempts) {
+            job.fail(error, res.status());
+            co_return false;
+        }
+        auto delay = retry.delay(++failures);
+        LOG_WARN("Range %llu-%llu failed (%s), retrying from %llu in %lld ms.", static_cast<unsigned long long>(beginPos),
+                 static_cast<unsigned long long>(endPos), errorString(error),
+                 static_cast<unsigned long long>(beginPos + body.size()), static_cast<long long>(delay.count()));
+        co_await ex.sleep(delay);
+    }
+    co_return false;
+}
+
+// 不支持Range时无法续传
+Task<> asyncDownloadWhole(Executor &ex, Job &job, std::string filename) {
+    if (job.cancelled() || job.failed())
+        co_return;
+    auto res = co_await job.conn.asyncGet(ex, job.options.url);
+    if (!checkResponse(job, res, -1))
+        co_return;
+    if (auto e = saveWhole(job, filename, res.body()); e != Error::Ok)
+        job.fail(e);
+}
+
+// 各协程依次从分段表中领取分段，内存中只有并发数个分段。执行器是单线程的，next不需要原子操作
+Task<> asyncDownloadSegments(Executor &ex, Job &job, DiskWriter &writer, const SegmentPlan &plan, size_t &next) {
+    while (!job.cancelled() && !job.failed() && next < plan.size()) {
+        const auto [beginPos, endPos] = plan[next++];
+        Rope body;
+        if (!co_await asyncFetchRange(ex, job, beginPos, endPos, body))
+            co_return;
+        if (auto e = saveRange(job, writer, std::move(body), beginPos, endPos); e != Error::Ok) {
+            job.fail(e);
+            co_return;
+        }
+    }
+}
+
+OutputFile::Mode outputMode(const DownloadOptions &options) {
+    if (options.directIO)
+        return OutputFile::Mode::Direct;
+    return options.mmapOutput ? OutputFile::Mode::Map : OutputFile::Mode::Write;
+}
+
+// 等待写线程写完排队的数据，再确认整个文件
+Error finishOutput(DiskWriter &writer, OutputFile &out) {
+    if (auto e = writer.finish(); e != Error::Ok)
+        return e;
+    return out.commit();
+}
+
+void downloadToFile(Job &job, size_t threadCount) {
+    std::string filename = outputFilename(job.options);
+    job.result.filename = filename;
+
+    if (job.total < 0 || !job.rangeable) {
+        LOG_WARN("The server does not support range request, using single thread to download!");
+        if (job.options.async && !job.options.http2 && !job.options.compressed) {
+            Executor ex;
+            ex.blockOn(asyncDownloadWhole(ex, job, filename));
+        } else {
+            downloadWhole(job, filename);
+        }
+        job.result.bytes = job.downloaded;
+        return;
+    }
+
+    const auto fileSize = static_cast<uint64_t>(job.total);
+    job.result.ranged = true;
+
+    // 开始下载前预留整个文件，空间不足时立即失败；各分段直接写入最终的偏移，不再拼接分段文件
+    OutputFile out{filename, fileSize, outputMode(job.options), job.options.sparse};
+    if (auto e = out.open(); e != Error::Ok) {
+        job.fail(e);
+        return;
+    }
+
+    DiskWriter writer{out, job.options.writerThreads, job.options.writeQueue};
+
+    // 每个线程至少一个分段，大分段拆小，收到的数据尽早交给写线程，内存中的未写数据也有上限；
+    // 多源或集群下载时切得更细，各条链路或各个worker按自己的速度领取
+    const uint64_t maxSegment = std::min(MAX_SEGMENT, memorySegment(threadCount));
+    uint64_t segmentSize = std::min<uint64_t>(maxSegment, (fileSize + threadCount - 1) / threadCount);
+    if (job.paths.size() > 1 || job.options.coordinatorPort)
+        segmentSize = std::clamp<uint64_t>(fileSize / (threadCount * SEGMENTS_PER_PATH_THREAD),
+                                           std::min(MIN_PATH_SEGMENT, maxSegment), maxSegment);
+    const SegmentPlan segments{fileSize, segmentSize};
+    if (job.options.async && !job.options.http2 && !job.options.coordinatorPort) {
+        // 所有分段在当前线程上以协程并发下载
+        Executor ex;
+        size_t next = 0;
+        for (size_t i = 0; i < std::min(threadCount, segments.size()); ++i)
+            ex.spawn(asyncDownloadSegments(ex, job, writer, segments, next));
+        ex.run();
+    } else {
+        if (job.options.coordinatorPort) {
+            runCluster(job, segments, out, writer);
+        } else {
+            runSegments(job, threadCount, segments, {.deliver = [&](size_t idx, Rope &&body) {
+                            const auto [b, e] = segments[idx];
+                            return saveRange(job, writer, std::move(body), b, e);
+                        }});
+        }
+    }
+
+    if (job.cancelled())
+        job.fail(Error::Cancelled);
+    if (job.failed())
+        return;
+    if (auto e = finishOutput(writer, out); e != Error::Ok) {
+        job.fail(e);
+        return;
+    }
+    job.result.bytes = fileSize;
+}
+
+// 增量下载：复用seed中与新文件相同的块，缺少的部分按Range多线程下载后写入对应偏移，
+// 最后校验整个文件。返回false表示无法增量下载，由调用者完整下载
+bool downloadDelta(Job &job, size_t threadCount) {
+    const auto &options = job.options;
+    const std::string filename = outputFilename(options);
+    const std::string seed = options.seed.empty() ? filename : options.seed;
+    if (!job.rangeable || job.total < 0 || !std::filesystem::exists(seed))
+        return false;
+
+    auto res = job.conn.get(options.blocksUrl);
+    if (res.error() != Error::Ok || res.status() < 200 || res.status() >= 300) {
+        LOG_WARN("Failed to get block map %s, downloading the whole file.", options.blocksUrl.c_str());
+        return false;
+    }
+    auto map = BlockMap::parse(res.body().flatten());
+    if (!map || map->length != static_cast<uint64_t>(job.total)) {
+        LOG_WARN("Block map %s does not describe %s, downloading the whole file.", options.blocksUrl.c_str(),
+                 options.url.c_str());
+        return false;
+    }
+    const auto found = map->locate(seed);
+
+    OutputFile out{filename, map->length, outputMode(options), options.sparse};
+    std::ifstream in(seed, std::ios::binary);
+    if (auto e = out.open(); e != Error::Ok || !in) {
+        job.fail(e != Error::Ok ? e : Error::FileError);
+        return true;
+    }
+
+    // 复制找到的块，旧文件中连续的块合并为一次读写
+    uint64_t reused = 0;
+    std::vector<char> buf;
+    for (size_t i = 0; i < found.size();) {
+        if (found[i] < 0) {
+            ++i;
+            continue;
+        }
+        size_t j = i + 1;
+        while (j < found.size() && found[j] == found[j - 1] + map->blockSize &&
+               (j - i + 1) * static_cast<uint64_t>(map->blockSize) <= 8 * 1024 * 1024)
+            ++j;
+        const uint64_t n = static_cast<uint64_t>(j - i) * map->blockSize;
+        buf.resize(n);
+        in.seekg(found[i]);
+        in.read(buf.data(), static_cast<std::streamsize>(n));
+        if (!in) {
+            job.fail(Error::FileError);
+            return true;
+        }
+        if (auto e = out.write(i * static_cast<uint64_t>(map->blockSize), buf.data(), n); e != Error::Ok) {
+            job.fail(e);
+            return true;
+        }
+        reused += n;
+        i = j;
+    }
+    in.close();
+    job.progress(reused);
+    if (job.meter)
+        job.meter->credit(reused);
+
+    // 缺少的块合并成区间，过长的区间拆开让各线程并行下载
+    std::vector<SegmentScheduler::Range> ranges;
+    uint64_t missing = 0;
+    for (size_t i = 0; i < found.size(); ++i) {
+        if (found[i] >= 0)
+            continue;
+        const uint64_t b = i * static_cast<uint64_t>(map->blockSize);
+        const uint64_t e = b + map->blockLength(i) - 1;
+        if (!ranges.empty() && ranges.back().second + 1 == b)
+            ranges.back().second = e;
+        else
+            ranges.emplace_back(b, e);
+        missing += e - b + 1;
+    }
+    const uint64_t maxPiece = std::min(MAX_SEGMENT, memorySegment(threadCount));
+    const uint64_t piece =
+        std::clamp<uint64_t>(missing / (threadCount * 2) + 1, std::min<uint64_t>(1024 * 1024, maxPiece), maxPiece);
+    SegmentPlan segments;
+    for (const auto &[b, e] : ranges)
+        segments.add(b, e, piece);
+    LOG_INFO("Reusing %llu bytes from %s, downloading %llu bytes in %zu range(s).",
+             static_cast<unsigned long long>(reused), seed.c_str(), static_cast<unsigned long long>(missing),
+             segments.size());
+
+    DiskWriter writer{out, options.writerThreads, options.writeQueue};
+    if (!segments.empty()) {
+        runSegments(job, std::min(threadCount, segments.size()), segments,
+                    {.deliver = [&](size_t idx, Rope &&body) {
+                        const auto [b, e] = segments[idx];
+                        return saveRange(job, writer, std::move(body), b, e);
+                    }});
+    }
+    if (auto e = writer.finish(); e != Error::Ok)
+        job.fail(e);
+    if (job.cancelled())
+        job.fail(Error::Cancelled);
+    if (job.failed())
+        return true;
+    if (sha256File(out.path()) != map->sha256) {
+        LOG_WARN("%s does not match the block map after patching, downloading the whole file.", filename.c_str());
+        out.discard();
+        job.downloaded = 0;
+        return false;
+    }
+    if (auto e = out.commit(); e != Error::Ok) {
+        job.fail(e);
+        return true;
+    }
+    job.result.filename = filename;
+    job.result.ranged = true;
+    job.result.bytes = map->length;
+    job.result.reused = reused;
+    return true;
+}
+
+// 并行下载各分段，但按顺序写入fd（stdout/管道），内存占用受window限制
+void downloadToFd(Job &job, size_t threadCount) {
+    const int fd = job.options.outputFd;
+    const size_t window = std::max<size_t>(job.options.window, 64 * 1024);
+
+    if (job.total < 0 || !job.rangeable) {
+        LOG_WARN("The server does not support range request, streaming with single connection!");
+        ReorderBuffer out{fd, 0};
+        uint64_t offset = 0;
+        auto push = [&](Rope &&data) {
+            const auto size = data.size();
+            if (!out.push(offset, std::move(data)))
+                return false;
+            offset += size;
+            job.progress(size);
+            return true;
+        };
+        // 2xx响应的body边收边写出
+        auto whole = job.whole(push);
+        if (!checkResponse(job, whole, -1)) {
+            job.result.bytes = out.written();
+            return;
+        }
+        if (!push(whole.takeBody()))
+            job.fail(Error::OutputError);
+        job.result.bytes = out.written();
+        return;
+    }
+
+    const auto fileSize = static_cast<uint64_t>(job.total);
+    job.result.ranged = true;
+    // 分段要足够小，使窗口内能同时容纳所有线程的分段
+    uint64_t segmentSize = std::clamp<uint64_t>(window / (threadCount * 2), 64 * 1024, 8 * 1024 * 1024);
+    segmentSize = std::min<uint64_t>(segmentSize, window);
+
+    ReorderBuffer out{fd, window};
+    // 分段按顺序领取，离写指针最近的分段总是最先被下载
+    const SegmentPlan segments{fileSize, segmentSize};
+    runSegments(job, threadCount, segments,
+                {.before = [&](size_t idx) { return out.reserve(segments[idx].first, segments[idx].second + 1); },
+                 .deliver =
+                     [&](size_t idx, Rope &&body) {
+                         auto size = body.size();
+                         if (!out.push(segments[idx].first, std::move(body)))
+                             return Error::OutputError;
+                         job.progress(size);
+                         return Error::Ok;
+                     },
+                 .stopped = [&] { out.fail(); }});
+
+    if (job.cancelled())
+        job.fail(Error::Cancelled);
+    job.result.bytes = out.written();
+}
+
+// 下载到内存中的Rope。分段按块对齐，各分段的块直接移入body对应的偏移处
+void downloadToMemory(Job &job, size_t threadCount, Rope &body) {
+    const auto &url = job.options.url;
+    const bool async = job.options.async && !job.options.http2;
+    body.clear();
+
+    if (job.total < 0 || !job.rangeable) {
+        LOG_WARN("The server does not support range request, using single connection!");
+        HTTPResponse whole;
+        if (async && !job.options.compressed) {
+            Executor ex;
+            whole = ex.blockOn(job.conn.asyncGet(ex, url));
+        } else {
+            whole = job.whole();
+        }
+        if (!checkResponse(job, whole, -1))
+            return;
+        job.progress(whole.contentLength());
+        job.result.bytes = whole.contentLength();
+        body = whole.takeBody();
+        return;
+    }
+
+    const auto fileSize = static_cast<uint64_t>(job.total);
+    job.result.ranged = true;
+    uint64_t segmentSize = (fileSize + threadCount - 1) / threadCount;
+    segmentSize = std::max<uint64_t>((segmentSize + Rope::BLOCK_SIZE - 1) / Rope::BLOCK_SIZE, 1) * Rope::BLOCK_SIZE;
+    body.resize(fileSize);
+
+    if (async) {
+        Executor ex;
+        for (uint64_t b = 0; b < fileSize; b += segmentSize) {
+            ex.spawn([](Executor &ex, Job &job, uint64_t b, uint64_t e, Rope &body) -> Task<> {
+                Rope part;
+                if (!co_await asyncFetchRange(ex, job, b, e, part))
+                    co_return;
+                auto size = part.size();
+                body.place(b, std::move(part));
+                job.progress(size);
+            }(ex, job, b, std::min(fileSize, b + segmentSize) - 1, body));
+        }
+        ex.run();
+    } else {
+        const SegmentPlan segments{fileSize, segmentSize};
+        runSegments(job, threadCount, segments, {.deliver = [&](size_t idx, Rope &&part) {
+                        auto size = part.size();
+                        body.place(segments[idx].first, std::move(part));
+                        job.progress(size);
+                        return Error::Ok;
+                    }});
+    }
+
+    if (job.cancelled())
+        job.fail(Error::Cancelled);
+    if (job.failed()) {
+        body.clear();
+        return;
+    }
+    job.result.bytes = fileSize;
+}
+
+bool sameHost(const std::string &a, const std::string &b) {
+    auto [protocolA, hostA, portA, pathA] = formatHost(a);
+    auto [protocolB, hostB, portB, pathB] = formatHost(b);
+    return protocolA == protocolB && hostA == hostB && portA == portB;
+}
+
+void planWithHead(Job &job, size_t threadCount) {
+    Transfer transfer;
+    transfer.setRequestHeaders(job.conditional);
+    auto res = job.conn.head(job.options.url, &transfer);
+    if (!job.validate(res) || !checkResponse(job, res, -1))
+        return;
+    job.total = res.declaredLength();
+    job.rangeable = threadCount == 1 || res["Accept-Ranges"] == "bytes";
+}
+
+// 发出探测，同时预热其余的连接。返回调整后的线程数；
+// 探测不能用于规划时job.probe为空，由调用者退回HEAD
+size_t planWithProbe(Job &job, Probe &probe, size_t threadCount, std::vector<std::future<void>> &warmers) {
+    auto &pool = ThreadPool::getInstance();
+    auto &conn = job.conn;
+    const auto initial = conn.redirected(job.options.url);
+    const size_t extra = threadCount - 1;
+    probe.end = std::max<uint64_t>(job.options.probeSize, 1) - 1;
+    probe.transfer.setRequestHeaders(job.conditional);
+    probe.start(conn, job.options.url);
+    if (extra)
+        warmers.push_back(pool.submit([&conn, initial, extra] { conn.prewarm(initial, extra); }, &probe.group));
+
+    auto res = pool.wait(probe.headers, &probe.group);
+    // 空文件等情况会返回416，交给HEAD处理
+    if (res.error() == Error::Ok && res.status() == 416)
+        return threadCount;
+    if (!job.validate(res) || !checkResponse(job, res, -1))
+        return threadCount;
+    // 重定向到了其他host时，预热最终的host
+    if (extra && !sameHost(initial, probe.url))
+        warmers.push_back(pool.submit([&conn, url = probe.url, extra] { conn.prewarm(url, extra); }, &probe.group));
+
+    if (res.status() != 206) {
+        // 服务器忽略了Range，探测就是整个文件
+        job.total = res.declaredLength();
+        job.rangeable = false;
+        job.probe = &probe;
+        // 探测没有sink，整个body会留在内存中。比探测大（或长度未知）时取消，由whole()重新请求并边收边写出
+        if (job.total < 0 || static_cast<uint64_t>(job.total) > probe.end + 1) {
+            probe.abandoned = true;
+            probe.transfer.cancel();
+        }
+        return threadCount;
+    }
+    if (res.contentRange().total < 0) {
+        LOG_WARN("Probe did not report the total size, falling back to HEAD.");
+        return threadCount;
+    }
+    job.total = res.contentRange().total;
+    job.rangeable = true;
+    job.probe = &probe;
+    // 探测已经覆盖整个文件
+    if (static_cast<uint64_t>(job.total) <= probe.end + 1)
+        return 1;
+    return threadCount;
+}
+
+// 服务器确认缓存仍然有效时直接放置文件，失败时由调用者重新下载
+bool restoreCached(Job &job, const Cache &cache, const Cache::Entry &entry) {
+    auto filename = outputFilename(job.options);
+    if (cache.restore(entry, filename) != Error::Ok) {
+        LOG_WARN("Failed to restore %s from cache, downloading it again.", filename.c_str());
+        return false;
+    }
+    LOG_INFO("%s is not modified, restored from cache.", job.options.url.c_str());
+    job.total = static_cast<int64_t>(entry.size);
+    job.progress(entry.size);
+    job.result.filename = filename;
+    job.result.bytes = entry.size;
+    job.result.cached = true;
+    return true;
+}
+
+} // namespace
+
+std::shared_ptr<HTTPConnection> Client::connection(const DownloadOptions &options) {
+    // HTTPConnection配置完成后是线程安全的，相同配置的任务共享同一个对象
+    const auto &t = options.timeouts;
+    const std::string key = options.proxy + (options.http2 ? "#h2#" : "#h1#") + std::to_string(t.connect.count()) +
+                            '/' + std::to_string(t.firstByte.count()) + '/' + std::to_string(t.idle.count()) + '#' +
+                            options.socket.key();
+    std::lock_guard<std::mutex> locker(m);
+    auto &conn = connections[key];
+    if (!conn)
+        conn = makeConnection(options);
+    return conn;
+}
+
+std::shared_ptr<HTTPConnection> Client::makeConnection(const DownloadOptions &options) {
+    std::shared_ptr<HTTPConnection> conn;
+    if (options.http2)
+        conn = std::make_shared<HTTP2Connection>();
+    else
+        conn = std::make_shared<HTTPConnection>();
+    if (!options.proxy.empty())
+        conn->setProxy(options.proxy);
+    conn->setTimeouts(options.timeouts);
+    conn->setSocketOptions(options.socket);
+    return conn;
+}
+
+DownloadResult Client::download(const DownloadOptions &options, DownloadJob *handle) {
+    return perform(options, handle, nullptr);
+}
+
+DownloadResult Client::fetch(const DownloadOptions &options, Rope &body, DownloadJob *handle) {
+    return perform(options, handle, &body);
+}
+
+DownloadResult Client::perform(const DownloadOptions &options, DownloadJob *handle, Rope *body) {
+    size_t threadCount = std::clamp<size_t>(options.threadCount, 1, 32);
+    LOG_INFO("Downloading %s using %zu thread(s)...", options.url.c_str(), threadCount);
+
+    // 每个源各自一组连接，第一个源同时用于探测
+    std::vector<std::shared_ptr<HTTPConnection>> paths;
+    for (const auto &source : options.sources) {
+        auto pathOptions = options;
+        pathOptions.socket.source = source;
+        paths.push_back(connection(pathOptions));
+    }
+    if (!paths.empty())
+        threadCount = std::clamp<size_t>(threadCount, paths.size(), 32);
+    auto conn = paths.empty() ? connection(options) : paths.front();
+    Job job{options, *conn, handle};
+    for (const auto &path : paths)
+        job.paths.push_back(path.get());
+    // 每个下载线程一个计数器，探测和不分段的下载使用第一个。
+    // 协程和集群模式的请求不经过这些线程，只按写出的分段计算进度
+    const bool cluster = options.coordinatorPort && !body && options.outputFd < 0;
+    std::optional<ProgressMeter> meter;
+    if (options.onSample) {
+        const bool lanes = !cluster && !(options.async && !options.http2);
+        meter.emplace(lanes ? threadCount : 0, options.sampleInterval, options.onSample);
+        job.meter = &*meter;
+        meter->run();
+    }
+
+    std::optional<Cache> cache;
+    std::optional<Cache::Entry> cached;
+    if (!options.cacheDir.empty() && !body && options.outputFd < 0) {
+        cache.emplace(options.cacheDir, options.cacheLimit);
+        if ((cached = cache->lookup(options.url))) {
+            if (!cached->etag.empty())
+                job.conditional.emplace("If-None-Match", cached->etag);
+            if (!cached->lastModified.empty())
+                job.conditional.emplace("If-Modified-Since", cached->lastModified);
+        }
+    }
+
+    // 协程模式下没有可以等待探测的线程，仍然先发HEAD
+    std::unique_ptr<Probe> probe;
+    std::vector<std::future<void>> warmers;
+    // 增量下载先用HEAD确认文件大小，不需要探测第一个分段
+    const bool delta = !options.blocksUrl.empty() && !body && options.outputFd < 0;
+    // 压缩的响应只能整个请求，探测的Range请求用不上
+    const bool compressed = options.compressed && !delta && !cluster;
+    // 集群模式下第一个分段也由worker下载
+    if (options.fastStart && !delta && !cluster && !compressed && !(options.async && !options.http2)) {
+        probe = std::make_unique<Probe>();
+        if (auto *lane = meter ? meter->lane(0) : nullptr)
+            probe->transfer.setCounter(&lane->bytes);
+        threadCount = planWithProbe(job, *probe, threadCount, warmers);
+    }
+    if (!probe || (!job.probe && !job.failed() && !job.notModified))
+        planWithHead(job, threadCount);
+    if (job.notModified && !restoreCached(job, *cache, *cached)) {
+        job.notModified = false;
+        job.conditional.clear();
+        planWithHead(job, threadCount);
+    }
+
+    // HEAD只用于条件请求和进度的总大小，压缩后的长度未知，不按Range分段
+    if (compressed)
+        job.rangeable = false;
+    if (meter)
+        meter->setTotal(job.total);
+    if (!job.failed() && !job.notModified) {
+        if (body)
+            downloadToMemory(job, threadCount, *body);
+        else if (options.outputFd >= 0)
+            downloadToFd(job, threadCount);
+        else if (!delta || !downloadDelta(job, threadCount))
+            downloadToFile(job, threadCount);
+    }
+    // 没有用上的探测和预热不再等待
+    if (probe)
+        probe->transfer.cancel();
+    for (auto &t : warmers)
+        ThreadPool::getInstance().wait(t, &probe->group);
+    if (meter)
+        meter->stop();
+    // 嵌入的进程在两次下载之间不常驻接收缓冲区
+    BufferPool::getInstance().trim();
+
+    // 没有校验信息的响应之后无法确认是否有效，不缓存
+    if (cache && !job.notModified && !job.failed() && (!job.etag.empty() || !job.lastModified.empty())) {
+        if (cache->store(options.url, job.etag, job.lastModified, job.result.filename) != Error::Ok)
+            LOG_WARN("Failed to add %s to cache.", job.result.filename.c_str());
+    }
+
+    auto duration = std::chrono::steady_clock::now() - job.start;
+    job.result.seconds = std::chrono::duration<double>(duration).count();
+    job.result.socket = conn->socketInfo();
+    if (job.result.error != Error::Ok)
+        LOG_ERROR("Download %s failed: %s", options.url.c_str(), errorString(job.result.error));
+    if (options.onComplete)
+        options.onComplete(job.result);
+    return job.result;
+}
+
+// 任务在共享的线程池上运行，提交再多的任务也不会为每个任务新建线程
+JobHandle Client::submit(DownloadOptions options) {
+    auto handle = std::make_shared<DownloadJob>();
+    auto finished = ThreadPool::getInstance().submit([this, handle, options = std::move(options)] {
+        handle->promise.set_value(download(options, handle.get()));
+    });
+    std::lock_guard<std::mutex> locker(m);
+    reap();
+    jobs.emplace_back(std::move(finished), handle);
+    return handle;
+}
+
+// 回收已完成的任务，调用者需持有m
+void Client::reap() {
+    for (auto it = jobs.begin(); it != jobs.end();) {
+        if (it->second->done()) {
+            it->first.wait();
+            it = jobs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+Client::~Client() {
+    std::vector<std::pair<std::future<void>, JobHandle>> pending;
+    {
+        std::lock_guard<std::mutex> locker(m);
+        pending.swap(jobs);
+    }
+    for (auto &[finished, handle] : pending)
+        handle->cancel();
+    for (auto &[finished, handle] : pending)
+        finished.wait();
+}
+
+} // namespace multi_get
@@ -0,0 +1,200 @@
+#include "Coroutine.h"
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "Logger.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#elif defined(_WIN32)
+#define poll_fds WSAPoll
+using pollfd_t = WSAPOLLFD;
+#else
+#include <poll.h>
+#define poll_fds ::poll
+using pollfd_t = pollfd;
+#endif
+
+namespace multi_get {
+
+Executor::Detached Executor::launch([[maybe_unused]] Executor &ex, Task<void> task) {
+    co_await task;
+}
+
+void Executor::spawn(Task<void> task) {
+    ++active;
+    // Detached协程立即开始执行，直到第一次挂起才返回
+    launch(*this, std::move(task));
+}
+
+void Executor::run() {
+    while (true) {
+        // 只运行本轮已就绪的协程，yield的协程留到下一轮，期间也要检查IO
+        for (auto n = ready.size(); n > 0; --n) {
+            auto h = ready.front();
+            ready.pop_front();
+            h.resume();
+        }
+        if (active == 0)
+            break;
+        if (!waiters.empty() || !timers.empty()) {
+            int timeout = -1;
+            if (!ready.empty()) {
+                timeout = 0;
+            } else if (!timers.empty()) {
+                auto left = std::chrono::ceil<std::chrono::milliseconds>(timers.begin()->first - Clock::now());
+                timeout = static_cast<int>(std::max<int64_t>(left.count(), 0));
+            }
+            poll(timeout);
+            expireTimers();
+        } else if (ready.empty()) {
+            LOG_ERROR("Executor has %zu suspended coroutine(s) but nothing to wait for.", active);
+            break;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void Executor::wake(FdAwaiter *awaiter) {
+    if (awaiter->timed)
+        timers.erase(awaiter->timer);
+    ready.push_back(awaiter->handle);
+}
+
+void Executor::addTimer(FdAwaiter *awaiter) {
+    awaiter->timer = timers.emplace(Clock::now() + awaiter->timeout, awaiter);
+    awaiter->timed = true;
+}
+
+void Executor::expireTimers() {
+    const auto now = Clock::now();
+    while (!timers.empty() && timers.begin()->first <= now) {
+        auto *awaiter = timers.begin()->second;
+        timers.erase(timers.begin());
+        awaiter->timed = false;
+        awaiter->timedOut = true;
+        if (auto it = waiters.find(awaiter->fd); it != waiters.end()) {
+            (awaiter->write ? it->second.writer : it->second.reader) = nullptr;
+            if (!it->second.reader && !it->second.writer)
+                waiters.erase(it);
+        }
+        ready.push_back(awaiter->handle);
+    }
+}
+
+#ifdef __linux__
+
+namespace {
+
+// 还有等待者的方向，EPOLLIN等是枚举值，统一按uint32_t组合
+uint32_t interest(bool reader, bool writer) noexcept {
+    return static_cast<uint32_t>(EPOLLONESHOT) | (reader ? static_cast<uint32_t>(EPOLLIN) : 0u) |
+           (writer ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+}
+
+} // namespace
+
+Executor::Executor() : pollFd(::epoll_create1(EPOLL_CLOEXEC)) {
+    if (pollFd < 0)
+        LOG_ERROR("epoll_create1: %s", std::strerror(errno));
+}
+
+Executor::~Executor() {
+    if (pollFd >= 0)
+        ::close(pollFd);
+}
+
+void Executor::wait(FdAwaiter *awaiter) {
+    auto &w = waiters[awaiter->fd];
+    (awaiter->write ? w.writer : w.reader) = awaiter;
+    if (awaiter->timeout.count() > 0)
+        addTimer(awaiter);
+    epoll_event ev{};
+    ev.events = interest(w.reader, w.writer);
+    ev.data.fd = awaiter->fd;
+    // fd关闭后会自动从epoll中移除，因此MOD失败时改用ADD
+    if (::epoll_ctl(pollFd, EPOLL_CTL_MOD, awaiter->fd, &ev) != 0 &&
+        ::epoll_ctl(pollFd, EPOLL_CTL_ADD, awaiter->fd, &ev) != 0) {
+        LOG_ERROR("epoll_ctl: %s", std::strerror(errno));
+        (awaiter->write ? w.writer : w.reader) = nullptr;
+        if (!w.reader && !w.writer)
+            waiters.erase(awaiter->fd);
+        wake(awaiter);
+    }
+}
+
+void Executor::poll(int timeout) {
+    epoll_event events[256];
+    int n = ::epoll_wait(pollFd, events, 256, timeout);
+    for (int i = 0; i < n; ++i) {
+        auto it = waiters.find(events[i].data.fd);
+        if (it == waiters.end())
+            continue;
+        auto &w = it->second;
+        // 出错或挂断时唤醒双方，由IO调用返回具体错误
+        bool err = events[i].events & (EPOLLERR | EPOLLHUP);
+        if (w.reader && (err || (events[i].events & EPOLLIN)))
+            wake(std::exchange(w.reader, nullptr));
+        if (w.writer && (err || (events[i].events & EPOLLOUT)))
+            wake(std::exchange(w.writer, nullptr));
+        if (!w.reader && !w.writer) {
+            waiters.erase(it);
+        } else {
+            // ONESHOT已触发，重新注册剩下的等待者
+            epoll_event ev{};
+            ev.events = interest(w.reader, w.writer);
+            ev.data.fd = it->first;
+            ::epoll_ctl(pollFd, EPOLL_CTL_MOD, it->first, &ev);
+        }
+    }
+}
+
+#else
+
+Executor::Executor() = default;
+Executor::~Executor() = default;
+
+void Executor::wait(FdAwaiter *awaiter) {
+    auto &w = waiters[awaiter->fd];
+    (awaiter->write ? w.writer : w.reader) = awaiter;
+    if (awaiter->timeout.count() > 0)
+        addTimer(awaiter);
+}
+
+void Executor::poll(int timeout) {
+    // 只有定时器时WSAPoll不能用于等待
+    if (waiters.empty()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::max(timeout, 0)));
+        return;
+    }
+    std::vector<pollfd_t> fds;
+    fds.reserve(waiters.size());
+    for (const auto &[fd, w] : waiters) {
+        pollfd_t p{};
+        p.fd = fd;
+        p.events = static_cast<short>((w.reader ? POLLIN : 0) | (w.writer ? POLLOUT : 0));
+        fds.push_back(p);
+    }
+    if (poll_fds(fds.data(), static_cast<unsigned long>(fds.size()), timeout) <= 0)
+        return;
+    for (const auto &p : fds) {
+        if (!p.revents)
+            continue;
+        auto &w = waiters[p.fd];
+        bool err = p.revents & (POLLERR | POLLHUP | POLLNVAL);
+        if (w.reader && (err || (p.revents & POLLIN)))
+            wake(std::exchange(w.reader, nullptr));
+        if (w.writer && (err || (p.revents & POLLOUT)))
+            wake(std::exchange(w.writer, nullptr));
+        if (!w.reader && !w.writer)
+            waiters.erase(p.fd);
+    }
+}
+
+#endif
+
+} // namespace multi_get
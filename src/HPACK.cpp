@@ -0,0 +1,351 @@
+#include "HPACK.h"
+
+
+namespace multi_get::hpack {
+
+namespace {
+
+// RFC 7541 附录A 静态表
+const HeaderEntry STATIC_TABLE[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541 附录B Huffman编码表，下标256为EOS
+const uint32_t HUFFMAN_CODES[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+
+const uint8_t HUFFMAN_CODE_LENGTHS[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+constexpr size_t STATIC_TABLE_SIZE = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+// 由编码表构造的解码二叉树，叶子节点保存符号
+struct HuffmanTree {
+    struct Node {
+        int16_t children[2]{-1, -1};
+        int16_t symbol{-1};
+    };
+    std::vector<Node> nodes;
+
+    HuffmanTree() {
+        nodes.reserve(512);
+        nodes.emplace_back();
+        for (int sym = 0; sym < 257; ++sym) {
+            size_t cur = 0;
+            for (int bit = HUFFMAN_CODE_LENGTHS[sym] - 1; bit >= 0; --bit) {
+                int b = (HUFFMAN_CODES[sym] >> bit) & 1;
+                if (nodes[cur].children[b] < 0) {
+                    nodes[cur].children[b] = static_cast<int16_t>(nodes.size());
+                    nodes.emplace_back();
+                }
+                cur = static_cast<size_t>(nodes[cur].children[b]);
+            }
+            nodes[cur].symbol = static_cast<int16_t>(sym);
+        }
+    }
+
+    static const HuffmanTree &instance() {
+        static HuffmanTree tree;
+        return tree;
+    }
+};
+
+void encodeInteger(std::vector<char> &out, uint8_t flags, int prefixBits, uint64_t value) {
+    const uint64_t maxPrefix = (1u << prefixBits) - 1;
+    if (value < maxPrefix) {
+        out.push_back(static_cast<char>(flags | value));
+        return;
+    }
+    out.push_back(static_cast<char>(flags | maxPrefix));
+    value -= maxPrefix;
+    while (value >= 128) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void encodeString(std::vector<char> &out, std::string_view s) {
+    encodeInteger(out, 0x00, 7, s.size());
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+bool decodeInteger(const uint8_t *&p, const uint8_t *end, int prefixBits, uint64_t &value) {
+    if (p >= end)
+        return false;
+    const uint64_t maxPrefix = (1u << prefixBits) - 1;
+    value = *p++ & maxPrefix;
+    if (value < maxPrefix)
+        return true;
+    int shift = 0;
+    while (p < end) {
+        uint8_t b = *p++;
+        value += static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+        shift += 7;
+        if (shift > 56)
+            return false;
+    }
+    return false;
+}
+
+bool decodeString(const uint8_t *&p, const uint8_t *end, std::string &out) {
+    if (p >= end)
+        return false;
+    bool huffman = *p & 0x80;
+    uint64_t len;
+    if (!decodeInteger(p, end, 7, len) || len > static_cast<uint64_t>(end - p))
+        return false;
+    out.clear();
+    bool ok = true;
+    if (huffman)
+        ok = huffmanDecode(p, len, out);
+    else
+        out.assign(reinterpret_cast<const char *>(p), len);
+    p += len;
+    return ok;
+}
+
+} // namespace
+
+bool huffmanDecode(const uint8_t *data, size_t len, std::string &out) {
+    const auto &tree = HuffmanTree::instance();
+    size_t cur = 0;
+    int depth = 0;
+    bool allOnes = true;
+    for (size_t i = 0; i < len; ++i) {
+        for (int bit = 7; bit >= 0; --bit) {
+            int b = (data[i] >> bit) & 1;
+            auto next = tree.nodes[cur].children[b];
+            if (next < 0)
+                return false;
+            cur = static_cast<size_t>(next);
+            ++depth;
+            allOnes = allOnes && b;
+            if (auto sym = tree.nodes[cur].symbol; sym >= 0) {
+                // 字符串中出现EOS属于解码错误
+                if (sym == 256)
+                    return false;
+                out.push_back(static_cast<char>(sym));
+                cur = 0;
+                depth = 0;
+                allOnes = true;
+            }
+        }
+    }
+    // 末尾填充必须是不超过7位的EOS前缀（全1）
+    return depth <= 7 && allOnes;
+}
+
+void Encoder::encode(std::vector<char> &out, std::string_view name, std::string_view value) {
+    size_t nameIndex = 0;
+    for (size_t i = 0; i < STATIC_TABLE_SIZE; ++i) {
+        if (STATIC_TABLE[i].name != name)
+            continue;
+        if (STATIC_TABLE[i].value == value) {
+            // 完全匹配，使用索引表示
+            encodeInteger(out, 0x80, 7, i + 1);
+            return;
+        }
+        if (!nameIndex)
+            nameIndex = i + 1;
+    }
+    // 不索引的字面量：0000xxxx
+    encodeInteger(out, 0x00, 4, nameIndex);
+    if (!nameIndex)
+        encodeString(out, name);
+    encodeString(out, value);
+}
+
+void Decoder::insert(std::string name, std::string value) {
+    size_t size = name.size() + value.size() + 32;
+    if (size > maxTableSize) {
+        dynamicTable.clear();
+        tableSize = 0;
+        return;
+    }
+    tableSize += size;
+    dynamicTable.emplace_front(std::move(name), std::move(value));
+    evict();
+}
+
+void Decoder::evict() {
+    while (tableSize > maxTableSize && !dynamicTable.empty()) {
+        const auto &[n, v] = dynamicTable.back();
+        tableSize -= n.size() + v.size() + 32;
+        dynamicTable.pop_back();
+    }
+}
+
+bool Decoder::lookup(uint64_t index, std::string &name, std::string *value) const {
+    if (index == 0)
+        return false;
+    if (index <= STATIC_TABLE_SIZE) {
+        name = STATIC_TABLE[index - 1].name;
+        if (value)
+            *value = STATIC_TABLE[index - 1].value;
+        return true;
+    }
+    index -= STATIC_TABLE_SIZE + 1;
+    if (index >= dynamicTable.size())
+        return false;
+    name = dynamicTable[index].first;
+    if (value)
+        *value = dynamicTable[index].second;
+    return true;
+}
+
+bool Decoder::decode(const uint8_t *data, size_t len, HeaderList &headers) {
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+    std::string name, value;
+    while (p < end) {
+        uint8_t b = *p;
+        uint64_t index;
+        if (b & 0x80) {
+            // 索引表示
+            if (!decodeInteger(p, end, 7, index) || !lookup(index, name, &value))
+                return false;
+            headers.emplace_back(name, value);
+        } else if ((b & 0xc0) == 0x40) {
+            // 带增量索引的字面量
+            if (!decodeInteger(p, end, 6, index))
+                return false;
+            if (index ? !lookup(index, name, nullptr) : !decodeString(p, end, name))
+                return false;
+            if (!decodeString(p, end, value))
+                return false;
+            headers.emplace_back(name, value);
+            insert(name, value);
+        } else if ((b & 0xe0) == 0x20) {
+            // 动态表大小更新
+            if (!decodeInteger(p, end, 5, index) || index > 4096)
+                return false;
+            maxTableSize = index;
+            evict();
+        } else {
+            // 不索引 / 永不索引的字面量
+            if (!decodeInteger(p, end, 4, index))
+                return false;
+            if (index ? !lookup(index, name, nullptr) : !decodeString(p, end, name))
+                return false;
+            if (!decodeString(p, end, value))
+                return false;
+            headers.emplace_back(name, value);
+        }
+    }
+    return true;
+}
+
+} // namespace multi_get::hpack
@@ -0,0 +1,696 @@
+#include "HTTP2Connection.h"
+
+#include <algorithm>
+#include <cctype>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+namespace multi_get {
+
+namespace {
+
+enum FrameType : uint8_t {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    PRIORITY = 0x2,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9
+};
+
+enum FrameFlag : uint8_t {
+    END_STREAM = 0x1,
+    ACK = 0x1,
+    END_HEADERS = 0x4,
+    PADDED = 0x8,
+    PRIORITY_FLAG = 0x20
+};
+
+enum SettingId : uint16_t {
+    HEADER_TABLE_SIZE = 0x1,
+    ENABLE_PUSH = 0x2,
+    MAX_CONCURRENT_STREAMS = 0x3,
+    INITIAL_WINDOW_SIZE = 0x4,
+    MAX_FRAME_SIZE = 0x5
+};
+
+constexpr std::string_view PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr uint32_t DEFAULT_WINDOW = 65535;
+constexpr uint32_t FRAME_HEADER_SIZE = 9;
+// IO线程等待缓冲池预算时重试的间隔（毫秒）
+constexpr int STALL_INTERVAL = 1;
+
+inline uint32_t readU32(const uint8_t *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+inline void putU32(char *p, uint32_t v) {
+    p[0] = static_cast<char>(v >> 24);
+    p[1] = static_cast<char>(v >> 16);
+    p[2] = static_cast<char>(v >> 8);
+    p[3] = static_cast<char>(v);
+}
+
+inline void putSetting(std::vector<char> &out, uint16_t id, uint32_t value) {
+    out.push_back(static_cast<char>(id >> 8));
+    out.push_back(static_cast<char>(id));
+    char v[4];
+    putU32(v, value);
+    out.insert(out.end(), v, v + 4);
+}
+
+// HTTP/2禁止发送的逐跳首部
+bool connectionSpecific(std::string_view name) {
+    return iequals(name, "Connection") || iequals(name, "Keep-Alive") || iequals(name, "Host") ||
+           iequals(name, "Transfer-Encoding") || iequals(name, "Upgrade") || iequals(name, "Proxy-Connection");
+}
+
+std::string lower(std::string_view s) {
+    std::string res(s);
+    for (auto &c : res)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return res;
+}
+
+} // namespace
+
+HTTP2Session::HTTP2Session(std::shared_ptr<SSLConnection> conn, const Settings &settings)
+    : conn(std::move(conn)), settings(settings) {
+    // 连接前言 + SETTINGS + 连接级窗口更新
+    outbox.insert(outbox.end(), PREFACE.begin(), PREFACE.end());
+    std::vector<char> payload;
+    putSetting(payload, ENABLE_PUSH, 0);
+    putSetting(payload, INITIAL_WINDOW_SIZE, settings.streamWindow);
+    putSetting(payload, MAX_FRAME_SIZE, settings.maxFrameSize);
+    appendFrame(outbox, SETTINGS, 0, 0, payload.data(), static_cast<uint32_t>(payload.size()));
+    if (settings.connectionWindow > DEFAULT_WINDOW)
+        queueWindowUpdate(0, settings.connectionWindow - DEFAULT_WINDOW);
+}
+
+HTTP2Session::~HTTP2Session() {
+    {
+        std::lock_guard<std::mutex> locker(m);
+        shutdown = true;
+    }
+    wake();
+    if (ioThread.joinable())
+        ioThread.join();
+#ifndef _WIN32
+    for (int fd : wakeFds) {
+        if (fd >= 0)
+            ::close(fd);
+    }
+#endif
+}
+
+#ifdef _WIN32
+
+std::shared_ptr<HTTP2Session> HTTP2Session::open(const std::string &, uint16_t, const std::string &, const Settings &,
+                                                 const Timeouts &, const SocketOptions &) {
+    LOG_WARN("HTTP/2 is not supported on this platform, using HTTP/1.1.");
+    return nullptr;
+}
+
+void HTTP2Session::wake() const {}
+void HTTP2Session::ioLoop() {}
+
+#else
+
+std::shared_ptr<HTTP2Session> HTTP2Session::open(const std::string &hostname, uint16_t port, const std::string &proxy,
+                                                 const Settings &settings, const Timeouts &timeouts,
+                                                 const SocketOptions &options) {
+    auto conn = std::make_shared<SSLConnection>(hostname, port, proxy);
+    conn->setTimeouts(timeouts);
+    conn->setSocketOptions(options);
+    conn->setAlpn({"h2", "http/1.1"});
+    if (!static_cast<Connection &>(*conn).connect())
+        return nullptr;
+    if (conn->alpnSelected() != "h2") {
+        LOG_INFO("%s:%d did not negotiate h2, using HTTP/1.1.", hostname.c_str(), port);
+        return nullptr;
+    }
+    LOG_INFO("Negotiated h2 with %s:%d", hostname.c_str(), port);
+
+    std::shared_ptr<HTTP2Session> session(new HTTP2Session(conn, settings));
+    if (::pipe(session->wakeFds) != 0)
+        return nullptr;
+    ::fcntl(session->wakeFds[0], F_SETFL, O_NONBLOCK);
+    ::fcntl(session->wakeFds[1], F_SETFL, O_NONBLOCK);
+    ::fcntl(conn->fd(), F_SETFL, ::fcntl(conn->fd(), F_GETFL) | O_NONBLOCK);
+    session->ioThread = std::thread(&HTTP2Session::ioLoop, session.get());
+    return session;
+}
+
+void HTTP2Session::wake() const {
+    char c = 0;
+    [[maybe_unused]] auto n = ::write(wakeFds[1], &c, 1);
+}
+
+void HTTP2Session::ioLoop() {
+    SSL *ssl = conn->handle();
+    std::vector<char> out;
+    std::vector<uint8_t> in;
+    size_t inPos = 0;
+    std::vector<uint8_t> buf(64 * 1024);
+    bool alive = true;
+
+    while (alive) {
+        bool wantWrite = false;
+        {
+            std::lock_guard<std::mutex> locker(m);
+            if (shutdown)
+                break;
+            out.insert(out.end(), outbox.begin(), outbox.end());
+            outbox.clear();
+        }
+
+        // 发送
+        size_t written = 0;
+        while (written < out.size()) {
+            int n = ::SSL_write(ssl, out.data() + written, static_cast<int>(out.size() - written));
+            if (n > 0) {
+                written += static_cast<size_t>(n);
+                continue;
+            }
+            int err = ::SSL_get_error(ssl, n);
+            if (err != SSL_ERROR_WANT_WRITE && err != SSL_ERROR_WANT_READ) {
+                LOG_ERROR("HTTP/2 write failed: %d", err);
+                alive = false;
+            }
+            wantWrite = err == SSL_ERROR_WANT_WRITE;
+            break;
+        }
+        out.erase(out.begin(), out.begin() + static_cast<ptrdiff_t>(written));
+
+        // 接收，直到SSL层没有可读数据。等待缓冲池时不再读取，让数据留在内核和服务器上
+        bool progress = written > 0;
+        while (alive && !stalled) {
+            int n = ::SSL_read(ssl, buf.data(), static_cast<int>(buf.size()));
+            if (n > 0) {
+                in.insert(in.end(), buf.begin(), buf.begin() + n);
+                progress = true;
+                continue;
+            }
+            int err = ::SSL_get_error(ssl, n);
+            if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+                LOG_WARN("HTTP/2 connection closed by peer.");
+                alive = false;
+            }
+            break;
+        }
+
+        // 解析完整的帧
+        while (alive && in.size() - inPos >= FRAME_HEADER_SIZE) {
+            const uint8_t *h = in.data() + inPos;
+            uint32_t len = (uint32_t(h[0]) << 16) | (uint32_t(h[1]) << 8) | h[2];
+            if (len > settings.maxFrameSize) {
+                LOG_ERROR("HTTP/2 frame too large: %u", len);
+                alive = false;
+                break;
+            }
+            if (in.size() - inPos < FRAME_HEADER_SIZE + len)
+                break;
+            uint32_t streamId = readU32(h + 5) & 0x7fffffff;
+            alive = handleFrame(h[3], h[4], streamId, h + FRAME_HEADER_SIZE, len);
+            if (stalled)
+                break;
+            inPos += FRAME_HEADER_SIZE + len;
+        }
+        if (inPos == in.size()) {
+            in.clear();
+            inPos = 0;
+        } else if (inPos > buf.size()) {
+            in.erase(in.begin(), in.begin() + static_cast<ptrdiff_t>(inPos));
+            inPos = 0;
+        }
+
+        if (!alive || progress)
+            continue;
+
+        // 等待缓冲池时只定时重试和处理发送
+        pollfd fds[2] = {{conn->fd(), static_cast<short>((stalled ? 0 : POLLIN) | (wantWrite ? POLLOUT : 0)), 0},
+                         {wakeFds[0], POLLIN, 0}};
+        ::poll(fds, 2, stalled ? STALL_INTERVAL : -1);
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (::read(wakeFds[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+    }
+    failAll();
+}
+
+#endif
+
+void HTTP2Session::appendFrame(std::vector<char> &out, uint8_t type, uint8_t flags, uint32_t streamId,
+                               const char *payload, uint32_t len) {
+    char header[FRAME_HEADER_SIZE];
+    header[0] = static_cast<char>(len >> 16);
+    header[1] = static_cast<char>(len >> 8);
+    header[2] = static_cast<char>(len);
+    header[3] = static_cast<char>(type);
+    header[4] = static_cast<char>(flags);
+    putU32(header + 5, streamId & 0x7fffffff);
+    out.insert(out.end(), header, header + FRAME_HEADER_SIZE);
+    if (len)
+        out.insert(out.end(), payload, payload + len);
+}
+
+// 调用者需持有m，或者处于构造阶段
+void HTTP2Session::queueWindowUpdate(uint32_t streamId, uint32_t increment) {
+    char payload[4];
+    putU32(payload, increment & 0x7fffffff);
+    appendFrame(outbox, WINDOW_UPDATE, 0, streamId, payload, 4);
+}
+
+void HTTP2Session::failAll() {
+    std::lock_guard<std::mutex> locker(m);
+    goaway = true;
+    for (auto &[id, stream] : streams) {
+        if (!stream->done)
+            stream->failed = true;
+    }
+    cv.notify_all();
+}
+
+bool HTTP2Session::handleFrame(uint8_t type, uint8_t flags, uint32_t streamId, const uint8_t *payload, uint32_t len) {
+    // HEADERS之后只能紧跟同一stream的CONTINUATION
+    if (headerBlockStream && type != CONTINUATION) {
+        LOG_ERROR("HTTP/2 protocol error: expected CONTINUATION.");
+        return false;
+    }
+
+    switch (type) {
+    case DATA: {
+        uint32_t padding = 0;
+        const uint8_t *data = payload;
+        if (flags & PADDED) {
+            if (len < 1 || payload[0] >= len)
+                return false;
+            padding = payload[0];
+            ++data;
+        }
+        uint32_t dataLen = len - padding - static_cast<uint32_t>(data - payload);
+
+        std::lock_guard<std::mutex> locker(m);
+        auto it = streams.find(streamId);
+        if (it != streams.end() && !it->second->failed && !it->second->body.tryReserve(dataLen)) {
+            // 预算用尽时先不消费这一帧，等其他传输归还块；与Rope的阻塞申请一样最多等待DEFAULT_PATIENCE
+            const auto now = std::chrono::steady_clock::now();
+            if (!stalled)
+                stalledSince = now;
+            if (now - stalledSince < Rope::DEFAULT_PATIENCE) {
+                stalled = true;
+                return true;
+            }
+            LOG_WARN("HTTP/2 stream %u ran out of buffer memory, resetting.", streamId);
+            it->second->failed = it->second->outOfMemory = true;
+            const char code[4] = {0, 0, 0, 0x8}; // CANCEL
+            appendFrame(outbox, RST_STREAM, 0, streamId, code, sizeof(code));
+            cv.notify_all();
+        }
+        stalled = false;
+        // 流控窗口按整个帧长度计算，消耗过半时补充
+        connectionUnacked += len;
+        if (connectionUnacked >= settings.connectionWindow / 2) {
+            queueWindowUpdate(0, connectionUnacked);
+            connectionUnacked = 0;
+        }
+        if (it == streams.end() || it->second->failed)
+            return true;
+        auto &stream = *it->second;
+        stream.received += dataLen;
+        if (stream.transfer)
+            stream.transfer->addReceived(dataLen);
+        if (!stream.body.append(reinterpret_cast<const char *>(data), dataLen)) {
+            stream.failed = stream.outOfMemory = true;
+            cv.notify_all();
+        } else if (flags & END_STREAM) {
+            stream.done = true;
+            cv.notify_all();
+        } else {
+            stream.unacked += len;
+            if (stream.unacked >= settings.streamWindow / 2) {
+                queueWindowUpdate(streamId, stream.unacked);
+                stream.unacked = 0;
+            }
+        }
+        return true;
+    }
+    case HEADERS: {
+        const uint8_t *p = payload;
+        const uint8_t *end = payload + len;
+        if (flags & PADDED) {
+            if (len < 1 || payload[0] >= len)
+                return false;
+            end -= payload[0];
+            ++p;
+        }
+        if (flags & PRIORITY_FLAG)
+            p += 5;
+        if (p > end)
+            return false;
+        headerBlock.assign(p, end);
+        headerBlockStream = streamId;
+        headerBlockEndStream = flags & END_STREAM;
+        if (flags & END_HEADERS)
+            return handleHeaderBlock();
+        return true;
+    }
+    case CONTINUATION: {
+        if (streamId != headerBlockStream)
+            return false;
+        headerBlock.insert(headerBlock.end(), payload, payload + len);
+        if (flags & END_HEADERS)
+            return handleHeaderBlock();
+        return true;
+    }
+    case RST_STREAM: {
+        std::lock_guard<std::mutex> locker(m);
+        if (auto it = streams.find(streamId); it != streams.end()) {
+            LOG_WARN("HTTP/2 stream %u reset by peer: %u", streamId, len >= 4 ? readU32(payload) : 0);
+            it->second->failed = true;
+            cv.notify_all();
+        }
+        return true;
+    }
+    case SETTINGS: {
+        if (flags & ACK)
+            return true;
+        std::lock_guard<std::mutex> locker(m);
+        for (uint32_t i = 0; i + 6 <= len; i += 6) {
+            uint16_t id = static_cast<uint16_t>((payload[i] << 8) | payload[i + 1]);
+            uint32_t value = readU32(payload + i + 2);
+            if (id == MAX_CONCURRENT_STREAMS)
+                peerMaxConcurrent = value ? value : 1;
+            else if (id == MAX_FRAME_SIZE)
+                peerMaxFrameSize = value;
+        }
+        appendFrame(outbox, SETTINGS, ACK, 0, nullptr, 0);
+        cv.notify_all();
+        return true;
+    }
+    case PING: {
+        if (flags & ACK)
+            return true;
+        std::lock_guard<std::mutex> locker(m);
+        appendFrame(outbox, PING, ACK, 0, reinterpret_cast<const char *>(payload), len);
+        return true;
+    }
+    case GOAWAY: {
+        uint32_t lastStream = len >= 4 ? readU32(payload) & 0x7fffffff : 0;
+        LOG_WARN("HTTP/2 GOAWAY received, last stream %u", lastStream);
+        std::lock_guard<std::mutex> locker(m);
+        goaway = true;
+        for (auto &[id, stream] : streams) {
+            if (id > lastStream)
+                stream->failed = true;
+        }
+        cv.notify_all();
+        return true;
+    }
+    case PUSH_PROMISE:
+        // 已通过SETTINGS_ENABLE_PUSH禁用
+        return false;
+    default:
+        // PRIORITY、WINDOW_UPDATE以及未知类型：只发送HEADERS，无需关心发送窗口
+        return true;
+    }
+}
+
+bool HTTP2Session::handleHeaderBlock() {
+    uint32_t streamId = headerBlockStream;
+    headerBlockStream = 0;
+
+    // 即使stream已不存在也必须解码，以保持动态表同步
+    hpack::HeaderList headers;
+    if (!decoder.decode(headerBlock.data(), headerBlock.size(), headers)) {
+        LOG_ERROR("HTTP/2 HPACK decoding failed.");
+        return false;
+    }
+
+    std::lock_guard<std::mutex> locker(m);
+    auto it = streams.find(streamId);
+    if (it == streams.end())
+        return true;
+    auto &stream = *it->second;
+    if (!stream.headersDone) {
+        // 1xx为中间响应，等待最终响应
+        bool informational = !headers.empty() && headers[0].first == ":status" && headers[0].second.size() == 3 &&
+                             headers[0].second[0] == '1';
+        if (!informational) {
+            stream.headers = std::move(headers);
+            stream.headersDone = true;
+        }
+    }
+    if (headerBlockEndStream) {
+        stream.done = true;
+        cv.notify_all();
+    }
+    return true;
+}
+
+bool HTTP2Session::usable() {
+    std::lock_guard<std::mutex> locker(m);
+    return !goaway && !shutdown && nextStreamId < 0x7fffffff;
+}
+
+HTTPResponse HTTP2Session::request(std::string_view method, std::string_view authority, std::string_view path,
+                                   const Headers &headers, int64_t beginPos, int64_t endPos,
+                                   const Timeouts &timeouts, Transfer *transfer) {
+    std::vector<char> block;
+    hpack::Encoder::encode(block, ":method", method);
+    hpack::Encoder::encode(block, ":scheme", "https");
+    hpack::Encoder::encode(block, ":authority", authority);
+    hpack::Encoder::encode(block, ":path", path);
+    for (const auto &[k, v] : headers) {
+        if (!connectionSpecific(k))
+            hpack::Encoder::encode(block, lower(k), v);
+    }
+    if (beginPos >= 0) {
+        std::string range = "bytes=" + std::to_string(beginPos) + '-';
+        if (endPos >= beginPos)
+            range += std::to_string(endPos);
+        hpack::Encoder::encode(block, "range", range);
+    }
+
+    auto stream = std::make_shared<Stream>();
+    stream->body.setPatience(std::chrono::milliseconds(0));
+    stream->transfer = transfer;
+    uint32_t streamId;
+    {
+        std::unique_lock<std::mutex> locker(m);
+        cv.wait(locker, [&] { return goaway || shutdown || streams.size() < peerMaxConcurrent; });
+        if (goaway || shutdown)
+            return HTTPResponse::failure(Error::ConnectFailed);
+        streamId = nextStreamId;
+        nextStreamId += 2;
+        streams.emplace(streamId, stream);
+
+        // 头部块超过对端最大帧长时拆分为CONTINUATION
+        uint32_t offset = 0;
+        auto total = static_cast<uint32_t>(block.size());
+        do {
+            uint32_t len = std::min(total - offset, peerMaxFrameSize);
+            bool first = offset == 0;
+            bool last = offset + len == total;
+            uint8_t flags = (first ? END_STREAM : 0) | (last ? END_HEADERS : 0);
+            appendFrame(outbox, first ? HEADERS : CONTINUATION, flags, streamId, block.data() + offset, len);
+            offset += len;
+        } while (offset < total);
+    }
+    wake();
+    if (transfer) {
+        transfer->attach([this] {
+            std::lock_guard<std::mutex> locker(m);
+            cv.notify_all();
+        });
+    }
+
+    // 在期限内没有任何进展（头部或DATA）才算超时
+    auto error = Error::Ok;
+    std::unique_lock<std::mutex> locker(m);
+    auto seen = [&] { return stream->received + (stream->headersDone ? 1 : 0); };
+    auto progress = seen();
+    auto last = std::chrono::steady_clock::now();
+    while (!stream->done && !stream->failed) {
+        if (transfer && transfer->cancelled()) {
+            error = Error::Cancelled;
+            break;
+        }
+        auto limit = stream->headersDone ? timeouts.idle : timeouts.firstByte;
+        if (limit.count() <= 0) {
+            cv.wait(locker);
+            continue;
+        }
+        if (cv.wait_until(locker, last + limit) == std::cv_status::timeout) {
+            if (seen() == progress) {
+                error = Error::Timeout;
+                break;
+            }
+            progress = seen();
+            last = std::chrono::steady_clock::now();
+        }
+    }
+    if (error != Error::Ok) {
+        LOG_WARN("HTTP/2 stream %u %s, resetting.", streamId, error == Error::Timeout ? "timed out" : "cancelled");
+        const char code[4] = {0, 0, 0, 0x8}; // CANCEL
+        appendFrame(outbox, RST_STREAM, 0, streamId, code, sizeof(code));
+    }
+    streams.erase(streamId);
+    cv.notify_all();
+    locker.unlock();
+    if (transfer)
+        transfer->detach();
+    if (error != Error::Ok)
+        wake();
+
+    if (!stream->headersDone)
+        return HTTPResponse::failure(error != Error::Ok ? error : Error::BadResponse);
+
+    // 转换为HTTP/1.1风格的头部文本，复用HTTPResponse的解析
+    std::string_view status;
+    std::vector<char> raw;
+    for (const auto &[k, v] : stream->headers) {
+        if (k == ":status")
+            status = v;
+    }
+    constexpr std::string_view VERSION = "HTTP/2 ";
+    raw.insert(raw.end(), VERSION.begin(), VERSION.end());
+    raw.insert(raw.end(), status.begin(), status.end());
+    raw.push_back('\r');
+    raw.push_back('\n');
+    for (const auto &[k, v] : stream->headers) {
+        if (!k.empty() && k[0] == ':')
+            continue;
+        raw.insert(raw.end(), k.begin(), k.end());
+        raw.push_back(':');
+        raw.push_back(' ');
+        raw.insert(raw.end(), v.begin(), v.end());
+        raw.push_back('\r');
+        raw.push_back('\n');
+    }
+    raw.push_back('\r');
+    raw.push_back('\n');
+    HTTPResponse resp{std::move(raw)};
+    resp.parseBody(stream->body);
+    if (error != Error::Ok)
+        resp.setError(error);
+    else if (stream->failed)
+        resp.setError(stream->outOfMemory ? Error::OutOfMemory : Error::IncompleteBody);
+    return resp;
+}
+
+std::shared_ptr<HTTP2Session> HTTP2Connection::session(const std::string &hostname, uint16_t port) {
+    const std::string key = hostname + ':' + std::to_string(port);
+    std::unique_lock<std::mutex> locker(sessionMutex);
+    while (true) {
+        if (http1Hosts.count(key))
+            return nullptr;
+        auto &list = sessions[key];
+        list.erase(std::remove_if(list.begin(), list.end(), [](const auto &s) { return !s->usable(); }), list.end());
+        auto pending = opening.find(key);
+        if (pending == opening.end() && list.size() < sessionsPerHost)
+            break;
+        if (!list.empty())
+            return list[roundRobin++ % list.size()];
+        // 该host的第一个会话正在建立，等它完成后重新检查
+        auto ready = pending->second;
+        locker.unlock();
+        ready.wait();
+        locker.lock();
+    }
+
+    // 连接、TLS握手和ALPN协商可能耗时到连接超时，期间不持有锁，其他请求（尤其是其他host的）不受影响
+    std::promise<void> done;
+    opening.emplace(key, done.get_future().share());
+    locker.unlock();
+    auto s = HTTP2Session::open(hostname, port, proxy, settings, timeouts, socketOptions);
+    locker.lock();
+    opening.erase(key);
+    done.set_value();
+    // 解锁期间sessions可能已经重新散列，重新查找
+    auto &list = sessions[key];
+    if (!s) {
+        if (list.empty())
+            http1Hosts.insert(key);
+        return list.empty() ? nullptr : list[roundRobin++ % list.size()];
+    }
+    list.push_back(s);
+    return s;
+}
+
+HTTPResponse HTTP2Connection::request(std::string_view method, const std::string &url, int64_t beginPos, int64_t endPos,
+                                      Transfer *transfer, bool &handled) {
+    auto [protocol, hostname, port, path] = formatHost(url);
+    handled = false;
+    if (protocol != "https")
+        return HTTPResponse{};
+    auto s = session(hostname, port);
+    if (!s)
+        return HTTPResponse{};
+    handled = true;
+
+    std::string authority = port == 443 ? hostname : hostname + ':' + std::to_string(port);
+    LOG_INFO("HTTP/2 %s url: %s", std::string(method).c_str(), url.c_str());
+    HTTPResponse resp;
+    if (transfer && !transfer->requestHeaders().empty()) {
+        auto merged = headers;
+        merged.insert(transfer->requestHeaders().begin(), transfer->requestHeaders().end());
+        resp = s->request(method, authority, path, merged, beginPos, endPos, timeouts, transfer);
+    } else {
+        resp = s->request(method, authority, path, headers, beginPos, endPos, timeouts, transfer);
+    }
+    if (resp.error() == Error::Ok)
+        noteSocket(s->socketInfo());
+    return resp;
+}
+
+HTTPResponse HTTP2Connection::get(const std::string &url, int64_t beginPos, int64_t endPos, Transfer *transfer) {
+    if (auto target = redirected(url); target != url)
+        return get(target, beginPos, endPos, transfer);
+    bool handled;
+    auto resp = request("GET", url, beginPos, endPos, transfer, handled);
+    if (!handled)
+        return HTTPConnection::get(url, beginPos, endPos, transfer);
+    if (resp.status() == 301 || resp.status() == 302) {
+        return get(redirect(url, resp), beginPos, endPos, transfer);
+    }
+    // stream的响应头和body一起返回，这里回调时body已经完整
+    if (transfer)
+        transfer->headersReceived(url, resp);
+    return resp;
+}
+
+void HTTP2Connection::prewarm(const std::string &url, size_t count) {
+    auto [protocol, hostname, port, path] = formatHost(redirected(url));
+    if (protocol != "https")
+        return HTTPConnection::prewarm(url, count);
+    // 所有请求复用sessionsPerHost条会话，不需要更多连接
+    for (size_t i = 0; i < std::min(count, sessionsPerHost); ++i) {
+        if (!session(hostname, port))
+            return HTTPConnection::prewarm(url, count);
+    }
+}
+
+HTTPResponse HTTP2Connection::head(const std::string &url, Transfer *transfer) {
+    if (auto target = redirected(url); target != url)
+        return head(target, transfer);
+    bool handled;
+    auto resp = request("HEAD", url, -1, -1, transfer, handled);
+    if (!handled)
+        return HTTPConnection::head(url, transfer);
+    if (resp.status() == 301 || resp.status() == 302) {
+        return head(redirect(url, resp), transfer);
+    }
+    return resp;
+}
+
+} // namespace multi_get
@@ -1,59 +1,394 @@
 #include "HTTPConnection.h"
+#include "BufferPool.h"
+#include "Coroutine.h"
+#include "Decoder.h"
+#include "ResponseReader.h"
+#include "ThreadPool.h"
 #include "version.h"
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <optional>
+#include <vector>
 
 namespace multi_get {
 
-std::string HTTPConnection::constructHeaders(const std::string &path, const std::string &method) const noexcept {
-    std::stringstream ss;
-    ss << method << " " << path << " HTTP/1.1\r\n";
-    for (const auto &[k, v] : headers) {
-        ss << k << ": " << v << "\r\n";
-    }
-    ss << "\r\n";
-    return ss.str();
-}
-
-HTTPResponse HTTPConnection::receiveHTTPHeaders(const std::shared_ptr<Connection> &conn) {
-    char response;
-    std::string receivedHeaders;
-    enum class CharState {
-        PLAIN = 0,
-        R,
-        RN,
-        RNR,
-        RNRN
+namespace {
+
+// 非默认端口时Host需要带上端口号
+std::string hostHeader(const std::string &protocol, const std::string &hostname, uint16_t port) {
+    if ((protocol == "https" && port == 443) || (protocol == "http" && port == 80))
+        return hostname;
+    return hostname + ':' + std::to_string(port);
+}
+
+// 协程等待缓冲池预算时的检查间隔
+constexpr std::chrono::milliseconds RESERVE_INTERVAL{1};
+
+// 协程中的带缓冲读取，解析头部和chunk长度时不必逐字节接收
+class AsyncReader {
+  private:
+    Executor &ex;
+    const Connection &conn;
+    Block buf;
+    size_t pos{0};
+    size_t end{0};
+    bool _outOfMemory{false};
+
+    // 预算用尽时挂起协程等待其他传输归还块，而不是阻塞同一Executor上的其他协程；
+    // 与reserve一样，超过Rope::DEFAULT_PATIENCE时返回false
+    Task<bool> acquire() {
+        const auto deadline = std::chrono::steady_clock::now() + Rope::DEFAULT_PATIENCE;
+        while (!(buf = BufferPool::getInstance().tryAcquire())) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                LOG_WARN("Buffer pool stayed exhausted for %lld ms.",
+                         static_cast<long long>(Rope::DEFAULT_PATIENCE.count()));
+                _outOfMemory = true;
+                co_return false;
+            }
+            co_await ex.sleep(RESERVE_INTERVAL);
+        }
+        co_return true;
+    }
+
+  public:
+    AsyncReader(Executor &ex, const Connection &conn) : ex(ex), conn(conn) {}
+
+    // more因为申请不到缓冲区而失败
+    [[nodiscard]] bool outOfMemory() const noexcept {
+        return _outOfMemory;
+    }
+
+    [[nodiscard]] std::string_view available() const noexcept {
+        return {buf.data() + pos, end - pos};
+    }
+    void consume(size_t n) noexcept {
+        pos += n;
+    }
+    // 追加读取一次，连接关闭、出错、缓冲区已满或申请不到缓冲区时返回false
+    Task<bool> more() {
+        if (!buf && !co_await acquire())
+            co_return false;
+        if (pos == end) {
+            pos = end = 0;
+        } else if (end == buf.size() && pos > 0) {
+            std::memmove(buf.data(), buf.data() + pos, end - pos);
+            end -= pos;
+            pos = 0;
+        }
+        if (end == buf.size())
+            co_return false;
+        auto len = co_await conn.asyncReceive(ex, buf.data() + end, buf.size() - end);
+        if (len <= 0)
+            co_return false;
+        end += static_cast<size_t>(len);
+        co_return true;
+    }
+    // 读取到空行为止的响应头，连接在空行之前关闭或出错时返回空。
+    // 与StreamReader::readHeaders一样逐段复制出来，头部可以比一个块大
+    Task<std::optional<std::vector<char>>> readHeaders() {
+        std::vector<char> raw;
+        raw.reserve(1024);
+        while (true) {
+            const auto data = available();
+            const size_t old = raw.size();
+            raw.insert(raw.end(), data.begin(), data.end());
+            // 空行可能跨越两次接收
+            const auto found = std::string_view(raw.data(), raw.size()).find("\r\n\r\n", old < 3 ? 0 : old - 3);
+            if (found != std::string_view::npos) {
+                const size_t headerEnd = found + 4;
+                consume(headerEnd - old);
+                raw.resize(headerEnd);
+                co_return raw;
+            }
+            consume(data.size());
+            if (!co_await more())
+                co_return std::nullopt;
+        }
+    }
+    // 读取以CRLF结束的一行（不含CRLF），连接关闭或出错时返回空
+    Task<std::optional<std::string>> readLine() {
+        size_t eol;
+        while ((eol = available().find("\r\n")) == std::string_view::npos) {
+            if (!co_await more())
+                co_return std::nullopt;
+        }
+        std::string line(available().substr(0, eol));
+        consume(eol + 2);
+        co_return line;
+    }
+    // 跳过最后一个chunk之后的trailer，直到空行
+    Task<bool> skipTrailers() {
+        while (true) {
+            auto line = co_await readLine();
+            if (!line)
+                co_return false;
+            if (line->empty())
+                co_return true;
+        }
+    }
+    // 读取n字节追加到body
+    // 预算用尽时挂起协程等待其他传输归还块，而不是阻塞Executor线程；
+    // 与Rope的阻塞申请一样，超过Rope::DEFAULT_PATIENCE时返回false
+    Task<bool> reserve(Rope &body) {
+        const auto deadline = std::chrono::steady_clock::now() + Rope::DEFAULT_PATIENCE;
+        while (!body.tryReserve(1)) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                LOG_WARN("Buffer pool stayed exhausted for %lld ms.",
+                         static_cast<long long>(Rope::DEFAULT_PATIENCE.count()));
+                co_return false;
+            }
+            co_await ex.sleep(RESERVE_INTERVAL);
+        }
+        co_return true;
+    }
+    // 把缓冲区中已有的数据移入body
+    Task<bool> drain(Rope &body) {
+        while (!available().empty()) {
+            if (!co_await reserve(body))
+                co_return false;
+            auto [ptr, avail] = body.prepare();
+            if (!ptr)
+                co_return false;
+            auto len = std::min(avail, available().size());
+            std::memcpy(ptr, available().data(), len);
+            body.commit(len);
+            consume(len);
+        }
+        co_return true;
+    }
+    Task<Fill> readInto(Rope &body, size_t n) {
+        while (n) {
+            if (!co_await reserve(body))
+                co_return Fill::OutOfMemory;
+            auto [ptr, avail] = body.prepare();
+            if (!ptr)
+                co_return Fill::OutOfMemory;
+            auto len = std::min(n, avail);
+            auto received = co_await read(ptr, len);
+            body.commit(received);
+            if (received != len)
+                co_return Fill::Short;
+            n -= len;
+        }
+        co_return Fill::Ok;
+    }
+    // 先取缓冲区中已有的数据，不足部分直接收到dst
+    Task<size_t> read(char *dst, size_t n) {
+        auto take = std::min(n, available().size());
+        if (take)
+            std::memcpy(dst, available().data(), take);
+        consume(take);
+        if (take < n)
+            take += co_await conn.asyncReceiveNBytes(ex, dst + take, n - take);
+        co_return take;
+    }
+};
+
+// transfer中只属于本次请求的头部，按HTTP/1.1格式序列化
+std::string requestHeaderLines(const Transfer *transfer) {
+    std::string lines;
+    if (!transfer)
+        return lines;
+    for (const auto &[k, v] : transfer->requestHeaders())
+        lines.append(k).append(": ").append(v).append("\r\n");
+    return lines;
+}
+
+// 有transfer时按该粒度更新进度
+constexpr size_t PROGRESS_STEP = 64 * 1024;
+
+// 接收不完整时区分被取消、超时和连接断开
+Error shortReadError(const Connection &conn, const Transfer *transfer, Error otherwise) {
+    if (transfer && transfer->cancelled())
+        return Error::Cancelled;
+    if (conn.timedOut())
+        return Error::Timeout;
+    return otherwise;
+}
+
+// 请求期间允许其他线程通过关闭socket中断接收
+class TransferScope {
+  private:
+    Transfer *transfer;
+
+  public:
+    TransferScope(Transfer *transfer, const std::shared_ptr<Connection> &conn) : transfer(transfer) {
+        if (transfer)
+            transfer->attach([conn] { conn->shutdown(); });
+    }
+    ~TransferScope() {
+        reset();
+    }
+    TransferScope(const TransferScope &) = delete;
+    TransferScope &operator=(const TransferScope &) = delete;
+    void reset() {
+        if (transfer)
+            transfer->detach();
+        transfer = nullptr;
+    }
+};
+
+// 按transfer的设置解码body，或边收边交给sink。原始数据每收到一段就处理掉，
+// 有sink时解码前后的数据都不在内存中累积
+class BodyFilter {
+  private:
+    const Transfer::Sink &sink;
+    std::unique_ptr<Decoder> decoder;
+    Rope decoded;
+    Error _error{Error::Ok};
+
+    bool flush(Rope &data) {
+        if (!sink || data.empty())
+            return true;
+        if (!sink(std::exchange(data, Rope{}))) {
+            _error = Error::OutputError;
+            return false;
+        }
+        return true;
+    }
+
+  public:
+    BodyFilter(const Transfer::Sink &sink, std::unique_ptr<Decoder> decoder)
+        : sink(sink), decoder(std::move(decoder)) {}
+
+    [[nodiscard]] Error error() const noexcept {
+        return _error;
+    }
+
+    // 处理raw中新收到的数据并清空raw，出错时返回false
+    bool consume(Rope &raw) {
+        if (!decoder)
+            return flush(raw);
+        raw.forEach([this](const char *data, size_t n) {
+            if (_error == Error::Ok)
+                _error = decoder->decode(data, n, decoded);
+        });
+        raw.clear();
+        return _error == Error::Ok && flush(decoded);
+    }
+
+    // body已经收完，检查压缩流是否完整。没有sink时解码结果放回body
+    Error finish(Rope &body) {
+        if (!decoder)
+            return Error::Ok;
+        if (auto e = decoder->finish(); e != Error::Ok)
+            return e;
+        body = std::move(decoded);
+        return Error::Ok;
+    }
+};
+
+// 读取响应头之后的body，失败时设置resp的错误。连接状态不确定时标记为不再复用
+template <typename Transport>
+Fill receiveBody(StreamReader<Transport> &reader, PoolGuard &conn, HTTPResponse &resp, Rope &body,
+                 Transfer *transfer) {
+    const size_t step = transfer ? PROGRESS_STEP : SIZE_MAX;
+    std::optional<BodyFilter> filter;
+    if (transfer && resp.hasBody() && resp.status() < 300) {
+        std::unique_ptr<Decoder> decoder;
+        if (const auto encoding = resp["Content-Encoding"]; transfer->decoding() && !Decoder::identity(encoding)) {
+            if (!(decoder = Decoder::create(encoding))) {
+                LOG_ERROR("Unsupported Content-Encoding: %.*s", static_cast<int>(encoding.size()), encoding.data());
+                resp.setError(Error::DecodeFailed);
+                conn.discard();
+                return Fill::Ok;
+            }
+        }
+        if (decoder || transfer->bodySink())
+            filter.emplace(transfer->bodySink(), std::move(decoder));
+    }
+    auto onReceived = [transfer, &filter, &body](size_t n) {
+        if (transfer)
+            transfer->addReceived(n);
+        return !filter || filter->consume(body);
     };
-    CharState s = CharState::PLAIN;
-    while (conn->receive(&response, sizeof(response)) != 0) {
-        if (response == '\r') {
-            if (s == CharState::RN) {
-                s = CharState::RNR;
-            } else {
-                s = CharState::R;
+    Fill fill = Fill::Ok;
+    if (!resp.hasBody()) {
+        // 304等响应即使带有Content-Length也没有body
+    } else if (resp.declaredLength() >= 0) {
+        fill = reader.readInto(body, static_cast<size_t>(resp.declaredLength()), step, onReceived);
+        if (fill == Fill::Short)
+            resp.setError(shortReadError(*conn.get(), transfer, Error::IncompleteBody));
+    } else if (resp.chunked()) {
+        while (true) {
+            auto chunkLen = reader.readChunkSize();
+            if (!chunkLen) {
+                resp.setError(shortReadError(*conn.get(), transfer, Error::BadResponse));
+                break;
+            }
+            if (*chunkLen == 0) {
+                if (!reader.skipTrailers())
+                    resp.setError(shortReadError(*conn.get(), transfer, Error::IncompleteBody));
+                break;
+            }
+            // 块是随数据到达逐个申请的，不会按服务器给出的长度预先分配
+            fill = reader.readInto(body, *chunkLen, step, onReceived);
+            if (fill != Fill::Ok) {
+                if (fill == Fill::Short)
+                    resp.setError(shortReadError(*conn.get(), transfer, Error::IncompleteBody));
+                break;
             }
-            // \r字符在接收时直接丢掉
-        } else if (response == '\n') {
-            if (s == CharState::R) {
-                s = CharState::RN;
-            } else if (s == CharState::RNR) {
-                s = CharState::RNRN;
-            } else {
-                s = CharState::PLAIN;
+            //  取出\r\n
+            if (auto crlf = reader.readLine(); !crlf || !crlf->empty()) {
+                resp.setError(shortReadError(*conn.get(), transfer, Error::BadResponse));
+                break;
             }
-            receivedHeaders.push_back(response);
-        } else {
-            s = CharState::PLAIN;
-            receivedHeaders.push_back(response);
         }
-        if (s == CharState::RNRN)
-            break;
+    } else {
+        fill = reader.readUntilClosed(body, onReceived);
+        if (fill == Fill::Short)
+            resp.setError(shortReadError(*conn.get(), transfer, Error::IncompleteBody));
+        else if (fill == Fill::Ok && transfer && transfer->cancelled())
+            resp.setError(Error::Cancelled);
+        // 没有长度信息时以连接关闭作为结束
+        conn.discard();
     }
-    return HTTPResponse{receivedHeaders};
+    if (filter && filter->error() != Error::Ok) {
+        resp.setError(filter->error());
+    } else if (filter && fill == Fill::Ok && resp.error() == Error::Ok) {
+        if (auto e = filter->finish(body); e != Error::Ok)
+            resp.setError(e);
+    }
+    // 响应之后还有数据时连接的状态不确定，不再复用
+    if (fill != Fill::Ok || resp.error() != Error::Ok || !reader.available().empty())
+        conn.discard();
+    return fill;
+}
+
+// 连接会被放回连接池供同步接口使用，结束时恢复阻塞模式
+struct BlockingRestorer {
+    const Connection &conn;
+    ~BlockingRestorer() {
+        conn.setNonBlocking(false);
+    }
+};
+
+} // namespace
+
+std::shared_ptr<const RequestTemplate> HTTPConnection::requestTemplate(std::string_view method, const std::string &host) const {
+    std::string key;
+    key.append(method).push_back(' ');
+    key.append(host);
+
+    std::lock_guard<std::mutex> locker(templateMutex);
+    auto &tpl = templates[key];
+    if (!tpl)
+        tpl = std::make_shared<const RequestTemplate>(method, host, headers);
+    return tpl;
+}
+
+bool HTTPConnection::sendRequest(const std::shared_ptr<Connection> &conn, const RequestTemplate &tpl,
+                                 std::string_view path, int64_t beginPos, int64_t endPos, std::string_view extra) {
+    thread_local RequestBuffer buf;
+    tpl.fill(buf, path, beginPos, endPos, extra);
+    return conn->sendv(buf.data(), buf.size()) == static_cast<ssize_t>(buf.bytes());
 }
 
 void HTTPConnection::setHeader(const std::string &key, const std::string &val) {
     headers.emplace(key, val);
+    std::lock_guard<std::mutex> locker(templateMutex);
+    templates.clear();
 }
 
 void HTTPConnection::initHeaders() noexcept {
@@ -62,104 +397,323 @@ void HTTPConnection::initHeaders() noexcept {
     headers.emplace("Accept", "*/*");
 }
 
-HTTPResponse HTTPConnection::head(const std::string &url) {
+std::string HTTPConnection::redirected(const std::string &url) const {
+    std::lock_guard<std::mutex> locker(redirectMutex);
+    auto target = url;
+    // 限制跳数，避免循环重定向
+    for (int i = 0; i < 10; ++i) {
+        auto it = redirects.find(target);
+        if (it == redirects.end())
+            break;
+        target = it->second;
+    }
+    return target;
+}
+
+std::string HTTPConnection::redirect(const std::string &url, const HTTPResponse &res) {
+    auto target = resolveUrl(url, res["Location"]);
+    std::lock_guard<std::mutex> locker(redirectMutex);
+    redirects[url] = target;
+    return target;
+}
+
+void HTTPConnection::prewarm(const std::string &url, size_t count) {
+    const auto target = redirected(url);
+    auto &pool = ThreadPool::getInstance();
+    // 预热本身也在池中运行，线程池已满时由它依次建立连接
+    ThreadPool::Group group;
+    std::vector<std::future<void>> tasks;
+    for (size_t i = 0; i < count; ++i) {
+        tasks.push_back(pool.submit([&] {
+            auto conn = PoolGuard(target, proxy, true, timeouts, socketOptions);
+            if (!conn->connected())
+                conn.discard();
+        }, &group));
+    }
+    for (auto &t : tasks)
+        pool.wait(t, &group);
+}
+
+HTTPResponse HTTPConnection::head(const std::string &url, Transfer *transfer) {
+    if (auto target = redirected(url); target != url)
+        return head(target, transfer);
     LOG_INFO("Heading url: %s", url.c_str());
 
-    auto conn = PoolGuard(url, proxy);
+    auto [protocol, hostname, port, path] = formatHost(url);
+    if (protocol.empty())
+        return HTTPResponse::failure(Error::InvalidUrl);
+    auto conn = PoolGuard(url, proxy, true, timeouts, socketOptions);
 
-    if (!conn->connected() && !conn->connect()) {
-        return HTTPResponse{};
+    // 连接池建立连接时已经超时的不再重试
+    if (!conn->connected() && (conn->error() == Error::Timeout || !conn->connect())) {
+        return HTTPResponse::failure(conn->error());
     }
-    auto [_, hostname, _port, path] = formatHost(url);
-    headers["Host"] = hostname;
-    auto req = constructHeaders(path, "HEAD");
-    conn->send(req.data(), req.length());
-    auto res = receiveHTTPHeaders(conn);
+    TransferScope scope{transfer, conn.get()};
+    auto tpl = requestTemplate("HEAD", hostHeader(protocol, hostname, port));
+    conn->setReceiveTimeout(timeouts.firstByte);
+    if (!sendRequest(conn.get(), *tpl, path, -1, -1, requestHeaderLines(transfer))) {
+        const auto error = shortReadError(*conn.get(), transfer, Error::SendFailed);
+        conn.discard();
+        return HTTPResponse::failure(error);
+    }
+    auto res = withTransport(*conn.get(), [](const auto &transport) {
+        // HEAD的响应没有body，头部之后不会有多余的数据
+        return StreamReader{transport}.readHeaders();
+    });
+    if (res.error() != Error::Ok) {
+        res.setError(shortReadError(*conn.get(), transfer, Error::BadResponse));
+        conn.discard();
+        return res;
+    }
+    conn->setReceiveTimeout(timeouts.idle);
     //    res.displayHeaders();
     if (res.status() == 301 || res.status() == 302) {
+        scope.reset();
         conn.release();
-        res = head(res["Location"]);
+        res = head(redirect(url, res), transfer);
     }
     return res;
 }
 
-HTTPResponse HTTPConnection::get(const std::string &url) {
+HTTPResponse HTTPConnection::get(const std::string &url, int64_t beginPos, int64_t endPos, Transfer *transfer) {
+    if (auto target = redirected(url); target != url)
+        return get(target, beginPos, endPos, transfer);
     LOG_INFO("Getting url: %s", url.c_str());
-    auto conn = PoolGuard(url, proxy);
-
-    if (!conn->connected() && !conn->connect()) {
-        return HTTPResponse{};
-    }
-
-    auto [_, hostname, _port, path] = formatHost(url);
-    headers["Host"] = hostname;
-    auto req = constructHeaders(path);
-    conn->send(req.data(), req.length());
-
-    auto resp = receiveHTTPHeaders(conn);
-    //        resp.displayHeaders();
-    if (resp.status() == 301 || resp.status() == 302) {
-        return get(resp["Location"]);
-    }
-    // BUF_SIZE = 1MB
-    constexpr size_t BUF_SIZE = 1024 * 1024;
-    std::vector<char> buf(BUF_SIZE);
-    std::vector<char> body;
-    if (resp.contains("Content-Length")) {
-        auto contentLength = std::stoull(resp["Content-Length"]);
-        body.resize(contentLength);
-        conn->receiveNBytes(body.data(), contentLength);
-    } else if (resp.contains("Transfer-Encoding") && resp["Transfer-Encoding"].find("chunked") != std::string::npos) {
-        char response;
-        size_t chunkLen = 0;
-        std::string chunkLength;
+    auto [protocol, hostname, port, path] = formatHost(url);
+    if (protocol.empty())
+        return HTTPResponse::failure(Error::InvalidUrl);
+    auto conn = PoolGuard(url, proxy, true, timeouts, socketOptions);
+
+    // 连接池建立连接时已经超时的不再重试
+    if (!conn->connected() && (conn->error() == Error::Timeout || !conn->connect())) {
+        return HTTPResponse::failure(conn->error());
+    }
+    // 其他线程可以通过关闭socket打断阻塞中的接收
+    TransferScope scope{transfer, conn.get()};
+
+    auto tpl = requestTemplate("GET", hostHeader(protocol, hostname, port));
+    conn->setReceiveTimeout(timeouts.firstByte);
+    auto extra = requestHeaderLines(transfer);
+    // 只有HTTP/1.1的接收路径会解码，Accept-Encoding不放进transfer的通用头部
+    if (transfer && transfer->decoding() && beginPos < 0 && !Decoder::accepted().empty())
+        extra.append("Accept-Encoding: ").append(Decoder::accepted()).append("\r\n");
+    if (!sendRequest(conn.get(), *tpl, path, beginPos, endPos, extra)) {
+        const auto error = shortReadError(*conn.get(), transfer, Error::SendFailed);
+        conn.discard();
+        return HTTPResponse::failure(error);
+    }
+
+    // 连接的具体类型只在这里判断一次，之后的接收和解析按该类型实例化
+    return withTransport(*conn.get(), [&](const auto &transport) {
+        StreamReader reader{transport};
+        auto resp = reader.readHeaders();
+        if (resp.error() != Error::Ok) {
+            resp.setError(shortReadError(*conn.get(), transfer, Error::BadResponse));
+            conn.discard();
+            return resp;
+        }
+        conn->setReceiveTimeout(timeouts.idle);
+        //        resp.displayHeaders();
+        if (resp.status() == 301 || resp.status() == 302) {
+            scope.reset();
+            conn.discard();
+            return get(redirect(url, resp), beginPos, endPos, transfer);
+        }
+        if (transfer)
+            transfer->headersReceived(url, resp);
+        // body直接接收到缓冲池的块中，增长时不搬移已有数据
+        Rope body;
+        if (receiveBody(reader, conn, resp, body, transfer) == Fill::OutOfMemory)
+            return HTTPResponse::failure(Error::OutOfMemory);
+        if (resp.error() == Error::Ok)
+            noteSocket(conn->socketInfo());
+        resp.parseBody(body);
+        return resp;
+    });
+}
+
+HTTPResponse HTTPConnection::request(std::string_view method, const std::string &url, std::string_view headerLines,
+                                     const iovec *body, size_t count, Transfer *transfer) {
+    LOG_INFO("%.*s url: %s", static_cast<int>(method.size()), method.data(), url.c_str());
+    auto [protocol, hostname, port, path] = formatHost(url);
+    if (protocol.empty())
+        return HTTPResponse::failure(Error::InvalidUrl);
+    auto conn = PoolGuard(url, proxy, true, timeouts, socketOptions);
+    if (!conn->connected() && (conn->error() == Error::Timeout || !conn->connect()))
+        return HTTPResponse::failure(conn->error());
+    TransferScope scope{transfer, conn.get()};
+
+    uint64_t length = 0;
+    for (size_t i = 0; i < count; ++i)
+        length += body[i].iov_len;
+    std::string extra(headerLines);
+    extra.append(requestHeaderLines(transfer)).append("Content-Length: ").append(std::to_string(length)).append("\r\n");
+    auto tpl = requestTemplate(method, hostHeader(protocol, hostname, port));
+    conn->setReceiveTimeout(timeouts.firstByte);
+    if (!sendRequest(conn.get(), *tpl, path, -1, -1, extra) || !conn->sendSlices(body, count)) {
+        const auto error = shortReadError(*conn.get(), transfer, Error::SendFailed);
+        conn.discard();
+        return HTTPResponse::failure(error);
+    }
+
+    return withTransport(*conn.get(), [&](const auto &transport) {
+        StreamReader reader{transport};
+        auto resp = reader.readHeaders();
+        if (resp.error() != Error::Ok) {
+            resp.setError(shortReadError(*conn.get(), transfer, Error::BadResponse));
+            conn.discard();
+            return resp;
+        }
+        conn->setReceiveTimeout(timeouts.idle);
+        Rope received;
+        if (receiveBody(reader, conn, resp, received, transfer) == Fill::OutOfMemory)
+            return HTTPResponse::failure(Error::OutOfMemory);
+        resp.parseBody(received);
+        return resp;
+    });
+}
+
+Task<HTTPResponse> HTTPConnection::asyncGet(Executor &ex, std::string url, int64_t beginPos, int64_t endPos) {
+    url = redirected(url);
+    auto res = co_await asyncRequest(ex, "GET", url, beginPos, endPos);
+    while (res.status() == 301 || res.status() == 302) {
+        url = redirect(url, res);
+        res = co_await asyncRequest(ex, "GET", url, beginPos, endPos);
+    }
+    co_return res;
+}
+
+Task<HTTPResponse> HTTPConnection::asyncHead(Executor &ex, std::string url) {
+    url = redirected(url);
+    auto res = co_await asyncRequest(ex, "HEAD", url, -1, -1);
+    while (res.status() == 301 || res.status() == 302) {
+        url = redirect(url, res);
+        res = co_await asyncRequest(ex, "HEAD", url, -1, -1);
+    }
+    co_return res;
+}
+
+Task<HTTPResponse> HTTPConnection::asyncRequest(Executor &ex, std::string_view method, const std::string &url,
+                                                int64_t beginPos, int64_t endPos) {
+    LOG_INFO("Requesting url asynchronously: %s", url.c_str());
+    auto [protocol, hostname, port, path] = formatHost(url);
+    if (protocol.empty())
+        co_return HTTPResponse::failure(Error::InvalidUrl);
+    auto conn = PoolGuard(url, proxy, false, timeouts, socketOptions);
+    BlockingRestorer restorer{*conn.get()};
+    if (conn->connected()) {
+        conn->setNonBlocking(true);
+    } else if (!co_await conn->asyncConnect(ex)) {
+        co_return HTTPResponse::failure(conn->error());
+    }
+    conn->setReceiveTimeout(timeouts.firstByte);
+
+    // 协程会在发送中途挂起，不能使用thread_local的缓冲区
+    auto tpl = requestTemplate(method, hostHeader(protocol, hostname, port));
+    RequestBuffer req;
+    tpl->fill(req, path, beginPos, endPos);
+    std::string data;
+    data.reserve(req.bytes());
+    for (size_t i = 0; i < req.size(); ++i)
+        data.append(static_cast<const char *>(req.data()[i].iov_base), req.data()[i].iov_len);
+    if (co_await conn->asyncSend(ex, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+        conn.discard();
+        co_return HTTPResponse::failure(conn->timedOut() ? Error::Timeout : Error::SendFailed);
+    }
+
+    AsyncReader reader{ex, *conn.get()};
+    // 接收不完整时区分缓冲池耗尽、超时和连接断开
+    auto shortRead = [&](Error otherwise) {
+        if (reader.outOfMemory())
+            return Error::OutOfMemory;
+        return conn->timedOut() ? Error::Timeout : otherwise;
+    };
+    auto header = co_await reader.readHeaders();
+    if (!header) {
+        conn.discard();
+        co_return HTTPResponse::failure(shortRead(Error::BadResponse));
+    }
+    conn->setReceiveTimeout(timeouts.idle);
+    HTTPResponse resp{std::move(*header)};
+    if (resp.status() < 0) {
+        resp.setError(Error::BadResponse);
+        conn.discard();
+        co_return resp;
+    }
+    if (method == "HEAD" || !resp.hasBody())
+        co_return resp;
+
+    // 在Executor线程中不阻塞等待预算，由reader.reserve挂起协程，形成背压
+    Rope body;
+    body.setPatience(std::chrono::milliseconds(0));
+    if (resp.declaredLength() >= 0) {
+        auto fill = co_await reader.readInto(body, static_cast<size_t>(resp.declaredLength()));
+        if (fill == Fill::OutOfMemory) {
+            conn.discard();
+            co_return HTTPResponse::failure(Error::OutOfMemory);
+        }
+        if (fill == Fill::Short)
+            resp.setError(conn->timedOut() ? Error::Timeout : Error::IncompleteBody);
+    } else if (resp.chunked()) {
         while (true) {
-            while (conn->receive(&response, 1) != 0) {
-                if (response == '\r') {
-                    conn->receive(&response, 1);
-                    break;
-                } else {
-                    chunkLength += response;
-                }
+            auto line = co_await reader.readLine();
+            if (!line) {
+                resp.setError(shortRead(Error::IncompleteBody));
+                break;
+            }
+            // 忽略chunk扩展
+            std::string chunkLength = line->substr(0, line->find(';'));
+            size_t chunkLen;
+            try {
+                chunkLen = std::stoull(chunkLength, nullptr, 16);
+            } catch (std::exception &) {
+                LOG_ERROR("Invalid chunk length: %s", chunkLength.c_str());
+                resp.setError(Error::BadResponse);
+                break;
             }
-            chunkLen = std::stoull(chunkLength, nullptr, 16);
-            chunkLength.clear();
-            if (chunkLen == 0)
+            if (chunkLen == 0) {
+                // 最后一个chunk之后还有trailer和空行，留在连接上会被下一个请求当成响应
+                if (!co_await reader.skipTrailers())
+                    resp.setError(shortRead(Error::IncompleteBody));
                 break;
+            }
 
-            if (buf.size() < chunkLen) {
-                try {
-                    buf.resize(chunkLen);
-                } catch (std::exception &e) {
-                    LOG_INFO("Failed to alloc memory, download failed.");
-                    std::cerr << "Failed to alloc memory, download failed." << std::endl;
-                    std::cerr << e.what() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
+            auto fill = co_await reader.readInto(body, chunkLen);
+            if (fill == Fill::OutOfMemory) {
+                conn.discard();
+                co_return HTTPResponse::failure(Error::OutOfMemory);
             }
-            conn->receiveNBytes(buf.data(), chunkLen);
-            body.insert(end(body), begin(buf), begin(buf) + chunkLen);
-            //  取出\r\n
-            conn->receiveNBytes(buf.data(), 2);
-        }
-    } else {
-        ssize_t len = 0;
-        while (true) {
-            len = conn->receive(buf.data(), buf.size());
-            if (len < 0) {
-                perror("receive without length");
+            if (fill == Fill::Short) {
+                resp.setError(shortRead(Error::IncompleteBody));
                 break;
-            } else if (len == 0) {
-                std::cerr << "peer closed..." << std::endl;
+            }
+            //  取出\r\n，和同步读取一样，不是空行说明chunk长度与数据不符
+            if (auto crlf = co_await reader.readLine(); !crlf || !crlf->empty()) {
+                resp.setError(shortRead(Error::BadResponse));
                 break;
-            } else {
-                body.insert(body.end(), std::begin(buf), std::begin(buf) + len);
             }
         }
+    } else {
+        // 没有长度信息时以连接关闭作为结束
+        do {
+            if (!co_await reader.drain(body)) {
+                conn.discard();
+                co_return HTTPResponse::failure(Error::OutOfMemory);
+            }
+        } while (co_await reader.more());
+        if (reader.outOfMemory() || conn->timedOut())
+            resp.setError(shortRead(Error::Ok));
+        conn.discard();
     }
+    // 响应之后还有数据时连接的状态不确定，不再复用
+    if (resp.error() != Error::Ok || !reader.available().empty())
+        conn.discard();
+    else
+        noteSocket(conn->socketInfo());
     resp.parseBody(body);
-    return resp;
+    co_return resp;
 }
+
 void HTTPConnection::setProxy(const std::string &_proxy) {
     this->proxy = _proxy;
 }
@@ -1,103 +1,163 @@
 #include "HTTPResponse.h"
 
+#include <charconv>
+
 namespace multi_get {
 
-void HTTPResponse::displayHeaders() const noexcept {
-    std::cout << _httpVersion << " " <<  _status << " " << _statusText << std::endl;
-    for (const auto &[k, v] : _headers) {
-        std::cout << k << ": " << v << std::endl;
-    }
+namespace {
+
+inline char toLower(char c) noexcept {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
 }
 
-void HTTPResponse::parse(const std::string &resText) {
-    // for (char c : resText) std::cout << c;
-    // std::cout << std::endl;
-    ResponseParts parts = ResponseParts::StartLine;
-    std::istringstream buffer(resText);
-    std::string line;
-    while (std::getline(buffer, line)) {
-        switch (parts) {
-        case ResponseParts::StartLine: {
-            std::istringstream temp(line);
-            temp >> this->_httpVersion;
-            temp >> this->_status;
-            temp.get();
-            std::getline(temp, this->_statusText);
-            parts = ResponseParts::Headers;
-            break;
-        }
-        case ResponseParts::Headers: {
-            if (line.length() == 1) {
-                parts = ResponseParts::Body;
-                break;
-            }
-            auto idx = line.find(':');
-            if (idx == std::string::npos)
-                continue;
-            auto idx2 = idx + 1;
-            while (line[idx2] == ' ') ++idx2; // 去除首部空格
-            this->_headers[line.substr(0, idx)] = line.substr(idx2); // 去除尾部\r
-            break;
-        }
-        case ResponseParts::Body: {
-            this->_body.insert(_body.end(), line.begin(), line.end());
-            this->_body.push_back('\n');
-            break;
-        }
-        }
+inline std::string_view trim(std::string_view s) noexcept {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+        s.remove_suffix(1);
+    return s;
+}
+
+inline bool parseInt(std::string_view s, int64_t &val) noexcept {
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), val);
+    return ec == std::errc{} && ptr == s.data() + s.size();
+}
+
+bool icontains(std::string_view haystack, std::string_view needle) noexcept {
+    if (needle.size() > haystack.size())
+        return false;
+    for (size_t i = 0; i + needle.size() <= haystack.size(); ++i) {
+        if (iequals(haystack.substr(i, needle.size()), needle))
+            return true;
     }
+    return false;
 }
 
-void HTTPResponse::parse(const std::vector<char> &data) {
-    // for (char c : data) std::cout << c;
-    // std::cout << std::endl;
-    ResponseParts parts = ResponseParts::StartLine;
-    std::string line;
-    size_t pos = 0;
-    bool parsed = false;
-    while (!parsed) {
-        getline(data, pos, line);
-        switch (parts) {
-        case ResponseParts::StartLine: {
-            std::istringstream temp(line);
-            temp >> this->_httpVersion;
-            temp >> this->_status;
-            temp.get();
-            std::getline(temp, this->_statusText);
-            parts = ResponseParts::Headers;
-            break;
-        }
-        case ResponseParts::Headers: {
-            if (line.length() == 1) {
-                parts = ResponseParts::Body;
-                break;
-            }
-            auto idx = line.find(':');
-            if (idx == std::string::npos)
-                continue;
-            auto idx2 = idx + 1;
-            while (line[idx2] == ' ') ++idx2; // 去除首部空格
-            this->_headers[line.substr(0, idx)] = line.substr(idx2);
-            break;
-        }
-        case ResponseParts::Body: {
-            parsed = true;
-            break;
-        }
-        default:
-            break;
-        }
+// bytes first-last/total 或 bytes */total
+ContentRange parseContentRange(std::string_view v) noexcept {
+    ContentRange range;
+    if (v.size() < 6 || !iequals(v.substr(0, 6), "bytes "))
+        return range;
+    v.remove_prefix(6);
+    auto slash = v.find('/');
+    if (slash == std::string_view::npos)
+        return range;
+    auto total = v.substr(slash + 1);
+    if (total != "*" && !parseInt(total, range.total))
+        range.total = -1;
+    auto span = v.substr(0, slash);
+    auto dash = span.find('-');
+    if (dash == std::string_view::npos)
+        return range;
+    if (!parseInt(span.substr(0, dash), range.first) || !parseInt(span.substr(dash + 1), range.last)) {
+        range.first = range.last = -1;
     }
+    return range;
 }
 
-bool HTTPResponse::getline(const std::vector<char> &data, size_t &pos, std::string &val) {
-    val.clear();
-    while (data[pos] != '\n') {
-        val.push_back(data[pos]);
-        ++pos;
+} // namespace
+
+bool iequals(std::string_view a, std::string_view b) noexcept {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (toLower(a[i]) != toLower(b[i]))
+            return false;
     }
-    ++pos;
     return true;
 }
 
-} // namespace multi_get
\ No newline at end of file
+HTTPResponse::HTTPResponse(const HTTPResponse &other)
+    : _raw(other._raw), _headers(other._headers), _headerCount(other._headerCount),
+      _status(other._status), _statusText(other._statusText), _httpVersion(other._httpVersion),
+      _declaredLength(other._declaredLength), _contentRange(other._contentRange),
+      _chunked(other._chunked), _body(other._body), _error(other._error) {
+    rebase(other._raw.data());
+}
+
+HTTPResponse &HTTPResponse::operator=(const HTTPResponse &other) {
+    if (this != &other) {
+        HTTPResponse tmp(other);
+        *this = std::move(tmp);
+    }
+    return *this;
+}
+
+void HTTPResponse::rebase(const char *oldBase) noexcept {
+    const char *newBase = _raw.data();
+    auto move = [&](std::string_view &sv) {
+        if (sv.data())
+            sv = std::string_view(newBase + (sv.data() - oldBase), sv.size());
+    };
+    for (size_t i = 0; i < _headerCount; ++i) {
+        move(_headers[i].name);
+        move(_headers[i].value);
+    }
+    move(_statusText);
+    move(_httpVersion);
+}
+
+void HTTPResponse::displayHeaders() const noexcept {
+    std::cout << _httpVersion << " " << _status << " " << _statusText << std::endl;
+    for (const auto &[k, v] : *this) {
+        std::cout << k << ": " << v << std::endl;
+    }
+}
+
+bool HTTPResponse::parse() noexcept {
+    _headerCount = 0;
+    _status = -1;
+    _declaredLength = -1;
+    _contentRange = {};
+    _chunked = false;
+
+    std::string_view text(_raw.data(), _raw.size());
+    bool startLine = true;
+    while (!text.empty()) {
+        auto eol = text.find('\n');
+        auto line = text.substr(0, eol);
+        text = eol == std::string_view::npos ? std::string_view{} : text.substr(eol + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+
+        if (startLine) {
+            // HTTP/1.1 200 OK
+            startLine = false;
+            auto sp = line.find(' ');
+            if (sp == std::string_view::npos)
+                return false;
+            _httpVersion = line.substr(0, sp);
+            auto rest = line.substr(sp + 1);
+            auto sp2 = rest.find(' ');
+            int64_t status;
+            if (!parseInt(rest.substr(0, sp2), status))
+                return false;
+            _status = static_cast<int>(status);
+            _statusText = sp2 == std::string_view::npos ? std::string_view{} : rest.substr(sp2 + 1);
+            continue;
+        }
+        // 空行表示头部结束
+        if (line.empty())
+            break;
+        auto idx = line.find(':');
+        if (idx == std::string_view::npos)
+            continue;
+        const auto name = trim(line.substr(0, idx));
+        const auto value = trim(line.substr(idx + 1));
+
+        // 预先解析常用字段，超出MAX_HEADERS的字段不保存，但决定body长度的字段仍要生效
+        if (iequals(name, "Content-Length")) {
+            if (!parseInt(value, _declaredLength))
+                _declaredLength = -1;
+        } else if (iequals(name, "Content-Range")) {
+            _contentRange = parseContentRange(value);
+        } else if (iequals(name, "Transfer-Encoding")) {
+            _chunked = icontains(value, "chunked");
+        }
+        if (_headerCount < MAX_HEADERS)
+            _headers[_headerCount++] = {name, value};
+    }
+    return _status >= 0;
+}
+
+} // namespace multi_get
@@ -0,0 +1,381 @@
+#include "OutputFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.h"
+
+namespace fs = std::filesystem;
+
+namespace multi_get {
+
+namespace {
+
+// 文件系统不支持预留空间时，至少在开始下载前确认剩余空间足够
+bool enoughSpace(const fs::path &file, uint64_t size) {
+    auto dir = file.parent_path();
+    if (dir.empty())
+        dir = ".";
+    std::error_code ec;
+    auto info = fs::space(dir, ec);
+    return ec || info.available >= size;
+}
+
+bool allZero(const char *p, size_t n) {
+    return n == 0 || (p[0] == 0 && std::memcmp(p, p + 1, n - 1) == 0);
+}
+
+// 按顺序从一组iovec中取出数据
+class IovReader {
+  private:
+    const iovec *iov;
+    size_t cnt;
+    size_t idx{0};
+    size_t off{0};
+
+  public:
+    IovReader(const iovec *iov, size_t cnt) : iov(iov), cnt(cnt) {}
+    void take(char *dst, size_t n) {
+        while (n && idx < cnt) {
+            const auto len = std::min(n, iov[idx].iov_len - off);
+            std::memcpy(dst, static_cast<const char *>(iov[idx].iov_base) + off, len);
+            dst += len;
+            n -= len;
+            off += len;
+            if (off == iov[idx].iov_len) {
+                ++idx;
+                off = 0;
+            }
+        }
+    }
+};
+
+} // namespace
+
+OutputFile::OutputFile(fs::path target, uint64_t size, Mode mode, bool sparse)
+    : target(std::move(target)), size(size), mode(mode), sparse(sparse) {
+    temp = this->target;
+    temp += ".download";
+}
+
+OutputFile::~OutputFile() {
+    discard();
+}
+
+#ifdef _WIN32
+
+Error OutputFile::open() {
+    if (!sparse && !enoughSpace(temp, size))
+        return Error::DiskFull;
+    {
+        std::ofstream create(temp, std::ios::binary | std::ios::trunc);
+    }
+    std::error_code ec;
+    fs::resize_file(temp, size, ec);
+    out.open(temp, std::ios::binary | std::ios::in | std::ios::out);
+    return ec || !out ? Error::FileError : Error::Ok;
+}
+
+void OutputFile::flush(uint64_t, uint64_t) noexcept {}
+
+Error OutputFile::writeAt(uint64_t offset, const iovec *iov, size_t cnt) {
+    std::lock_guard<std::mutex> locker(m);
+    out.seekp(static_cast<std::streamoff>(offset));
+    for (size_t i = 0; i < cnt; ++i)
+        out.write(static_cast<const char *>(iov[i].iov_base), static_cast<std::streamsize>(iov[i].iov_len));
+    return out ? Error::Ok : Error::FileError;
+}
+
+Error OutputFile::commit() {
+    out.close();
+    std::error_code ec;
+    if (!out)
+        return Error::FileError;
+    fs::rename(temp, target, ec);
+    return ec ? Error::FileError : Error::Ok;
+}
+
+void OutputFile::discard() noexcept {
+    if (out.is_open())
+        out.close();
+    std::error_code ec;
+    fs::remove(temp, ec);
+}
+
+#else
+
+namespace {
+
+Error writeError(const fs::path &path, int err) {
+    LOG_ERROR("Writing %s failed: %s", path.string().c_str(), std::strerror(err));
+    return err == ENOSPC || err == EDQUOT ? Error::DiskFull : Error::FileError;
+}
+
+// 写完全部数据，pwritev可能只写出一部分
+bool pwriteAll(int fd, uint64_t offset, const iovec *iov, size_t cnt) {
+    std::vector<iovec> rest(iov, iov + cnt);
+    size_t first = 0;
+    while (first < rest.size()) {
+        const int batch = static_cast<int>(std::min<size_t>(rest.size() - first, IOV_MAX));
+        auto len = ::pwritev(fd, rest.data() + first, batch, static_cast<off_t>(offset));
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        offset += static_cast<uint64_t>(len);
+        auto written = static_cast<size_t>(len);
+        while (first < rest.size() && written >= rest[first].iov_len)
+            written -= rest[first++].iov_len;
+        if (written) {
+            rest[first].iov_base = static_cast<char *>(rest[first].iov_base) + written;
+            rest[first].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+bool pwriteAll(int fd, uint64_t offset, const char *data, size_t n) {
+    iovec iov{const_cast<char *>(data), n};
+    return pwriteAll(fd, offset, &iov, 1);
+}
+
+struct AlignedFree {
+    void operator()(char *p) const noexcept {
+        ::operator delete(p, std::align_val_t{OutputFile::DIRECT_ALIGN});
+    }
+};
+
+} // namespace
+
+Error OutputFile::open() {
+    fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create %s: %s", temp.string().c_str(), std::strerror(errno));
+        return Error::FileError;
+    }
+    if (size == 0)
+        return Error::Ok;
+
+    // 一次预留全部空间，文件在磁盘上尽量连续，写入时也不再更新文件大小。
+    // 稀疏文件只设置大小，没有写入的部分不占用磁盘
+    int err = EOPNOTSUPP;
+#ifdef __linux__
+    if (!sparse)
+        err = ::fallocate(fd, 0, 0, static_cast<off_t>(size)) == 0 ? 0 : errno;
+#endif
+    if (err == EOPNOTSUPP || err == ENOSYS) {
+        err = 0;
+        if (!sparse && !enoughSpace(temp, size))
+            err = ENOSPC;
+        else if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+            err = errno;
+    }
+    if (err) {
+        LOG_ERROR("Failed to reserve %llu bytes for %s: %s", static_cast<unsigned long long>(size),
+                  temp.string().c_str(), std::strerror(err));
+        return err == ENOSPC || err == EFBIG || err == EDQUOT ? Error::DiskFull : Error::FileError;
+    }
+
+    if (mode == Mode::Map) {
+        void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            LOG_WARN("Failed to map %s, writing it with pwrite: %s", temp.string().c_str(), std::strerror(errno));
+            mode = Mode::Write;
+        } else {
+            mapped = static_cast<char *>(addr);
+        }
+    } else if (mode == Mode::Direct) {
+#ifdef O_DIRECT
+        directFd = ::open(temp.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+#else
+        errno = EOPNOTSUPP;
+#endif
+        if (directFd < 0) {
+            // tmpfs等文件系统不支持O_DIRECT
+            LOG_WARN("O_DIRECT is not available for %s, using buffered writes: %s", temp.string().c_str(),
+                     std::strerror(errno));
+            mode = Mode::Write;
+        }
+    }
+    return Error::Ok;
+}
+
+void OutputFile::flush(uint64_t offset, uint64_t n) noexcept {
+#ifdef __linux__
+    // 映射区中的脏页也在页缓存里，两种方式都可以用sync_file_range发起回写
+    ::sync_file_range(fd, static_cast<off_t>(offset), static_cast<off_t>(n), SYNC_FILE_RANGE_WRITE);
+#else
+    if (mapped) {
+        const auto page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+        const uint64_t begin = offset / page * page;
+        ::msync(mapped + begin, offset + n - begin, MS_ASYNC);
+    }
+#endif
+}
+
+Error OutputFile::writeDirect(uint64_t offset, const iovec *iov, size_t cnt, uint64_t n) {
+    thread_local std::unique_ptr<char, AlignedFree> bounce{
+        static_cast<char *>(::operator new(DIRECT_CHUNK, std::align_val_t{DIRECT_ALIGN}))};
+    IovReader reader{iov, cnt};
+    char edge[DIRECT_ALIGN];
+
+    // 不对齐的头部
+    const uint64_t head = std::min<uint64_t>(n, (DIRECT_ALIGN - offset % DIRECT_ALIGN) % DIRECT_ALIGN);
+    if (head) {
+        reader.take(edge, head);
+        if (!pwriteAll(fd, offset, edge, head))
+            return writeError(temp, errno);
+        offset += head;
+        n -= head;
+    }
+    while (n >= DIRECT_ALIGN) {
+        const size_t chunk = std::min<uint64_t>(DIRECT_CHUNK, n / DIRECT_ALIGN * DIRECT_ALIGN);
+        reader.take(bounce.get(), chunk);
+        if (!pwriteAll(directFd, offset, bounce.get(), chunk))
+            return writeError(temp, errno);
+        offset += chunk;
+        n -= chunk;
+    }
+    // 不足一页的尾部
+    if (n) {
+        reader.take(edge, n);
+        if (!pwriteAll(fd, offset, edge, n))
+            return writeError(temp, errno);
+    }
+    return Error::Ok;
+}
+
+Error OutputFile::writeAt(uint64_t offset, const iovec *iov, size_t cnt) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < cnt; ++i)
+        n += iov[i].iov_len;
+    if (offset + n > size)
+        return Error::FileError;
+    if (mapped) {
+        IovReader{iov, cnt}.take(mapped + offset, n);
+    } else if (directFd >= 0) {
+        // 直接写入的数据不经过页缓存，不需要回写
+        return writeDirect(offset, iov, cnt, n);
+    } else if (!pwriteAll(fd, offset, iov, cnt)) {
+        return writeError(temp, errno);
+    }
+    flush(offset, n);
+    return Error::Ok;
+}
+
+Error OutputFile::commit() {
+    if (holes)
+        LOG_INFO("Left %llu zero bytes of %s as holes.", static_cast<unsigned long long>(holes.load()),
+                 target.string().c_str());
+    bool ok = true;
+    if (mapped) {
+        ok = ::munmap(mapped, size) == 0;
+        mapped = nullptr;
+    }
+    if (directFd >= 0) {
+        ok = ::close(directFd) == 0 && ok;
+        directFd = -1;
+    }
+    if (fd >= 0) {
+        // 只在完成时同步一次，rename之后的文件内容一定已经落盘
+        ok = ::fdatasync(fd) == 0 && ok;
+        ok = ::close(fd) == 0 && ok;
+        fd = -1;
+    }
+    std::error_code ec;
+    if (ok)
+        fs::rename(temp, target, ec);
+    if (!ok || ec) {
+        LOG_ERROR("Failed to finish %s", target.string().c_str());
+        return Error::FileError;
+    }
+    return Error::Ok;
+}
+
+void OutputFile::discard() noexcept {
+    if (mapped) {
+        ::munmap(mapped, size);
+        mapped = nullptr;
+    }
+    if (directFd >= 0) {
+        ::close(directFd);
+        directFd = -1;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+        std::error_code ec;
+        fs::remove(temp, ec);
+    }
+}
+
+#endif
+
+Error OutputFile::write(uint64_t offset, const iovec *iov, size_t cnt) {
+    if (!sparse)
+        return writeAt(offset, iov, cnt);
+    uint64_t n = 0;
+    for (size_t i = 0; i < cnt; ++i)
+        n += iov[i].iov_len;
+    if (offset + n > size)
+        return Error::FileError;
+    // 临时文件是新建的，没有写入的部分读出来就是零，对齐的全零块直接跳过。
+    // 跨越两段数据的块照常写出
+    std::vector<iovec> run;
+    uint64_t runOffset = offset;
+    uint64_t pos = offset;
+    auto flushRun = [&]() {
+        auto e = run.empty() ? Error::Ok : writeAt(runOffset, run.data(), run.size());
+        run.clear();
+        return e;
+    };
+    auto append = [&](char *p, size_t n) {
+        if (!run.empty() && static_cast<char *>(run.back().iov_base) + run.back().iov_len == p)
+            run.back().iov_len += n;
+        else
+            run.push_back({p, n});
+    };
+    for (size_t i = 0; i < cnt; ++i) {
+        auto *data = static_cast<char *>(iov[i].iov_base);
+        const size_t len = iov[i].iov_len;
+        size_t done = 0;
+        while (done < len) {
+            const auto lead = static_cast<size_t>((SPARSE_BLOCK - pos % SPARSE_BLOCK) % SPARSE_BLOCK);
+            size_t take = std::min(lead ? lead : SPARSE_BLOCK, len - done);
+            if (take == SPARSE_BLOCK && allZero(data + done, take)) {
+                if (auto e = flushRun(); e != Error::Ok)
+                    return e;
+                holes += take;
+                runOffset = pos + take;
+            } else {
+                append(data + done, take);
+            }
+            done += take;
+            pos += take;
+        }
+    }
+    return flushRun();
+}
+
+Error OutputFile::write(uint64_t offset, const char *data, size_t n) {
+    iovec iov{const_cast<char *>(data), n};
+    return write(offset, &iov, 1);
+}
+
+Error OutputFile::write(uint64_t offset, const Rope &data) {
+    const auto slices = data.slices();
+    return write(offset, slices.data(), slices.size());
+}
+
+} // namespace multi_get
@@ -0,0 +1,88 @@
+#include "ProgressMeter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace multi_get {
+
+ProgressMeter::ProgressMeter(size_t lanes, std::chrono::milliseconds interval, SampleCallback sink)
+    : lanes(std::make_unique<Lane[]>(lanes)), count(lanes),
+      interval(std::max(interval, std::chrono::milliseconds(10))), sink(std::move(sink)), states(lanes) {}
+
+ProgressMeter::~ProgressMeter() {
+    stop();
+}
+
+void ProgressMeter::run() {
+    start = last = Clock::now();
+    for (auto &s : states)
+        s.changed = start;
+    sampler = std::thread([this] {
+        std::unique_lock<std::mutex> locker(m);
+        while (!cv.wait_for(locker, interval, [this] { return stopping; })) {
+            locker.unlock();
+            sink(sample(false));
+            locker.lock();
+        }
+    });
+}
+
+void ProgressMeter::stop() {
+    if (!sampler.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> locker(m);
+        stopping = true;
+    }
+    cv.notify_all();
+    sampler.join();
+    sink(sample(true));
+}
+
+ProgressSample ProgressMeter::sample(bool finished) {
+    const auto now = Clock::now();
+    const double dt = std::chrono::duration<double>(now - last).count();
+    ProgressSample s;
+    s.total = total.load(std::memory_order_relaxed);
+    s.elapsed = std::chrono::duration<double>(now - start).count();
+    s.finished = finished;
+
+    uint64_t received = 0;
+    s.connections.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        const auto bytes = lanes[i].bytes.load(std::memory_order_relaxed);
+        auto &state = states[i];
+        ConnectionSample c;
+        c.bytes = bytes;
+        c.speed = dt > 0 ? static_cast<double>(bytes - state.bytes) / dt : 0;
+        if (bytes != state.bytes || lanes[i].busy.load(std::memory_order_relaxed) == 0)
+            state.changed = now;
+        c.stalled = !finished && now - state.changed >= STALL_AFTER;
+        state.bytes = bytes;
+        received += bytes;
+        s.connections.push_back(c);
+    }
+    // 被取消的重复请求收到的数据也计入了计数器，不超过文件大小
+    s.downloaded = std::max(saved.load(std::memory_order_relaxed), credited.load(std::memory_order_relaxed) + received);
+    if (s.total >= 0)
+        s.downloaded = std::min(s.downloaded, static_cast<uint64_t>(s.total));
+    if (s.downloaded < lastDownloaded)
+        s.downloaded = lastDownloaded;
+
+    if (dt > 0) {
+        const double instant = static_cast<double>(s.downloaded - lastDownloaded) / dt;
+        // 按实际间隔换算平滑系数，采样线程被推迟时也保持相同的时间常数
+        const double alpha = 1 - std::exp(-dt / SMOOTHING_SECONDS);
+        smoothed = smoothed < 0 ? instant : smoothed + alpha * (instant - smoothed);
+    }
+    s.speed = std::max(smoothed, 0.0);
+    if (finished)
+        s.eta = 0;
+    else if (s.total >= 0 && s.speed > 0)
+        s.eta = static_cast<double>(static_cast<uint64_t>(s.total) - s.downloaded) / s.speed;
+    last = now;
+    lastDownloaded = s.downloaded;
+    return s;
+}
+
+} // namespace multi_get
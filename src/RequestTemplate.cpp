@@ -0,0 +1,45 @@
+#include "RequestTemplate.h"
+
+#include <charconv>
+
+namespace multi_get {
+
+RequestTemplate::RequestTemplate(std::string_view method, std::string_view host, const Headers &headers) {
+    prefix.append(method).push_back(' ');
+    suffix.append(" HTTP/1.1\r\nHost: ").append(host).append("\r\n");
+    for (const auto &[k, v] : headers) {
+        if (iequals(k, "Host"))
+            continue;
+        suffix.append(k).append(": ").append(v).append("\r\n");
+    }
+}
+
+void RequestTemplate::fill(RequestBuffer &buf, std::string_view path, int64_t beginPos, int64_t endPos,
+                           std::string_view extra) const noexcept {
+    auto slice = [&](const char *p, size_t n) {
+        buf.slices[buf.count++] = iovec{const_cast<char *>(p), n};
+    };
+    buf.count = 0;
+    slice(prefix.data(), prefix.size());
+    slice(path.data(), path.size());
+    slice(suffix.data(), suffix.size());
+    if (!extra.empty())
+        slice(extra.data(), extra.size());
+
+    if (beginPos >= 0) {
+        constexpr std::string_view RANGE = "Range: bytes=";
+        char *p = buf.range;
+        char *const last = buf.range + sizeof(buf.range);
+        p = std::copy(RANGE.begin(), RANGE.end(), p);
+        p = std::to_chars(p, last, beginPos).ptr;
+        *p++ = '-';
+        if (endPos >= beginPos)
+            p = std::to_chars(p, last, endPos).ptr;
+        *p++ = '\r';
+        *p++ = '\n';
+        slice(buf.range, static_cast<size_t>(p - buf.range));
+    }
+    slice(TERMINATOR.data(), TERMINATOR.size());
+}
+
+} // namespace multi_get
@@ -0,0 +1,155 @@
+#include "Rope.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Logger.h"
+
+namespace multi_get {
+
+Rope::Rope(const Rope &other) : patience(other.patience) {
+    other.forEach([this](const char *data, size_t n) { append(data, n); });
+}
+
+Rope &Rope::operator=(const Rope &other) {
+    if (this != &other) {
+        Rope tmp(other);
+        *this = std::move(tmp);
+    }
+    return *this;
+}
+
+void Rope::clear() noexcept {
+    blocks.clear();
+    _size = 0;
+    flat.clear();
+}
+
+Block &Rope::blockAt(size_t idx) {
+    auto &block = blocks[idx];
+    if (!block)
+        block = BufferPool::getInstance().acquire(patience);
+    return block;
+}
+
+std::pair<char *, size_t> Rope::prepare() {
+    auto idx = _size / BLOCK_SIZE;
+    if (idx == blocks.size())
+        blocks.emplace_back();
+    auto &block = blockAt(idx);
+    if (!block) {
+        LOG_ERROR("Failed to alloc memory for body.");
+        return {nullptr, 0};
+    }
+    auto offset = _size % BLOCK_SIZE;
+    return {block.data() + offset, BLOCK_SIZE - offset};
+}
+
+bool Rope::tryReserve(size_t n) {
+    const auto last = (_size + n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (blocks.size() < last)
+        blocks.resize(last);
+    for (auto idx = _size / BLOCK_SIZE; idx < last; ++idx) {
+        if (!blocks[idx] && !(blocks[idx] = BufferPool::getInstance().tryAcquire()))
+            return false;
+    }
+    return true;
+}
+
+void Rope::commit(size_t n) noexcept {
+    _size += n;
+    flat.clear();
+}
+
+bool Rope::append(const char *data, size_t n) {
+    while (n) {
+        auto [ptr, avail] = prepare();
+        if (!ptr)
+            return false;
+        auto len = std::min(n, avail);
+        std::memcpy(ptr, data, len);
+        commit(len);
+        data += len;
+        n -= len;
+    }
+    return true;
+}
+
+bool Rope::append(const Rope &other) {
+    bool ok = true;
+    other.forEach([&](const char *data, size_t n) { ok = ok && append(data, n); });
+    return ok;
+}
+
+void Rope::resize(size_t n) {
+    blocks.resize((n + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    _size = n;
+    flat.clear();
+}
+
+bool Rope::write(size_t offset, const char *data, size_t n) {
+    if (offset + n > _size)
+        return false;
+    while (n) {
+        auto &block = blockAt(offset / BLOCK_SIZE);
+        if (!block)
+            return false;
+        auto pos = offset % BLOCK_SIZE;
+        auto len = std::min(n, BLOCK_SIZE - pos);
+        std::memcpy(block.data() + pos, data, len);
+        offset += len;
+        data += len;
+        n -= len;
+    }
+    return true;
+}
+
+void Rope::place(size_t offset, Rope &&other) {
+    if (offset % BLOCK_SIZE != 0) {
+        other.forEach([&](const char *data, size_t n) {
+            write(offset, data, n);
+            offset += n;
+        });
+        other.clear();
+        return;
+    }
+    auto first = offset / BLOCK_SIZE;
+    // other末尾可能有预留但还没有数据的块，不能移入
+    const auto count = (other._size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (size_t i = 0; i < count && first + i < blocks.size(); ++i) {
+        // 最后一个块不满时，超出other的部分不属于它，只能拷贝
+        auto len = std::min(BLOCK_SIZE, other._size - i * BLOCK_SIZE);
+        if (len == BLOCK_SIZE || offset + other._size == _size)
+            blocks[first + i] = std::move(other.blocks[i]);
+        else
+            write(offset + i * BLOCK_SIZE, other.blocks[i].data(), len);
+    }
+    other.clear();
+}
+
+std::vector<iovec> Rope::slices() const {
+    std::vector<iovec> vec;
+    vec.reserve(blocks.size());
+    forEach([&](const char *data, size_t n) { vec.push_back({const_cast<char *>(data), n}); });
+    return vec;
+}
+
+std::string_view Rope::flatten() const {
+    if (_size <= BLOCK_SIZE)
+        return {_size ? blocks[0].data() : nullptr, _size};
+    if (flat.size() != _size) {
+        flat.clear();
+        flat.reserve(_size);
+        forEach([this](const char *data, size_t n) { flat.insert(flat.end(), data, data + n); });
+    }
+    return {flat.data(), flat.size()};
+}
+
+std::vector<char> Rope::toVector() const {
+    std::vector<char> vec;
+    vec.reserve(_size);
+    forEach([&](const char *data, size_t n) { vec.insert(vec.end(), data, data + n); });
+    return vec;
+}
+
+} // namespace multi_get
@@ -0,0 +1,36 @@
+#include "SegmentPlan.h"
+
+#include <algorithm>
+
+namespace multi_get {
+
+void SegmentPlan::add(uint64_t first, uint64_t last, uint64_t step) {
+    if (last < first)
+        return;
+    step = std::max<uint64_t>(step, 1);
+    const uint64_t length = last - first + 1;
+    // 与前一个区间首尾相接且步长相同、前一个区间正好切完时直接延长
+    if (!spans.empty()) {
+        auto &prev = spans.back();
+        if (prev.last + 1 == first && prev.step == step && (prev.last - prev.first + 1) % step == 0) {
+            prev.last = last;
+            count = prev.index + static_cast<size_t>((prev.last - prev.first) / step + 1);
+            total += length;
+            return;
+        }
+    }
+    spans.push_back({first, last, step, count});
+    count += static_cast<size_t>((length - 1) / step + 1);
+    total += length;
+}
+
+SegmentPlan::Range SegmentPlan::operator[](size_t idx) const noexcept {
+    // 第一个index大于idx的区间的前一个
+    auto it = std::upper_bound(spans.begin(), spans.end(), idx,
+                               [](size_t i, const Span &span) { return i < span.index; });
+    const auto &span = *std::prev(it);
+    const uint64_t first = span.first + static_cast<uint64_t>(idx - span.index) * span.step;
+    return {first, std::min(span.last, first + span.step - 1)};
+}
+
+} // namespace multi_get
@@ -0,0 +1,386 @@
+#include "SegmentScheduler.h"
+
+#include <tuple>
+
+#include "Logger.h"
+#include "ThreadPool.h"
+
+namespace multi_get {
+
+SegmentScheduler::SegmentScheduler(HTTPConnection &conn, std::string url, SegmentPlan plan, const Policy &policy)
+    : url(std::move(url)), policy(policy), plan(std::move(plan)) {
+    paths.emplace_back(&conn);
+}
+
+void SegmentScheduler::prefetch(size_t idx, Prefetch &&p) {
+    if (idx < plan.size() && p.begin == plan[idx].first)
+        acquire(idx)->prefetch = std::move(p);
+}
+
+std::shared_ptr<SegmentScheduler::Segment> SegmentScheduler::acquire(size_t idx) {
+    std::lock_guard<std::mutex> locker(activeMutex);
+    auto &seg = active[idx];
+    if (!seg) {
+        seg = std::make_shared<Segment>();
+        std::tie(seg->begin, seg->end) = plan[idx];
+    }
+    return seg;
+}
+
+void SegmentScheduler::release(size_t idx) {
+    std::lock_guard<std::mutex> locker(activeMutex);
+    active.erase(idx);
+}
+
+std::vector<std::shared_ptr<SegmentScheduler::Segment>> SegmentScheduler::snapshot() {
+    std::lock_guard<std::mutex> locker(activeMutex);
+    std::vector<std::shared_ptr<Segment>> list;
+    list.reserve(active.size());
+    for (const auto &[idx, seg] : active)
+        list.push_back(seg);
+    return list;
+}
+
+void SegmentScheduler::addPath(HTTPConnection &conn) {
+    paths.emplace_back(&conn);
+}
+
+std::vector<uint64_t> SegmentScheduler::pathBytes() const {
+    std::vector<uint64_t> bytes;
+    for (const auto &path : paths)
+        bytes.push_back(path.bytes);
+    return bytes;
+}
+
+Error SegmentScheduler::run(size_t threadCount, Hooks h) {
+    hooks = std::move(h);
+    auto &pool = ThreadPool::getInstance();
+    remaining = threadCount;
+    done = threadCount == 0;
+    std::vector<std::future<void>> workers;
+    for (size_t i = 0; i < threadCount; ++i) {
+        auto *lane = meter ? meter->lane(i) : nullptr;
+        workers.push_back(pool.submit([this, &path = paths[i % paths.size()], lane] {
+            worker(path, lane);
+            std::lock_guard<std::mutex> locker(watchMutex);
+            if (--remaining == 0) {
+                done = true;
+                watchCv.notify_all();
+            }
+        }, &group));
+    }
+    // 调用线程负责测速和检查取消，直到所有任务结束，不占用池中的线程
+    watch();
+    for (auto &w : workers)
+        pool.wait(w, &group);
+
+    if (_error == Error::Ok && hooks.cancelled && hooks.cancelled())
+        _error = Error::Cancelled;
+    return _error;
+}
+
+void SegmentScheduler::fail(Error e, int status) {
+    {
+        std::lock_guard<std::mutex> locker(errorMutex);
+        if (_error == Error::Ok) {
+            _error = e;
+            _status = status;
+        }
+    }
+    if (!_stopped.exchange(true)) {
+        {
+            std::lock_guard<std::mutex> locker(stopMutex);
+        }
+        stopCv.notify_all();
+        interruptAll();
+        if (hooks.stopped)
+            hooks.stopped();
+    }
+}
+
+bool SegmentScheduler::pause(std::chrono::milliseconds duration) {
+    std::unique_lock<std::mutex> locker(stopMutex);
+    return !stopCv.wait_for(locker, duration, [this] { return _stopped.load(); });
+}
+
+void SegmentScheduler::interruptAll() {
+    for (auto &ptr : snapshot()) {
+        auto &seg = *ptr;
+        std::lock_guard<std::mutex> locker(seg.m);
+        if (seg.primary)
+            seg.primary->cancel();
+        if (seg.hedge)
+            seg.hedge->cancel();
+        if (seg.prefetch)
+            seg.prefetch->transfer->cancel();
+    }
+}
+
+void SegmentScheduler::worker(Path &path, ProgressMeter::Lane *lane) {
+    while (!_stopped) {
+        auto idx = next++;
+        if (idx < plan.size()) {
+            if (hooks.before && !hooks.before(idx))
+                break;
+            runPrimary(idx, path, lane);
+            continue;
+        }
+        // 没有新分段时去追赶最慢的分段
+        if (!policy.hedge || !hedgeSlowest(path, lane))
+            break;
+    }
+}
+
+void SegmentScheduler::runPrimary(size_t idx, Path &path, ProgressMeter::Lane *lane) {
+    const auto ptr = acquire(idx);
+    auto &seg = *ptr;
+    // 无论以何种方式结束，分段都不再需要测速和追赶
+    struct Release {
+        SegmentScheduler *self;
+        size_t idx;
+        ~Release() {
+            self->release(idx);
+        }
+    } release{this, idx};
+    {
+        std::lock_guard<std::mutex> locker(seg.m);
+        seg.started = true;
+        seg.startTime = Clock::now();
+    }
+
+    Rope body;
+    unsigned failures = 0;
+    // 主请求需要收到的字节数。重复请求胜出后只需要hedgeFrom之前的部分
+    uint64_t size = seg.end - seg.begin + 1;
+    while (!_stopped) {
+        const uint64_t from = seg.begin + body.size();
+        Transfer transfer;
+        if (lane)
+            transfer.setCounter(&lane->bytes);
+        Transfer *active = &transfer;
+        std::optional<Prefetch> prefetch;
+        {
+            std::lock_guard<std::mutex> locker(seg.m);
+            if (seg.hedgeWon) {
+                size = seg.hedgeFrom - seg.begin;
+                if (body.size() >= size)
+                    break;
+                // 主请求在重复请求发出后重试或被重置过，hedgeFrom之前的数据还没有收全，补上缺口
+                LOG_WARN("Range %llu-%llu is missing %llu-%llu before the hedge, fetching it again.",
+                         static_cast<unsigned long long>(seg.begin), static_cast<unsigned long long>(seg.end),
+                         static_cast<unsigned long long>(from), static_cast<unsigned long long>(seg.hedgeFrom - 1));
+            }
+            // 优先使用已经在进行的请求
+            prefetch = std::exchange(seg.prefetch, std::nullopt);
+            if (prefetch)
+                active = prefetch->transfer;
+            seg.primary = active;
+            seg.checkTime = Clock::now();
+            seg.checkReceived = active->received();
+            seg.slow = false;
+        }
+        const uint64_t to = prefetch ? prefetch->end : seg.begin + size - 1;
+        auto res = [&] {
+            // 探测的数据计入它自己的计数器
+            ProgressMeter::Busy busy{prefetch ? nullptr : lane};
+            return prefetch ? prefetch->response.get()
+                            : path.conn->get(url, static_cast<int64_t>(from), static_cast<int64_t>(to), &transfer);
+        }();
+        // 探测是在构造时的连接上发出的
+        (prefetch ? paths.front() : path).bytes += active->received();
+        bool slow;
+        {
+            std::lock_guard<std::mutex> locker(seg.m);
+            seg.primary = nullptr;
+            slow = seg.slow;
+        }
+
+        const bool usable = res.answersRange(from, to);
+        const auto before = body.size();
+        if (usable && body.empty()) {
+            body = res.takeBody();
+        } else if (usable && !body.append(res.body())) {
+            fail(Error::OutOfMemory);
+            return;
+        }
+        if (body.size() > size)
+            body.resize(size);
+        {
+            std::lock_guard<std::mutex> locker(seg.m);
+            seg.committed = body.size();
+        }
+        if (res.error() == Error::Ok && usable) {
+            if (body.size() == size)
+                break;
+            continue;
+        }
+        if (res.error() == Error::Cancelled) {
+            std::lock_guard<std::mutex> locker(seg.m);
+            // 由循环开头决定是否还需要补上hedgeFrom之前的部分
+            if (seg.hedgeWon)
+                continue;
+            if (slow) {
+                ++seg.reissues;
+                LOG_WARN("Range %llu-%llu is too slow, reissuing from %llu on a new connection.",
+                         static_cast<unsigned long long>(seg.begin), static_cast<unsigned long long>(seg.end),
+                         static_cast<unsigned long long>(seg.begin + body.size()));
+                continue;
+            }
+            if (_stopped)
+                return;
+        }
+
+        auto error = res.error();
+        if (error == Error::Ok) {
+            LOG_ERROR("Unexpected response for range %llu-%llu: status %d", static_cast<unsigned long long>(from),
+                      static_cast<unsigned long long>(seg.end), res.status());
+            // 2xx但范围不对说明服务器不按Range返回，重试也没有用
+            if (res.status() >= 200 && res.status() < 300) {
+                fail(Error::BadResponse);
+                return;
+            }
+            error = Error::HTTPStatus;
+        }
+        // 有进展说明连接本身可用，重新计算连续失败次数
+        if (body.size() > before)
+            failures = 0;
+        if (!retryable(error, res.status()) || failures >= policy.retry.attempts) {
+            fail(error, res.status());
+            return;
+        }
+        auto delay = policy.retry.delay(++failures);
+        LOG_WARN("Range %llu-%llu failed (%s), retrying from %llu in %lld ms (%u/%u).",
+                 static_cast<unsigned long long>(seg.begin), static_cast<unsigned long long>(seg.end),
+                 errorString(error), static_cast<unsigned long long>(seg.begin + body.size()),
+                 static_cast<long long>(delay.count()), failures, policy.retry.attempts);
+        if (!pause(delay))
+            return;
+    }
+    if (_stopped)
+        return;
+
+    auto error = Error::Ok;
+    {
+        std::lock_guard<std::mutex> locker(seg.m);
+        if (seg.hedgeWon) {
+            // 重复请求先完成，丢弃主请求在hedgeFrom之后收到的数据。循环保证已经收全了hedgeFrom之前的部分
+            body.resize(seg.hedgeFrom - seg.begin);
+            if (!body.append(seg.hedgeBody))
+                error = Error::OutOfMemory;
+            seg.hedgeBody.clear();
+        } else {
+            seg.finished = true;
+            if (seg.hedge)
+                seg.hedge->cancel();
+        }
+    }
+    if (error != Error::Ok) {
+        fail(error);
+        return;
+    }
+    if (hooks.deliver) {
+        if (auto e = hooks.deliver(idx, std::move(body)); e != Error::Ok)
+            fail(e);
+    }
+}
+
+bool SegmentScheduler::hedgeSlowest(Path &path, ProgressMeter::Lane *lane) {
+    std::shared_ptr<Segment> target;
+    uint64_t from = 0;
+    {
+        std::lock_guard<std::mutex> hedgeLocker(hedgeMutex);
+        const auto now = Clock::now();
+        double worst = -1;
+        for (auto &ptr : snapshot()) {
+            auto &seg = *ptr;
+            std::lock_guard<std::mutex> locker(seg.m);
+            if (!seg.started || seg.finished || seg.hedged)
+                continue;
+            const uint64_t pos = seg.begin + seg.committed + (seg.primary ? seg.primary->received() : 0);
+            if (pos > seg.end || seg.end - pos + 1 < MIN_HEDGE_BYTES)
+                continue;
+            // 按目前的平均速度估计剩余时间
+            const double elapsed = std::chrono::duration<double>(now - seg.startTime).count();
+            const double rate = static_cast<double>(pos - seg.begin) / std::max(elapsed, 0.001);
+            const double left = static_cast<double>(seg.end - pos + 1) / std::max(rate, 1.0);
+            if (left > worst) {
+                worst = left;
+                target = ptr;
+                from = pos;
+            }
+        }
+        if (!target)
+            return false;
+        std::lock_guard<std::mutex> locker(target->m);
+        target->hedged = true;
+        target->hedgeFrom = from;
+    }
+
+    auto &seg = *target;
+    LOG_INFO("Hedging range %llu-%llu from %llu.", static_cast<unsigned long long>(seg.begin),
+             static_cast<unsigned long long>(seg.end), static_cast<unsigned long long>(from));
+    Transfer transfer;
+    if (lane)
+        transfer.setCounter(&lane->bytes);
+    {
+        std::lock_guard<std::mutex> locker(seg.m);
+        if (seg.finished)
+            return true;
+        seg.hedge = &transfer;
+    }
+    auto res = [&] {
+        ProgressMeter::Busy busy{lane};
+        return path.conn->get(url, static_cast<int64_t>(from), static_cast<int64_t>(seg.end), &transfer);
+    }();
+    path.bytes += transfer.received();
+    std::lock_guard<std::mutex> locker(seg.m);
+    seg.hedge = nullptr;
+    // 重复请求失败不影响主请求
+    if (res.error() == Error::Ok && res.answersRange(from, seg.end) && !seg.finished) {
+        seg.finished = true;
+        seg.hedgeWon = true;
+        seg.hedgeBody = res.takeBody();
+        if (seg.primary)
+            seg.primary->cancel();
+    }
+    return true;
+}
+
+void SegmentScheduler::watch() {
+    std::unique_lock<std::mutex> locker(watchMutex);
+    while (!watchCv.wait_for(locker, TICK, [this] { return done; })) {
+        // 过了一个TICK仍在排队的任务说明线程池已满（调用者自己也可能是池中的线程），
+        // 由调用线程执行，执行期间不测速
+        locker.unlock();
+        while (ThreadPool::getInstance().runOne(group)) {
+        }
+        locker.lock();
+        if (done)
+            break;
+        if (!_stopped && hooks.cancelled && hooks.cancelled()) {
+            fail(Error::Cancelled);
+            continue;
+        }
+        if (policy.minSpeed == 0)
+            continue;
+        const auto now = Clock::now();
+        for (auto &ptr : snapshot()) {
+            auto &seg = *ptr;
+            std::lock_guard<std::mutex> segLocker(seg.m);
+            if (!seg.primary || seg.reissues >= MAX_REISSUES || now - seg.checkTime < SPEED_WINDOW)
+                continue;
+            const auto received = seg.primary->received();
+            const double seconds = std::chrono::duration<double>(now - seg.checkTime).count();
+            const double speed = static_cast<double>(received - seg.checkReceived) / seconds;
+            if (speed < static_cast<double>(policy.minSpeed)) {
+                seg.slow = true;
+                seg.primary->cancel();
+            } else {
+                seg.checkTime = now;
+                seg.checkReceived = received;
+            }
+        }
+    }
+}
+
+} // namespace multi_get
@@ -0,0 +1,116 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Logger.h"
+
+namespace multi_get {
+
+namespace {
+
+thread_local size_t currentWorker = ThreadPool::NOT_WORKER;
+
+void pinTo(std::thread &t, size_t index) {
+#ifdef __linux__
+    const auto cpus = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cpus, &set);
+    if (::pthread_setaffinity_np(t.native_handle(), sizeof(set), &set) != 0)
+        LOG_WARN("Failed to pin worker %zu to CPU %zu", index, index % cpus);
+#else
+    (void)t;
+    (void)index;
+#endif
+}
+
+} // namespace
+
+ThreadPool::ThreadPool() : limit(std::max<size_t>(32, std::thread::hardware_concurrency() * 4)) {}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> locker(m);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto &t : threads)
+        t.join();
+}
+
+void ThreadPool::setLimit(size_t n) {
+    std::lock_guard<std::mutex> locker(m);
+    limit = std::max<size_t>(n, 1);
+}
+
+void ThreadPool::setPinning(bool on) {
+    std::lock_guard<std::mutex> locker(m);
+    pin = on;
+}
+
+size_t ThreadPool::size() {
+    std::lock_guard<std::mutex> locker(m);
+    return threads.size();
+}
+
+bool ThreadPool::inWorker() noexcept {
+    return currentWorker != NOT_WORKER;
+}
+
+size_t ThreadPool::workerIndex() noexcept {
+    return currentWorker;
+}
+
+void ThreadPool::enqueue(const Group *group, std::function<void()> task) {
+    std::lock_guard<std::mutex> locker(m);
+    tasks.push_back({group, std::move(task)});
+    // 空闲线程不够时新建，已经排队的任务也算在内
+    if (idle < tasks.size() && threads.size() < limit) {
+        const size_t index = threads.size();
+        threads.emplace_back(&ThreadPool::run, this, index);
+        if (pin)
+            pinTo(threads.back(), index);
+    }
+    cv.notify_one();
+}
+
+bool ThreadPool::runOne(const Group &group) {
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> locker(m);
+        auto it = std::find_if(tasks.begin(), tasks.end(), [&](const Entry &e) { return e.group == &group; });
+        if (it == tasks.end())
+            return false;
+        task = std::move(it->task);
+        tasks.erase(it);
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::run(size_t index) {
+    currentWorker = index;
+    LOG_INFO("Worker %zu started.", index);
+    std::unique_lock<std::mutex> locker(m);
+    while (true) {
+        ++idle;
+        cv.wait(locker, [this] { return stopping || !tasks.empty(); });
+        --idle;
+        if (tasks.empty())
+            return;
+        auto task = std::move(tasks.front().task);
+        tasks.pop_front();
+        locker.unlock();
+        task();
+        // 任务持有的资源在解锁期间释放
+        task = nullptr;
+        locker.lock();
+    }
+}
+
+} // namespace multi_get
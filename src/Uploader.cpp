@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Digest.h"
+#include "HTTPConnection.h"
+#include "Logger.h"
+#include "MultiGet.h"
+#include "Retry.h"
+#include "ThreadPool.h"
+
+namespace multi_get {
+
+namespace {
+
+// 上传的源文件，各线程按偏移读取各自的分段，互不影响
+class InputFile {
+  private:
+#ifdef _WIN32
+    std::ifstream in;
+    std::mutex m;
+#else
+    int fd{-1};
+#endif
+    uint64_t _size{0};
+
+  public:
+    InputFile() = default;
+    InputFile(const InputFile &) = delete;
+    InputFile &operator=(const InputFile &) = delete;
+    ~InputFile() {
+#ifndef _WIN32
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+
+    bool open(const std::string &path) {
+#ifdef _WIN32
+        in.open(path, std::ios::binary | std::ios::ate);
+        if (!in)
+            return false;
+        _size = static_cast<uint64_t>(in.tellg());
+        return true;
+#else
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st {};
+        if (fd < 0 || ::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+            return false;
+        _size = static_cast<uint64_t>(st.st_size);
+        return true;
+#endif
+    }
+
+    [[nodiscard]] uint64_t size() const noexcept {
+        return _size;
+    }
+
+    // 读取[offset, offset + n)追加到data，数据直接读入Rope的块中
+    bool read(uint64_t offset, uint64_t n, Rope &data) {
+#ifdef _WIN32
+        std::lock_guard<std::mutex> locker(m);
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(offset));
+#endif
+        while (n) {
+            auto [ptr, avail] = data.prepare();
+            if (!ptr)
+                return false;
+            const auto len = static_cast<size_t>(std::min<uint64_t>(n, avail));
+#ifdef _WIN32
+            in.read(ptr, static_cast<std::streamsize>(len));
+            const auto got = in.gcount();
+#else
+            const auto got = ::pread(fd, ptr, len, static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR)
+                continue;
+#endif
+            if (got <= 0) {
+                LOG_ERROR("Failed to read input at %llu", static_cast<unsigned long long>(offset));
+                return false;
+            }
+            data.commit(static_cast<size_t>(got));
+            offset += static_cast<uint64_t>(got);
+            n -= static_cast<uint64_t>(got);
+        }
+        return true;
+    }
+};
+
+// 查询参数中的uploadId等值
+std::string encodeQuery(std::string_view s) {
+    static constexpr char HEX[] = "0123456789ABCDEF";
+    std::string out;
+    for (unsigned char c : s) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            out.push_back(static_cast<char>(c));
+        } else {
+            out.push_back('%');
+            out.push_back(HEX[c >> 4]);
+            out.push_back(HEX[c & 0xf]);
+        }
+    }
+    return out;
+}
+
+std::string withQuery(const std::string &url, std::string_view query) {
+    std::string res = url;
+    res.push_back(url.find('?') == std::string::npos ? '?' : '&');
+    res.append(query);
+    return res;
+}
+
+// S3的响应都很简单，只需要取出第一个指定元素的文本
+std::string_view xmlValue(std::string_view xml, std::string_view tag) {
+    const std::string open = "<" + std::string(tag) + ">";
+    const std::string close = "</" + std::string(tag) + ">";
+    auto begin = xml.find(open);
+    if (begin == std::string_view::npos)
+        return {};
+    begin += open.size();
+    auto end = xml.find(close, begin);
+    if (end == std::string_view::npos)
+        return {};
+    return xml.substr(begin, end - begin);
+}
+
+std::string_view unquote(std::string_view s) {
+    if (s.size() >= 2 && s.front() == '"' && s.back() == '"')
+        return s.substr(1, s.size() - 2);
+    return s;
+}
+
+class Upload {
+  private:
+    struct Part {
+        uint64_t offset;
+        uint64_t length;
+        std::string etag;
+    };
+
+    const UploadOptions &options;
+    HTTPConnection &http;
+    InputFile &input;
+    std::vector<Part> parts;
+    std::string uploadId;
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> uploaded{0};
+    std::mutex errorMutex;
+    UploadResult result;
+
+    // 只记录第一个错误
+    void fail(Error e, int status = 0) {
+        std::lock_guard<std::mutex> locker(errorMutex);
+        if (result.error == Error::Ok) {
+            result.error = e;
+            result.status = status;
+        }
+    }
+
+    [[nodiscard]] bool failed() {
+        std::lock_guard<std::mutex> locker(errorMutex);
+        return result.error != Error::Ok;
+    }
+
+    [[nodiscard]] bool multipart() const noexcept {
+        return options.mode == UploadMode::Multipart;
+    }
+
+    // 发送请求并按RetryPolicy重试，accept判断响应是否成功，不成功时返回错误
+    template <typename Accept>
+    HTTPResponse send(std::string_view method, const std::string &url, const std::string &headers,
+                      const std::vector<iovec> &body, Accept &&accept, Error &error) {
+        unsigned failures = 0;
+        while (true) {
+            auto res = http.request(method, url, headers, body.data(), body.size());
+            error = res.error() != Error::Ok ? res.error() : accept(res);
+            if (error == Error::Ok)
+                return res;
+            if (!retryable(error, res.status()) || failures >= options.retry.attempts) {
+                LOG_ERROR("%.*s %s failed: %s (%d)", static_cast<int>(method.size()), method.data(), url.c_str(),
+                          errorString(error), res.status());
+                return res;
+            }
+            auto delay = options.retry.delay(++failures);
+            LOG_WARN("%.*s %s failed: %s, retrying in %lld ms", static_cast<int>(method.size()), method.data(),
+                     url.c_str(), errorString(error), static_cast<long long>(delay.count()));
+            std::this_thread::sleep_for(delay);
+        }
+    }
+
+    static Error successful(const HTTPResponse &res) {
+        return res.status() >= 200 && res.status() < 300 ? Error::Ok : Error::HTTPStatus;
+    }
+
+    void uploadPart(size_t idx) {
+        auto &part = parts[idx];
+        Rope data;
+        if (!input.read(part.offset, part.length, data)) {
+            fail(Error::InputError);
+            return;
+        }
+        Md5 md5;
+        data.forEach([&](const char *p, size_t n) { md5.update(p, n); });
+        const auto digest = md5.finish();
+        const auto hex = toHex(digest.data(), digest.size());
+
+        std::string headers = "Content-Type: application/octet-stream\r\nContent-MD5: " +
+                              toBase64(digest.data(), digest.size()) + "\r\n";
+        std::string url = options.url;
+        if (multipart()) {
+            url = withQuery(url, "partNumber=" + std::to_string(idx + 1) + "&uploadId=" + encodeQuery(uploadId));
+        } else if (parts.size() > 1) {
+            headers += "Content-Range: bytes " + std::to_string(part.offset) + '-' +
+                       std::to_string(part.offset + part.length - 1) + '/' + std::to_string(input.size()) + "\r\n";
+        }
+
+        Error error;
+        auto res = send("PUT", url, headers, data.slices(), [&](const HTTPResponse &r) {
+            // 可续传上传的服务器对中间分段返回308
+            if (!multipart() && r.status() == 308)
+                return Error::Ok;
+            if (auto e = successful(r); e != Error::Ok)
+                return e;
+            // 未加密的S3分段的ETag就是分段的MD5，不一致说明数据在传输中被改动
+            auto etag = unquote(r["ETag"]);
+            if (multipart() && !etag.empty() && etag.find('-') == std::string_view::npos && etag != hex) {
+                LOG_WARN("Part %zu ETag %.*s does not match MD5 %s", idx + 1, static_cast<int>(etag.size()),
+                         etag.data(), hex.c_str());
+                return Error::ChecksumMismatch;
+            }
+            return Error::Ok;
+        }, error);
+        if (error != Error::Ok) {
+            fail(error, res.status());
+            return;
+        }
+        part.etag = res["ETag"];
+        if (part.etag.empty() && multipart())
+            part.etag = '"' + hex + '"';
+        auto now = uploaded += part.length;
+        if (options.onProgress)
+            options.onProgress(Progress{now, static_cast<int64_t>(input.size())});
+    }
+
+    void worker() {
+        for (size_t idx; !failed() && (idx = next++) < parts.size();)
+            uploadPart(idx);
+    }
+
+    bool initiate() {
+        Error error;
+        auto res = send("POST", withQuery(options.url, "uploads"), {}, {}, successful, error);
+        if (error != Error::Ok) {
+            fail(error, res.status());
+            return false;
+        }
+        uploadId = xmlValue(res.body().flatten(), "UploadId");
+        if (uploadId.empty()) {
+            LOG_ERROR("No UploadId in response to initiate multipart upload");
+            fail(Error::BadResponse);
+            return false;
+        }
+        LOG_INFO("Multipart upload id: %s", uploadId.c_str());
+        return true;
+    }
+
+    void complete() {
+        std::string xml = "<CompleteMultipartUpload>";
+        for (size_t i = 0; i < parts.size(); ++i) {
+            xml += "<Part><PartNumber>" + std::to_string(i + 1) + "</PartNumber><ETag>" + parts[i].etag +
+                   "</ETag></Part>";
+        }
+        xml += "</CompleteMultipartUpload>";
+        const std::vector<iovec> body{{xml.data(), xml.size()}};
+        Error error;
+        auto res = send("POST", withQuery(options.url, "uploadId=" + encodeQuery(uploadId)),
+                        "Content-Type: application/xml\r\n", body, [](const HTTPResponse &r) {
+            // 合并失败时S3也可能在200的响应体中返回错误
+            if (auto e = successful(r); e != Error::Ok)
+                return e;
+            return r.body().flatten().find("<Error>") == std::string_view::npos ? Error::Ok : Error::HTTPStatus;
+        }, error);
+        if (error != Error::Ok) {
+            fail(error, res.status());
+            return;
+        }
+        result.etag = unquote(xmlValue(res.body().flatten(), "ETag"));
+    }
+
+    // 尽力放弃未完成的分段上传，释放服务器上已上传的分段
+    void abort() {
+        if (uploadId.empty())
+            return;
+        auto res = http.request("DELETE", withQuery(options.url, "uploadId=" + encodeQuery(uploadId)), {});
+        if (res.error() != Error::Ok || successful(res) != Error::Ok)
+            LOG_WARN("Failed to abort multipart upload %s", uploadId.c_str());
+    }
+
+  public:
+    Upload(const UploadOptions &options, HTTPConnection &http, InputFile &input)
+        : options(options), http(http), input(input) {
+        const uint64_t partSize = std::max<uint64_t>(options.partSize, 1);
+        const uint64_t size = input.size();
+        // 空文件也要发送一个分段
+        for (uint64_t offset = 0; offset < size || parts.empty(); offset += partSize)
+            parts.push_back({offset, std::min(partSize, size - offset), {}});
+    }
+
+    UploadResult run() {
+        if (multipart() && !initiate())
+            return result;
+        const size_t threadCount = std::clamp<size_t>(options.threadCount, 1, std::min<size_t>(parts.size(), 32));
+        LOG_INFO("Uploading %zu parts with %zu threads", parts.size(), threadCount);
+        auto &pool = ThreadPool::getInstance();
+        ThreadPool::Group group;
+        std::vector<std::future<void>> workers;
+        for (size_t i = 0; i < threadCount; ++i)
+            workers.push_back(pool.submit([this] { worker(); }, &group));
+        for (auto &w : workers)
+            pool.wait(w, &group);
+
+        if (multipart()) {
+            if (!failed())
+                complete();
+            if (failed())
+                abort();
+        } else if (!failed() && !parts.empty()) {
+            result.etag = unquote(parts.back().etag);
+        }
+        result.bytes = uploaded;
+        result.parts = parts.size();
+        return result;
+    }
+};
+
+} // namespace
+
+UploadResult Client::upload(const UploadOptions &options) {
+    const auto start = std::chrono::steady_clock::now();
+    InputFile input;
+    if (!input.open(options.input)) {
+        LOG_ERROR("Failed to open %s", options.input.c_str());
+        return UploadResult{Error::InputError};
+    }
+    // 上传只使用HTTP/1.1的连接
+    DownloadOptions config;
+    config.proxy = options.proxy;
+    config.timeouts = options.timeouts;
+    config.socket = options.socket;
+    auto http = connection(config);
+
+    auto result = Upload(options, *http, input).run();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+} // namespace multi_get
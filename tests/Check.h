@@ -0,0 +1,31 @@
+#ifndef MULTI_GET_TEST_CHECK_H
+#define MULTI_GET_TEST_CHECK_H
+
+#include <cstdio>
+
+namespace multi_get::test {
+
+inline int failures = 0;
+
+// 所有检查结束后作为main的返回值
+inline int finish(const char *name) {
+    if (failures) {
+        std::fprintf(stderr, "%s: %d check(s) failed\n", name, failures);
+        return 1;
+    }
+    std::printf("%s: ok\n", name);
+    return 0;
+}
+
+} // namespace multi_get::test
+
+// 失败时输出位置并继续执行，便于一次看到所有失败的检查
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);          \
+            ++multi_get::test::failures;                                                           \
+        }                                                                                          \
+    } while (0)
+
+#endif // MULTI_GET_TEST_CHECK_H
@@ -0,0 +1,351 @@
+#include "H2Server.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include "HPACK.h"
+
+namespace multi_get::test {
+
+namespace {
+
+enum : uint8_t { DATA = 0x0, HEADERS = 0x1, RST_STREAM = 0x3, SETTINGS = 0x4, PING = 0x6, GOAWAY = 0x7,
+                 WINDOW_UPDATE = 0x8, CONTINUATION = 0x9 };
+enum : uint8_t { END_STREAM = 0x1, ACK = 0x1, END_HEADERS = 0x4, PADDED = 0x8, PRIORITY_FLAG = 0x20 };
+
+constexpr std::string_view PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr uint32_t FRAME_HEADER_SIZE = 9;
+constexpr int64_t DEFAULT_WINDOW = 65535;
+// 不超过所有实现都接受的最小帧长
+constexpr uint32_t DATA_FRAME = 16384;
+
+uint32_t readU32(const uint8_t *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+void appendFrame(std::vector<char> &out, uint8_t type, uint8_t flags, uint32_t streamId, const char *payload,
+                 uint32_t len) {
+    const char header[FRAME_HEADER_SIZE] = {static_cast<char>(len >> 16), static_cast<char>(len >> 8),
+                                            static_cast<char>(len),       static_cast<char>(type),
+                                            static_cast<char>(flags),     static_cast<char>(streamId >> 24),
+                                            static_cast<char>(streamId >> 16), static_cast<char>(streamId >> 8),
+                                            static_cast<char>(streamId)};
+    out.insert(out.end(), header, header + FRAME_HEADER_SIZE);
+    out.insert(out.end(), payload, payload + len);
+}
+
+// 非阻塞socket上写完全部数据
+bool writeAll(SSL *ssl, int fd, std::vector<char> &out) {
+    size_t written = 0;
+    while (written < out.size()) {
+        int n = ::SSL_write(ssl, out.data() + written, static_cast<int>(out.size() - written));
+        if (n > 0) {
+            written += static_cast<size_t>(n);
+            continue;
+        }
+        int err = ::SSL_get_error(ssl, n);
+        if (err != SSL_ERROR_WANT_WRITE && err != SSL_ERROR_WANT_READ)
+            return false;
+        pollfd pfd{fd, static_cast<short>(err == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN), 0};
+        ::poll(&pfd, 1, 100);
+    }
+    out.clear();
+    return true;
+}
+
+int selectAlpn(SSL *, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen,
+               void *) {
+    static const unsigned char h2[] = {2, 'h', '2'};
+    unsigned char *selected;
+    if (::SSL_select_next_proto(&selected, outlen, h2, sizeof(h2), in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+} // namespace
+
+bool useSelfSigned(SSL_CTX *ctx) {
+    EVP_PKEY *key = nullptr;
+    EVP_PKEY_CTX *pctx = ::EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    bool ok = pctx && ::EVP_PKEY_keygen_init(pctx) > 0 &&
+              ::EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) > 0 &&
+              ::EVP_PKEY_keygen(pctx, &key) > 0;
+    ::EVP_PKEY_CTX_free(pctx);
+    X509 *cert = ok ? ::X509_new() : nullptr;
+    if (cert) {
+        ::X509_set_version(cert, 2);
+        ::ASN1_INTEGER_set(::X509_get_serialNumber(cert), 1);
+        ::X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        ::X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+        ::X509_set_pubkey(cert, key);
+        auto *name = ::X509_get_subject_name(cert);
+        ::X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("127.0.0.1"),
+                                     -1, -1, 0);
+        ::X509_set_issuer_name(cert, name);
+        ok = ::X509_sign(cert, key, ::EVP_sha256()) > 0 && ::SSL_CTX_use_certificate(ctx, cert) == 1 &&
+             ::SSL_CTX_use_PrivateKey(ctx, key) == 1;
+    }
+    ::X509_free(cert);
+    ::EVP_PKEY_free(key);
+    return ok;
+}
+
+H2Server::H2Server(std::string content, std::chrono::microseconds pace) : content(std::move(content)), pace(pace) {
+    ctx = ::SSL_CTX_new(::TLS_server_method());
+    if (!ctx || !useSelfSigned(ctx)) {
+        std::fprintf(stderr, "h2 test server: failed to create the certificate\n");
+        return;
+    }
+    ::SSL_CTX_set_alpn_select_cb(ctx, selectAlpn, nullptr);
+
+    listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(listenFd, 16) != 0 ||
+        ::getsockname(listenFd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+        std::perror("h2 test server");
+        return;
+    }
+    _port = ntohs(addr.sin_port);
+    acceptThread = std::thread(&H2Server::acceptLoop, this);
+}
+
+H2Server::~H2Server() {
+    stopping = true;
+    ::shutdown(listenFd, SHUT_RDWR);
+    if (acceptThread.joinable())
+        acceptThread.join();
+    ::close(listenFd);
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> locker(m);
+        threads.swap(workers);
+    }
+    for (auto &t : threads)
+        t.join();
+    ::SSL_CTX_free(ctx);
+}
+
+std::string H2Server::url(std::string_view path) const {
+    return "https://127.0.0.1:" + std::to_string(_port) + std::string(path);
+}
+
+void H2Server::acceptLoop() {
+    while (!stopping) {
+        int fd = ::accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (stopping)
+                return;
+            continue;
+        }
+        ++_connections;
+        std::lock_guard<std::mutex> locker(m);
+        workers.emplace_back(&H2Server::serve, this, fd);
+    }
+}
+
+void H2Server::serve(int fd) {
+    struct Stream {
+        uint64_t offset;
+        uint64_t end;
+        int64_t window;
+    };
+
+    SSL *ssl = ::SSL_new(ctx);
+    ::SSL_set_fd(ssl, fd);
+    if (::SSL_accept(ssl) != 1) {
+        ::SSL_free(ssl);
+        ::close(fd);
+        return;
+    }
+    ::SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    std::vector<uint8_t> in;
+    std::vector<char> out;
+    bool prefaced = false;
+    bool alive = true;
+    hpack::Decoder decoder;
+    std::vector<uint8_t> headerBlock;
+    uint32_t headerStream = 0;
+    std::map<uint32_t, Stream> streams;
+    uint32_t lastSent = 0;
+    int64_t connectionWindow = DEFAULT_WINDOW;
+    int64_t initialWindow = DEFAULT_WINDOW;
+    appendFrame(out, SETTINGS, 0, 0, nullptr, 0);
+
+    // 收到完整的头部块后回复响应头，body由发送循环按窗口发出
+    auto respond = [&](uint32_t streamId) {
+        hpack::HeaderList headers;
+        if (!decoder.decode(headerBlock.data(), headerBlock.size(), headers)) {
+            alive = false;
+            return;
+        }
+        ++_requests;
+        uint64_t first = 0;
+        uint64_t last = content.size() - 1;
+        bool partial = false;
+        for (const auto &[k, v] : headers) {
+            if (k == "range" && v.compare(0, 6, "bytes=") == 0) {
+                auto dash = v.find('-');
+                first = std::stoull(v.substr(6, dash - 6));
+                if (dash + 1 < v.size())
+                    last = std::min<uint64_t>(std::stoull(v.substr(dash + 1)), content.size() - 1);
+                partial = true;
+            }
+        }
+        std::vector<char> block;
+        hpack::Encoder::encode(block, ":status", partial ? "206" : "200");
+        hpack::Encoder::encode(block, "content-length", std::to_string(last - first + 1));
+        hpack::Encoder::encode(block, "accept-ranges", "bytes");
+        if (partial)
+            hpack::Encoder::encode(block, "content-range",
+                                   "bytes " + std::to_string(first) + '-' + std::to_string(last) + '/' +
+                                       std::to_string(content.size()));
+        appendFrame(out, HEADERS, END_HEADERS, streamId, block.data(), static_cast<uint32_t>(block.size()));
+        streams[streamId] = Stream{first, last + 1, initialWindow};
+        _maxConcurrent = std::max(_maxConcurrent.load(), streams.size());
+    };
+
+    auto handle = [&](uint8_t type, uint8_t flags, uint32_t streamId, const uint8_t *p, uint32_t len) {
+        switch (type) {
+        case HEADERS: {
+            const uint8_t *end = p + len;
+            if (flags & PADDED)
+                end -= *p++;
+            if (flags & PRIORITY_FLAG)
+                p += 5;
+            headerBlock.assign(p, end);
+            headerStream = streamId;
+            if (flags & END_HEADERS)
+                respond(streamId);
+            break;
+        }
+        case CONTINUATION:
+            headerBlock.insert(headerBlock.end(), p, p + len);
+            if (flags & END_HEADERS)
+                respond(headerStream);
+            break;
+        case SETTINGS:
+            if (flags & ACK)
+                break;
+            for (uint32_t i = 0; i + 6 <= len; i += 6) {
+                const uint16_t id = static_cast<uint16_t>((p[i] << 8) | p[i + 1]);
+                const uint32_t value = readU32(p + i + 2);
+                if (id == 0x4) {
+                    for (auto &[sid, s] : streams)
+                        s.window += static_cast<int64_t>(value) - initialWindow;
+                    initialWindow = value;
+                }
+            }
+            appendFrame(out, SETTINGS, ACK, 0, nullptr, 0);
+            break;
+        case WINDOW_UPDATE: {
+            const auto increment = static_cast<int64_t>(readU32(p) & 0x7fffffff);
+            if (streamId == 0)
+                connectionWindow += increment;
+            else if (auto it = streams.find(streamId); it != streams.end())
+                it->second.window += increment;
+            break;
+        }
+        case RST_STREAM:
+            ++_resets;
+            streams.erase(streamId);
+            break;
+        case PING:
+            if (!(flags & ACK))
+                appendFrame(out, PING, ACK, 0, reinterpret_cast<const char *>(p), len);
+            break;
+        case GOAWAY:
+            alive = false;
+            break;
+        default:
+            break;
+        }
+    };
+
+    uint8_t buf[64 * 1024];
+    while (alive && !stopping) {
+        // 接收，直到SSL层没有可读数据
+        while (true) {
+            int n = ::SSL_read(ssl, buf, sizeof(buf));
+            if (n > 0) {
+                in.insert(in.end(), buf, buf + n);
+                continue;
+            }
+            int err = ::SSL_get_error(ssl, n);
+            if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
+                alive = false;
+            break;
+        }
+        size_t pos = 0;
+        if (!prefaced && in.size() >= PREFACE.size()) {
+            alive = alive && std::equal(PREFACE.begin(), PREFACE.end(), in.begin());
+            prefaced = true;
+            pos = PREFACE.size();
+        }
+        while (prefaced && in.size() - pos >= FRAME_HEADER_SIZE) {
+            const uint8_t *h = in.data() + pos;
+            const uint32_t len = (uint32_t(h[0]) << 16) | (uint32_t(h[1]) << 8) | h[2];
+            if (in.size() - pos < FRAME_HEADER_SIZE + len)
+                break;
+            handle(h[3], h[4], readU32(h + 5) & 0x7fffffff, h + FRAME_HEADER_SIZE, len);
+            pos += FRAME_HEADER_SIZE + len;
+        }
+        in.erase(in.begin(), in.begin() + static_cast<ptrdiff_t>(pos));
+
+        // 从上次发送的stream之后开始，轮流给各stream发送一个DATA帧
+        bool sent = false;
+        if (connectionWindow > 0 && !streams.empty()) {
+            auto it = streams.upper_bound(lastSent);
+            for (size_t i = 0; i < streams.size(); ++i, ++it) {
+                if (it == streams.end())
+                    it = streams.begin();
+                if (it->second.window > 0)
+                    break;
+            }
+            if (it != streams.end() && it->second.window > 0) {
+                auto &s = it->second;
+                const auto n = static_cast<uint32_t>(
+                    std::min<int64_t>({DATA_FRAME, static_cast<int64_t>(s.end - s.offset), s.window, connectionWindow}));
+                const bool last = s.offset + n == s.end;
+                appendFrame(out, DATA, last ? END_STREAM : 0, it->first, content.data() + s.offset, n);
+                s.offset += n;
+                s.window -= n;
+                connectionWindow -= n;
+                lastSent = it->first;
+                sent = true;
+                if (last)
+                    streams.erase(it);
+            }
+        }
+        if (!out.empty() && !writeAll(ssl, fd, out))
+            alive = false;
+        if (sent) {
+            std::this_thread::sleep_for(pace);
+        } else if (alive) {
+            pollfd pfd{fd, POLLIN, 0};
+            ::poll(&pfd, 1, 20);
+        }
+    }
+    ::SSL_free(ssl);
+    ::close(fd);
+}
+
+} // namespace multi_get::test
@@ -0,0 +1,72 @@
+#ifndef MULTI_GET_TEST_H2_SERVER_H
+#define MULTI_GET_TEST_H2_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <openssl/ssl.h>
+
+namespace multi_get::test {
+
+// 只监听127.0.0.1、用自签名证书的HTTP/2服务器，任何路径都按Range返回content。
+// 每个连接一个线程，在所有进行中的stream之间轮流发送DATA帧，每帧之后等待pace，
+// 让多个stream同时处于进行中；按对端的SETTINGS和WINDOW_UPDATE遵守流控窗口
+class H2Server {
+  private:
+    std::string content;
+    std::chrono::microseconds pace;
+    SSL_CTX *ctx{nullptr};
+    int listenFd{-1};
+    uint16_t _port{0};
+    std::thread acceptThread;
+    std::atomic<bool> stopping{false};
+
+    std::atomic<size_t> _connections{0};
+    std::atomic<size_t> _requests{0};
+    std::atomic<size_t> _resets{0};
+    std::atomic<size_t> _maxConcurrent{0};
+
+    std::mutex m;
+    std::vector<std::thread> workers;
+
+    void acceptLoop();
+    void serve(int fd);
+
+  public:
+    H2Server(std::string content, std::chrono::microseconds pace);
+    H2Server(const H2Server &) = delete;
+    H2Server &operator=(const H2Server &) = delete;
+    ~H2Server();
+
+    [[nodiscard]] uint16_t port() const noexcept {
+        return _port;
+    }
+    [[nodiscard]] std::string url(std::string_view path) const;
+    [[nodiscard]] size_t connections() const noexcept {
+        return _connections;
+    }
+    [[nodiscard]] size_t requests() const noexcept {
+        return _requests;
+    }
+    // 收到的RST_STREAM个数
+    [[nodiscard]] size_t resets() const noexcept {
+        return _resets;
+    }
+    // 一条连接上同时进行的stream数的最大值
+    [[nodiscard]] size_t maxConcurrent() const noexcept {
+        return _maxConcurrent;
+    }
+};
+
+// 给ctx配置进程内生成的P-256自签名证书，客户端不校验证书
+bool useSelfSigned(SSL_CTX *ctx);
+
+} // namespace multi_get::test
+
+#endif // MULTI_GET_TEST_H2_SERVER_H
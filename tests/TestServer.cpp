@@ -0,0 +1,328 @@
+#include "TestServer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace multi_get::test {
+
+namespace {
+
+std::string lower(std::string_view s) {
+    std::string out(s);
+    std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) { return std::tolower(c); });
+    return out;
+}
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+bool sendAll(int fd, const char *data, size_t n) {
+    while (n) {
+        auto len = ::send(fd, data, n, MSG_NOSIGNAL);
+        if (len <= 0)
+            return false;
+        data += len;
+        n -= static_cast<size_t>(len);
+    }
+    return true;
+}
+
+bool sendAll(int fd, std::string_view s) {
+    return sendAll(fd, s.data(), s.size());
+}
+
+const char *reason(int status) {
+    switch (status) {
+    case 200:
+        return "OK";
+    case 206:
+        return "Partial Content";
+    case 304:
+        return "Not Modified";
+    case 404:
+        return "Not Found";
+    case 416:
+        return "Range Not Satisfiable";
+    case 500:
+        return "Internal Server Error";
+    default:
+        return "Status";
+    }
+}
+
+// 解析"bytes=first-last"，last为空时到结尾
+bool parseRange(std::string_view value, uint64_t length, uint64_t &first, uint64_t &last) {
+    if (value.substr(0, 6) != "bytes=")
+        return false;
+    value.remove_prefix(6);
+    auto dash = value.find('-');
+    if (dash == std::string_view::npos || dash == 0)
+        return false;
+    first = std::stoull(std::string(value.substr(0, dash)));
+    last = dash + 1 < value.size() ? std::stoull(std::string(value.substr(dash + 1))) : length - 1;
+    last = std::min(last, length - 1);
+    return first <= last;
+}
+
+} // namespace
+
+std::string_view Request::header(std::string_view name) const {
+    const auto key = lower(name);
+    for (const auto &[k, v] : headers) {
+        if (k == key)
+            return v;
+    }
+    return {};
+}
+
+TestServer::TestServer(Handler handler) : handler(std::move(handler)) {
+    listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // 端口由系统分配，多个测试可以同时运行
+    socklen_t len = sizeof(addr);
+    if (::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(listenFd, 64) != 0 ||
+        ::getsockname(listenFd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+        std::perror("test server");
+        return;
+    }
+    _port = ntohs(addr.sin_port);
+    acceptThread = std::thread(&TestServer::acceptLoop, this);
+}
+
+TestServer::~TestServer() {
+    stopping = true;
+    ::shutdown(listenFd, SHUT_RDWR);
+    if (acceptThread.joinable())
+        acceptThread.join();
+    ::close(listenFd);
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> locker(m);
+        for (int fd : clients)
+            ::shutdown(fd, SHUT_RDWR);
+        threads.swap(workers);
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+std::string TestServer::url(std::string_view target) const {
+    return "http://127.0.0.1:" + std::to_string(_port) + std::string(target);
+}
+
+std::vector<Request> TestServer::requests() {
+    std::lock_guard<std::mutex> locker(m);
+    return log;
+}
+
+void TestServer::acceptLoop() {
+    while (!stopping) {
+        int fd = ::accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (stopping)
+                return;
+            continue;
+        }
+        ++_connections;
+        std::lock_guard<std::mutex> locker(m);
+        clients.push_back(fd);
+        workers.emplace_back(&TestServer::serve, this, fd);
+    }
+}
+
+void TestServer::serve(int fd) {
+    std::string buf;
+    char chunk[64 * 1024];
+    while (!stopping) {
+        size_t end;
+        while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+            auto n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+                goto done;
+            buf.append(chunk, static_cast<size_t>(n));
+        }
+        {
+            Request req;
+            std::string_view head(buf.data(), end);
+            auto eol = head.find("\r\n");
+            auto line = head.substr(0, eol);
+            auto sp1 = line.find(' ');
+            auto sp2 = line.rfind(' ');
+            if (sp1 == std::string_view::npos || sp2 <= sp1)
+                break;
+            req.method = line.substr(0, sp1);
+            req.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+            while (eol != std::string_view::npos) {
+                head.remove_prefix(eol + 2);
+                eol = head.find("\r\n");
+                auto field = head.substr(0, eol);
+                auto colon = field.find(':');
+                if (colon != std::string_view::npos)
+                    req.headers.emplace_back(lower(trim(field.substr(0, colon))), trim(field.substr(colon + 1)));
+            }
+            buf.erase(0, end + 4);
+            const auto declared = req.header("content-length");
+            const size_t length = declared.empty() ? 0 : std::stoull(std::string(declared));
+            while (buf.size() < length) {
+                auto n = ::recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0)
+                    goto done;
+                buf.append(chunk, static_cast<size_t>(n));
+            }
+            req.body = buf.substr(0, length);
+            buf.erase(0, length);
+            {
+                std::lock_guard<std::mutex> locker(m);
+                log.push_back(req);
+            }
+            auto res = handler(req);
+            if (!send(fd, req, res) || res.close || lower(req.header("connection")) == "close")
+                break;
+        }
+    }
+done:
+    std::lock_guard<std::mutex> locker(m);
+    clients.erase(std::remove(clients.begin(), clients.end(), fd), clients.end());
+    ::close(fd);
+}
+
+// 返回false时关闭连接
+bool TestServer::send(int fd, const Request &req, const Response &res) {
+    const uint64_t length = res.generate ? res.length : res.body.size();
+    std::string head = "HTTP/1.1 " + std::to_string(res.status) + ' ' + reason(res.status) + "\r\n";
+    for (const auto &[k, v] : res.headers)
+        head.append(k).append(": ").append(v).append("\r\n");
+    if (res.chunked)
+        head.append("Transfer-Encoding: chunked\r\n");
+    else
+        head.append("Content-Length: ").append(std::to_string(length)).append("\r\n");
+    if (res.close)
+        head.append("Connection: close\r\n");
+    head.append("\r\n");
+    if (!sendAll(fd, head))
+        return false;
+    if (req.method == "HEAD")
+        return true;
+
+    const uint64_t limit = res.truncate >= 0 ? std::min<uint64_t>(res.truncate, length) : length;
+    std::vector<char> piece(res.chunked ? res.chunkSize : 256 * 1024);
+    for (uint64_t offset = 0; offset < limit;) {
+        const auto n = static_cast<size_t>(std::min<uint64_t>(piece.size(), length - offset));
+        if (res.generate)
+            res.generate(offset, piece.data(), n);
+        else
+            std::memcpy(piece.data(), res.body.data() + offset, n);
+        // 截断时chunk的长度仍按完整的数据给出，接收方看到的是不完整的chunk
+        if (res.chunked) {
+            char size[32];
+            std::snprintf(size, sizeof(size), "%zx\r\n", n);
+            if (!sendAll(fd, size))
+                return false;
+        }
+        const auto sent = static_cast<size_t>(std::min<uint64_t>(n, limit - offset));
+        if (!sendAll(fd, piece.data(), sent))
+            return false;
+        offset += sent;
+        if (res.chunked && sent == n && !sendAll(fd, "\r\n"))
+            return false;
+    }
+    if (limit < length)
+        return false;
+    if (res.chunked) {
+        std::string tail = "0\r\n";
+        for (const auto &[k, v] : res.trailers)
+            tail.append(k).append(": ").append(v).append("\r\n");
+        tail.append("\r\n");
+        if (!sendAll(fd, tail))
+            return false;
+    }
+    return true;
+}
+
+Response rangeResponse(const Request &req, std::string_view content) {
+    Response res;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    res.headers.emplace_back("Accept-Ranges", "bytes");
+    if (!content.empty() && parseRange(req.header("range"), content.size(), first, last)) {
+        res.status = 206;
+        res.headers.emplace_back("Content-Range", "bytes " + std::to_string(first) + '-' + std::to_string(last) +
+                                                      '/' + std::to_string(content.size()));
+        res.body = content.substr(first, last - first + 1);
+    } else {
+        res.body = content;
+    }
+    return res;
+}
+
+Response rangeResponse(const Request &req, uint64_t length,
+                       std::function<void(uint64_t offset, char *data, size_t n)> generate) {
+    Response res;
+    uint64_t first = 0;
+    uint64_t last = length ? length - 1 : 0;
+    res.headers.emplace_back("Accept-Ranges", "bytes");
+    if (length && parseRange(req.header("range"), length, first, last)) {
+        res.status = 206;
+        res.headers.emplace_back("Content-Range", "bytes " + std::to_string(first) + '-' + std::to_string(last) +
+                                                      '/' + std::to_string(length));
+    }
+    res.length = length ? last - first + 1 : 0;
+    res.generate = [first, generate = std::move(generate)](uint64_t offset, char *data, size_t n) {
+        generate(first + offset, data, n);
+    };
+    return res;
+}
+
+std::string pattern(size_t size, uint32_t seed) {
+    std::string out(size, '\0');
+    uint32_t x = seed * 2654435761u + 1;
+    for (size_t i = 0; i < size; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        out[i] = static_cast<char>(x);
+    }
+    return out;
+}
+
+TempDir::TempDir() {
+    auto tmpl = (std::filesystem::temp_directory_path() / "multi-get-test-XXXXXX").string();
+    if (::mkdtemp(tmpl.data()))
+        _path = tmpl;
+}
+
+TempDir::~TempDir() {
+    std::error_code ec;
+    if (!_path.empty())
+        std::filesystem::remove_all(_path, ec);
+}
+
+std::string readFile(const std::filesystem::path &file) {
+    std::ifstream in(file, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+void writeFile(const std::filesystem::path &file, std::string_view data) {
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+} // namespace multi_get::test
@@ -0,0 +1,121 @@
+#ifndef MULTI_GET_TEST_SERVER_H
+#define MULTI_GET_TEST_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace multi_get::test {
+
+using HeaderPairs = std::vector<std::pair<std::string, std::string>>;
+
+struct Request {
+    std::string method;
+    // 路径和查询串
+    std::string target;
+    // 名字为小写
+    HeaderPairs headers;
+    std::string body;
+
+    [[nodiscard]] std::string_view header(std::string_view name) const;
+};
+
+struct Response {
+    int status{200};
+    HeaderPairs headers;
+    std::string body;
+    // 不放在内存中的body：length字节，按偏移由generate生成
+    uint64_t length{0};
+    std::function<void(uint64_t offset, char *data, size_t n)> generate;
+    // 用chunked编码发送，每个chunk最多chunkSize字节，最后发送trailers
+    bool chunked{false};
+    size_t chunkSize{16 * 1024};
+    HeaderPairs trailers;
+    // >= 0时只发送body的前truncate字节就关闭连接
+    int64_t truncate{-1};
+    // 响应之后关闭连接
+    bool close{false};
+};
+
+// 只监听127.0.0.1的HTTP/1.1服务器，每条连接一个线程，支持keep-alive。
+// 处理函数在连接线程中调用，可能被多个线程同时调用
+class TestServer {
+  public:
+    using Handler = std::function<Response(const Request &)>;
+
+  private:
+    Handler handler;
+    int listenFd{-1};
+    uint16_t _port{0};
+    std::thread acceptThread;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> _connections{0};
+
+    std::mutex m;
+    std::vector<std::thread> workers;
+    std::vector<int> clients;
+    std::vector<Request> log;
+
+    void acceptLoop();
+    void serve(int fd);
+    bool send(int fd, const Request &req, const Response &res);
+
+  public:
+    explicit TestServer(Handler handler);
+    TestServer(const TestServer &) = delete;
+    TestServer &operator=(const TestServer &) = delete;
+    ~TestServer();
+
+    [[nodiscard]] uint16_t port() const noexcept {
+        return _port;
+    }
+    [[nodiscard]] std::string url(std::string_view target) const;
+    // 已接受的连接数
+    [[nodiscard]] size_t connections() const noexcept {
+        return _connections;
+    }
+    // 已收到的请求，按到达顺序
+    [[nodiscard]] std::vector<Request> requests();
+};
+
+// 按请求的Range返回content的一部分，没有Range时返回全部
+Response rangeResponse(const Request &req, std::string_view content);
+// 同上，body是length字节的生成内容
+Response rangeResponse(const Request &req, uint64_t length,
+                       std::function<void(uint64_t offset, char *data, size_t n)> generate);
+
+// 确定的伪随机内容，不同的seed得到不同的内容
+std::string pattern(size_t size, uint32_t seed = 1);
+
+// 系统临时目录下的新目录，析构时连同内容删除
+class TempDir {
+  private:
+    std::filesystem::path _path;
+
+  public:
+    TempDir();
+    TempDir(const TempDir &) = delete;
+    TempDir &operator=(const TempDir &) = delete;
+    ~TempDir();
+
+    [[nodiscard]] const std::filesystem::path &path() const noexcept {
+        return _path;
+    }
+    [[nodiscard]] std::string file(std::string_view name) const {
+        return (_path / name).string();
+    }
+};
+
+std::string readFile(const std::filesystem::path &file);
+void writeFile(const std::filesystem::path &file, std::string_view data);
+
+} // namespace multi_get::test
+
+#endif // MULTI_GET_TEST_SERVER_H
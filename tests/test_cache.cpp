@@ -0,0 +1,89 @@
+// 缓存命中时复制或reflink缓存内容：输出文件可写、不与缓存对象共用inode，
+// 之后修改输出文件不会改变缓存，下次命中仍得到原来的内容
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "Check.h"
+#include "MultiGet.h"
+#include "TestServer.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string CONTENT = pattern(512 * 1024 + 7, 51);
+const std::string ETAG = "\"v1\"";
+
+Response withETag(const Request &req) {
+    if (req.header("If-None-Match") == ETAG) {
+        Response res;
+        res.status = 304;
+        res.headers.emplace_back("ETag", ETAG);
+        return res;
+    }
+    auto res = rangeResponse(req, CONTENT);
+    res.headers.emplace_back("ETag", ETAG);
+    return res;
+}
+
+// 缓存目录中唯一的内容文件
+fs::path findObject(const fs::path &cacheDir) {
+    for (const auto &entry : fs::recursive_directory_iterator(cacheDir / "objects"))
+        if (entry.is_regular_file())
+            return entry.path();
+    return {};
+}
+
+void testRestoreIsIndependent() {
+    TempDir dir;
+    TestServer server{withETag};
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/file");
+    options.output = dir.file("file.bin");
+    options.cacheDir = dir.file("cache");
+
+    auto result = client.download(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(!result.cached);
+    const auto object = findObject(options.cacheDir);
+    CHECK(!object.empty());
+
+    result = client.download(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(result.cached);
+    CHECK(readFile(options.output) == CONTENT);
+
+    struct stat out {};
+    struct stat obj {};
+    CHECK(::stat(options.output.c_str(), &out) == 0);
+    CHECK(::stat(object.c_str(), &obj) == 0);
+    CHECK(out.st_ino != obj.st_ino);
+    CHECK(out.st_mode & S_IWUSR);
+
+    // 修改输出文件，缓存对象不变
+    {
+        std::ofstream file{options.output, std::ios::binary | std::ios::trunc};
+        CHECK(file.good());
+        file << "modified";
+    }
+    CHECK(readFile(object) == CONTENT);
+
+    result = client.download(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(result.cached);
+    CHECK(readFile(options.output) == CONTENT);
+}
+
+} // namespace
+
+int main() {
+    testRestoreIsIndependent();
+    return finish("test_cache");
+}
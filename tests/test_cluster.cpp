@@ -0,0 +1,122 @@
+// 集群下载：本进程作为协调者，另外启动几个multi-get --worker进程分担分段。
+// 共享输出时worker直接写入输出文件，否则worker把分段传回协调者写入
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Check.h"
+#include "MultiGet.h"
+#include "TestServer.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+constexpr int WORKERS = 3;
+const std::string CONTENT = pattern(24 * 1024 * 1024 + 4321, 11);
+
+// 绑定端口0取得一个当前空闲的端口
+uint16_t freePort() {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    uint16_t port = 0;
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 &&
+        ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) == 0)
+        port = ntohs(addr.sin_port);
+    ::close(fd);
+    return port;
+}
+
+// 日志写到工作目录，worker在临时目录中运行
+pid_t spawnWorker(uint16_t port, const TempDir &dir) {
+    const auto address = "127.0.0.1:" + std::to_string(port);
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        if (::chdir(dir.path().c_str()) == 0)
+            ::execl(MULTI_GET_BINARY, "multi-get", "--worker", address.c_str(), "-n", "2", nullptr);
+        ::_exit(127);
+    }
+    return pid;
+}
+
+// 等待worker退出，超时后杀掉，返回退出码
+int reap(pid_t pid) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    int status = 0;
+    while (::waitpid(pid, &status, WNOHANG) == 0) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            ::kill(pid, SIGKILL);
+            ::waitpid(pid, &status, 0);
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void testCluster(bool shared) {
+    TempDir dir;
+    TestServer server{[](const Request &req) {
+        // 分段请求放慢，保证每个worker都分到分段
+        if (!req.header("range").empty())
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        return rangeResponse(req, CONTENT);
+    }};
+
+    const auto port = freePort();
+    CHECK(port != 0);
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/file");
+    options.output = dir.file("file.bin");
+    options.threadCount = 4;
+    options.coordinatorPort = port;
+    options.sharedOutput = shared;
+    DownloadResult result;
+    std::thread coordinator([&] { result = client.download(options); });
+
+    // 协调者探测完文件后才开始监听，worker连接失败时也会按重试策略等待
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (server.requests().empty() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::vector<pid_t> workers;
+    for (int i = 0; i < WORKERS; ++i)
+        workers.push_back(spawnWorker(port, dir));
+
+    coordinator.join();
+    for (auto pid : workers)
+        CHECK(reap(pid) == 0);
+
+    CHECK(result.error == Error::Ok);
+    CHECK(readFile(dir.file("file.bin")) == CONTENT);
+    CHECK(result.paths.size() == WORKERS);
+    uint64_t bytes = 0;
+    for (const auto &path : result.paths) {
+        CHECK(path.bytes > 0);
+        bytes += path.bytes;
+    }
+    CHECK(bytes == CONTENT.size());
+    // 每个worker各自连接服务器
+    CHECK(server.connections() > WORKERS);
+}
+
+} // namespace
+
+int main() {
+    testCluster(true);
+    testCluster(false);
+    return finish("test_cluster");
+}
@@ -0,0 +1,164 @@
+// 压缩传输：--compressed时请求gzip/deflate（有libzstd时还有zstd），边收边解码写入文件或fd。
+// 包括chunked传输、原始deflate和被截断的压缩流
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#ifdef MULTI_GET_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "Check.h"
+#include "MultiGet.h"
+#include "TestServer.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+// 重复较多的文本，压缩后明显变小
+std::string makeText(size_t size) {
+    std::string text;
+    for (size_t i = 0; text.size() < size; ++i)
+        text.append("{\"id\":").append(std::to_string(i)).append(",\"name\":\"item-").append(std::to_string(i % 97))
+            .append("\",\"tags\":[\"export\",\"json\"]}\n");
+    text.resize(size);
+    return text;
+}
+
+const std::string TEXT = makeText(3 * 1024 * 1024 + 17);
+
+// windowBits为31时是gzip，15时是zlib格式（HTTP的deflate），-15时是原始deflate
+std::string deflateWith(const std::string &input, int windowBits) {
+    z_stream zs{};
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&zs, static_cast<uLong>(input.size())), '\0');
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    zs.avail_in = static_cast<uInt>(input.size());
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = static_cast<uInt>(out.size());
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+struct Encoded {
+    std::string encoding;
+    std::string body;
+    bool chunked{false};
+};
+
+// 只有请求中带了对应的Accept-Encoding时才返回压缩的body
+TestServer serve(const Encoded &encoded) {
+    return TestServer{[&encoded](const Request &req) {
+        Response res;
+        if (req.header("accept-encoding").find(encoded.encoding) == std::string_view::npos) {
+            res.body = TEXT;
+            return res;
+        }
+        res.headers.emplace_back("Content-Encoding", encoded.encoding);
+        res.body = encoded.body;
+        res.chunked = encoded.chunked;
+        return res;
+    }};
+}
+
+DownloadResult download(TestServer &server, const std::string &output) {
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/export.json");
+    options.output = output;
+    options.compressed = true;
+    options.retry.base = std::chrono::milliseconds(10);
+    return client.download(options);
+}
+
+void testEncoding(const Encoded &encoded) {
+    TempDir dir;
+    auto server = serve(encoded);
+    const auto output = dir.file("export.json");
+    auto result = download(server, output);
+    CHECK(result.error == Error::Ok);
+    CHECK(readFile(output) == TEXT);
+    // 只用一条连接，不带Range，收到的确实是压缩的body
+    bool negotiated = false;
+    for (const auto &req : server.requests()) {
+        CHECK(req.header("range").empty());
+        if (req.method == "GET")
+            negotiated = req.header("accept-encoding").find(encoded.encoding) != std::string_view::npos;
+    }
+    CHECK(negotiated);
+    CHECK(server.connections() == 1);
+}
+
+void testOutputFd() {
+    TempDir dir;
+    const Encoded encoded{"gzip", deflateWith(TEXT, 31), true};
+    auto server = serve(encoded);
+    const auto output = dir.file("stdout.json");
+    int fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0);
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/export.json");
+    options.outputFd = fd;
+    options.compressed = true;
+    auto result = client.download(options);
+    ::close(fd);
+    CHECK(result.error == Error::Ok);
+    CHECK(readFile(output) == TEXT);
+}
+
+// 没有--compressed时不协商压缩
+void testNotRequested() {
+    TempDir dir;
+    const Encoded encoded{"gzip", deflateWith(TEXT, 31)};
+    auto server = serve(encoded);
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/export.json");
+    options.output = dir.file("export.json");
+    auto result = client.download(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(readFile(dir.file("export.json")) == TEXT);
+    for (const auto &req : server.requests())
+        CHECK(req.header("accept-encoding").empty());
+}
+
+// 传输完整但压缩流没有结束，不能当作成功
+void testTruncated(bool chunked) {
+    TempDir dir;
+    auto body = deflateWith(TEXT, 31);
+    body.resize(body.size() / 2);
+    const Encoded encoded{"gzip", body, chunked};
+    auto server = serve(encoded);
+    const auto output = dir.file("export.json");
+    auto result = download(server, output);
+    CHECK(result.error == Error::DecodeFailed);
+    CHECK(!std::filesystem::exists(output));
+}
+
+} // namespace
+
+int main() {
+    testEncoding({"gzip", deflateWith(TEXT, 31)});
+    testEncoding({"gzip", deflateWith(TEXT, 31), true});
+    testEncoding({"deflate", deflateWith(TEXT, 15)});
+    // 有的服务器在deflate中发送不带zlib头的原始数据
+    testEncoding({"deflate", deflateWith(TEXT, -15), true});
+#ifdef MULTI_GET_HAVE_ZSTD
+    std::string zstd(ZSTD_compressBound(TEXT.size()), '\0');
+    zstd.resize(ZSTD_compress(zstd.data(), zstd.size(), TEXT.data(), TEXT.size(), 3));
+    testEncoding({"zstd", zstd});
+    testEncoding({"zstd", zstd, true});
+#endif
+    testOutputFd();
+    testNotRequested();
+    testTruncated(false);
+    testTruncated(true);
+    return finish("test_decode");
+}
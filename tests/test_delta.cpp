@@ -0,0 +1,87 @@
+// 增量下载：新文件与本地旧文件只差几处修改和一段插入的数据，只用Range请求取回变化的块，
+// 其余部分从旧文件复制，结果与新文件相同
+#include <string>
+
+#include "Check.h"
+#include "Delta.h"
+#include "MultiGet.h"
+#include "TestServer.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+constexpr uint32_t BLOCK = 4096;
+
+// 解析"bytes=first-last"得到请求的字节数
+uint64_t rangeLength(std::string_view range) {
+    auto dash = range.find('-');
+    const auto first = std::stoull(std::string(range.substr(6, dash - 6)));
+    const auto last = std::stoull(std::string(range.substr(dash + 1)));
+    return last - first + 1;
+}
+
+void testDelta() {
+    TempDir dir;
+    const std::string oldContent = pattern(2 * 1024 * 1024, 7);
+    std::string newContent = oldContent;
+    // 一个块内的修改、跨两个块的修改，以及使之后所有块错位的插入
+    newContent.replace(300000, 100, pattern(100, 8));
+    newContent.replace(1500000, 5000, pattern(5000, 9));
+    newContent.insert(1000000, pattern(777, 10));
+    // 最多影响的块数：修改1 + 2~3，插入1~2
+    constexpr uint64_t CHANGED_BLOCKS = 6;
+
+    writeFile(dir.file("new.bin"), newContent);
+    auto map = BlockMap::build(dir.file("new.bin"), BLOCK);
+    CHECK(map.has_value());
+    if (!map)
+        return;
+    const auto blocks = map->serialize();
+
+    TestServer server{[&](const Request &req) {
+        if (req.target == "/file.blocks") {
+            Response res;
+            res.body = blocks;
+            return res;
+        }
+        return rangeResponse(req, newContent);
+    }};
+
+    const auto output = dir.file("file.bin");
+    writeFile(output, oldContent);
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/file");
+    options.output = output;
+    options.blocksUrl = server.url("/file.blocks");
+    options.threadCount = 4;
+    auto result = client.download(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(readFile(output) == newContent);
+    CHECK(result.reused >= newContent.size() - CHANGED_BLOCKS * BLOCK);
+
+    uint64_t fetched = 0;
+    size_t ranges = 0;
+    for (const auto &req : server.requests()) {
+        if (req.method != "GET" || req.target != "/file")
+            continue;
+        // 不能有不带Range的完整下载
+        CHECK(!req.header("range").empty());
+        if (req.header("range").empty())
+            continue;
+        fetched += rangeLength(req.header("range"));
+        ++ranges;
+    }
+    CHECK(ranges > 0);
+    CHECK(fetched <= CHANGED_BLOCKS * BLOCK);
+    CHECK(fetched + result.reused == newContent.size());
+}
+
+} // namespace
+
+int main() {
+    testDelta();
+    return finish("test_delta");
+}
@@ -0,0 +1,192 @@
+// HTTP/1.1的接收路径：chunked编码和trailer、keep-alive连接的复用，以及不完整的响应之后不再复用连接；
+// 头部字段超过HTTPResponse::MAX_HEADERS时，排在后面的Content-Length和Transfer-Encoding仍然生效，
+// 头部比一个缓冲块大时也能完整接收；chunk数据之后不是CRLF时报告BadResponse。
+// 同步的get和协程的asyncGet各测一遍
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Check.h"
+#include "Coroutine.h"
+#include "HTTPConnection.h"
+#include "TestServer.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+const std::string CONTENT = pattern(1024 * 1024 + 123);
+
+Response handle(const Request &req) {
+    if (req.target == "/chunked" || req.target == "/truncated") {
+        Response res;
+        res.body = CONTENT;
+        res.chunked = true;
+        res.chunkSize = 100000;
+        res.trailers = {{"X-Checksum", "0123456789abcdef"}, {"X-Count", "11"}};
+        if (req.target == "/truncated")
+            res.truncate = 250000;
+        return res;
+    }
+    if (req.target == "/headers" || req.target == "/headers-chunked") {
+        // 服务器在这些字段之后才给出Content-Length或Transfer-Encoding
+        Response res;
+        for (int i = 0; i < 100; ++i)
+            res.headers.emplace_back("X-Filler-" + std::to_string(i), "value");
+        res.body = CONTENT;
+        res.chunked = req.target == "/headers-chunked";
+        return res;
+    }
+    if (req.target == "/large-headers") {
+        // 头部共约320KB，超过一个256KB的块
+        Response res;
+        for (int i = 0; i < 40; ++i)
+            res.headers.emplace_back("X-Large-" + std::to_string(i), std::string(8 * 1024, 'v'));
+        res.body = CONTENT;
+        return res;
+    }
+    return rangeResponse(req, CONTENT);
+}
+
+// 对每个请求原样返回固定的字节，用于构造TestServer不会发出的错误响应
+class RawServer {
+  private:
+    std::string reply;
+    int listenFd{-1};
+    uint16_t port{0};
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    void serve() {
+        pollfd p{listenFd, POLLIN, 0};
+        while (!stopping) {
+            if (::poll(&p, 1, 50) <= 0)
+                continue;
+            int fd = ::accept(listenFd, nullptr, nullptr);
+            std::string req;
+            char buf[4096];
+            ssize_t n;
+            while (req.find("\r\n\r\n") == std::string::npos && (n = ::recv(fd, buf, sizeof(buf), 0)) > 0)
+                req.append(buf, static_cast<size_t>(n));
+            ::send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+            ::close(fd);
+        }
+    }
+
+  public:
+    explicit RawServer(std::string reply) : reply(std::move(reply)) {
+        listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(listenFd, 4) != 0 ||
+            ::getsockname(listenFd, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+            return;
+        port = ntohs(addr.sin_port);
+        thread = std::thread(&RawServer::serve, this);
+    }
+    RawServer(const RawServer &) = delete;
+    RawServer &operator=(const RawServer &) = delete;
+    ~RawServer() {
+        stopping = true;
+        if (thread.joinable())
+            thread.join();
+        ::close(listenFd);
+    }
+
+    [[nodiscard]] std::string url() const {
+        return "http://127.0.0.1:" + std::to_string(port) + "/";
+    }
+};
+
+void testSync() {
+    TestServer server{handle};
+    HTTPConnection conn;
+
+    for (int i = 0; i < 2; ++i) {
+        auto res = conn.get(server.url("/chunked"));
+        CHECK(res.error() == Error::Ok);
+        CHECK(res.status() == 200);
+        CHECK(res.body().flatten() == CONTENT);
+    }
+    auto part = conn.get(server.url("/file"), 1000, 199999);
+    CHECK(part.error() == Error::Ok);
+    CHECK(part.status() == 206);
+    CHECK(part.body().flatten() == std::string_view(CONTENT).substr(1000, 199000));
+    // trailer已经读完，三个请求复用同一条连接
+    CHECK(server.connections() == 1);
+
+    auto cut = conn.get(server.url("/truncated"));
+    CHECK(cut.error() != Error::Ok);
+    auto after = conn.get(server.url("/file"), 0, 999);
+    CHECK(after.error() == Error::Ok);
+    CHECK(after.body().flatten() == std::string_view(CONTENT).substr(0, 1000));
+    CHECK(server.connections() == 2);
+}
+
+void testManyHeaders() {
+    TestServer server{handle};
+    HTTPConnection conn;
+    Executor ex;
+    for (const char *target : {"/headers", "/headers-chunked", "/large-headers"}) {
+        auto res = conn.get(server.url(target));
+        CHECK(res.error() == Error::Ok);
+        CHECK(res.body().flatten() == CONTENT);
+        auto async = ex.blockOn(conn.asyncGet(ex, server.url(target)));
+        CHECK(async.error() == Error::Ok);
+        CHECK(async.body().flatten() == CONTENT);
+    }
+    // body的边界正确，连接仍可复用
+    CHECK(server.connections() == 1);
+}
+
+void testAsync() {
+    TestServer server{handle};
+    HTTPConnection conn;
+    Executor ex;
+
+    for (int i = 0; i < 2; ++i) {
+        auto res = ex.blockOn(conn.asyncGet(ex, server.url("/chunked")));
+        CHECK(res.error() == Error::Ok);
+        CHECK(res.body().flatten() == CONTENT);
+    }
+    auto part = ex.blockOn(conn.asyncGet(ex, server.url("/file"), 500000, 599999));
+    CHECK(part.error() == Error::Ok);
+    CHECK(part.body().flatten() == std::string_view(CONTENT).substr(500000, 100000));
+    CHECK(server.connections() == 1);
+
+    auto cut = ex.blockOn(conn.asyncGet(ex, server.url("/truncated")));
+    CHECK(cut.error() != Error::Ok);
+    auto after = ex.blockOn(conn.asyncGet(ex, server.url("/file"), 0, 999));
+    CHECK(after.error() == Error::Ok);
+    CHECK(after.body().flatten() == std::string_view(CONTENT).substr(0, 1000));
+    CHECK(server.connections() == 2);
+}
+
+void testBadChunkTerminator() {
+    // 第一个chunk的长度比实际数据小，之后的字节不是CRLF；只读走两个字节会把剩下的"0"当成最后一个chunk
+    RawServer server{"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                     "5\r\nhelloXX0\r\n\r\n"};
+    HTTPConnection conn;
+    Executor ex;
+    CHECK(conn.get(server.url()).error() == Error::BadResponse);
+    CHECK(ex.blockOn(conn.asyncGet(ex, server.url())).error() == Error::BadResponse);
+}
+
+} // namespace
+
+int main() {
+    testSync();
+    testAsync();
+    testManyHeaders();
+    testBadChunkTerminator();
+    return finish("test_http1");
+}
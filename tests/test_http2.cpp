@@ -0,0 +1,80 @@
+// HTTP/2：多个线程的Range请求作为并发的stream复用一条连接；取消的请求发送RST_STREAM，
+// 只放弃这个stream，之后的请求继续使用同一条连接
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "H2Server.h"
+#include "HTTP2Connection.h"
+#include "TestServer.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+constexpr size_t PART = 1024 * 1024;
+constexpr size_t PARTS = 4;
+const std::string CONTENT = pattern(PART * PARTS);
+
+template <typename F>
+bool waitFor(F &&done) {
+    for (int i = 0; i < 500 && !done(); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return done();
+}
+
+void testMultiplexing() {
+    // 每帧16KB，发完一个分段需要几十毫秒，各stream的发送交错进行
+    H2Server server{CONTENT, std::chrono::microseconds(500)};
+    HTTP2Connection conn;
+    std::vector<HTTPResponse> results(PARTS);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < PARTS; ++i) {
+        threads.emplace_back([&, i] {
+            results[i] = conn.get(server.url("/file"), static_cast<int64_t>(i * PART),
+                                  static_cast<int64_t>((i + 1) * PART - 1));
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    for (size_t i = 0; i < PARTS; ++i) {
+        CHECK(results[i].error() == Error::Ok);
+        CHECK(results[i].status() == 206);
+        CHECK(results[i].body().flatten() == std::string_view(CONTENT).substr(i * PART, PART));
+    }
+    CHECK(server.connections() == 1);
+    CHECK(server.requests() == PARTS);
+    CHECK(server.maxConcurrent() >= 2);
+    CHECK(server.resets() == 0);
+}
+
+void testCancel() {
+    // 整个文件要发送一秒以上，取消时一定还在进行
+    H2Server server{CONTENT, std::chrono::microseconds(5000)};
+    HTTP2Connection conn;
+    Transfer transfer;
+    HTTPResponse cancelled;
+    std::thread request([&] { cancelled = conn.get(server.url("/file"), 0, -1, &transfer); });
+    CHECK(waitFor([&] { return transfer.received() > 0; }));
+    transfer.cancel();
+    request.join();
+    CHECK(cancelled.error() == Error::Cancelled);
+    CHECK(cancelled.body().size() < CONTENT.size());
+    CHECK(waitFor([&] { return server.resets() == 1; }));
+
+    auto res = conn.get(server.url("/file"), 0, 16383);
+    CHECK(res.error() == Error::Ok);
+    CHECK(res.body().flatten() == std::string_view(CONTENT).substr(0, 16384));
+    CHECK(server.connections() == 1);
+}
+
+} // namespace
+
+int main() {
+    testMultiplexing();
+    testCancel();
+    return finish("test_http2");
+}
@@ -0,0 +1,111 @@
+// 大文件：超过4 GiB的偏移和长度不能被截断；几百GB的文件切成10^5以上的分段时分段表仍然紧凑。
+// 下载的内容由服务器按偏移生成，大部分为零，sparse输出只占很少的磁盘空间
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "Check.h"
+#include "MultiGet.h"
+#include "SegmentPlan.h"
+#include "TestServer.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+constexpr uint64_t GiB = 1024ull * 1024 * 1024;
+constexpr uint64_t SIZE = 4 * GiB + 3 * 1024 * 1024 + 123;
+
+// 非零数据所在的位置，包括跨越4 GiB边界和文件结尾的
+struct Island {
+    uint64_t offset;
+    std::string data;
+};
+const Island ISLANDS[] = {
+    {1000, pattern(5000, 21)},
+    {4 * GiB - 2000, pattern(4000, 22)},
+    {4 * GiB + 1024 * 1024 + 7, pattern(70000, 23)},
+    {SIZE - 3000, pattern(3000, 24)},
+};
+
+void generate(uint64_t offset, char *data, size_t n) {
+    std::memset(data, 0, n);
+    const uint64_t end = offset + n;
+    for (const auto &island : ISLANDS) {
+        const uint64_t b = std::max(offset, island.offset);
+        const uint64_t e = std::min(end, island.offset + island.data.size());
+        if (b < e)
+            std::memcpy(data + (b - offset), island.data.data() + (b - island.offset), e - b);
+    }
+}
+
+std::string readAt(const std::string &file, uint64_t offset, size_t n) {
+    std::ifstream in(file, std::ios::binary);
+    in.seekg(static_cast<std::streamoff>(offset));
+    std::string out(n, '\0');
+    in.read(out.data(), static_cast<std::streamsize>(n));
+    out.resize(static_cast<size_t>(in.gcount()));
+    return out;
+}
+
+void testSegmentPlan() {
+    // 300 GiB按1 MiB切分得到307200个分段，每个区间只占一项
+    constexpr uint64_t size = 300 * GiB + 12345;
+    constexpr uint64_t step = 1024 * 1024;
+    SegmentPlan plan{size, step};
+    CHECK(plan.size() == size / step + 1);
+    CHECK(plan.bytes() == size);
+    CHECK(plan[0] == SegmentPlan::Range(0, step - 1));
+    CHECK(plan[4096] == SegmentPlan::Range(4 * GiB, 4 * GiB + step - 1));
+    CHECK(plan[plan.size() - 1] == SegmentPlan::Range(size - 12345, size - 1));
+
+    // 追加的区间从前一个区间的分段之后编号
+    const auto count = plan.size();
+    plan.add(400 * GiB, 400 * GiB + 10 * step - 1, 2 * step);
+    CHECK(plan.size() == count + 5);
+    CHECK(plan[count] == SegmentPlan::Range(400 * GiB, 400 * GiB + 2 * step - 1));
+    CHECK(plan[count + 4].second == 400 * GiB + 10 * step - 1);
+    CHECK(plan.bytes() == size + 10 * step);
+}
+
+void testSparseDownload() {
+    TempDir dir;
+    TestServer server{[](const Request &req) { return rangeResponse(req, SIZE, generate); }};
+
+    const auto output = dir.file("disk.img");
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/disk.img");
+    options.output = output;
+    options.threadCount = 8;
+    options.sparse = true;
+    auto result = client.download(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(result.ranged);
+    CHECK(result.bytes == SIZE);
+
+    std::error_code ec;
+    CHECK(std::filesystem::file_size(output, ec) == SIZE);
+    for (const auto &island : ISLANDS)
+        CHECK(readAt(output, island.offset, island.data.size()) == island.data);
+    // 数据前后仍是零
+    CHECK(readAt(output, 4 * GiB + 1024 * 1024, 7) == std::string(7, '\0'));
+    CHECK(readAt(output, 2 * GiB, 4096) == std::string(4096, '\0'));
+
+    // 全零的块是空洞，实际占用只有几个非零的块
+    struct stat st {};
+    CHECK(::stat(output.c_str(), &st) == 0);
+    CHECK(static_cast<uint64_t>(st.st_blocks) * 512 < 16 * 1024 * 1024);
+}
+
+} // namespace
+
+int main() {
+    testSegmentPlan();
+    testSparseDownload();
+    return finish("test_large");
+}
@@ -0,0 +1,80 @@
+// 提交的任务在共享线程池上运行：线程数到达上限时，任务自己等待的探测和分段排在队列中，
+// 由等待的线程代为执行，不会互相等待。包括分段按顺序写出、会在ReorderBuffer中阻塞的fd输出
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Check.h"
+#include "MultiGet.h"
+#include "TestServer.h"
+#include "ThreadPool.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+const std::string CONTENT = pattern(6 * 1024 * 1024 + 99, 31);
+
+// 死锁时直接结束，不在析构中继续等待
+const DownloadResult &await(const JobHandle &handle) {
+    if (handle->future().wait_for(std::chrono::seconds(60)) != std::future_status::ready) {
+        std::fprintf(stderr, "job did not finish\n");
+        std::_Exit(1);
+    }
+    return handle->wait();
+}
+
+DownloadOptions fileOptions(const TestServer &server, const std::string &output) {
+    DownloadOptions options;
+    options.url = server.url("/file");
+    options.output = output;
+    options.threadCount = 4;
+    options.probeSize = 256 * 1024;
+    return options;
+}
+
+void testLimit(size_t limit, size_t jobs) {
+    ThreadPool::getInstance().setLimit(limit);
+    TempDir dir;
+    TestServer server{[](const Request &req) { return rangeResponse(req, CONTENT); }};
+
+    Client client;
+    std::vector<JobHandle> handles;
+    std::vector<int> fds;
+    for (size_t i = 0; i < jobs; ++i) {
+        auto options = fileOptions(server, dir.file("file" + std::to_string(i)));
+        // 奇数的任务写到fd
+        if (i % 2) {
+            fds.push_back(::open(options.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+            options.outputFd = fds.back();
+        }
+        handles.push_back(client.submit(options));
+    }
+    for (size_t i = 0; i < jobs; ++i) {
+        const auto &result = await(handles[i]);
+        CHECK(result.error == Error::Ok);
+        CHECK(result.ranged);
+    }
+    for (int fd : fds)
+        ::close(fd);
+    for (size_t i = 0; i < jobs; ++i)
+        CHECK(readFile(dir.file("file" + std::to_string(i))) == CONTENT);
+    CHECK(ThreadPool::getInstance().size() <= limit);
+}
+
+} // namespace
+
+int main() {
+    // 上限只能在创建线程之前降低，从小到大测试
+    testLimit(1, 1);
+    testLimit(1, 2);
+    testLimit(2, 2);
+    testLimit(2, 4);
+    return finish("test_pool");
+}
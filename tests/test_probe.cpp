@@ -0,0 +1,95 @@
+// 快速启动的探测遇到忽略Range、返回200的服务器：比探测大的文件不能整个收进内存，
+// 在内存上限远小于文件时也要边收边写出；不比探测大的文件直接使用探测的响应，不再请求。
+// 支持Range的服务器上比探测小的文件同样只有探测这一个请求
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "BufferPool.h"
+#include "Check.h"
+#include "MultiGet.h"
+#include "TestServer.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+const std::string LARGE = pattern(8 * 1024 * 1024 + 5, 41);
+const std::string SMALL = pattern(300 * 1024, 42);
+
+// 不支持Range的服务器
+Response ignoreRange(const Request &req) {
+    Response res;
+    res.body = req.target == "/small" ? SMALL : LARGE;
+    return res;
+}
+
+size_t gets(TestServer &server) {
+    size_t n = 0;
+    for (const auto &req : server.requests())
+        n += req.method == "GET";
+    return n;
+}
+
+void testLargerThanMemory() {
+    TempDir dir;
+    TestServer server{ignoreRange};
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/large");
+    options.output = dir.file("large.bin");
+    auto result = client.download(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(!result.ranged);
+    CHECK(readFile(dir.file("large.bin")) == LARGE);
+
+    // 输出到fd时同样边收边写
+    const auto output = dir.file("stdout.bin");
+    int fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    options.output.clear();
+    options.outputFd = fd;
+    result = client.download(options);
+    ::close(fd);
+    CHECK(result.error == Error::Ok);
+    CHECK(readFile(output) == LARGE);
+}
+
+void testSmall() {
+    TempDir dir;
+    TestServer server{ignoreRange};
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/small");
+    options.output = dir.file("small.bin");
+    auto result = client.download(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(readFile(dir.file("small.bin")) == SMALL);
+    CHECK(gets(server) == 1);
+}
+
+void testSmallRanged() {
+    TempDir dir;
+    TestServer server{[](const Request &req) { return rangeResponse(req, SMALL); }};
+    Client client;
+    DownloadOptions options;
+    options.url = server.url("/small");
+    options.output = dir.file("small.bin");
+    auto result = client.download(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(result.ranged);
+    CHECK(readFile(dir.file("small.bin")) == SMALL);
+    CHECK(gets(server) == 1);
+}
+
+} // namespace
+
+int main() {
+    // 远小于文件的内存上限
+    BufferPool::getInstance().setLimit(2 * 1024 * 1024);
+    testLargerThanMemory();
+    testSmall();
+    testSmallRanged();
+    return finish("test_probe");
+}
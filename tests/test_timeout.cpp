@@ -0,0 +1,109 @@
+// 发送超时：对端完成TLS握手后不再读取，请求body写满socket缓冲区后要在超时后失败，
+// 不能在SSL_write的WANT_WRITE上一直重试。明文连接同样检查
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+
+#include "Check.h"
+#include "H2Server.h"
+#include "HTTPConnection.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+// 接受一条连接（tls时先握手），之后不读取任何数据，直到析构
+class StalledServer {
+  private:
+    SSL_CTX *ctx{nullptr};
+    int listenFd{-1};
+    uint16_t port{0};
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    void serve() {
+        pollfd p{listenFd, POLLIN, 0};
+        while (!stopping && ::poll(&p, 1, 50) == 0) {
+        }
+        if (stopping)
+            return;
+        int fd = ::accept(listenFd, nullptr, nullptr);
+        SSL *ssl = nullptr;
+        if (ctx) {
+            ssl = ::SSL_new(ctx);
+            ::SSL_set_fd(ssl, fd);
+            ::SSL_accept(ssl);
+        }
+        while (!stopping)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ::SSL_free(ssl);
+        ::close(fd);
+    }
+
+  public:
+    explicit StalledServer(bool tls) {
+        if (tls) {
+            ctx = ::SSL_CTX_new(::TLS_server_method());
+            if (!useSelfSigned(ctx))
+                return;
+        }
+        listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(listenFd, 4) != 0 ||
+            ::getsockname(listenFd, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+            return;
+        port = ntohs(addr.sin_port);
+        thread = std::thread(&StalledServer::serve, this);
+    }
+    StalledServer(const StalledServer &) = delete;
+    StalledServer &operator=(const StalledServer &) = delete;
+    ~StalledServer() {
+        stopping = true;
+        if (thread.joinable())
+            thread.join();
+        ::close(listenFd);
+        ::SSL_CTX_free(ctx);
+    }
+
+    [[nodiscard]] std::string url() const {
+        return std::string(ctx ? "https" : "http") + "://127.0.0.1:" + std::to_string(port) + "/upload";
+    }
+};
+
+void testSendTimeout(bool tls) {
+    StalledServer server{tls};
+    HTTPConnection conn;
+    Timeouts timeouts;
+    timeouts.firstByte = timeouts.idle = std::chrono::milliseconds(300);
+    conn.setTimeouts(timeouts);
+
+    // 远大于两端socket缓冲区的body
+    const std::string body(64 * 1024 * 1024, 'x');
+    iovec iov{const_cast<char *>(body.data()), body.size()};
+    const auto start = std::chrono::steady_clock::now();
+    auto res = conn.request("PUT", server.url(), {}, &iov, 1);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(res.error() == Error::Timeout);
+    CHECK(elapsed < std::chrono::seconds(10));
+}
+
+} // namespace
+
+int main() {
+    testSendTimeout(true);
+    testSendTimeout(false);
+    return finish("test_timeout");
+}
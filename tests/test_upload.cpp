@@ -0,0 +1,167 @@
+// 分段上传：Content-Range的PUT由服务器写入对应偏移；S3风格的分段上传按分段号合并。
+// 两种方式下都让部分分段第一次失败（5xx或ETag与Content-MD5不一致），只重传这些分段
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "Check.h"
+#include "Digest.h"
+#include "MultiGet.h"
+#include "TestServer.h"
+
+using namespace multi_get;
+using namespace multi_get::test;
+
+namespace {
+
+constexpr uint64_t PART = 256 * 1024;
+const std::string CONTENT = pattern(5 * PART + 1000, 3);
+constexpr size_t PARTS = 6;
+
+std::string md5Hex(std::string_view data) {
+    Md5 md5;
+    md5.update(data.data(), data.size());
+    const auto digest = md5.finish();
+    return toHex(digest.data(), digest.size());
+}
+
+std::string md5Base64(std::string_view data) {
+    Md5 md5;
+    md5.update(data.data(), data.size());
+    const auto digest = md5.finish();
+    return toBase64(digest.data(), digest.size());
+}
+
+// target中查询参数name的值
+std::string query(std::string_view target, std::string_view name) {
+    const auto key = std::string(name) + '=';
+    auto pos = target.find(key);
+    if (pos == std::string_view::npos)
+        return {};
+    auto value = target.substr(pos + key.size());
+    return std::string(value.substr(0, value.find('&')));
+}
+
+UploadOptions uploadOptions(const std::string &url, const std::string &input) {
+    UploadOptions options;
+    options.url = url;
+    options.input = input;
+    options.partSize = PART;
+    options.threadCount = 3;
+    options.retry.base = std::chrono::milliseconds(10);
+    return options;
+}
+
+void testRangePut() {
+    TempDir dir;
+    writeFile(dir.file("input.bin"), CONTENT);
+
+    std::mutex m;
+    std::string stored(CONTENT.size(), '\0');
+    std::map<uint64_t, int> attempts;
+    TestServer server{[&](const Request &req) {
+        Response res;
+        auto range = req.header("content-range");
+        if (req.method != "PUT" || range.substr(0, 6) != "bytes ") {
+            res.status = 404;
+            return res;
+        }
+        const auto dash = range.find('-');
+        const auto slash = range.find('/');
+        const auto first = std::stoull(std::string(range.substr(6, dash - 6)));
+        const auto last = std::stoull(std::string(range.substr(dash + 1, slash - dash - 1)));
+        std::lock_guard<std::mutex> locker(m);
+        // 第二个分段第一次返回503
+        if (++attempts[first] == 1 && first == PART) {
+            res.status = 503;
+            return res;
+        }
+        CHECK(std::stoull(std::string(range.substr(slash + 1))) == CONTENT.size());
+        CHECK(last - first + 1 == req.body.size());
+        CHECK(req.header("content-md5") == md5Base64(req.body));
+        stored.replace(first, req.body.size(), req.body);
+        return res;
+    }};
+
+    Client client;
+    auto result = client.upload(uploadOptions(server.url("/object"), dir.file("input.bin")));
+    CHECK(result.error == Error::Ok);
+    CHECK(result.parts == PARTS);
+    CHECK(result.bytes == CONTENT.size());
+    CHECK(stored == CONTENT);
+    CHECK(attempts.size() == PARTS);
+    CHECK(attempts[PART] == 2);
+    CHECK(attempts[0] == 1);
+}
+
+void testMultipart() {
+    TempDir dir;
+    writeFile(dir.file("input.bin"), CONTENT);
+
+    std::mutex m;
+    std::map<int, std::string> parts;
+    std::map<int, int> attempts;
+    std::string completed;
+    bool aborted = false;
+    TestServer server{[&](const Request &req) {
+        Response res;
+        std::lock_guard<std::mutex> locker(m);
+        if (req.method == "POST" && req.target == "/object?uploads") {
+            res.body = "<InitiateMultipartUploadResult><Bucket>b</Bucket><Key>object</Key>"
+                       "<UploadId>test-upload</UploadId></InitiateMultipartUploadResult>";
+        } else if (req.method == "PUT") {
+            CHECK(query(req.target, "uploadId") == "test-upload");
+            const int number = std::stoi(query(req.target, "partNumber"));
+            const int attempt = ++attempts[number];
+            if (number == 2 && attempt == 1) {
+                res.status = 500;
+            } else if (number == 4 && attempt == 1) {
+                // 数据被改动时S3返回的ETag与Content-MD5不一致
+                res.headers.emplace_back("ETag", '"' + md5Hex("corrupted") + '"');
+            } else {
+                parts[number] = req.body;
+                res.headers.emplace_back("ETag", '"' + md5Hex(req.body) + '"');
+            }
+        } else if (req.method == "POST" && query(req.target, "uploadId") == "test-upload") {
+            // 按请求中列出的分段号和ETag合并
+            std::string_view xml = req.body;
+            for (size_t pos = 0; (pos = xml.find("<PartNumber>", pos)) != std::string_view::npos;) {
+                const int number = std::stoi(std::string(xml.substr(pos + 12)));
+                const auto etagBegin = xml.find("<ETag>", pos) + 6;
+                const auto etag = xml.substr(etagBegin, xml.find("</ETag>", etagBegin) - etagBegin);
+                CHECK(etag == '"' + md5Hex(parts[number]) + '"');
+                completed += parts[number];
+                pos = etagBegin;
+            }
+            res.body = "<CompleteMultipartUploadResult><ETag>\"merged-6\"</ETag></CompleteMultipartUploadResult>";
+        } else if (req.method == "DELETE") {
+            aborted = true;
+        } else {
+            res.status = 404;
+        }
+        return res;
+    }};
+
+    Client client;
+    auto options = uploadOptions(server.url("/object"), dir.file("input.bin"));
+    options.mode = UploadMode::Multipart;
+    auto result = client.upload(options);
+    CHECK(result.error == Error::Ok);
+    CHECK(result.parts == PARTS);
+    CHECK(result.etag == "merged-6");
+    CHECK(completed == CONTENT);
+    CHECK(!aborted);
+    CHECK(attempts.size() == PARTS);
+    // 只有失败的分段重传
+    CHECK(attempts[1] == 1);
+    CHECK(attempts[2] == 2);
+    CHECK(attempts[4] == 2);
+}
+
+} // namespace
+
+int main() {
+    testRangePut();
+    testMultipart();
+    return finish("test_upload");
+}